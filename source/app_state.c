@@ -4,10 +4,6 @@
 int canvasWidth = BOTTOM_SCREEN_WIDTH;
 int canvasHeight = BOTTOM_SCREEN_HEIGHT;
 
-// Texture size (power-of-2, computed from canvas size)
-int texWidth = 512;
-int texHeight = 256;
-
 // Available brushes
 const BrushDef brushDefs[] = {
     {"Antialias Pen", BRUSH_ANTIALIAS},
@@ -31,12 +27,6 @@ Layer layers[MAX_LAYERS];
 int currentLayerIndex = 0;
 int numLayers = MAX_LAYERS;
 
-// Composite buffer (result of merging all layers)
-u32* compositeBuffer = NULL;
-C3D_Tex canvasTex;
-Tex3DS_SubTexture canvasSubTex;
-C2D_Image canvasImage;
-
 // Current drawing state
 u32 currentColor = 0x000000FF;  // Black (RGBA format: 0xRRGGBBAA)
 int brushSizesByType[BRUSH_TYPE_COUNT] = {2, 2, 2, 2};
@@ -45,6 +35,7 @@ bool isDrawing = false;
 float lastCanvasX = 0.0f;
 float lastCanvasY = 0.0f;
 bool brushSizeSliderActive = false;  // For brush size preview on top screen
+bool layerOpacitySliderActive = false;  // One history record per opacity drag
 
 // UI settings
 bool showDrawMenuButton = true;
@@ -135,8 +126,9 @@ bool projectHasName = false;
 bool projectHasUnsavedChanges = false;
 
 // Open project browser state
-char openProjectNames[OPEN_MAX_PROJECTS][PROJECT_NAME_MAX];
+ProjectIndexEntry* openProjects = NULL;
 int openProjectCount = 0;
+OpenSortMode openSortMode = OPEN_SORT_DATE;
 int openSelectedIndex = -1;  // -1 = none selected
 float openListScrollY = 0;
 int openListLastTouchX = 0;
@@ -144,8 +136,6 @@ float openListLastTouchY = 0;
 bool openListDragging = false;
 
 // Preview texture for open browser
-C3D_Tex openPreviewTex;
-Tex3DS_SubTexture openPreviewSubTex;
 C2D_Image openPreviewImage;
 bool openPreviewValid = false;
 int openPreviewWidth = 0;
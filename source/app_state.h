@@ -16,8 +16,8 @@
 #define BOTTOM_SCREEN_WIDTH  320
 #define BOTTOM_SCREEN_HEIGHT 240
 
-// Max canvas dimension (GPU texture limit on 3DS)
-#define MAX_CANVAS_DIM 1024
+// Max canvas dimension; the display is tiled, so memory is the real limit (see canvasSizeFits)
+#define MAX_CANVAS_DIM 4096
 
 // Layer settings
 #define MAX_LAYERS 4
@@ -28,11 +28,9 @@ extern int canvasHeight;
 #define CANVAS_WIDTH  canvasWidth
 #define CANVAS_HEIGHT canvasHeight
 
-// Texture size (power-of-2, computed from canvas size)
-extern int texWidth;
-extern int texHeight;
-#define TEX_WIDTH  texWidth
-#define TEX_HEIGHT texHeight
+// Layer buffers are canvas sized (row stride LAYER_STRIDE pixels).
+#define LAYER_STRIDE      canvasWidth
+#define LAYER_BUFFER_SIZE ((size_t)canvasWidth * (size_t)canvasHeight * sizeof(u32))
 
 // Blend modes
 typedef enum {
@@ -112,12 +110,6 @@ extern Layer layers[MAX_LAYERS];
 extern int currentLayerIndex;
 extern int numLayers;
 
-// Composite buffer (result of merging all layers)
-extern u32* compositeBuffer;
-extern C3D_Tex canvasTex;
-extern Tex3DS_SubTexture canvasSubTex;
-extern C2D_Image canvasImage;
-
 // Current drawing state
 extern u32 currentColor;  /**< RGBA format: 0xRRGGBBAA. */
 extern int brushSizesByType[BRUSH_TYPE_COUNT];
@@ -126,6 +118,7 @@ extern bool isDrawing;
 extern float lastCanvasX;
 extern float lastCanvasY;
 extern bool brushSizeSliderActive;
+extern bool layerOpacitySliderActive;  /**< Layer opacity slider drag in progress. */
 
 // UI settings
 extern bool showDrawMenuButton;  /**< Show menu button during draw mode. */
@@ -251,7 +244,7 @@ extern C2D_TextBuf g_textBuf;
 #define SAVE_DIR "sdmc:/3ds/magicdraw"
 #define PROJECT_NAME_MAX 32
 #define PROJECT_FILE_MAGIC 0x4D474457  /**< "MGDW" */
-#define PROJECT_FILE_VERSION 2
+#define PROJECT_FILE_VERSION 3
 
 // Current project state
 extern char currentProjectName[PROJECT_NAME_MAX];
@@ -259,19 +252,38 @@ extern bool projectHasName;
 extern bool projectHasUnsavedChanges;
 
 // Open project browser state
-#define OPEN_MAX_PROJECTS 64
 #define OPEN_LIST_ITEM_HEIGHT 36
-extern char openProjectNames[OPEN_MAX_PROJECTS][PROJECT_NAME_MAX];
+#define OPEN_SORT_BTN_WIDTH 80
+#define OPEN_SORT_BTN_X (BOTTOM_SCREEN_WIDTH - OPEN_SORT_BTN_WIDTH)
+#define OPEN_BTN_WIDTH (SAVE_EXIT_BTN_WIDTH - OPEN_SORT_BTN_WIDTH)
+
+/** @brief Browser sort order. */
+typedef enum {
+    OPEN_SORT_DATE,   /**< Most recently modified first. */
+    OPEN_SORT_NAME
+} OpenSortMode;
+
+/** @brief One saved project, as cached by the project index (project_index.h). */
+typedef struct {
+    char name[PROJECT_NAME_MAX];
+    u64 mtime;            /**< File modification time. */
+    u64 fileSize;
+    u32 width;            /**< Canvas size. */
+    u32 height;
+    u32 thumbOffset;      /**< Thumbnail chunk payload, 0 when the file has none. */
+    u32 thumbSize;
+} ProjectIndexEntry;
+
+extern ProjectIndexEntry* openProjects;
 extern int openProjectCount;
+extern OpenSortMode openSortMode;
 extern int openSelectedIndex;
 extern float openListScrollY;
 extern int openListLastTouchX;
 extern float openListLastTouchY;
 extern bool openListDragging;
 
-// Preview texture for open browser
-extern C3D_Tex openPreviewTex;
-extern Tex3DS_SubTexture openPreviewSubTex;
+// Preview image for open browser (textures are owned by the preview cache)
 extern C2D_Image openPreviewImage;
 extern bool openPreviewValid;
 extern int openPreviewWidth;
@@ -0,0 +1,478 @@
+#include "autosave.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "layers.h"
+#include "memory.h"
+#include "project_io.h"
+#include "project_stream.h"
+#include "util.h"
+#include "worker.h"
+
+typedef enum {
+    AUTOSAVE_IDLE,
+    AUTOSAVE_QUEUED,
+    AUTOSAVE_RUNNING,
+    AUTOSAVE_DONE
+} AutosaveState;
+
+typedef struct {
+    u32 layer;
+    u32 tile;
+    u32 generation;   // Tile generation when it was copied.
+    u32* pixels;      // Tile-sized copy, NULL when the tile is now empty.
+} AutosaveTile;
+
+typedef struct {
+    char path[256];
+    bool rewrite;     // Start a new file instead of appending.
+    int width;
+    int height;
+    u32 generation;   // Layer generation at snapshot time.
+    ProjectHeader header;
+    ProjectLayerInfo layerInfo[MAX_LAYERS];
+    u8 settings[PROJECT_SETTINGS_SIZE];
+    AutosaveTile* tiles;
+    int tileCount;
+} AutosaveJob;
+
+// The job and the recovery file description belong to the worker from
+// QUEUED to DONE and to the main thread otherwise; the lock guards the state.
+static LightLock autosaveLock;
+static LightEvent autosaveWorkEvent;
+static Thread autosaveWorker = NULL;
+static volatile bool autosaveWorkerQuit = false;
+static AutosaveState autosaveState = AUTOSAVE_IDLE;
+static bool autosaveJobOk = false;
+static AutosaveJob autosaveJob;
+
+static bool autosaveFileValid = false;
+static ProjectChunk* autosaveChunks = NULL;
+static u32 autosaveChunkCount = 0;
+static u64 autosaveFileSize = 0;
+static u64 autosaveLiveBytes = 0;
+
+// Main thread bookkeeping.
+static char autosaveProject[PROJECT_NAME_MAX] = "";
+static int autosaveWidth = 0;
+static int autosaveHeight = 0;
+static u32* autosaveTileGens = NULL;   // Generation of each tile held by the file.
+static u64 autosaveLastTime = 0;
+static bool autosaveBacklog = false;   // Last pass hit the snapshot budget.
+
+// Metadata of the last written autosave, to skip passes that would change nothing.
+static struct {
+    ProjectHeader header;
+    ProjectLayerInfo layerInfo[MAX_LAYERS];
+    u8 settings[PROJECT_SETTINGS_SIZE];
+} autosaveWritten;
+
+static const char* autosaveProjectName(void) {
+    return (projectHasName && currentProjectName[0] != '\0') ? currentProjectName : AUTOSAVE_UNNAMED;
+}
+
+static void getAutosavePath(const char* projectName, char* out, size_t size) {
+    snprintf(out, size, "%s/%s.mgdw", AUTOSAVE_DIR, projectName);
+}
+
+static void freeJobTiles(AutosaveJob* job) {
+    for (int i = 0; i < job->tileCount; i++) {
+        free(job->tiles[i].pixels);
+    }
+    free(job->tiles);
+    job->tiles = NULL;
+    job->tileCount = 0;
+}
+
+static void forgetAutosaveFile(void) {
+    free(autosaveChunks);
+    autosaveChunks = NULL;
+    autosaveChunkCount = 0;
+    autosaveFileSize = 0;
+    autosaveLiveBytes = 0;
+    autosaveFileValid = false;
+}
+
+//---------------------------------------------------------------------------------
+// Worker
+//---------------------------------------------------------------------------------
+
+// Write the job's chunks and table. In append mode, tiles the job does not
+// carry keep their entries from the current recovery file.
+static bool writeAutosaveChunks(ProjectBlockWriter* writer, const AutosaveJob* job, ProjectChunkList* list,
+                                ProjectChunkHeader* chunkHeader) {
+    int tileCount = projectTileCount(job->width, job->height, PROJECT_TILE_SIZE);
+
+    int* jobSlots = (int*)malloc(MAX_LAYERS * tileCount * sizeof(int));
+    int* fileSlots = job->rewrite ? NULL
+        : projectMapTileChunks(autosaveChunks, autosaveChunkCount, MAX_LAYERS, tileCount);
+    u32* scratch = (u32*)malloc(PROJECT_TILE_SIZE * PROJECT_TILE_SIZE * sizeof(u32));
+    bool ok = jobSlots && scratch && (job->rewrite || fileSlots);
+
+    if (ok) {
+        for (int i = 0; i < MAX_LAYERS * tileCount; i++) {
+            jobSlots[i] = -1;
+        }
+        for (int i = 0; i < job->tileCount; i++) {
+            jobSlots[job->tiles[i].layer * tileCount + job->tiles[i].tile] = i;
+        }
+    }
+
+    for (int layer = 0; ok && layer < MAX_LAYERS; layer++) {
+        ok = projectWriteChunk(writer, list, PROJECT_CHUNK_LAYER, layer, 0,
+                               &job->layerInfo[layer], sizeof(ProjectLayerInfo));
+
+        for (int t = 0; ok && t < tileCount; t++) {
+            int slot = jobSlots[layer * tileCount + t];
+            if (slot < 0) {
+                int fileSlot = fileSlots ? fileSlots[layer * tileCount + t] : -1;
+                if (fileSlot >= 0) ok = projectChunkListAdd(list, &autosaveChunks[fileSlot]);
+                continue;
+            }
+
+            const AutosaveTile* tile = &job->tiles[slot];
+            if (!tile->pixels) continue;
+
+            int x, y, w, h;
+            projectTileRect(job->width, job->height, PROJECT_TILE_SIZE, t, &x, &y, &w, &h);
+            u8* packed;
+            size_t packedSize;
+            ok = projectPackTile(tile->pixels, w, 0, 0, w, h, scratch, &packed, &packedSize);
+            if (ok && packed) {
+                ok = projectWriteChunk(writer, list, PROJECT_CHUNK_TILE, layer, t, packed, packedSize);
+                free(packed);
+            }
+        }
+    }
+
+    free(scratch);
+    free(fileSlots);
+    free(jobSlots);
+
+    chunkHeader->tileSize = PROJECT_TILE_SIZE;
+    return ok &&
+           projectWriteChunk(writer, list, PROJECT_CHUNK_SETTINGS, 0, 0, job->settings, sizeof(job->settings)) &&
+           projectWriteChunkTable(writer, list->entries, list->count, chunkHeader);
+}
+
+static bool runAutosaveJob(const AutosaveJob* job) {
+    ProjectBlockWriter writer;
+    ProjectChunkList list = {0};
+    struct {
+        ProjectHeader header;
+        ProjectChunkHeader chunkHeader;
+    } headers;
+    headers.header = job->header;
+    memset(&headers.chunkHeader, 0, sizeof(headers.chunkHeader));
+
+    char tempPath[256 + 8];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", job->path);
+
+    bool ok;
+    if (job->rewrite) {
+        ok = projectWriterOpen(&writer, tempPath);
+        if (!ok) return false;
+        ok = projectWriterWrite(&writer, &headers, sizeof(headers)) &&
+             writeAutosaveChunks(&writer, job, &list, &headers.chunkHeader) &&
+             projectWriterPatch(&writer, 0, &headers, sizeof(headers));
+    } else {
+        // Appending is only safe onto the exact file we wrote last.
+        struct stat st;
+        if (stat(job->path, &st) != 0 || (u64)st.st_size != autosaveFileSize) return false;
+        ok = projectWriterOpenAt(&writer, job->path, autosaveFileSize);
+        if (!ok) return false;
+        ok = writeAutosaveChunks(&writer, job, &list, &headers.chunkHeader) &&
+             projectWriterFlush(&writer) &&
+             projectWriterPatch(&writer, 0, &headers, sizeof(headers));
+    }
+
+    u64 fileSize = projectWriterTell(&writer);
+    if (!projectWriterClose(&writer)) ok = false;
+
+    if (ok && job->rewrite) {
+        remove(job->path);
+        ok = rename(tempPath, job->path) == 0;
+    }
+    if (!ok) {
+        if (job->rewrite) remove(tempPath);
+        free(list.entries);
+        return false;
+    }
+
+    free(autosaveChunks);
+    autosaveChunks = list.entries;
+    autosaveChunkCount = list.count;
+    autosaveFileSize = fileSize;
+    autosaveLiveBytes = projectLiveBytes(list.entries, list.count, sizeof(headers));
+    return true;
+}
+
+static void autosaveWorkerMain(void* arg) {
+    (void)arg;
+    while (!autosaveWorkerQuit) {
+        LightEvent_Wait(&autosaveWorkEvent);
+        if (autosaveWorkerQuit) break;
+
+        LightLock_Lock(&autosaveLock);
+        bool run = autosaveState == AUTOSAVE_QUEUED;
+        if (run) autosaveState = AUTOSAVE_RUNNING;
+        LightLock_Unlock(&autosaveLock);
+        if (!run) continue;
+
+        bool ok = runAutosaveJob(&autosaveJob);
+
+        LightLock_Lock(&autosaveLock);
+        autosaveJobOk = ok;
+        autosaveState = AUTOSAVE_DONE;
+        LightLock_Unlock(&autosaveLock);
+    }
+}
+
+//---------------------------------------------------------------------------------
+// Main thread
+//---------------------------------------------------------------------------------
+
+void initAutosave(void) {
+    static bool syncInitialized = false;
+    if (!syncInitialized) {
+        LightLock_Init(&autosaveLock);
+        LightEvent_Init(&autosaveWorkEvent, RESET_ONESHOT);
+        syncInitialized = true;
+    }
+    autosaveLastTime = osGetTime();
+    if (!autosaveWorker) {
+        autosaveWorkerQuit = false;
+        autosaveWorker = workerThreadCreate(autosaveWorkerMain, NULL, 2);
+    }
+}
+
+void exitAutosave(void) {
+    if (autosaveWorker) {
+        autosaveWorkerQuit = true;
+        LightEvent_Signal(&autosaveWorkEvent);
+        threadJoin(autosaveWorker, U64_MAX);
+        threadFree(autosaveWorker);
+        autosaveWorker = NULL;
+    }
+    autosaveState = AUTOSAVE_IDLE;
+    freeJobTiles(&autosaveJob);
+    forgetAutosaveFile();
+    free(autosaveTileGens);
+    autosaveTileGens = NULL;
+}
+
+bool autosaveIsRunning(void) {
+    LightLock_Lock(&autosaveLock);
+    bool running = autosaveState != AUTOSAVE_IDLE;
+    LightLock_Unlock(&autosaveLock);
+    return running;
+}
+
+// Drop the recovery file and start over with every tile unsaved.
+static void resetAutosave(bool removeFile) {
+    if (removeFile && autosaveProject[0] != '\0') {
+        char path[256];
+        getAutosavePath(autosaveProject, path, sizeof(path));
+        remove(path);
+    }
+    forgetAutosaveFile();
+
+    int tileCount = projectTileCount(CANVAS_WIDTH, CANVAS_HEIGHT, PROJECT_TILE_SIZE);
+    if (autosaveWidth != CANVAS_WIDTH || autosaveHeight != CANVAS_HEIGHT) {
+        free(autosaveTileGens);
+        autosaveTileGens = (u32*)memAlloc(MAX_LAYERS * tileCount * sizeof(u32));
+        autosaveWidth = CANVAS_WIDTH;
+        autosaveHeight = CANVAS_HEIGHT;
+    }
+    if (autosaveTileGens) {
+        memset(autosaveTileGens, 0, MAX_LAYERS * tileCount * sizeof(u32));
+    }
+    autosaveBacklog = false;
+}
+
+static void collectFinishedAutosave(void) {
+    AutosaveJob* job = &autosaveJob;
+    if (autosaveJobOk) {
+        autosaveFileValid = true;
+        autosaveWritten.header = job->header;
+        memcpy(autosaveWritten.layerInfo, job->layerInfo, sizeof(job->layerInfo));
+        memcpy(autosaveWritten.settings, job->settings, sizeof(job->settings));
+        int tileCount = projectTileCount(job->width, job->height, PROJECT_TILE_SIZE);
+        if (job->rewrite) {
+            for (int i = 0; i < MAX_LAYERS * tileCount; i++) {
+                autosaveTileGens[i] = job->generation;
+            }
+        } else {
+            for (int i = 0; i < job->tileCount; i++) {
+                autosaveTileGens[job->tiles[i].layer * tileCount + job->tiles[i].tile] = job->tiles[i].generation;
+            }
+        }
+    } else {
+        forgetAutosaveFile();
+        autosaveBacklog = false;
+    }
+    freeJobTiles(job);
+    autosaveLastTime = osGetTime();
+}
+
+// Copy one tile; returns false when out of memory. Empty tiles are recorded without pixels.
+static bool snapshotTile(AutosaveJob* job, int layer, int tile, int capacity, size_t* bytes) {
+    int x, y, w, h;
+    projectTileRect(CANVAS_WIDTH, CANVAS_HEIGHT, PROJECT_TILE_SIZE, tile, &x, &y, &w, &h);
+    const u32* src = layers[layer].buffer;
+
+    bool empty = true;
+    for (int row = 0; row < h && empty && src; row++) {
+        const u32* line = &src[(y + row) * LAYER_STRIDE + x];
+        for (int col = 0; col < w; col++) {
+            if (line[col]) { empty = false; break; }
+        }
+    }
+    // A rewrite starts from nothing, so empty tiles need no record.
+    if (empty && job->rewrite) return true;
+
+    u32* pixels = NULL;
+    if (!empty) {
+        pixels = (u32*)memAlloc(w * h * sizeof(u32));
+        if (!pixels) return false;
+        for (int row = 0; row < h; row++) {
+            memcpy(&pixels[row * w], &src[(y + row) * LAYER_STRIDE + x], w * sizeof(u32));
+        }
+        *bytes += w * h * sizeof(u32);
+    }
+
+    if (job->tileCount == capacity) {
+        free(pixels);
+        return false;
+    }
+    AutosaveTile* entry = &job->tiles[job->tileCount++];
+    entry->layer = layer;
+    entry->tile = tile;
+    entry->generation = getLayerTileGeneration(layer, tile);
+    entry->pixels = pixels;
+    return true;
+}
+
+static bool snapshotProject(AutosaveJob* job, bool rewrite) {
+    memset(job, 0, sizeof(*job));
+    getAutosavePath(autosaveProject, job->path, sizeof(job->path));
+    job->rewrite = rewrite;
+    job->width = CANVAS_WIDTH;
+    job->height = CANVAS_HEIGHT;
+    job->generation = getLayerGeneration();
+    projectFillHeader(&job->header);
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        projectFillLayerInfo(i, &job->layerInfo[i]);
+    }
+    projectFillSettings(job->settings);
+
+    int tileCount = projectTileCount(CANVAS_WIDTH, CANVAS_HEIGHT, PROJECT_TILE_SIZE);
+    int capacity = MAX_LAYERS * tileCount;
+    job->tiles = (AutosaveTile*)memAlloc(capacity * sizeof(AutosaveTile));
+    if (!job->tiles) return false;
+
+    size_t bytes = 0;
+    autosaveBacklog = false;
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        for (int t = 0; t < tileCount; t++) {
+            if (!rewrite && getLayerTileGeneration(layer, t) <= autosaveTileGens[layer * tileCount + t]) continue;
+            // Large edits are spread over several passes; a rewrite has to be complete.
+            if (!rewrite && bytes >= AUTOSAVE_SNAPSHOT_BUDGET) {
+                autosaveBacklog = true;
+                return true;
+            }
+            if (!snapshotTile(job, layer, t, capacity, &bytes)) {
+                freeJobTiles(job);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void updateAutosave(bool busy) {
+    LightLock_Lock(&autosaveLock);
+    AutosaveState state = autosaveState;
+    LightLock_Unlock(&autosaveLock);
+
+    if (state == AUTOSAVE_DONE) {
+        collectFinishedAutosave();
+        LightLock_Lock(&autosaveLock);
+        autosaveState = AUTOSAVE_IDLE;
+        LightLock_Unlock(&autosaveLock);
+        state = AUTOSAVE_IDLE;
+    }
+    if (state != AUTOSAVE_IDLE || !autosaveWorker) return;
+
+    // A different project (or canvas) leaves the old recovery file behind.
+    const char* name = autosaveProjectName();
+    if (strcmp(name, autosaveProject) != 0 || autosaveWidth != CANVAS_WIDTH || autosaveHeight != CANVAS_HEIGHT) {
+        resetAutosave(true);
+        snprintf(autosaveProject, sizeof(autosaveProject), "%s", name);
+    }
+
+    // Saved work needs no recovery copy.
+    if (!projectHasUnsavedChanges) {
+        if (autosaveFileValid) resetAutosave(true);
+        autosaveLastTime = osGetTime();
+        return;
+    }
+
+    // Tiles still streaming in are not in memory yet; they are safe on disk anyway.
+    if (busy || !autosaveTileGens || projectStreamIsActive()) return;
+    if (!autosaveBacklog && osGetTime() - autosaveLastTime < AUTOSAVE_INTERVAL_MS) return;
+
+    // Compact by rewriting once dead space outgrows the live data.
+    bool rewrite = !autosaveFileValid || autosaveFileSize - autosaveLiveBytes > autosaveLiveBytes;
+    if (rewrite) ensureDirectoryExists(AUTOSAVE_DIR);
+
+    if (!snapshotProject(&autosaveJob, rewrite)) {
+        autosaveLastTime = osGetTime();
+        return;
+    }
+    if (!rewrite && autosaveJob.tileCount == 0 &&
+        memcmp(&autosaveWritten.header, &autosaveJob.header, sizeof(ProjectHeader)) == 0 &&
+        memcmp(autosaveWritten.layerInfo, autosaveJob.layerInfo, sizeof(autosaveJob.layerInfo)) == 0 &&
+        memcmp(autosaveWritten.settings, autosaveJob.settings, sizeof(autosaveJob.settings)) == 0) {
+        freeJobTiles(&autosaveJob);
+        autosaveLastTime = osGetTime();
+        return;
+    }
+
+    LightLock_Lock(&autosaveLock);
+    autosaveState = AUTOSAVE_QUEUED;
+    LightLock_Unlock(&autosaveLock);
+    LightEvent_Signal(&autosaveWorkEvent);
+}
+
+bool findNewestAutosave(char* outName, char* outPath, size_t pathSize) {
+    DIR* dir = opendir(AUTOSAVE_DIR);
+    if (!dir) return false;
+
+    bool found = false;
+    time_t newest = 0;
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+        const char* name = ent->d_name;
+        size_t len = strlen(name);
+        if (len <= 5 || len - 5 >= PROJECT_NAME_MAX || strcmp(name + len - 5, ".mgdw") != 0) continue;
+
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s", AUTOSAVE_DIR, name);
+        struct stat st;
+        if (stat(path, &st) != 0) continue;
+        if (found && st.st_mtime <= newest) continue;
+
+        found = true;
+        newest = st.st_mtime;
+        memcpy(outName, name, len - 5);
+        outName[len - 5] = '\0';
+        snprintf(outPath, pathSize, "%s", path);
+    }
+    closedir(dir);
+    return found;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "app_state.h"
+
+/**
+ * @file autosave.h
+ * @brief Periodic background autosave to recovery files.
+ *
+ * While the project has unsaved changes, the main thread copies the tiles
+ * modified since the last autosave (so the cost follows the size of the
+ * edit) and a low-priority worker packs and appends them to
+ * AUTOSAVE_DIR/<project>.mgdw, a regular v3 project file. The recovery file
+ * is deleted once the project is saved.
+ */
+
+#define AUTOSAVE_DIR SAVE_DIR "/autosave"
+#define AUTOSAVE_UNNAMED "Untitled"   /**< Recovery name of a canvas that has no project name yet. */
+#define AUTOSAVE_INTERVAL_MS 60000
+#define AUTOSAVE_SNAPSHOT_BUDGET (4 * 1024 * 1024)  /**< Max tile bytes copied per pass. */
+
+void initAutosave(void);
+
+/** @brief Stop the worker. Recovery files are kept for the next start. */
+void exitAutosave(void);
+
+/**
+ * @brief Per-frame hook: collect a finished autosave and start the next one when due.
+ * @param busy true while a stroke is in progress; the snapshot is postponed.
+ */
+void updateAutosave(bool busy);
+
+/** @brief Check whether the worker is writing an autosave. */
+bool autosaveIsRunning(void);
+
+/**
+ * @brief Find the most recently written recovery file.
+ * @param outName Receives the project name (PROJECT_NAME_MAX bytes).
+ * @param outPath Receives the file path.
+ * @return false when there is none.
+ */
+bool findNewestAutosave(char* outName, char* outPath, size_t pathSize);
@@ -5,6 +5,9 @@
 #include <string.h>
 
 #include "canvas.h"
+#include "layers.h"
+#include "memory.h"
+#include "project_stream.h"
 
 typedef struct {
     int x, y;
@@ -17,6 +20,9 @@ static u32* strokeBackupBuffer = NULL;
 static u8* strokeAlphaMap = NULL;
 static int strokeLayerIdx = -1;
 
+// Brush type is fixed per stroke so a recorded stroke replays the same way.
+static BrushType strokeBrushType = BRUSH_ANTIALIAS;
+
 static void blendPixelOver(u32* outPixel, u32 srcR, u32 srcG, u32 srcB, u32 srcA,
                            u32 dst, bool alphaLock) {
     u32 dstR = (dst >> 24) & 0xFF;
@@ -54,7 +60,7 @@ static void erasePixelAlpha(int layerIndex, int x, int y, u8 eraseAlpha) {
     if (eraseAlpha == 0) return;
     if (layers[layerIndex].alphaLock) return;
 
-    int idx = y * TEX_WIDTH + x;
+    int idx = y * LAYER_STRIDE + x;
     u32 dst = layers[layerIndex].buffer[idx];
 
     u32 dstR = (dst >> 24) & 0xFF;
@@ -94,7 +100,7 @@ static void drawPixelBlended(int layerIndex, int x, int y, u32 color, u8 alpha)
     srcA = (srcA * alpha) / 255;
     if (srcA == 0) return;
 
-    int idx = y * TEX_WIDTH + x;
+    int idx = y * LAYER_STRIDE + x;
     bool alphaLock = layers[layerIndex].alphaLock;
 
     // Stroke-level alpha: blend from original pixel, track max alpha per pixel
@@ -121,7 +127,7 @@ void drawPixelToLayer(int layerIndex, int x, int y, u32 color) {
         return;
     }
 
-    int idx = y * TEX_WIDTH + x;
+    int idx = y * LAYER_STRIDE + x;
     u32 srcR = (color >> 24) & 0xFF;
     u32 srcG = (color >> 16) & 0xFF;
     u32 srcB = (color >> 8) & 0xFF;
@@ -261,11 +267,17 @@ static void drawBrushGPen(int layerIndex, int x, int y, int size, u32 color, flo
     }
 }
 
+// Widest footprint of any brush type (airbrush reaches 1.5x size).
+static int brushReach(int size) {
+    return size + size / 2 + 2;
+}
+
 void drawBrushToLayer(int layerIndex, int x, int y, int size, u32 color) {
     projectHasUnsavedChanges = true;
-    BrushType brushType = brushDefs[currentBrushType].type;
+    int reach = brushReach(size);
+    markLayerTilesDirty(layerIndex, x - reach, y - reach, x + reach, y + reach);
 
-    switch (brushType) {
+    switch (strokeBrushType) {
         case BRUSH_ANTIALIAS:
             drawBrushAntialias(layerIndex, x, y, size, color);
             break;
@@ -293,10 +305,8 @@ void drawLineToLayer(int layerIndex, int x0, int y0, int x1, int y1, int size, u
     int sy = (y0 < y1) ? 1 : -1;
     int err = dx - dy;
 
-    BrushType brushType = brushDefs[currentBrushType].type;
-
     while (1) {
-        if (brushType == BRUSH_GPEN) {
+        if (strokeBrushType == BRUSH_GPEN) {
             float strokeProgress = (float)gpenStrokeLength / 30.0f;
             if (strokeProgress > 1.0f) strokeProgress = 1.0f;
             gpenPressure = strokeProgress;
@@ -319,7 +329,8 @@ void drawLineToLayer(int layerIndex, int x0, int y0, int x1, int y1, int size, u
     }
 }
 
-void startStroke(int layerIndex) {
+void startStroke(int layerIndex, BrushType brushType) {
+    strokeBrushType = brushType;
     gpenPressure = 0.0f;
     gpenStrokeStarted = true;
     gpenStrokeLength = 0;
@@ -328,19 +339,18 @@ void startStroke(int layerIndex) {
 
     // Initialize stroke buffer for stroke-level alpha
     strokeLayerIdx = layerIndex;
-    size_t bufSize = TEX_WIDTH * TEX_HEIGHT * sizeof(u32);
-    strokeBackupBuffer = (u32*)malloc(bufSize);
+    size_t bufSize = LAYER_BUFFER_SIZE;
+    strokeBackupBuffer = (u32*)memAlloc(bufSize);
+    projectStreamWaitLayers(1u << layerIndex);
     if (strokeBackupBuffer && layers[layerIndex].buffer) {
         memcpy(strokeBackupBuffer, layers[layerIndex].buffer, bufSize);
     }
-    strokeAlphaMap = (u8*)calloc(CANVAS_WIDTH * CANVAS_HEIGHT, sizeof(u8));
+    strokeAlphaMap = (u8*)memCalloc(CANVAS_WIDTH * CANVAS_HEIGHT, sizeof(u8));
 }
 
 static void applyGpenTaperOut(void) {
     if (gpenHistoryCount < 2) return;
-
-    BrushType brushType = brushDefs[currentBrushType].type;
-    if (brushType != BRUSH_GPEN) return;
+    if (strokeBrushType != BRUSH_GPEN) return;
 
     int startIdx;
     if (gpenHistoryCount < GPEN_HISTORY_SIZE) {
@@ -377,6 +387,8 @@ static void applyGpenTaperOut(void) {
         int x = lastPt->x + (int)(dx * i);
         int y = lastPt->y + (int)(dy * i);
 
+        int reach = brushReach(lastPt->size);
+        markLayerTilesDirty(lastPt->layerIndex, x - reach, y - reach, x + reach, y + reach);
         drawBrushGPen(lastPt->layerIndex, x, y, lastPt->size, lastPt->color, pressure);
     }
 }
@@ -384,7 +396,6 @@ static void applyGpenTaperOut(void) {
 void endStroke(void) {
     applyGpenTaperOut();
     markCanvasDirtyFull();
-    forceUpdateCanvasTexture();
 
     gpenStrokeStarted = false;
     gpenHistoryCount = 0;
@@ -413,102 +424,198 @@ static bool colorWithinTolerance(u32 a, u32 b, int tolerance) {
     return maxDiff <= threshold;
 }
 
-void floodFill(int layerIndex, int startX, int startY, u32 fillColor, int expand, int tolerancePct) {
-    projectHasUnsavedChanges = true;
-    if (layerIndex < 0 || layerIndex >= MAX_LAYERS) return;
-    if (!layers[layerIndex].buffer || !compositeBuffer) return;
-    if (startX < 0 || startX >= CANVAS_WIDTH || startY < 0 || startY >= CANVAS_HEIGHT) return;
+//---------------------------------------------------------------------------------
+// Flood fill: a scanline fill over the composite, read a row at a time. The
+// region is collected in a one-bit-per-pixel mask before anything is drawn, so
+// the fill sees the layers as they were; the working set beyond the mask is a
+// few composite rows and a fixed span stack, whatever the canvas size.
+//---------------------------------------------------------------------------------
+#define FILL_ROW_CACHE 8
+#define FILL_STACK_SIZE 4096
 
-    int startIdx = startY * TEX_WIDTH + startX;
-    u32 targetColor = compositeBuffer[startIdx];
+typedef struct {
+    u32* rows[FILL_ROW_CACHE];
+    int rowY[FILL_ROW_CACHE];
+    unsigned rowUse[FILL_ROW_CACHE];
+    unsigned useClock;
+    u8* mask;
+    int maskStride;
+    Point* stack;
+    int stackSize;
+    bool overflowed;
+    u32 targetColor;
+    int tolerance;
+    int minX, minY, maxX, maxY;
+} FillState;
+
+// Composite row y, from the cache or composited into its least recently used slot.
+static const u32* fillRow(FillState* fs, int y) {
+    int slot = 0;
+    for (int i = 0; i < FILL_ROW_CACHE; i++) {
+        if (fs->rowY[i] == y) {
+            fs->rowUse[i] = ++fs->useClock;
+            return fs->rows[i];
+        }
+        if (fs->rowUse[i] < fs->rowUse[slot]) slot = i;
+    }
+    compositeLayerRect(fs->rows[slot], CANVAS_WIDTH, 0, y, CANVAS_WIDTH - 1, y);
+    fs->rowY[slot] = y;
+    fs->rowUse[slot] = ++fs->useClock;
+    return fs->rows[slot];
+}
 
-    // Only skip if fill color exactly matches target (tolerance doesn't apply here)
-    if (targetColor == fillColor) return;
+static inline bool fillMasked(const FillState* fs, int x, int y) {
+    return (fs->mask[y * fs->maskStride + (x >> 3)] >> (x & 7)) & 1;
+}
 
-    const int maxStackSize = CANVAS_WIDTH * CANVAS_HEIGHT;
-    Point* stack = (Point*)malloc(maxStackSize * sizeof(Point));
-    if (!stack) return;
+// Unfilled and within tolerance of the start colour.
+static inline bool fillMatches(const FillState* fs, const u32* row, int x, int y) {
+    return !fillMasked(fs, x, y) && colorWithinTolerance(row[x], fs->targetColor, fs->tolerance);
+}
 
-    bool* filled = (bool*)calloc(CANVAS_WIDTH * CANVAS_HEIGHT, sizeof(bool));
-    if (!filled) {
-        free(stack);
-        return;
+static void fillPush(FillState* fs, int x, int y) {
+    if (fs->stackSize < FILL_STACK_SIZE) {
+        fs->stack[fs->stackSize++] = (Point){x, y};
+    } else {
+        // Picked up again by fillRescan().
+        fs->overflowed = true;
     }
+}
 
-    bool* visited = (bool*)calloc(CANVAS_WIDTH * CANVAS_HEIGHT, sizeof(bool));
-    if (!visited) {
-        free(filled);
-        free(stack);
-        return;
+// Seed one point per run of matching pixels in row y between x0 and x1.
+static void fillSeedRow(FillState* fs, int x0, int x1, int y) {
+    if (y < 0 || y >= CANVAS_HEIGHT) return;
+    const u32* row = fillRow(fs, y);
+    bool inRun = false;
+    for (int x = x0; x <= x1; x++) {
+        bool match = fillMatches(fs, row, x, y);
+        if (match && !inRun) fillPush(fs, x, y);
+        inRun = match;
     }
+}
 
-    int stackSize = 0;
-    stack[stackSize++] = (Point){startX, startY};
-    visited[startY * CANVAS_WIDTH + startX] = true;
-
-    while (stackSize > 0) {
-        Point p = stack[--stackSize];
-        int x = p.x;
-        int y = p.y;
-
-        drawPixelToLayer(layerIndex, x, y, fillColor);
-        filled[y * CANVAS_WIDTH + x] = true;
-
-        const int dx[] = {0, 0, -1, 1};
-        const int dy[] = {-1, 1, 0, 0};
-
-        for (int i = 0; i < 4; i++) {
-            int nx = x + dx[i];
-            int ny = y + dy[i];
-
-            if (nx < 0 || nx >= CANVAS_WIDTH || ny < 0 || ny >= CANVAS_HEIGHT) continue;
-
-            int visitIdx = ny * CANVAS_WIDTH + nx;
-            if (visited[visitIdx]) continue;
+static void fillDrain(FillState* fs) {
+    while (fs->stackSize > 0) {
+        Point p = fs->stack[--fs->stackSize];
+        const u32* row = fillRow(fs, p.y);
+        if (!fillMatches(fs, row, p.x, p.y)) continue;
+
+        int x0 = p.x, x1 = p.x;
+        while (x0 > 0 && fillMatches(fs, row, x0 - 1, p.y)) x0--;
+        while (x1 < CANVAS_WIDTH - 1 && fillMatches(fs, row, x1 + 1, p.y)) x1++;
+        u8* maskRow = fs->mask + p.y * fs->maskStride;
+        for (int x = x0; x <= x1; x++) maskRow[x >> 3] |= (u8)(1 << (x & 7));
+
+        if (x0 < fs->minX) fs->minX = x0;
+        if (x1 > fs->maxX) fs->maxX = x1;
+        if (p.y < fs->minY) fs->minY = p.y;
+        if (p.y > fs->maxY) fs->maxY = p.y;
+
+        fillSeedRow(fs, x0, x1, p.y - 1);
+        fillSeedRow(fs, x0, x1, p.y + 1);
+    }
+}
 
-            int nIdx = ny * TEX_WIDTH + nx;
-            if (colorWithinTolerance(compositeBuffer[nIdx], targetColor, tolerancePct)) {
-                if (stackSize < maxStackSize) {
-                    stack[stackSize++] = (Point){nx, ny};
-                    visited[visitIdx] = true;
+// After the stack overflowed, seed from every filled pixel whose neighbour
+// above or below still matches, until a pass finds nothing dropped.
+static void fillRescan(FillState* fs) {
+    while (fs->overflowed) {
+        fs->overflowed = false;
+        for (int y = fs->minY; y <= fs->maxY; y++) {
+            for (int ny = y - 1; ny <= y + 1; ny += 2) {
+                if (ny < 0 || ny >= CANVAS_HEIGHT) continue;
+                int x = fs->minX;
+                while (x <= fs->maxX) {
+                    if (!fillMasked(fs, x, y)) {
+                        x++;
+                        continue;
+                    }
+                    int x1 = x;
+                    while (x1 < fs->maxX && fillMasked(fs, x1 + 1, y)) x1++;
+                    fillSeedRow(fs, x, x1, ny);
+                    x = x1 + 1;
                 }
+                if (fs->stackSize >= FILL_STACK_SIZE / 2) fillDrain(fs);
             }
         }
+        fillDrain(fs);
     }
+}
 
-    if (expand > 0) {
-        bool* expanded = (bool*)calloc(CANVAS_WIDTH * CANVAS_HEIGHT, sizeof(bool));
-        if (expanded) {
-            memcpy(expanded, filled, CANVAS_WIDTH * CANVAS_HEIGHT * sizeof(bool));
-            for (int pass = 0; pass < expand; pass++) {
-                bool* nextExpanded = (bool*)calloc(CANVAS_WIDTH * CANVAS_HEIGHT, sizeof(bool));
-                if (!nextExpanded) break;
-                memcpy(nextExpanded, expanded, CANVAS_WIDTH * CANVAS_HEIGHT * sizeof(bool));
-                for (int y = 0; y < CANVAS_HEIGHT; y++) {
-                    for (int x = 0; x < CANVAS_WIDTH; x++) {
-                        if (!expanded[y * CANVAS_WIDTH + x]) continue;
-                        const int edx[] = {0, 0, -1, 1};
-                        const int edy[] = {-1, 1, 0, 0};
-                        for (int d = 0; d < 4; d++) {
-                            int nx = x + edx[d];
-                            int ny = y + edy[d];
-                            if (nx < 0 || nx >= CANVAS_WIDTH || ny < 0 || ny >= CANVAS_HEIGHT) continue;
-                            int ni = ny * CANVAS_WIDTH + nx;
-                            if (!nextExpanded[ni]) {
-                                nextExpanded[ni] = true;
-                                drawPixelToLayer(layerIndex, nx, ny, fillColor);
-                            }
-                        }
-                    }
+// Draw the mask grown by `expand` in Manhattan distance, each pixel once.
+static void fillPaint(FillState* fs, int layerIndex, u32 fillColor, int expand, u8* paint) {
+    int y0 = fs->minY - expand < 0 ? 0 : fs->minY - expand;
+    int y1 = fs->maxY + expand >= CANVAS_HEIGHT ? CANVAS_HEIGHT - 1 : fs->maxY + expand;
+    for (int y = y0; y <= y1; y++) {
+        memset(paint, 0, CANVAS_WIDTH);
+        for (int dy = -expand; dy <= expand; dy++) {
+            int sy = y + dy;
+            if (sy < fs->minY || sy > fs->maxY) continue;
+            int reach = expand - (dy < 0 ? -dy : dy);
+            int x = fs->minX;
+            while (x <= fs->maxX) {
+                if (!fillMasked(fs, x, sy)) {
+                    x++;
+                    continue;
                 }
-                free(expanded);
-                expanded = nextExpanded;
+                int x1 = x;
+                while (x1 < fs->maxX && fillMasked(fs, x1 + 1, sy)) x1++;
+                int from = x - reach < 0 ? 0 : x - reach;
+                int to = x1 + reach >= CANVAS_WIDTH ? CANVAS_WIDTH - 1 : x1 + reach;
+                memset(paint + from, 1, (size_t)(to - from + 1));
+                x = x1 + 1;
             }
-            free(expanded);
+        }
+        for (int x = 0; x < CANVAS_WIDTH; x++) {
+            if (paint[x]) drawPixelToLayer(layerIndex, x, y, fillColor);
         }
     }
+}
+
+void floodFill(int layerIndex, int startX, int startY, u32 fillColor, int expand, int tolerancePct) {
+    projectHasUnsavedChanges = true;
+    if (layerIndex < 0 || layerIndex >= MAX_LAYERS) return;
+    if (!layers[layerIndex].buffer) return;
+    if (startX < 0 || startX >= CANVAS_WIDTH || startY < 0 || startY >= CANVAS_HEIGHT) return;
+    if (expand < 0) expand = 0;
+
+    // The fill samples the composite of every layer as it is right now, with
+    // no thumbnail stand-ins, so it waits for a streaming load to finish.
+    projectStreamWaitAll();
+
+    FillState fs;
+    memset(&fs, 0, sizeof(fs));
+    fs.maskStride = (CANVAS_WIDTH + 7) / 8;
+    fs.tolerance = tolerancePct;
+    // One block: the row cache, the span stack, the mask and a row of paint flags.
+    size_t rowBytes = (size_t)CANVAS_WIDTH * sizeof(u32);
+    size_t stackBytes = FILL_STACK_SIZE * sizeof(Point);
+    size_t maskBytes = (size_t)fs.maskStride * CANVAS_HEIGHT;
+    u8* block = (u8*)memAlloc(rowBytes * FILL_ROW_CACHE + stackBytes + maskBytes + CANVAS_WIDTH);
+    if (!block) return;
+    for (int i = 0; i < FILL_ROW_CACHE; i++) {
+        fs.rows[i] = (u32*)(block + rowBytes * i);
+        fs.rowY[i] = -1;
+    }
+    fs.stack = (Point*)(block + rowBytes * FILL_ROW_CACHE);
+    fs.mask = (u8*)fs.stack + stackBytes;
+    memset(fs.mask, 0, maskBytes);
+    u8* paint = fs.mask + maskBytes;
+
+    fs.targetColor = fillRow(&fs, startY)[startX];
+    // Only skip if fill color exactly matches target (tolerance doesn't apply here)
+    if (fs.targetColor == fillColor) {
+        free(block);
+        return;
+    }
+
+    fs.minX = fs.maxX = startX;
+    fs.minY = fs.maxY = startY;
+    fillPush(&fs, startX, startY);
+    fillDrain(&fs);
+    fillRescan(&fs);
 
-    free(visited);
-    free(filled);
-    free(stack);
+    markLayerTilesDirty(layerIndex, fs.minX - expand, fs.minY - expand, fs.maxX + expand, fs.maxY + expand);
+    fillPaint(&fs, layerIndex, fillColor, expand, paint);
+    free(block);
 }
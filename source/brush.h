@@ -11,5 +11,14 @@ void floodFill(int layerIndex, int startX, int startY, u32 fillColor, int expand
 void drawPixelToLayer(int layerIndex, int x, int y, u32 color);
 void drawBrushToLayer(int layerIndex, int x, int y, int size, u32 color);
 void drawLineToLayer(int layerIndex, int x0, int y0, int x1, int y1, int size, u32 color);
-void startStroke(int layerIndex);
+/**
+ * @brief Begin a stroke on a layer.
+ *
+ * Everything that shapes the stroke (brush type, G-pen pressure, stroke-level
+ * alpha) is fixed here, so feeding the same calls again from the same layer
+ * state reproduces the same pixels. Used by history replay.
+ */
+void startStroke(int layerIndex, BrushType brushType);
+
+/** @brief Finish the stroke (G-pen taper) and mark the canvas dirty; no GPU upload. */
 void endStroke(void);
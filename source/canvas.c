@@ -1,6 +1,14 @@
 #include "canvas.h"
 
+#include <math.h>
+#include <stdlib.h>
+
 #include "layers.h"
+#include "project_stream.h"
+
+//---------------------------------------------------------------------------
+// Dirty tracking
+//---------------------------------------------------------------------------
 
 static void clampDirtyRect(int* minX, int* minY, int* maxX, int* maxY) {
     if (*minX < 0) *minX = 0;
@@ -40,29 +48,402 @@ void markCanvasDirtyRect(int minX, int minY, int maxX, int maxY) {
     if (maxY > canvasDirtyMaxY) canvasDirtyMaxY = maxY;
 }
 
+//---------------------------------------------------------------------------
+// Views
+//---------------------------------------------------------------------------
+
+void getCanvasTopView(CanvasView* view) {
+    float scaleX = (float)TOP_SCREEN_WIDTH / CANVAS_WIDTH;
+    float scaleY = (float)TOP_SCREEN_HEIGHT / CANVAS_HEIGHT;
+    view->zoom = (scaleX < scaleY) ? scaleX : scaleY;
+    view->x = (TOP_SCREEN_WIDTH - CANVAS_WIDTH * view->zoom) / 2;
+    view->y = (TOP_SCREEN_HEIGHT - CANVAS_HEIGHT * view->zoom) / 2;
+    view->width = TOP_SCREEN_WIDTH;
+    view->height = TOP_SCREEN_HEIGHT;
+}
+
+void getCanvasBottomView(CanvasView* view) {
+    view->zoom = canvasZoom;
+    view->x = canvasPanX + (BOTTOM_SCREEN_WIDTH - CANVAS_WIDTH * canvasZoom) / 2;
+    view->y = canvasPanY + (BOTTOM_SCREEN_HEIGHT - CANVAS_HEIGHT * canvasZoom) / 2;
+    view->width = BOTTOM_SCREEN_WIDTH;
+    view->height = BOTTOM_SCREEN_HEIGHT;
+}
+
+bool getCanvasViewRect(const CanvasView* view, int* minX, int* minY, int* maxX, int* maxY) {
+    // Rows count up from the bottom of the screen, as in the touch mapping.
+    int left = (int)floorf(-view->x / view->zoom);
+    int right = (int)floorf((view->width - view->x) / view->zoom);
+    int top = CANVAS_HEIGHT - 1 - (int)floorf(-view->y / view->zoom);
+    int bottom = CANVAS_HEIGHT - 1 - (int)floorf((view->height - view->y) / view->zoom);
+
+    if (left < 0) left = 0;
+    if (bottom < 0) bottom = 0;
+    if (right >= CANVAS_WIDTH) right = CANVAS_WIDTH - 1;
+    if (top >= CANVAS_HEIGHT) top = CANVAS_HEIGHT - 1;
+    if (left > right || bottom > top) return false;
+
+    *minX = left;
+    *minY = bottom;
+    *maxX = right;
+    *maxY = top;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Display tiles
+//---------------------------------------------------------------------------
+
+// Updates a tile may stay out of view before it is released; also keeps
+// tiles the GPU drew or uploaded last frame alive until it is done with them.
+#define DISPLAY_TILE_KEEP_UPDATES 30
+
+// Texel i of tile (tx, ty) at a level samples canvas pixel
+// tx * (DISPLAY_TILE_SPAN << level) + (i - 1) * step, clamped to the canvas.
+// Texels 1..n are drawn; 0 and n + 1 repeat the neighbouring tiles so
+// linear filtering blends across the seams.
+//
+// Uploads are asynchronous: updateCanvasTexture() composites into the
+// staging buffer while the GPU may still be busy with the previous frame,
+// and queueCanvasUploads() adds the transfers to the frame's GX queue ahead
+// of its draws. The texture is thus only written once the previous frame
+// is done with it, and is complete before this frame samples it; the CPU
+// never waits for the DMA.
+typedef struct {
+    C3D_Tex tex;
+    Tex3DS_SubTexture subtex;
+    u32* pixels;             // Linear staging copy of the texels
+    bool resident;
+    bool needed;             // Under a view in this update
+    int idleUpdates;
+    bool dirty;
+    int dirtyMinX, dirtyMinY, dirtyMaxX, dirtyMaxY;   // Texels
+    bool staged;             // pixels are newer than the texture
+    bool uploaded;           // The texture holds an image
+    u32 uploadFrame;         // Frame whose queue last read pixels
+} DisplayTile;
+
+typedef struct {
+    DisplayTile* tiles;
+    int cols;
+    int rows;
+} DisplayLevel;
+
+static DisplayLevel displayLevels[DISPLAY_LEVELS];
+static int displayWidth = 0;     // Canvas size the grids were built for
+static int displayHeight = 0;
+static u32 displayFrame = 1;     // Frames that queued uploads; tiles start at 0
+static int sampleColumns[DISPLAY_TILE_TEXELS];
+static int sampleRows[DISPLAY_TILE_TEXELS];
+
+static int displayTileExtent(int level) {
+    return DISPLAY_TILE_SPAN << level;
+}
+
+// Coarsest level that still has a texel per screen pixel.
+static int displayLevelForZoom(float zoom) {
+    int level = 0;
+    while (level + 1 < DISPLAY_LEVELS && zoom * (float)(2 << level) <= 1.0f) level++;
+    return level;
+}
+
+static void releaseTile(DisplayTile* tile) {
+    if (!tile->resident) return;
+    C3D_TexDelete(&tile->tex);
+    linearFree(tile->pixels);
+    tile->pixels = NULL;
+    tile->resident = false;
+}
+
+void resetCanvasDisplay(void) {
+    for (int level = 0; level < DISPLAY_LEVELS; level++) {
+        DisplayLevel* grid = &displayLevels[level];
+        for (int i = 0; i < grid->cols * grid->rows; i++) {
+            releaseTile(&grid->tiles[i]);
+        }
+        free(grid->tiles);
+        grid->tiles = NULL;
+        grid->cols = 0;
+        grid->rows = 0;
+    }
+    displayWidth = 0;
+    displayHeight = 0;
+}
+
+static bool ensureDisplayGrids(void) {
+    if (displayWidth == CANVAS_WIDTH && displayHeight == CANVAS_HEIGHT) return true;
+
+    resetCanvasDisplay();
+    for (int level = 0; level < DISPLAY_LEVELS; level++) {
+        DisplayLevel* grid = &displayLevels[level];
+        int extent = displayTileExtent(level);
+        grid->cols = (CANVAS_WIDTH + extent - 1) / extent;
+        grid->rows = (CANVAS_HEIGHT + extent - 1) / extent;
+        grid->tiles = (DisplayTile*)calloc(grid->cols * grid->rows, sizeof(DisplayTile));
+        if (!grid->tiles) {
+            grid->cols = 0;
+            grid->rows = 0;
+            resetCanvasDisplay();
+            return false;
+        }
+    }
+    displayWidth = CANVAS_WIDTH;
+    displayHeight = CANVAS_HEIGHT;
+    return true;
+}
+
+static void markTileDirty(DisplayTile* tile, int minX, int minY, int maxX, int maxY) {
+    if (!tile->dirty) {
+        tile->dirty = true;
+        tile->dirtyMinX = minX;
+        tile->dirtyMinY = minY;
+        tile->dirtyMaxX = maxX;
+        tile->dirtyMaxY = maxY;
+        return;
+    }
+    if (minX < tile->dirtyMinX) tile->dirtyMinX = minX;
+    if (minY < tile->dirtyMinY) tile->dirtyMinY = minY;
+    if (maxX > tile->dirtyMaxX) tile->dirtyMaxX = maxX;
+    if (maxY > tile->dirtyMaxY) tile->dirtyMaxY = maxY;
+}
+
+static bool allocTile(DisplayTile* tile) {
+    tile->pixels = (u32*)linearAlloc(DISPLAY_TILE_TEXELS * DISPLAY_TILE_TEXELS * sizeof(u32));
+    if (!tile->pixels) return false;
+    if (!C3D_TexInit(&tile->tex, DISPLAY_TILE_TEXELS, DISPLAY_TILE_TEXELS, GPU_RGBA8)) {
+        linearFree(tile->pixels);
+        tile->pixels = NULL;
+        return false;
+    }
+    C3D_TexSetFilter(&tile->tex, GPU_LINEAR, GPU_LINEAR);
+    C3D_TexSetWrap(&tile->tex, GPU_CLAMP_TO_EDGE, GPU_CLAMP_TO_EDGE);
+    tile->resident = true;
+    tile->idleUpdates = 0;
+    tile->dirty = false;
+    tile->staged = false;
+    tile->uploaded = false;
+    tile->uploadFrame = 0;
+    markTileDirty(tile, 0, 0, DISPLAY_TILE_TEXELS - 1, DISPLAY_TILE_TEXELS - 1);
+    return true;
+}
+
+// Texels [first, last] along one axis of a tile whose samples fall in the
+// canvas range [min, max]. Samples clamped to the canvas edge count as
+// that edge pixel.
+static bool dirtyTexelRange(int origin, int step, int size, int min, int max, int* first, int* last) {
+    int lo = 0;
+    int hi = DISPLAY_TILE_TEXELS - 1;
+    if (min > 0 && min > origin) {
+        lo = (min - origin + step - 1) / step;
+    }
+    if (max < size - 1) {
+        if (max < origin) return false;
+        int limit = (max - origin) / step;
+        if (limit < hi) hi = limit;
+    }
+    if (lo > hi) return false;
+    *first = lo;
+    *last = hi;
+    return true;
+}
+
+// Pass the canvas dirty rect on to every resident tile it touches.
+static void spreadCanvasDirtyRect(int minX, int minY, int maxX, int maxY) {
+    for (int level = 0; level < DISPLAY_LEVELS; level++) {
+        DisplayLevel* grid = &displayLevels[level];
+        int step = 1 << level;
+        int extent = displayTileExtent(level);
+        // The border texels reach one step into the neighbouring tiles.
+        int tx0 = (minX - step) / extent;
+        int ty0 = (minY - step) / extent;
+        int tx1 = (maxX + step) / extent;
+        int ty1 = (maxY + step) / extent;
+        if (tx0 < 0) tx0 = 0;
+        if (ty0 < 0) ty0 = 0;
+        if (tx1 >= grid->cols) tx1 = grid->cols - 1;
+        if (ty1 >= grid->rows) ty1 = grid->rows - 1;
+
+        for (int ty = ty0; ty <= ty1; ty++) {
+            for (int tx = tx0; tx <= tx1; tx++) {
+                DisplayTile* tile = &grid->tiles[ty * grid->cols + tx];
+                if (!tile->resident) continue;
+                int firstX, lastX, firstY, lastY;
+                if (!dirtyTexelRange(tx * extent - step, step, CANVAS_WIDTH, minX, maxX, &firstX, &lastX) ||
+                    !dirtyTexelRange(ty * extent - step, step, CANVAS_HEIGHT, minY, maxY, &firstY, &lastY)) {
+                    continue;
+                }
+                markTileDirty(tile, firstX, firstY, lastX, lastY);
+            }
+        }
+    }
+}
+
+// Tile range of a level under a view; false when the view shows no canvas.
+static bool getViewTileRange(const CanvasView* view, int level, int* tx0, int* ty0, int* tx1, int* ty1) {
+    int minX, minY, maxX, maxY;
+    if (!getCanvasViewRect(view, &minX, &minY, &maxX, &maxY)) return false;
+    int extent = displayTileExtent(level);
+    *tx0 = minX / extent;
+    *ty0 = minY / extent;
+    *tx1 = maxX / extent;
+    *ty1 = maxY / extent;
+    return true;
+}
+
+static void markViewTilesNeeded(const CanvasView* view) {
+    int level = displayLevelForZoom(view->zoom);
+    DisplayLevel* grid = &displayLevels[level];
+    int tx0, ty0, tx1, ty1;
+    if (!getViewTileRange(view, level, &tx0, &ty0, &tx1, &ty1)) return;
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            grid->tiles[ty * grid->cols + tx].needed = true;
+        }
+    }
+}
+
+static int clampSample(int value, int size) {
+    if (value < 0) return 0;
+    if (value >= size) return size - 1;
+    return value;
+}
+
+// Composite the dirty texels into the staging buffer.
+static void refreshTile(DisplayTile* tile, int level, int tx, int ty) {
+    int step = 1 << level;
+    int originX = tx * displayTileExtent(level) - step;
+    int originY = ty * displayTileExtent(level) - step;
+    int width = tile->dirtyMaxX - tile->dirtyMinX + 1;
+    int height = tile->dirtyMaxY - tile->dirtyMinY + 1;
+    for (int i = 0; i < width; i++) {
+        sampleColumns[i] = clampSample(originX + (tile->dirtyMinX + i) * step, CANVAS_WIDTH);
+    }
+    for (int j = 0; j < height; j++) {
+        sampleRows[j] = clampSample(originY + (tile->dirtyMinY + j) * step, CANVAS_HEIGHT);
+    }
+
+    u32* dst = &tile->pixels[tile->dirtyMinY * DISPLAY_TILE_TEXELS + tile->dirtyMinX];
+    compositeLayerSamples(dst, DISPLAY_TILE_TEXELS, sampleColumns, width, sampleRows, height);
+    // Tiles a streaming load has not reached yet in a visible layer show the thumbnail.
+    projectStreamFillPending(dst, DISPLAY_TILE_TEXELS, sampleColumns, width, sampleRows, height);
+
+    GSPGPU_FlushDataCache(tile->pixels, DISPLAY_TILE_TEXELS * DISPLAY_TILE_TEXELS * sizeof(u32));
+    tile->dirty = false;
+    tile->staged = true;
+}
+
 void updateCanvasTexture(void) {
-    if (!compositeBuffer || !canvasNeedsUpdate) return;
+    if (!ensureDisplayGrids()) return;
 
-    if (!canvasDirtyValid) {
-        markCanvasDirtyFull();
+    if (canvasNeedsUpdate) {
+        if (!canvasDirtyValid) {
+            markCanvasDirtyFull();
+        }
+        spreadCanvasDirtyRect(canvasDirtyMinX, canvasDirtyMinY, canvasDirtyMaxX, canvasDirtyMaxY);
+        canvasNeedsUpdate = false;
+        canvasDirtyValid = false;
     }
 
-    compositeAllLayers();
+    CanvasView topView, bottomView;
+    getCanvasTopView(&topView);
+    getCanvasBottomView(&bottomView);
+    markViewTilesNeeded(&topView);
+    markViewTilesNeeded(&bottomView);
 
-    GSPGPU_FlushDataCache(compositeBuffer, TEX_WIDTH * TEX_HEIGHT * sizeof(u32));
-    C3D_SyncDisplayTransfer(
-        (u32*)compositeBuffer, GX_BUFFER_DIM(TEX_WIDTH, TEX_HEIGHT),
-        (u32*)canvasTex.data, GX_BUFFER_DIM(TEX_WIDTH, TEX_HEIGHT),
-        (GX_TRANSFER_FLIP_VERT(1) | GX_TRANSFER_OUT_TILED(1) | GX_TRANSFER_RAW_COPY(0) |
-         GX_TRANSFER_IN_FORMAT(GX_TRANSFER_FMT_RGBA8) | GX_TRANSFER_OUT_FORMAT(GX_TRANSFER_FMT_RGBA8) |
-         GX_TRANSFER_SCALING(GX_TRANSFER_SCALE_NO))
-    );
+    for (int level = 0; level < DISPLAY_LEVELS; level++) {
+        DisplayLevel* grid = &displayLevels[level];
+        for (int ty = 0; ty < grid->rows; ty++) {
+            for (int tx = 0; tx < grid->cols; tx++) {
+                DisplayTile* tile = &grid->tiles[ty * grid->cols + tx];
+                if (!tile->needed) {
+                    if (tile->resident && ++tile->idleUpdates > DISPLAY_TILE_KEEP_UPDATES) {
+                        releaseTile(tile);
+                    }
+                    continue;
+                }
+                tile->needed = false;
+                tile->idleUpdates = 0;
+                if (!tile->resident && !allocTile(tile)) continue;
+                // The last frame's queue may still be reading the staging
+                // buffer; the tile stays dirty until the next update.
+                if (tile->dirty && tile->uploadFrame != displayFrame) refreshTile(tile, level, tx, ty);
+            }
+        }
+    }
+}
 
-    canvasNeedsUpdate = false;
-    canvasDirtyValid = false;
+void queueCanvasUploads(void) {
+    if (displayWidth != CANVAS_WIDTH || displayHeight != CANVAS_HEIGHT) return;
+
+    // C3D_FrameBegin has waited for the previous frame, so its uploads are done.
+    displayFrame++;
+    for (int level = 0; level < DISPLAY_LEVELS; level++) {
+        DisplayLevel* grid = &displayLevels[level];
+        for (int i = 0; i < grid->cols * grid->rows; i++) {
+            DisplayTile* tile = &grid->tiles[i];
+            if (!tile->resident || !tile->staged) continue;
+            GX_DisplayTransfer(
+                tile->pixels, GX_BUFFER_DIM(DISPLAY_TILE_TEXELS, DISPLAY_TILE_TEXELS),
+                (u32*)tile->tex.data, GX_BUFFER_DIM(DISPLAY_TILE_TEXELS, DISPLAY_TILE_TEXELS),
+                (GX_TRANSFER_FLIP_VERT(1) | GX_TRANSFER_OUT_TILED(1) | GX_TRANSFER_RAW_COPY(0) |
+                 GX_TRANSFER_IN_FORMAT(GX_TRANSFER_FMT_RGBA8) | GX_TRANSFER_OUT_FORMAT(GX_TRANSFER_FMT_RGBA8) |
+                 GX_TRANSFER_SCALING(GX_TRANSFER_SCALE_NO))
+            );
+            tile->staged = false;
+            tile->uploaded = true;
+            tile->uploadFrame = displayFrame;
+        }
+    }
 }
 
 void forceUpdateCanvasTexture(void) {
     markCanvasDirtyFull();
     updateCanvasTexture();
 }
+
+void drawCanvasView(const CanvasView* view) {
+    if (displayWidth != CANVAS_WIDTH || displayHeight != CANVAS_HEIGHT) return;
+
+    int level = displayLevelForZoom(view->zoom);
+    DisplayLevel* grid = &displayLevels[level];
+    int step = 1 << level;
+    int extent = displayTileExtent(level);
+    int tx0, ty0, tx1, ty1;
+    if (!getViewTileRange(view, level, &tx0, &ty0, &tx1, &ty1)) return;
+
+    for (int ty = ty0; ty <= ty1; ty++) {
+        // Neighbouring tiles share their edge coordinates exactly, so no gaps open up.
+        int canvasY0 = ty * extent;
+        int canvasY1 = canvasY0 + extent < CANVAS_HEIGHT ? canvasY0 + extent : CANVAS_HEIGHT;
+        // Row 0 is at the bottom, so the tile's last row is its top edge.
+        float y0 = view->y + (CANVAS_HEIGHT - canvasY1) * view->zoom;
+        float y1 = view->y + (CANVAS_HEIGHT - canvasY0) * view->zoom;
+        int texelsY = (canvasY1 - canvasY0 + step - 1) / step;
+
+        for (int tx = tx0; tx <= tx1; tx++) {
+            int canvasX0 = tx * extent;
+            int canvasX1 = canvasX0 + extent < CANVAS_WIDTH ? canvasX0 + extent : CANVAS_WIDTH;
+            float x0 = view->x + canvasX0 * view->zoom;
+            float x1 = view->x + canvasX1 * view->zoom;
+            int texelsX = (canvasX1 - canvasX0 + step - 1) / step;
+
+            DisplayTile* tile = &grid->tiles[ty * grid->cols + tx];
+            if (!tile->resident || !tile->uploaded) {
+                // No texture (out of memory) or none uploaded yet: show the paper colour.
+                C2D_DrawRectSolid(x0, y0, 0, x1 - x0, y1 - y0, C2D_Color32(0xFF, 0xFF, 0xFF, 0xFF));
+                continue;
+            }
+
+            // Staging row r spans v = r / DISPLAY_TILE_TEXELS upwards, as the
+            // single canvas texture did (top = height / texture height, bottom = 0).
+            tile->subtex.width = texelsX;
+            tile->subtex.height = texelsY;
+            tile->subtex.left = 1.0f / DISPLAY_TILE_TEXELS;
+            tile->subtex.right = (float)(1 + texelsX) / DISPLAY_TILE_TEXELS;
+            tile->subtex.top = (float)(1 + texelsY) / DISPLAY_TILE_TEXELS;
+            tile->subtex.bottom = 1.0f / DISPLAY_TILE_TEXELS;
+            C2D_Image image = {&tile->tex, &tile->subtex};
+            C2D_DrawImageAt(image, x0, y0, 0, NULL, (x1 - x0) / texelsX, (y1 - y0) / texelsY);
+        }
+    }
+}
@@ -4,10 +4,70 @@
 
 /**
  * @file canvas.h
- * @brief Canvas texture upload helpers.
+ * @brief Canvas display: dirty tracking, tiled textures and views.
+ *
+ * The composited canvas is shown through a grid of DISPLAY_TILE_TEXELS
+ * square textures rather than one texture, so it is not bound by the GPU's
+ * 1024 texel limit. Each level of detail samples every 2^level-th canvas
+ * pixel; a view draws the level matching its zoom. Only tiles under the top
+ * or bottom view are kept, and only their dirty texels are composited.
+ * Textures are filled from linear staging buffers by asynchronous transfers.
  */
 
+#define DISPLAY_TILE_TEXELS 256
+#define DISPLAY_TILE_SPAN   (DISPLAY_TILE_TEXELS - 2)   /**< Texels drawn; the border repeats the neighbours. */
+#define DISPLAY_LEVELS      5                           /**< 1:1 down to 1:16. */
+
+/**
+ * @brief Placement of the canvas on a screen.
+ *
+ * (x, y) is the screen position of the canvas's top-left corner. Canvas rows
+ * count up from the bottom, as in the touch mapping: pixel (px, py) is drawn
+ * at (x + px * zoom, y + (CANVAS_HEIGHT - 1 - py) * zoom).
+ */
+typedef struct {
+    float x;
+    float y;
+    float zoom;
+    int width;              /**< Screen size. */
+    int height;
+} CanvasView;
+
+/** @brief The whole canvas fitted to the top screen. */
+void getCanvasTopView(CanvasView* view);
+
+/** @brief The bottom screen drawing view (pan and zoom). */
+void getCanvasBottomView(CanvasView* view);
+
+/**
+ * @brief Canvas pixels (inclusive) that fall on screen in a view.
+ * @return false when the canvas is entirely off screen.
+ */
+bool getCanvasViewRect(const CanvasView* view, int* minX, int* minY, int* maxX, int* maxY);
+
+/**
+ * @brief Bring the display tiles up to date for both views.
+ *
+ * Loads tiles that came into view, drops those out of view for a while and
+ * recomposites the dirty part of the rest into their staging buffers. Call
+ * before C3D_FrameBegin, so it overlaps with the GPU finishing the previous
+ * frame.
+ */
 void updateCanvasTexture(void);
+
+/**
+ * @brief Queue the texture transfers of the tiles updateCanvasTexture composited.
+ *
+ * Call right after C3D_FrameBegin, before drawing: the transfers run on the
+ * GPU ahead of the frame's draws, without blocking the CPU.
+ */
+void queueCanvasUploads(void);
 void forceUpdateCanvasTexture(void);
 void markCanvasDirtyFull(void);
 void markCanvasDirtyRect(int minX, int minY, int maxX, int maxY);
+
+/** @brief Draw the canvas tiles of a view into the current scene. */
+void drawCanvasView(const CanvasView* view);
+
+/** @brief Release every display tile (they are rebuilt on the next update). */
+void resetCanvasDisplay(void);
@@ -1,9 +1,14 @@
 #include "export.h"
 
 #include "app_state.h"
-#include "canvas.h"
+#include "jpeg_encode.h"
 #include "layers.h"
+#include "png_encode.h"
+#include "project_stream.h"
+#include "quantize.h"
 #include "util.h"
+#include "worker.h"
+#include "zip_write.h"
 
 #include <3ds.h>
 #include <png.h>
@@ -14,89 +19,1038 @@
 
 #define EXPORT_DIR SAVE_DIR "/exports"
 
-bool exportCanvasPNG(char* outPath, size_t outPathSize) {
-    // Ensure composite buffer is up to date
-    forceUpdateCanvasTexture();
+// Rows composited per pass: enough to amortize the per-layer setup, small
+// enough that the strip stays a few hundred KB at the largest canvas.
+#define EXPORT_STRIP_ROWS 16
 
-    // Ensure export directory exists
-    ensureDirectoryExists(SAVE_DIR);
-    ensureDirectoryExists(EXPORT_DIR);
+// Filtered bytes per deflate segment. Large enough that the sync flush and
+// the restart at each boundary cost well under 1% of the output.
+#define EXPORT_SEGMENT_BYTES (128 * 1024)
 
-    // Build filename: [name]_YYYYMMDD_HHMMSS.png
-    time_t t = time(NULL);
-    struct tm* tm = localtime(&t);
+static ExportStats lastExportStats;
 
-    char filePath[256];
-    snprintf(filePath, sizeof(filePath),
-             "%s/%s_%04d%02d%02d_%02d%02d%02d.png",
-             EXPORT_DIR,
-             currentProjectName,
-             tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
-             tm->tm_hour, tm->tm_min, tm->tm_sec);
+void exportDefaultOptions(ExportOptions* options) {
+    options->zlibLevel = EXPORT_DEFAULT_ZLIB_LEVEL;
+    options->filter = EXPORT_FILTER_ADAPTIVE;
+    options->deflateThreads = EXPORT_DEFAULT_DEFLATE_THREADS;
+    options->scales[0] = 1;
+    options->targetCount = 1;
+    options->cropToContent = false;
+    options->colorMode = EXPORT_COLOR_AUTO;
+    options->dither = true;
+    options->jpegQuality = EXPORT_DEFAULT_JPEG_QUALITY;
+}
 
-    FILE* fp = fopen(filePath, "wb");
-    if (!fp) return false;
+void getExportStats(ExportStats* stats) {
+    *stats = lastExportStats;
+}
 
-    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING,
-                                              NULL, NULL, NULL);
-    if (!png) {
-        fclose(fp);
-        return false;
+static int countVisibleLayers(void) {
+    int count = 0;
+    for (int i = 0; i < numLayers; i++) {
+        if (layers[i].visible && layers[i].buffer && layers[i].opacity > 0) count++;
     }
+    return count;
+}
 
-    png_infop info = png_create_info_struct(png);
-    if (!info) {
-        png_destroy_write_struct(&png, NULL);
-        fclose(fp);
-        return false;
+// Composite pixels are RGBA8: (R << 24) | (G << 16) | (B << 8) | A.
+// Every step-th pixel is taken and repeated scale times (nearest-neighbour
+// downscale / upscale).
+static void packRgbaRow(const u32* pixels, int width, int step, int scale, u8* out) {
+    for (int x = 0; x < width; x += step) {
+        u32 pixel = pixels[x];
+        u8 r = (pixel >> 24) & 0xFF;
+        u8 g = (pixel >> 16) & 0xFF;
+        u8 b = (pixel >>  8) & 0xFF;
+        u8 a =  pixel        & 0xFF;
+        for (int i = 0; i < scale; i++) {
+            out[0] = r;
+            out[1] = g;
+            out[2] = b;
+            out[3] = a;
+            out += 4;
+        }
+    }
+}
+
+// Palette indices are packed MSB first, bitDepth bits each, and sampled
+// like packRgbaRow; the row's last byte is zero padded.
+static void packIndexRow(const u8* indices, int width, int step, int scale, int bitDepth, size_t rowBytes, u8* out) {
+    if (bitDepth == 8) {
+        for (int x = 0; x < width; x += step) {
+            for (int i = 0; i < scale; i++) *out++ = indices[x];
+        }
+        return;
+    }
+    memset(out, 0, rowBytes);
+    int bit = 0;
+    for (int x = 0; x < width; x += step) {
+        for (int i = 0; i < scale; i++) {
+            out[bit >> 3] |= (u8)(indices[x] << (8 - bitDepth - (bit & 7)));
+            bit += bitDepth;
+        }
     }
+}
 
-    if (setjmp(png_jmpbuf(png))) {
-        png_destroy_write_struct(&png, &info);
-        fclose(fp);
+//---------------------------------------------------------------------------
+// Palette
+//---------------------------------------------------------------------------
+
+typedef struct {
+    bool indexed;
+    bool quantized;
+    QuantizeColorSet* set;              // Exact colours (not quantized)
+    QuantizeMapper mapper;              // Quantized
+    u32 colors[QUANTIZE_MAX_COLORS];
+    int count;
+    int bitDepth;
+} ExportPalette;
+
+// Smallest PNG bit depth holding count palette indices.
+static int paletteBitDepth(int count) {
+    if (count <= 2) return 1;
+    if (count <= 4) return 2;
+    if (count <= 16) return 4;
+    return 8;
+}
+
+// Composite the area once to collect its colours. Up to 256 distinct ones
+// become the palette as they are; beyond that, AUTO falls back to RGBA and
+// QUANTIZE composites again into an octree. Returns false only when out of memory.
+static bool buildPalette(ExportPalette* palette, const ExportOptions* options, u32* strip,
+                         int areaX, int areaY, int areaWidth, int areaHeight, u64* compositeTicks) {
+    memset(palette, 0, sizeof(*palette));
+    if (options->colorMode == EXPORT_COLOR_RGBA) return true;
+
+    palette->set = (QuantizeColorSet*)malloc(sizeof(QuantizeColorSet));
+    if (!palette->set) return false;
+    quantizeSetInit(palette->set);
+
+    bool exact = true;
+    for (int y = 0; y < areaHeight && exact; y += EXPORT_STRIP_ROWS) {
+        int count = (y + EXPORT_STRIP_ROWS <= areaHeight) ? EXPORT_STRIP_ROWS : areaHeight - y;
+        u64 compositeStart = svcGetSystemTick();
+        compositeLayerRect(strip, areaWidth, areaX, areaY + y, areaX + areaWidth - 1, areaY + y + count - 1);
+        *compositeTicks += svcGetSystemTick() - compositeStart;
+        exact = quantizeSetAddPixels(palette->set, strip, areaWidth * count);
+    }
+    if (exact) {
+        palette->indexed = true;
+        palette->count = palette->set->count;
+        memcpy(palette->colors, palette->set->colors, palette->count * sizeof(u32));
+        palette->bitDepth = paletteBitDepth(palette->count);
+        return true;
+    }
+    free(palette->set);
+    palette->set = NULL;
+    if (options->colorMode == EXPORT_COLOR_AUTO) return true;
+
+    QuantizeOctree* tree = quantizeOctreeCreate(QUANTIZE_MAX_COLORS);
+    if (!tree) return false;
+    for (int y = 0; y < areaHeight; y += EXPORT_STRIP_ROWS) {
+        int count = (y + EXPORT_STRIP_ROWS <= areaHeight) ? EXPORT_STRIP_ROWS : areaHeight - y;
+        u64 compositeStart = svcGetSystemTick();
+        compositeLayerRect(strip, areaWidth, areaX, areaY + y, areaX + areaWidth - 1, areaY + y + count - 1);
+        *compositeTicks += svcGetSystemTick() - compositeStart;
+        quantizeOctreeAddPixels(tree, strip, areaWidth * count);
+    }
+    palette->count = quantizeOctreePalette(tree, palette->colors);
+    quantizeOctreeDestroy(tree);
+    if (!quantizeMapperInit(&palette->mapper, palette->colors, palette->count, options->dither)) {
+        quantizeMapperFree(&palette->mapper);
         return false;
     }
+    palette->indexed = true;
+    palette->quantized = true;
+    palette->bitDepth = paletteBitDepth(palette->count);
+    return true;
+}
+
+static void freePalette(ExportPalette* palette) {
+    free(palette->set);
+    palette->set = NULL;
+    if (palette->quantized) quantizeMapperFree(&palette->mapper);
+}
+
+// Palette indices of one composited row at canvas position (x, y).
+static void mapPaletteRow(ExportPalette* palette, const u32* pixels, int width, int x, int y, u8* out) {
+    if (palette->quantized) {
+        quantizeMapPixels(&palette->mapper, pixels, width, x, y, out);
+    } else {
+        quantizeSetMapPixels(palette->set, pixels, width, out);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Parallel deflate pool
+//---------------------------------------------------------------------------
+
+typedef enum {
+    SEGMENT_FREE,
+    SEGMENT_QUEUED,
+    SEGMENT_RUNNING,
+    SEGMENT_DONE,
+} SegmentState;
+
+typedef struct {
+    SegmentState state;
+    int seq;
+    u32 order;                          // Queue position across all writers
+    bool ok;
+    PngDeflateSegment job;
+    u8* input;                          // Filtered rows
+    u8* output;
+    u8 dict[PNG_ENCODE_DICT_SIZE];
+} ExportSegment;
+
+// Shared by every file of an export; each writer owns a range of slots.
+typedef struct {
+    LightLock lock;
+    LightEvent workEvent;
+    LightEvent doneEvent;
+    ExportSegment* slots;
+    int slotCount;
+    u32 nextOrder;
+    bool quit;
+    Thread threads[EXPORT_MAX_DEFLATE_THREADS];
+    int threadCount;
+} DeflatePool;
+
+static void deflateWorkerMain(void* arg) {
+    DeflatePool* pool = (DeflatePool*)arg;
+    while (true) {
+        LightLock_Lock(&pool->lock);
+        ExportSegment* segment = NULL;
+        int queued = 0;
+        for (int i = 0; i < pool->slotCount; i++) {
+            ExportSegment* candidate = &pool->slots[i];
+            if (candidate->state != SEGMENT_QUEUED) continue;
+            queued++;
+            if (!segment || candidate->order < segment->order) segment = candidate;
+        }
+        if (segment) segment->state = SEGMENT_RUNNING;
+        bool quit = pool->quit;
+        LightLock_Unlock(&pool->lock);
+
+        if (!segment) {
+            if (quit) {
+                // Pass the wake-up on to the next worker.
+                LightEvent_Signal(&pool->workEvent);
+                break;
+            }
+            LightEvent_Wait(&pool->workEvent);
+            continue;
+        }
+        if (queued > 1) LightEvent_Signal(&pool->workEvent);
+
+        bool ok = pngEncodeDeflateSegment(&segment->job);
+
+        LightLock_Lock(&pool->lock);
+        segment->ok = ok;
+        segment->state = SEGMENT_DONE;
+        LightLock_Unlock(&pool->lock);
+        LightEvent_Signal(&pool->doneEvent);
+    }
+}
+
+static void stopDeflatePool(DeflatePool* pool) {
+    LightLock_Lock(&pool->lock);
+    pool->quit = true;
+    LightLock_Unlock(&pool->lock);
+    LightEvent_Signal(&pool->workEvent);
+    for (int i = 0; i < pool->threadCount; i++) {
+        threadJoin(pool->threads[i], U64_MAX);
+        threadFree(pool->threads[i]);
+    }
+    if (pool->slots) {
+        for (int i = 0; i < pool->slotCount; i++) {
+            free(pool->slots[i].input);
+            free(pool->slots[i].output);
+        }
+        free(pool->slots);
+    }
+    memset(pool, 0, sizeof(*pool));
+}
+
+// Slot buffers are allocated by the writers, which know their row size.
+static bool startDeflatePool(DeflatePool* pool, int threads, int slotCount) {
+    memset(pool, 0, sizeof(*pool));
+    LightLock_Init(&pool->lock);
+    LightEvent_Init(&pool->workEvent, RESET_ONESHOT);
+    LightEvent_Init(&pool->doneEvent, RESET_ONESHOT);
+
+    pool->slotCount = slotCount;
+    pool->slots = (ExportSegment*)calloc(pool->slotCount, sizeof(ExportSegment));
+    if (!pool->slots) return false;
+
+    // Without workers the segments are deflated on the calling thread.
+    for (int i = 0; i < threads; i++) {
+        Thread thread = workerThreadCreate(deflateWorkerMain, pool, 1);
+        if (!thread) break;
+        pool->threads[pool->threadCount++] = thread;
+    }
+    return true;
+}
+
+static void queueSegment(DeflatePool* pool, ExportSegment* segment) {
+    if (pool->threadCount == 0) {
+        segment->ok = pngEncodeDeflateSegment(&segment->job);
+        segment->state = SEGMENT_DONE;
+        return;
+    }
+    LightLock_Lock(&pool->lock);
+    segment->order = pool->nextOrder++;
+    segment->state = SEGMENT_QUEUED;
+    LightLock_Unlock(&pool->lock);
+    LightEvent_Signal(&pool->workEvent);
+}
+
+static void waitSegmentDone(DeflatePool* pool, ExportSegment* segment) {
+    while (true) {
+        LightLock_Lock(&pool->lock);
+        bool done = segment->state == SEGMENT_DONE;
+        LightLock_Unlock(&pool->lock);
+        if (done) return;
+        LightEvent_Wait(&pool->doneEvent);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Segment writer (one PNG file)
+//---------------------------------------------------------------------------
+
+// Segment seq lives in slot seq % slotCount of the writer's range; the main
+// thread fills a slot while the workers deflate the others, and writes them
+// out in order.
+typedef struct {
+    FILE* fp;
+    DeflatePool* pool;
+    ExportSegment* slots;
+    int slotCount;
+    int nextWrite;
+    u32 adler;
+    u8 zlibHeader[2];
+    bool ok;
+} SegmentWriter;
+
+// Write segment nextWrite as one IDAT chunk (the first carries the zlib
+// header, the last the combined Adler-32) and free its slot.
+static void writeNextSegment(SegmentWriter* writer) {
+    ExportSegment* segment = &writer->slots[writer->nextWrite % writer->slotCount];
+    waitSegmentDone(writer->pool, segment);
+    writer->ok = writer->ok && segment->ok;
+
+    const PngDeflateSegment* job = &segment->job;
+    writer->adler = writer->nextWrite == 0 ? job->adler
+                                           : pngEncodeCombineAdler(writer->adler, job->adler, job->size);
+    u8 trailer[4] = {
+        (u8)(writer->adler >> 24), (u8)(writer->adler >> 16), (u8)(writer->adler >> 8), (u8)writer->adler,
+    };
+    const void* parts[3] = {writer->zlibHeader, job->out, trailer};
+    size_t sizes[3] = {writer->nextWrite == 0 ? 2 : 0, job->outSize, job->last ? 4 : 0};
+    if (writer->ok) {
+        writer->ok = pngEncodeWriteChunk(writer->fp, "IDAT", parts, sizes, 3);
+    }
+
+    LightLock_Lock(&writer->pool->lock);
+    segment->state = SEGMENT_FREE;
+    LightLock_Unlock(&writer->pool->lock);
+    writer->nextWrite++;
+}
+
+// Slot for segment seq, after writing out the segment that used it before.
+static ExportSegment* acquireSegment(SegmentWriter* writer, int seq) {
+    while (writer->nextWrite <= seq - writer->slotCount) {
+        writeNextSegment(writer);
+    }
+    ExportSegment* segment = &writer->slots[seq % writer->slotCount];
+    segment->seq = seq;
+    segment->job.size = 0;
+
+    // Prime with the tail of the previous segment, which is still queued or in flight.
+    segment->job.dict = NULL;
+    segment->job.dictSize = 0;
+    if (seq > 0) {
+        const PngDeflateSegment* prev = &writer->slots[(seq - 1) % writer->slotCount].job;
+        size_t dictSize = prev->size < PNG_ENCODE_DICT_SIZE ? prev->size : PNG_ENCODE_DICT_SIZE;
+        memcpy(segment->dict, prev->data + prev->size - dictSize, dictSize);
+        segment->job.dict = segment->dict;
+        segment->job.dictSize = dictSize;
+    }
+    return segment;
+}
+
+static int encodeFilter(ExportFilter filter) {
+    switch (filter) {
+        case EXPORT_FILTER_NONE:  return PNG_ENCODE_FILTER_NONE;
+        case EXPORT_FILTER_SUB:   return PNG_ENCODE_FILTER_SUB;
+        case EXPORT_FILTER_UP:    return PNG_ENCODE_FILTER_UP;
+        case EXPORT_FILTER_PAETH: return PNG_ENCODE_FILTER_PAETH;
+        default:                  return PNG_ENCODE_FILTER_ADAPTIVE;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Export targets
+//---------------------------------------------------------------------------
+
+// Rows fed to a target come from the composite or straight from a layer.
+#define EXPORT_SOURCE_COMPOSITE (-1)
+
+// Canvas rectangle being exported.
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} ExportArea;
+
+// One output file. Rows arrive from the shared pass already packed and
+// scaled; the encoder is libpng, the segment writer or the JPEG encoder.
+typedef struct {
+    int source;                         // EXPORT_SOURCE_COMPOSITE or a layer index
+    int scale;
+    int shrink;                         // Keep every shrink-th row and column
+    int width;                          // Output size
+    int height;
+    int colorType;                      // PNG_ENCODE_COLOR_RGBA or _PALETTE
+    int bitDepth;
+    size_t rowBytes;
+    char path[256];
+    FILE* fp;
+    u8* rows;                           // Two packed rows: current and previous
+    u8* prevRow;
+    int sourceRows;                     // Rows handed in so far
+    int rowsWritten;
+
+    png_structp png;
+    png_infop info;
 
-    png_init_io(png, fp);
+    bool jpeg;                          // Set with path, before openTarget
+    JpegEncoder* jpegEncoder;           // Heap: targets live on the stack
 
-    png_set_IHDR(png, info,
-                 CANVAS_WIDTH, CANVAS_HEIGHT,
-                 8,
-                 PNG_COLOR_TYPE_RGBA,
+    SegmentWriter writer;
+    ExportSegment* segment;             // Being filled
+    int seq;                            // Segments queued so far
+    size_t segmentCapacity;
+    int filter;
+    int zlibLevel;
+} ExportTarget;
+
+static int pngFilterFlags(ExportFilter filter) {
+    switch (filter) {
+        case EXPORT_FILTER_NONE:  return PNG_FILTER_NONE;
+        case EXPORT_FILTER_SUB:   return PNG_FILTER_SUB;
+        case EXPORT_FILTER_UP:    return PNG_FILTER_UP;
+        case EXPORT_FILTER_PAETH: return PNG_FILTER_PAETH;
+        default:                  return PNG_ALL_FILTERS;
+    }
+}
+
+// The spec recommends no filtering for palette images, so the per-row
+// choice means none there; an explicit filter is kept.
+static ExportFilter targetFilter(const ExportTarget* target, ExportFilter filter) {
+    if (target->colorType == PNG_ENCODE_COLOR_PALETTE && filter == EXPORT_FILTER_ADAPTIVE) return EXPORT_FILTER_NONE;
+    return filter;
+}
+
+// libpng reports errors by longjmp, so every call into it sets its own
+// landing point; the png structs are destroyed in releaseTarget.
+static bool beginLibpngTarget(ExportTarget* target, const ExportOptions* options, const ExportPalette* palette) {
+    target->png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    target->info = target->png ? png_create_info_struct(target->png) : NULL;
+    if (!target->png || !target->info) return false;
+
+    if (setjmp(png_jmpbuf(target->png))) return false;
+
+    png_init_io(target->png, target->fp);
+    png_set_compression_level(target->png, options->zlibLevel);
+    png_set_filter(target->png, PNG_FILTER_TYPE_BASE, pngFilterFlags(targetFilter(target, options->filter)));
+
+    bool indexed = target->colorType == PNG_ENCODE_COLOR_PALETTE;
+    png_set_IHDR(target->png, target->info,
+                 target->width, target->height,
+                 target->bitDepth,
+                 indexed ? PNG_COLOR_TYPE_PALETTE : PNG_COLOR_TYPE_RGBA,
                  PNG_INTERLACE_NONE,
                  PNG_COMPRESSION_TYPE_DEFAULT,
                  PNG_FILTER_TYPE_DEFAULT);
 
-    png_write_info(png, info);
+    if (indexed) {
+        png_color colors[QUANTIZE_MAX_COLORS];
+        png_byte alpha[QUANTIZE_MAX_COLORS];
+        int alphaCount = 0;
+        for (int i = 0; i < palette->count; i++) {
+            colors[i].red = (palette->colors[i] >> 24) & 0xFF;
+            colors[i].green = (palette->colors[i] >> 16) & 0xFF;
+            colors[i].blue = (palette->colors[i] >> 8) & 0xFF;
+            alpha[i] = palette->colors[i] & 0xFF;
+            if (alpha[i] != 0xFF) alphaCount = i + 1;
+        }
+        png_set_PLTE(target->png, target->info, colors, palette->count);
+        if (alphaCount > 0) png_set_tRNS(target->png, target->info, alpha, alphaCount, NULL);
+    }
 
-    // Allocate a row buffer (4 bytes per pixel: R, G, B, A)
-    png_bytep row = (png_bytep)malloc(CANVAS_WIDTH * 4);
-    if (!row) {
-        png_destroy_write_struct(&png, &info);
-        fclose(fp);
+    png_write_info(target->png, target->info);
+    return true;
+}
+
+static bool writeLibpngRow(ExportTarget* target, const u8* row) {
+    if (setjmp(png_jmpbuf(target->png))) return false;
+    png_write_row(target->png, row);
+    return true;
+}
+
+static bool finishLibpngTarget(ExportTarget* target) {
+    if (setjmp(png_jmpbuf(target->png))) return false;
+    png_write_end(target->png, NULL);
+    return true;
+}
+
+static bool beginSegmentTarget(ExportTarget* target, DeflatePool* pool, int firstSlot, int slotCount,
+                               const ExportOptions* options, const ExportPalette* palette) {
+    size_t filteredRowBytes = target->rowBytes + 1;
+    size_t rowsPerSegment = EXPORT_SEGMENT_BYTES / filteredRowBytes;
+    if (rowsPerSegment < 1) rowsPerSegment = 1;
+    target->segmentCapacity = rowsPerSegment * filteredRowBytes;
+    target->filter = encodeFilter(targetFilter(target, options->filter));
+    target->zlibLevel = options->zlibLevel;
+
+    SegmentWriter* writer = &target->writer;
+    writer->fp = target->fp;
+    writer->pool = pool;
+    writer->slots = &pool->slots[firstSlot];
+    writer->slotCount = slotCount;
+    writer->ok = true;
+    pngEncodeZlibHeader(options->zlibLevel, writer->zlibHeader);
+
+    // Freed with the pool.
+    for (int i = 0; i < slotCount; i++) {
+        writer->slots[i].input = (u8*)malloc(target->segmentCapacity);
+        writer->slots[i].output = (u8*)malloc(pngEncodeSegmentBound(target->segmentCapacity));
+        if (!writer->slots[i].input || !writer->slots[i].output) return false;
+    }
+
+    if (!pngEncodeWriteHeader(target->fp, target->width, target->height, target->bitDepth, target->colorType)) return false;
+    if (target->colorType == PNG_ENCODE_COLOR_PALETTE &&
+        !pngEncodeWritePalette(target->fp, palette->colors, palette->count)) {
         return false;
     }
+    target->segment = acquireSegment(writer, 0);
+    return true;
+}
+
+static bool writeSegmentRow(ExportTarget* target, const u8* row, const u8* prev, bool last) {
+    size_t rowBytes = target->rowBytes;
+    int bpp = target->colorType == PNG_ENCODE_COLOR_RGBA ? 4 : 1;
+    ExportSegment* segment = target->segment;
+    pngEncodeFilterRow(target->filter, row, prev, rowBytes, bpp, segment->input + segment->job.size);
+    segment->job.size += rowBytes + 1;
+    if (!last && segment->job.size + rowBytes + 1 <= target->segmentCapacity) return true;
+
+    segment->job.data = segment->input;
+    segment->job.level = target->zlibLevel;
+    segment->job.filtered = target->filter != PNG_ENCODE_FILTER_NONE;
+    segment->job.last = last;
+    segment->job.out = segment->output;
+    queueSegment(target->writer.pool, segment);
+    target->seq++;
+    target->segment = last ? NULL : acquireSegment(&target->writer, target->seq);
+    return target->writer.ok;
+}
 
-    for (int y = 0; y < CANVAS_HEIGHT; y++) {
-        for (int x = 0; x < CANVAS_WIDTH; x++) {
-            u32 pixel = compositeBuffer[y * TEX_WIDTH + x];
-            // compositeBuffer is RGBA8: (R << 24) | (G << 16) | (B << 8) | A
-            row[x * 4 + 0] = (pixel >> 24) & 0xFF; // R
-            row[x * 4 + 1] = (pixel >> 16) & 0xFF; // G
-            row[x * 4 + 2] = (pixel >>  8) & 0xFF; // B
-            row[x * 4 + 3] =  pixel        & 0xFF; // A
+// Drains the segments still in flight, also after a failure: the pool must
+// not go away while a worker holds one of them.
+static bool finishSegmentTarget(ExportTarget* target, bool complete) {
+    while (target->writer.nextWrite < target->seq) {
+        writeNextSegment(&target->writer);
+    }
+    return complete && target->writer.ok && pngEncodeWriteEnd(target->fp);
+}
+
+// Size the target for the area and open its file (path already set).
+static bool openTarget(ExportTarget* target, const ExportArea* area, int source, int scale, int shrink,
+                       const ExportPalette* palette) {
+    target->source = source;
+    target->scale = scale;
+    target->shrink = shrink;
+    target->width = (area->width + shrink - 1) / shrink * scale;
+    target->height = (area->height + shrink - 1) / shrink * scale;
+    // Palettes describe the composite; layers and JPEGs are always RGBA.
+    bool indexed = source == EXPORT_SOURCE_COMPOSITE && palette->indexed && !target->jpeg;
+    target->colorType = indexed ? PNG_ENCODE_COLOR_PALETTE : PNG_ENCODE_COLOR_RGBA;
+    target->bitDepth = indexed ? palette->bitDepth : 8;
+    target->rowBytes = indexed ? ((size_t)target->width * target->bitDepth + 7) / 8
+                               : (size_t)target->width * 4;
+    target->rows = (u8*)malloc(target->rowBytes * 2);
+    target->fp = target->rows ? fopen(target->path, "wb") : NULL;
+    return target->fp != NULL;
+}
+
+// One source row (or its palette indices), sampled and fed to the target
+// scale times.
+static bool writeTargetRow(ExportTarget* target, const u32* pixels, const u8* indices, int sourceWidth,
+                           bool segmented) {
+    if (target->sourceRows++ % target->shrink != 0) return true;
+
+    u8* row = target->prevRow == target->rows ? target->rows + target->rowBytes : target->rows;
+    if (target->colorType == PNG_ENCODE_COLOR_PALETTE) {
+        packIndexRow(indices, sourceWidth, target->shrink, target->scale, target->bitDepth, target->rowBytes, row);
+    } else {
+        packRgbaRow(pixels, sourceWidth, target->shrink, target->scale, row);
+    }
+
+    for (int i = 0; i < target->scale; i++) {
+        bool last = target->rowsWritten == target->height - 1;
+        bool ok = target->jpeg ? jpegEncodeRow(target->jpegEncoder, row)
+            : segmented ? writeSegmentRow(target, row, target->prevRow, last)
+            : writeLibpngRow(target, row);
+        if (!ok) return false;
+        target->prevRow = row;
+        target->rowsWritten++;
+    }
+    return true;
+}
+
+static void releaseTarget(ExportTarget* target) {
+    if (target->png) png_destroy_write_struct(&target->png, &target->info);
+    if (target->jpegEncoder) {
+        jpegEncodeFree(target->jpegEncoder);
+        free(target->jpegEncoder);
+        target->jpegEncoder = NULL;
+    }
+    free(target->rows);
+    target->rows = NULL;
+}
+
+// Encode all open targets in one pass over the area: each strip is
+// composited once (into strip, areaWidth * EXPORT_STRIP_ROWS pixels) and
+// every row handed to each target. All files share one deflate pool.
+static bool encodeTargets(ExportTarget* targets, int targetCount, const ExportOptions* options,
+                          ExportPalette* palette, const ExportArea* area, u32* strip, u64* compositeTicks) {
+    u8* indexRow = NULL;
+    bool ok = true;
+    if (palette->indexed) {
+        indexRow = (u8*)malloc(area->width);
+        ok = indexRow != NULL;
+    }
+
+    // One target keeps every worker busy with threads + 1 slots; several
+    // share the work, so two slots each (one filling, one deflating) do.
+    bool segmented = options->deflateThreads > 0;
+    int threads = options->deflateThreads;
+    if (threads > EXPORT_MAX_DEFLATE_THREADS) threads = EXPORT_MAX_DEFLATE_THREADS;
+    int slotsPerTarget = threads / targetCount + 1;
+    if (slotsPerTarget < 2) slotsPerTarget = 2;
+    DeflatePool pool;
+    memset(&pool, 0, sizeof(pool));
+    if (ok && segmented) {
+        ok = startDeflatePool(&pool, threads, targetCount * slotsPerTarget);
+    }
+    for (int i = 0; i < targetCount && ok; i++) {
+        ExportTarget* target = &targets[i];
+        if (target->jpeg) {
+            target->jpegEncoder = (JpegEncoder*)malloc(sizeof(JpegEncoder));
+            ok = target->jpegEncoder &&
+                 jpegEncodeBegin(target->jpegEncoder, target->fp, target->width, target->height, options->jpegQuality);
+        } else {
+            ok = segmented ? beginSegmentTarget(target, &pool, i * slotsPerTarget, slotsPerTarget, options, palette)
+                           : beginLibpngTarget(target, options, palette);
         }
-        png_write_row(png, row);
     }
 
-    free(row);
-    png_write_end(png, NULL);
-    png_destroy_write_struct(&png, &info);
-    fclose(fp);
+    for (int y = 0; y < area->height && ok; y += EXPORT_STRIP_ROWS) {
+        int count = (y + EXPORT_STRIP_ROWS <= area->height) ? EXPORT_STRIP_ROWS : area->height - y;
 
-    if (outPath && outPathSize > 0) {
-        snprintf(outPath, outPathSize, "%s", filePath);
+        u64 compositeStart = svcGetSystemTick();
+        compositeLayerRect(strip, area->width, area->x, area->y + y, area->x + area->width - 1, area->y + y + count - 1);
+        *compositeTicks += svcGetSystemTick() - compositeStart;
+
+        for (int r = 0; r < count && ok; r++) {
+            int canvasY = area->y + y + r;
+            const u32* composite = &strip[r * area->width];
+            if (indexRow) mapPaletteRow(palette, composite, area->width, area->x, canvasY, indexRow);
+            for (int i = 0; i < targetCount && ok; i++) {
+                ExportTarget* target = &targets[i];
+                const u32* pixels = target->source == EXPORT_SOURCE_COMPOSITE
+                    ? composite
+                    : &layers[target->source].buffer[canvasY * LAYER_STRIDE + area->x];
+                ok = writeTargetRow(target, pixels, indexRow, area->width, segmented);
+            }
+        }
     }
 
+    for (int i = 0; i < targetCount; i++) {
+        ExportTarget* target = &targets[i];
+        if (target->jpeg) {
+            if (ok) ok = jpegEncodeEnd(target->jpegEncoder);
+        } else if (segmented) {
+            if (!finishSegmentTarget(target, ok)) ok = false;
+        } else if (ok) {
+            ok = finishLibpngTarget(target);
+        }
+        releaseTarget(target);
+    }
+    if (segmented) stopDeflatePool(&pool);
+    free(indexRow);
+    return ok;
+}
+
+// Close every opened file, adding up their sizes; on failure (or a failed
+// close) the files are removed.
+static bool closeTargets(ExportTarget* targets, int targetCount, bool ok, u64* bytes) {
+    *bytes = 0;
+    for (int i = 0; i < targetCount; i++) {
+        ExportTarget* target = &targets[i];
+        free(target->rows);
+        target->rows = NULL;
+        if (!target->fp) continue;
+        long size = ftell(target->fp);
+        if (size > 0) *bytes += (u64)size;
+        if (fclose(target->fp) != 0) ok = false;
+    }
+    if (!ok) {
+        for (int i = 0; i < targetCount; i++) {
+            if (targets[i].fp) remove(targets[i].path);
+        }
+    }
+    return ok;
+}
+
+//---------------------------------------------------------------------------
+// Export
+//---------------------------------------------------------------------------
+
+static bool validOptions(const ExportOptions* options) {
+    if (options->targetCount < 1 || options->targetCount > EXPORT_MAX_TARGETS) return false;
+    if (options->jpegQuality < 1 || options->jpegQuality > 100) return false;
+    for (int i = 0; i < options->targetCount; i++) {
+        int scale = options->scales[i];
+        if (scale < 1 || scale > EXPORT_MAX_SCALE) return false;
+        // Equal scales would write the same file name twice.
+        for (int j = 0; j < i; j++) {
+            if (options->scales[j] == scale) return false;
+        }
+    }
+    return true;
+}
+
+// The canvas, or with cropping the union of the visible layers' content
+// (still the whole canvas when nothing is drawn).
+static void getExportArea(bool cropToContent, ExportArea* area) {
+    area->x = 0;
+    area->y = 0;
+    area->width = CANVAS_WIDTH;
+    area->height = CANVAS_HEIGHT;
+    if (!cropToContent) return;
+
+    int minX = CANVAS_WIDTH, minY = CANVAS_HEIGHT, maxX = -1, maxY = -1;
+    for (int i = 0; i < numLayers; i++) {
+        if (!layers[i].visible || !layers[i].buffer || layers[i].opacity == 0) continue;
+        int layerMinX, layerMinY, layerMaxX, layerMaxY;
+        if (!getLayerContentBounds(i, &layerMinX, &layerMinY, &layerMaxX, &layerMaxY)) continue;
+        if (layerMinX < minX) minX = layerMinX;
+        if (layerMinY < minY) minY = layerMinY;
+        if (layerMaxX > maxX) maxX = layerMaxX;
+        if (layerMaxY > maxY) maxY = layerMaxY;
+    }
+    if (maxX < 0) return;
+
+    area->x = minX;
+    area->y = minY;
+    area->width = maxX - minX + 1;
+    area->height = maxY - minY + 1;
+}
+
+// EXPORT_DIR/[name]_YYYYMMDD_HHMMSS, without an extension.
+static void buildExportBasePath(char* out, size_t outSize, struct tm* tm) {
+    snprintf(out, outSize,
+             "%s/%s_%04d%02d%02d_%02d%02d%02d",
+             EXPORT_DIR,
+             currentProjectName,
+             tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+             tm->tm_hour, tm->tm_min, tm->tm_sec);
+}
+
+static void recordExportStats(const ExportOptions* options, const ExportArea* area, int fileCount,
+                              const ExportPalette* palette, bool jpeg, u64 bytes, u64 compositeTicks,
+                              u64 analyzeTicks, u64 start) {
+    lastExportStats.valid = true;
+    lastExportStats.width = area->width;
+    lastExportStats.height = area->height;
+    lastExportStats.cropX = area->x;
+    lastExportStats.cropY = area->y;
+    lastExportStats.targetCount = fileCount;
+    lastExportStats.layerCount = countVisibleLayers();
+    lastExportStats.paletteSize = palette->indexed ? palette->count : 0;
+    lastExportStats.quantized = palette->quantized;
+    lastExportStats.zlibLevel = options->zlibLevel;
+    lastExportStats.filter = options->filter;
+    lastExportStats.deflateThreads = options->deflateThreads;
+    lastExportStats.jpegQuality = jpeg ? options->jpegQuality : 0;
+    lastExportStats.bytes = bytes;
+    lastExportStats.compositeMs = workerTicksToMs(compositeTicks);
+    lastExportStats.analyzeMs = workerTicksToMs(analyzeTicks);
+    lastExportStats.ms = workerTicksToMs(svcGetSystemTick() - start);
+}
+
+// The composite as one PNG or JPEG file per scale.
+static bool exportComposite(const ExportOptions* options, bool jpeg, char* outPath, size_t outPathSize) {
+    ExportOptions defaults;
+    if (!options) {
+        exportDefaultOptions(&defaults);
+        options = &defaults;
+    }
+    if (!validOptions(options)) return false;
+    ExportOptions jpegOptions;
+    if (jpeg) {
+        // No palette analysis and no deflate pool for JPEG targets.
+        jpegOptions = *options;
+        jpegOptions.colorMode = EXPORT_COLOR_RGBA;
+        jpegOptions.deflateThreads = 0;
+        options = &jpegOptions;
+    }
+
+    // Every layer must be in memory before compositing from it
+    projectStreamWaitAll();
+    u64 start = svcGetSystemTick();
+
+    // Ensure export directory exists
+    ensureDirectoryExists(SAVE_DIR);
+    ensureDirectoryExists(EXPORT_DIR);
+
+    // Build filenames: [name]_YYYYMMDD_HHMMSS[_Nx].png / .jpg
+    time_t t = time(NULL);
+    char basePath[224];
+    buildExportBasePath(basePath, sizeof(basePath), localtime(&t));
+
+    ExportArea area;
+    getExportArea(options->cropToContent, &area);
+
+    // A strip of composited pixels shared by the colour analysis and all
+    // targets, which each keep two packed rows of their own width
+    u32* strip = (u32*)malloc(area.width * EXPORT_STRIP_ROWS * sizeof(u32));
+    u64 compositeTicks = 0;
+    u64 analyzeStart = svcGetSystemTick();
+    ExportPalette palette;
+    memset(&palette, 0, sizeof(palette));
+    bool ok = strip && buildPalette(&palette, options, strip, area.x, area.y, area.width, area.height, &compositeTicks);
+    u64 analyzeTicks = options->colorMode == EXPORT_COLOR_RGBA ? 0 : svcGetSystemTick() - analyzeStart;
+
+    int targetCount = options->targetCount;
+    ExportTarget targets[EXPORT_MAX_TARGETS];
+    memset(targets, 0, sizeof(targets));
+    for (int i = 0; i < targetCount && ok; i++) {
+        ExportTarget* target = &targets[i];
+        const char* extension = jpeg ? "jpg" : "png";
+        if (options->scales[i] == 1) {
+            snprintf(target->path, sizeof(target->path), "%s.%s", basePath, extension);
+        } else {
+            snprintf(target->path, sizeof(target->path), "%s_%dx.%s", basePath, options->scales[i], extension);
+        }
+        target->jpeg = jpeg;
+        ok = openTarget(target, &area, EXPORT_SOURCE_COMPOSITE, options->scales[i], 1, &palette);
+    }
+
+    ok = ok && encodeTargets(targets, targetCount, options, &palette, &area, strip, &compositeTicks);
+    u64 bytes;
+    ok = closeTargets(targets, targetCount, ok, &bytes);
+    free(strip);
+    if (ok) {
+        recordExportStats(options, &area, targetCount, &palette, jpeg, bytes, compositeTicks, analyzeTicks, start);
+        if (outPath && outPathSize > 0) {
+            snprintf(outPath, outPathSize, "%s", targets[0].path);
+        }
+    }
+    freePalette(&palette);
+    return ok;
+}
+
+bool exportCanvasPNG(const ExportOptions* options, char* outPath, size_t outPathSize) {
+    return exportComposite(options, false, outPath, outPathSize);
+}
+
+bool exportCanvasJPEG(const ExportOptions* options, char* outPath, size_t outPathSize) {
+    return exportComposite(options, true, outPath, outPathSize);
+}
+
+//---------------------------------------------------------------------------
+// Layered export
+//---------------------------------------------------------------------------
+
+// Merged image, every layer and (OpenRaster) the thumbnail.
+#define EXPORT_LAYERED_MAX_FILES (MAX_LAYERS + 2)
+#define ORA_THUMBNAIL_MAX 256
+
+static const char* oraCompositeOp(BlendMode mode) {
+    switch (mode) {
+        case BLEND_ADD:      return "svg:plus";
+        case BLEND_MULTIPLY: return "svg:multiply";
+        default:             return "svg:src-over";
+    }
+}
+
+// Append text to out with XML attribute escaping; returns the new length.
+static size_t appendXmlEscaped(char* out, size_t length, size_t outSize, const char* text) {
+    for (; *text && length + 7 < outSize; text++) {
+        const char* entity = NULL;
+        switch (*text) {
+            case '&':  entity = "&amp;"; break;
+            case '<':  entity = "&lt;"; break;
+            case '>':  entity = "&gt;"; break;
+            case '"':  entity = "&quot;"; break;
+            default:   break;
+        }
+        if (entity) {
+            length += snprintf(&out[length], outSize - length, "%s", entity);
+        } else {
+            out[length++] = *text;
+        }
+    }
+    out[length] = '\0';
+    return length;
+}
+
+// stack.xml lists layers top first; layer i is stored as data/layer<i+1>.png.
+static size_t buildOraStack(char* out, size_t outSize) {
+    size_t length = snprintf(out, outSize,
+                             "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                             "<image version=\"0.0.5\" w=\"%d\" h=\"%d\">\n <stack>\n",
+                             CANVAS_WIDTH, CANVAS_HEIGHT);
+    for (int i = numLayers - 1; i >= 0 && length < outSize; i--) {
+        const Layer* layer = &layers[i];
+        length += snprintf(&out[length], outSize - length, "  <layer name=\"");
+        if (length >= outSize) break;
+        length = appendXmlEscaped(out, length, outSize, layer->name);
+        if (length >= outSize) break;
+        length += snprintf(&out[length], outSize - length,
+                           "\" src=\"data/layer%d.png\" x=\"0\" y=\"0\" opacity=\"%.3f\""
+                           " visibility=\"%s\" composite-op=\"%s\"/>\n",
+                           i + 1, layer->opacity / 255.0f, layer->visible ? "visible" : "hidden",
+                           oraCompositeOp(layer->blendMode));
+    }
+    if (length < outSize) length += snprintf(&out[length], outSize - length, " </stack>\n</image>\n");
+    return length < outSize ? length : 0;
+}
+
+// Assemble the OpenRaster zip from the encoded PNGs: targets[0] is the
+// merged image, targets[1..numLayers] the layers, the last the thumbnail.
+static bool writeOraArchive(const char* path, const ExportTarget* targets, int targetCount, struct tm* tm) {
+    FILE* fp = fopen(path, "wb");
+    if (!fp) return false;
+
+    ZipWriter zip;
+    zipWriteBegin(&zip, fp, tm);
+    // The mimetype entry must come first, stored.
+    static const char mimetype[] = "image/openraster";
+    zipWriteStored(&zip, "mimetype", mimetype, sizeof(mimetype) - 1);
+
+    char stack[2048];
+    size_t stackLength = buildOraStack(stack, sizeof(stack));
+    if (stackLength == 0) zip.ok = false;
+    zipWriteStored(&zip, "stack.xml", stack, stackLength);
+
+    for (int i = 0; i < targetCount && zip.ok; i++) {
+        char name[ZIP_WRITE_MAX_NAME];
+        if (i == 0) {
+            snprintf(name, sizeof(name), "mergedimage.png");
+        } else if (i == targetCount - 1) {
+            snprintf(name, sizeof(name), "Thumbnails/thumbnail.png");
+        } else {
+            snprintf(name, sizeof(name), "data/layer%d.png", targets[i].source + 1);
+        }
+        FILE* src = fopen(targets[i].path, "rb");
+        if (!src) {
+            zip.ok = false;
+            break;
+        }
+        zipWriteStoredFile(&zip, name, src);
+        fclose(src);
+    }
+
+    bool ok = zipWriteEnd(&zip);
+    if (fclose(fp) != 0) ok = false;
+    if (!ok) remove(path);
+    return ok;
+}
+
+bool exportCanvasLayers(ExportLayersFormat format, const ExportOptions* options, char* outPath, size_t outPathSize) {
+    ExportOptions defaults;
+    if (!options) {
+        exportDefaultOptions(&defaults);
+        options = &defaults;
+    }
+
+    projectStreamWaitAll();
+    u64 start = svcGetSystemTick();
+
+    ensureDirectoryExists(SAVE_DIR);
+    ensureDirectoryExists(EXPORT_DIR);
+
+    time_t t = time(NULL);
+    struct tm* tm = localtime(&t);
+    char basePath[224];
+    buildExportBasePath(basePath, sizeof(basePath), tm);
+
+    ExportArea area = {0, 0, CANVAS_WIDTH, CANVAS_HEIGHT};
+    ExportPalette palette;
+    memset(&palette, 0, sizeof(palette));
+    u32* strip = (u32*)malloc(area.width * EXPORT_STRIP_ROWS * sizeof(u32));
+    bool ok = strip != NULL;
+
+    // PNG: a folder of files. OpenRaster: temporary files zipped afterwards
+    // (the archive needs each image contiguous, the pass makes them all at once).
+    bool ora = format == EXPORT_LAYERS_ORA;
+    if (!ora) ensureDirectoryExists(basePath);
+
+    ExportTarget targets[EXPORT_LAYERED_MAX_FILES];
+    memset(targets, 0, sizeof(targets));
+    int targetCount = 0;
+    for (int i = -1; i < numLayers && ok; i++) {
+        ExportTarget* target = &targets[targetCount++];
+        if (i < 0) {
+            snprintf(target->path, sizeof(target->path), ora ? "%s_merged.tmp" : "%s/merged.png", basePath);
+        } else {
+            snprintf(target->path, sizeof(target->path), ora ? "%s_layer%d.tmp" : "%s/layer%d.png", basePath, i + 1);
+            ok = layers[i].buffer != NULL;
+        }
+        ok = ok && openTarget(target, &area, i, 1, 1, &palette);
+    }
+    if (ok && ora) {
+        int longest = area.width > area.height ? area.width : area.height;
+        ExportTarget* target = &targets[targetCount++];
+        snprintf(target->path, sizeof(target->path), "%s_thumbnail.tmp", basePath);
+        ok = openTarget(target, &area, EXPORT_SOURCE_COMPOSITE, 1,
+                        (longest + ORA_THUMBNAIL_MAX - 1) / ORA_THUMBNAIL_MAX, &palette);
+    }
+
+    u64 compositeTicks = 0;
+    ok = ok && encodeTargets(targets, targetCount, options, &palette, &area, strip, &compositeTicks);
+    u64 bytes;
+    ok = closeTargets(targets, targetCount, ok, &bytes);
+    free(strip);
+
+    char resultPath[256];
+    if (ora) {
+        snprintf(resultPath, sizeof(resultPath), "%s.ora", basePath);
+        if (ok) ok = writeOraArchive(resultPath, targets, targetCount, tm);
+        for (int i = 0; i < targetCount; i++) {
+            if (targets[i].fp) remove(targets[i].path);
+        }
+        if (ok) {
+            FILE* fp = fopen(resultPath, "rb");
+            if (fp && fseek(fp, 0, SEEK_END) == 0) bytes = (u64)ftell(fp);
+            if (fp) fclose(fp);
+        }
+    } else {
+        snprintf(resultPath, sizeof(resultPath), "%s", basePath);
+        if (!ok) remove(basePath);
+    }
+    if (!ok) return false;
+
+    recordExportStats(options, &area, ora ? 1 : targetCount, &palette, false, bytes, compositeTicks, 0, start);
+    if (outPath && outPathSize > 0) {
+        snprintf(outPath, outPathSize, "%s", resultPath);
+    }
     return true;
 }
@@ -3,19 +3,135 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "app_state.h"
+
 /**
  * @file export.h
- * @brief PNG export functionality for the canvas.
+ * @brief PNG and JPEG export functionality for the canvas.
  */
 
+/** @brief PNG row filter applied before compression. */
+typedef enum {
+    EXPORT_FILTER_NONE,
+    EXPORT_FILTER_SUB,
+    EXPORT_FILTER_UP,
+    EXPORT_FILTER_PAETH,
+    EXPORT_FILTER_ADAPTIVE,   /**< Best of all five filters per row (slowest, usually smallest). */
+} ExportFilter;
+
+/** @brief Pixel format of the written PNG. */
+typedef enum {
+    EXPORT_COLOR_RGBA,        /**< Always truecolour with alpha. */
+    EXPORT_COLOR_AUTO,        /**< Palette when the image has at most 256 colours, else RGBA. */
+    EXPORT_COLOR_QUANTIZE,    /**< Palette always; more than 256 colours are reduced with an octree. */
+} ExportColorMode;
+
+#define EXPORT_DEFAULT_ZLIB_LEVEL 6
+#define EXPORT_MAX_DEFLATE_THREADS 4
+#define EXPORT_DEFAULT_DEFLATE_THREADS 2
+#define EXPORT_MAX_TARGETS 3
+#define EXPORT_MAX_SCALE 4
+#define EXPORT_DEFAULT_JPEG_QUALITY 90
+
+/** @brief Encoder settings for an export. */
+typedef struct {
+    int zlibLevel;            /**< 0 (store) to 9 (smallest). */
+    ExportFilter filter;
+    /**
+     * Worker threads deflating the image in independent segments (see
+     * png_encode.h); the calling thread composites and filters meanwhile.
+     * 0 encodes on the calling thread with libpng.
+     */
+    int deflateThreads;
+    /**
+     * Nearest-neighbour scale factor (1 to EXPORT_MAX_SCALE) of each file to
+     * write. All targets are fed from one composite pass; scales other than
+     * 1 add a _2x / _4x ... suffix to the file name.
+     */
+    int scales[EXPORT_MAX_TARGETS];
+    int targetCount;
+    /** Export only the bounding box of the visible layers' content. */
+    bool cropToContent;
+    ExportColorMode colorMode;
+    /** Ordered (4x4 Bayer) dither when quantizing; exact palettes are never dithered. */
+    bool dither;
+    /** JPEG quality, 1 to 100 (libjpeg's scale). */
+    int jpegQuality;
+} ExportOptions;
+
+/** @brief Size and timing of the most recent export. */
+typedef struct {
+    bool valid;               /**< false until an export has completed. */
+    int width;                /**< Exported area at 1x (the crop when cropping). */
+    int height;
+    int cropX;                /**< Canvas position of the exported area. */
+    int cropY;
+    int targetCount;          /**< Files written. */
+    int layerCount;           /**< Visible layers composited. */
+    int paletteSize;          /**< Colours in the palette, 0 for RGBA. */
+    bool quantized;           /**< The palette approximates the image. */
+    int zlibLevel;
+    ExportFilter filter;
+    int deflateThreads;
+    int jpegQuality;          /**< 0 for PNG. */
+    u64 bytes;                /**< Size of all written files. */
+    float compositeMs;        /**< Time spent compositing rows (both passes for a palette). */
+    float analyzeMs;          /**< Colour counting / palette building pass, 0 for RGBA. */
+    float ms;                 /**< Total time including filtering, compression and writes. */
+} ExportStats;
+
+/** @brief Fill options with the defaults used by the export button. */
+void exportDefaultOptions(ExportOptions* options);
+
 /**
  * @brief Export the composited canvas to a PNG file.
  *
- * Composites all visible layers and writes the result as a PNG image.
- * The file is saved to sdmc:/3ds/magicdraw/exports/[name]_YYYYMMDD_HHMMSS.png.
+ * Composites all visible layers a strip of rows at a time straight into the
+ * PNG encoders of every target; neither the composite buffer nor the GPU is
+ * involved. Palette modes composite twice: once to collect the colours,
+ * once to encode. Files are saved to
+ * sdmc:/3ds/magicdraw/exports/[name]_YYYYMMDD_HHMMSS[_Nx].png.
  *
- * @param outPath If non-NULL, receives the exported file path on success.
+ * @param options Encoder settings, or NULL for the defaults.
+ * @param outPath If non-NULL, receives the first exported file path on success.
  * @param outPathSize Size of the outPath buffer.
  * @return true on success, false on failure.
  */
-bool exportCanvasPNG(char* outPath, size_t outPathSize);
+bool exportCanvasPNG(const ExportOptions* options, char* outPath, size_t outPathSize);
+
+/**
+ * @brief Export the composited canvas to a baseline JPEG file.
+ *
+ * Same single pass as exportCanvasPNG (scales and cropping apply), but each
+ * target is a streaming 4:2:0 JPEG encoder at options->jpegQuality that
+ * buffers one row of 16x16 MCUs. The composite is opaque, so nothing is lost
+ * with the alpha channel. The colour mode and deflate settings are ignored.
+ * Files are saved to sdmc:/3ds/magicdraw/exports/[name]_YYYYMMDD_HHMMSS[_Nx].jpg.
+ */
+bool exportCanvasJPEG(const ExportOptions* options, char* outPath, size_t outPathSize);
+
+/** @brief Output of exportCanvasLayers. */
+typedef enum {
+    EXPORT_LAYERS_PNG,        /**< A folder with merged.png and layer1.png (bottom) ... layerN.png. */
+    EXPORT_LAYERS_ORA,        /**< One OpenRaster archive (.ora). */
+} ExportLayersFormat;
+
+/**
+ * @brief Export every layer as its own image plus the merged image.
+ *
+ * One pass composites each strip for the merged image and packs the same
+ * rows of every layer, feeding all encoders at once; with deflate threads
+ * they share one worker pool. Layer images hold the layer's own pixels
+ * (opacity, blend mode and visibility are not applied). For OpenRaster they
+ * are described in stack.xml, along with mergedimage.png and a thumbnail
+ * (at most 256 pixels on a side).
+ * Written to sdmc:/3ds/magicdraw/exports/[name]_YYYYMMDD_HHMMSS/ or .ora.
+ * Only the encoder settings of options are used (1x, whole canvas, RGBA).
+ *
+ * @param options Encoder settings, or NULL for the defaults.
+ * @param outPath If non-NULL, receives the folder or archive path on success.
+ */
+bool exportCanvasLayers(ExportLayersFormat format, const ExportOptions* options, char* outPath, size_t outPathSize);
+
+/** @brief Statistics of the last successful export. */
+void getExportStats(ExportStats* stats);
@@ -3,285 +3,1498 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define HISTORY_MAX 10
+#include "brush.h"
+#include "canvas.h"
+#include "history_codec.h"
+#include "history_log.h"
+#include "layers.h"
+#include "memory.h"
+#include "project_stream.h"
+#include "util.h"
+#include "worker.h"
+
+#define HISTORY_RING_SIZE 128            /**< Max records of any type. */
+#define HISTORY_DEFAULT_BUDGET (32u * 1024u * 1024u)
+#define HISTORY_RESERVE_LAYERS 3         /**< Layer-sized buffers kept free for painting. */
+#define HISTORY_LOG_NAME ".undo"         /**< Spill log files under SAVE_DIR. */
+#define HISTORY_KEYFRAME_INTERVAL 8      /**< Max journal ops replayed per undo. */
+#define HISTORY_SPILL_QUEUE 8            /**< Evicted records waiting to be written by the worker. */
+
+typedef enum {
+    HISTORY_PIXELS,   /**< Pixel snapshot of the layers in layerMask (plus their fields). */
+    HISTORY_PROPS,    /**< Layer field change (visibility, opacity, blend, locks, name). */
+    HISTORY_REORDER,  /**< Swap of two layers in the stack. */
+    HISTORY_OP,       /**< Journal op: undone by keyframe restore + replay. */
+    HISTORY_KEYFRAME  /**< Pre-chain pixels for the ops that follow; not a user step. */
+} HistoryType;
+
+typedef enum {
+    JOURNAL_STROKE,
+    JOURNAL_FILL,
+    JOURNAL_CLEAR,
+    JOURNAL_MERGE_DOWN
+} JournalOpType;
+
+typedef struct {
+    s16 x0, y0, x1, y1;
+    s16 size;
+    u8 isLine;            /**< 0: drawBrushToLayer at (x0, y0), 1: drawLineToLayer. */
+    u32 color;
+} StrokeSample;
+
+typedef struct {
+    u8 type;              /**< JournalOpType */
+    u8 brushType;         /**< JOURNAL_STROKE */
+    s8 layerIndex;
+    s16 x, y;             /**< JOURNAL_FILL tap */
+    s16 expand;
+    s16 tolerance;
+    u32 color;            /**< JOURNAL_FILL / JOURNAL_CLEAR */
+    u8 incomplete;        /**< Stroke samples were lost; cannot be replayed. */
+    u32 sampleCount;
+    u32 sampleCapacity;
+    StrokeSample* samples;
+} JournalOp;
 
 typedef struct {
-    u32* buffer;
     bool visible;
     u8 opacity;
     BlendMode blendMode;
     bool alphaLock;
     bool clipping;
     char name[32];
+} LayerProps;
+
+typedef struct {
+    u32* buffer;          /**< Raw snapshot in layer layout (canvas sized), NULL while packed. */
+    u8* packed;           /**< Compressed snapshot, NULL while raw. */
+    size_t packedSize;
+    bool packBusy;        /**< Worker is compressing this snapshot. */
+    bool packSkip;        /**< Data did not compress; keep it raw. */
+    LayerProps props;
 } LayerSnapshot;
 
 typedef struct {
+    HistoryType type;
     int currentLayerIndex;
+    u32 layerMask;        /**< Layers whose fields (and pixels for HISTORY_PIXELS) are held. */
+    int reorderA;         /**< HISTORY_REORDER: swapped layer indices. */
+    int reorderB;
+    JournalOp op;         /**< HISTORY_OP parameters. */
     LayerSnapshot layers[MAX_LAYERS];
 } HistoryEntry;
 
-static HistoryEntry historyStack[HISTORY_MAX];
+// Ring buffer of records: logical index 0 is the oldest, at historyHead.
+static HistoryEntry historyRing[HISTORY_RING_SIZE];
+static int historyHead = 0;
 static int historyCount = 0;
 static int historyIndex = -1;
 static bool historyInitialized = false;
 static int historyCanvasWidth = 0;
 static int historyCanvasHeight = 0;
+static size_t historyByteBudget = HISTORY_DEFAULT_BUDGET;
+static size_t historyRawBytes = 0;
+
+// Background compression state. The lock guards the ring bookkeeping;
+// the worker only holds it while picking a job or publishing a result.
+static LightLock historyLock;
+static LightEvent historyWorkEvent;
+static Thread historyWorker = NULL;
+static volatile bool historyWorkerQuit = false;
+static volatile bool historyPackCancel = false;
+static size_t historyPackedBytes = 0;
+static u64 historyPackInBytes = 0;
+static u64 historyPackOutBytes = 0;
+static u64 historyPackTicks = 0;
+
+// Second tier: records evicted from RAM are appended to a log under SAVE_DIR
+// and read back by the worker when undo walks past the RAM window. The log
+// only ever holds applied records, oldest first, so it behaves as a stack.
+// Eviction itself only moves a record to a queue; the worker packs it and
+// writes it, so the main thread never waits for the card.
+typedef enum {
+    HISTORY_LOAD_IDLE,
+    HISTORY_LOAD_REQUESTED,
+    HISTORY_LOAD_RUNNING,
+    HISTORY_LOAD_DONE
+} HistoryLoadState;
 
+typedef struct {
+    u32 type;
+    s32 currentLayerIndex;
+    u32 layerMask;
+    s32 reorderA;
+    s32 reorderB;
+    u32 canvasWidth;
+    u32 canvasHeight;
+} SpillHeader;
+
+typedef struct {
+    HistoryEntry entry;
+    SpillHeader header;
+    size_t rawBytes;      /**< Share of historyRawBytes (buffers and samples). */
+    size_t packedBytes;   /**< Share of historyPackedBytes. */
+} SpilledRecord;
+
+static LightLock historyLogLock;      // Guards historyLog; taken after historyLock.
+static HistoryLog historyLog;
+static bool historyLogReady = false;
+static u32 historySpilledCount = 0;   // Mirrors the log count under historyLock.
+static SpilledRecord historySpillQueue[HISTORY_SPILL_QUEUE];  // Oldest at historySpillHead.
+static int historySpillHead = 0;
+static int historySpillQueued = 0;
+static bool historySpillWriting = false;  // The worker is writing a record taken off the queue.
+static u32 historySpillEpoch = 0;         // Bumped by resets; a write spanning one is dropped.
+static size_t historySpillBytes = 0;      // Held by queued and in-flight records.
+static HistoryLoadState historyLoadState = HISTORY_LOAD_IDLE;
+static volatile bool historyLoadCancel = false;
+static volatile float historyLoadProgress = 0.0f;
+static bool historyUndoPending = false;
+
+// Journal state. A replay runs on the main thread with historyLock held; any
+// allocation it makes may re-enter the reclaimer, which then must not lock and
+// must keep every record from historyReplayFloor on.
+static HistoryEntry* historyActiveStroke = NULL;
+static HistoryEntry* historyReplayFloor = NULL;
+static u32 historyReplayThreadId = 0;
+
+static HistoryEntry* historyAt(int index) {
+    return &historyRing[(historyHead + index) % HISTORY_RING_SIZE];
+}
+
+static int historyIndexOf(const HistoryEntry* entry) {
+    int slot = (int)(entry - historyRing);
+    return (slot - historyHead + HISTORY_RING_SIZE) % HISTORY_RING_SIZE;
+}
+
+// Snapshots share the live layer layout so undo/redo can trade buffer ownership.
 static size_t getHistoryBufferSize(void) {
-    return (size_t)CANVAS_WIDTH * (size_t)CANVAS_HEIGHT * sizeof(u32);
+    return LAYER_BUFFER_SIZE;
 }
 
-static void freeHistoryEntry(int index) {
-    historyStack[index].currentLayerIndex = -1;
+// Wait until the worker is no longer reading this snapshot. Caller holds historyLock.
+static void waitSnapshotIdle(LayerSnapshot* snap) {
+    while (snap->packBusy) {
+        historyPackCancel = true;
+        LightLock_Unlock(&historyLock);
+        workerSleepMs(1);
+        LightLock_Lock(&historyLock);
+    }
+}
+
+static void freeSnapshotData(LayerSnapshot* snap) {
+    waitSnapshotIdle(snap);
+    if (snap->buffer) {
+        free(snap->buffer);
+        snap->buffer = NULL;
+        historyRawBytes -= getHistoryBufferSize();
+    }
+    if (snap->packed) {
+        free(snap->packed);
+        snap->packed = NULL;
+        historyPackedBytes -= snap->packedSize;
+        snap->packedSize = 0;
+    }
+    snap->packSkip = false;
+}
+
+// Make sure the snapshot holds raw pixels, decompressing on demand.
+static bool ensureSnapshotRaw(LayerSnapshot* snap) {
+    waitSnapshotIdle(snap);
+    if (snap->buffer) return true;
+    if (!snap->packed) return false;
+
+    size_t bufferSize = getHistoryBufferSize();
+    u32* raw = (u32*)malloc(bufferSize);
+    if (!raw) return false;
+    if (!historyCodecDecompress(snap->packed, snap->packedSize, raw, bufferSize / sizeof(u32))) {
+        free(raw);
+        return false;
+    }
+
+    free(snap->packed);
+    snap->packed = NULL;
+    historyPackedBytes -= snap->packedSize;
+    snap->packedSize = 0;
+    snap->buffer = raw;
+    historyRawBytes += bufferSize;
+    snap->packSkip = false;
+    return true;
+}
+
+static bool snapshotHasData(const LayerSnapshot* snap) {
+    return snap->buffer || snap->packed;
+}
+
+static void freeJournalOp(JournalOp* op) {
+    if (op->samples) {
+        free(op->samples);
+        historyRawBytes -= op->sampleCapacity * sizeof(StrokeSample);
+    }
+    memset(op, 0, sizeof(*op));
+}
+
+static size_t freeHistoryEntry(HistoryEntry* entry) {
+    size_t before = historyRawBytes + historyPackedBytes;
+    if (entry == historyActiveStroke) historyActiveStroke = NULL;
+    freeJournalOp(&entry->op);
+    entry->currentLayerIndex = -1;
+    entry->layerMask = 0;
     for (int j = 0; j < MAX_LAYERS; j++) {
-        if (historyStack[index].layers[j].buffer) {
-            free(historyStack[index].layers[j].buffer);
-            historyStack[index].layers[j].buffer = NULL;
-        }
+        freeSnapshotData(&entry->layers[j]);
+    }
+    return before - (historyRawBytes + historyPackedBytes);
+}
+
+// Abandon a pending read-back (a new action or a reset makes it stale).
+static void cancelHistoryLoad(void) {
+    historyUndoPending = false;
+    if (historyLoadState == HISTORY_LOAD_RUNNING) {
+        historyLoadCancel = true;
+    } else {
+        historyLoadState = HISTORY_LOAD_IDLE;
     }
 }
 
-static void dropOldestHistoryEntry(void) {
-    freeHistoryEntry(0);
-    for (int i = 0; i < HISTORY_MAX - 1; i++) {
-        historyStack[i] = historyStack[i + 1];
+// Free a record that is not in the ring (spilled or read back). Plain free:
+// the byte counters are the caller's business.
+static void freeDetachedEntry(HistoryEntry* entry) {
+    free(entry->op.samples);
+    entry->op.samples = NULL;
+    for (int j = 0; j < MAX_LAYERS; j++) {
+        free(entry->layers[j].buffer);
+        entry->layers[j].buffer = NULL;
+        free(entry->layers[j].packed);
+        entry->layers[j].packed = NULL;
     }
-    historyStack[HISTORY_MAX - 1].currentLayerIndex = -1;
+}
+
+// Caller holds historyLock.
+static void releaseSpilledRecord(SpilledRecord* record) {
+    freeDetachedEntry(&record->entry);
+    historyRawBytes -= record->rawBytes;
+    historyPackedBytes -= record->packedBytes;
+    historySpillBytes -= record->rawBytes + record->packedBytes;
+}
+
+static void discardSpillQueue(void) {
+    while (historySpillQueued > 0) {
+        releaseSpilledRecord(&historySpillQueue[historySpillHead]);
+        historySpillHead = (historySpillHead + 1) % HISTORY_SPILL_QUEUE;
+        historySpillQueued--;
+    }
+}
+
+// Wait until the worker has finished writing a record. Caller holds historyLock.
+static void waitSpillIdle(void) {
+    while (historySpillWriting) {
+        LightLock_Unlock(&historyLock);
+        workerSleepMs(1);
+        LightLock_Lock(&historyLock);
+    }
+}
+
+// Evicted records undo can still reach: written, being written or queued.
+static u32 historySpilledTotal(void) {
+    return historySpilledCount + (u32)historySpillQueued + (historySpillWriting ? 1u : 0u);
+}
+
+static void resetHistoryLog(void) {
+    cancelHistoryLoad();
+    discardSpillQueue();
+    historySpilledCount = 0;
+    historySpillEpoch++;
+    // A write in progress is left to finish; the worker sees the new epoch and drops it.
+    if (!historyLogReady || historySpillWriting) return;
+    LightLock_Lock(&historyLogLock);
+    historyLogTruncate(&historyLog, 0);
+    LightLock_Unlock(&historyLogLock);
+}
+
+static bool entryPackBusy(const HistoryEntry* entry) {
     for (int j = 0; j < MAX_LAYERS; j++) {
-        historyStack[HISTORY_MAX - 1].layers[j].buffer = NULL;
+        if (entry->layers[j].packBusy) return true;
     }
-    if (historyCount > 0) historyCount--;
-    if (historyIndex >= 0) historyIndex--;
+    return false;
 }
 
-static bool ensureHistoryEntryBuffers(int index, size_t bufferSize) {
+// Move the oldest record to the spill queue; the worker writes and frees it.
+// Caller holds historyLock. Returns false when there is nowhere to spill to.
+static bool queueSpill(void) {
+    if (!historyLogReady || !historyWorker) return false;
+
+    // Both waits let the worker run, so the oldest record is only picked
+    // once there is room and the worker is not packing it.
+    for (;;) {
+        if (historySpillQueued == HISTORY_SPILL_QUEUE) {
+            // The card is behind: waiting keeps the chain, which dropping would break.
+            LightEvent_Signal(&historyWorkEvent);
+        } else if (entryPackBusy(historyAt(0))) {
+            historyPackCancel = true;
+        } else {
+            break;
+        }
+        LightLock_Unlock(&historyLock);
+        workerSleepMs(1);
+        LightLock_Lock(&historyLock);
+    }
+
+    HistoryEntry* entry = historyAt(0);
+    SpilledRecord* record = &historySpillQueue[(historySpillHead + historySpillQueued) % HISTORY_SPILL_QUEUE];
+    record->entry = *entry;
+    record->header.type = entry->type;
+    record->header.currentLayerIndex = entry->currentLayerIndex;
+    record->header.layerMask = entry->layerMask;
+    record->header.reorderA = entry->reorderA;
+    record->header.reorderB = entry->reorderB;
+    record->header.canvasWidth = historyCanvasWidth;
+    record->header.canvasHeight = historyCanvasHeight;
+    record->rawBytes = entry->op.sampleCapacity * sizeof(StrokeSample);
+    record->packedBytes = 0;
     for (int j = 0; j < MAX_LAYERS; j++) {
-        if (!layers[j].buffer) {
-            if (historyStack[index].layers[j].buffer) {
-                free(historyStack[index].layers[j].buffer);
-                historyStack[index].layers[j].buffer = NULL;
-            }
-            continue;
+        if (entry->layers[j].buffer) record->rawBytes += getHistoryBufferSize();
+        record->packedBytes += entry->layers[j].packedSize;
+    }
+    historySpillBytes += record->rawBytes + record->packedBytes;
+    historySpillQueued++;
+
+    // The ring slot no longer owns anything.
+    if (entry == historyActiveStroke) historyActiveStroke = NULL;
+    memset(entry, 0, sizeof(*entry));
+    entry->currentLayerIndex = -1;
+    LightEvent_Signal(&historyWorkEvent);
+    return true;
+}
+
+// Worker side of eviction: append a record to the spill log. Raw snapshots
+// are packed first, so the card only sees compressed data. A record that
+// cannot be written breaks the chain, so the older spilled records go too.
+static void writeSpilledRecord(SpilledRecord* record) {
+    HistoryEntry* entry = &record->entry;
+    size_t bufferSize = (size_t)record->header.canvasWidth * record->header.canvasHeight * sizeof(u32);
+
+    LightLock_Lock(&historyLogLock);
+    bool ok = historyLogBeginRecord(&historyLog);
+    ok = ok && historyLogWrite(&historyLog, &record->header, sizeof(record->header));
+    for (int j = 0; ok && j < MAX_LAYERS; j++) {
+        if (!(entry->layerMask & (1u << j))) continue;
+        LayerSnapshot* snap = &entry->layers[j];
+        ok = historyLogWrite(&historyLog, &snap->props, sizeof(snap->props));
+
+        const u8* packed = snap->packed;
+        size_t packedSize = snap->packedSize;
+        u8* temp = NULL;
+        if (!packed && snap->buffer && !snap->packSkip) {
+            temp = historyCodecCompress(snap->buffer, bufferSize / sizeof(u32), &packedSize, &historyWorkerQuit);
+            packed = temp;
         }
 
-        if (!historyStack[index].layers[j].buffer) {
-            historyStack[index].layers[j].buffer = (u32*)malloc(bufferSize);
-            if (!historyStack[index].layers[j].buffer) {
-                freeHistoryEntry(index);
-                return false;
-            }
+        u32 dataSize = 0;
+        if (packed) {
+            dataSize = (u32)packedSize;
+        } else if (snap->buffer) {
+            dataSize = (u32)(1 + bufferSize);
         }
+        ok = ok && !historyWorkerQuit;
+        ok = ok && historyLogWrite(&historyLog, &dataSize, sizeof(dataSize));
+        if (packed) {
+            ok = ok && historyLogWrite(&historyLog, packed, packedSize);
+        } else if (snap->buffer) {
+            u8 tag = HISTORY_CODEC_RAW;
+            ok = ok && historyLogWrite(&historyLog, &tag, 1);
+            ok = ok && historyLogWrite(&historyLog, snap->buffer, bufferSize);
+        }
+        free(temp);
+    }
+    if (ok && entry->type == HISTORY_OP) {
+        ok = historyLogWrite(&historyLog, &entry->op, sizeof(entry->op));
+        ok = ok && historyLogWrite(&historyLog, entry->op.samples,
+                                   entry->op.sampleCount * sizeof(StrokeSample));
+    }
+    ok = historyLogEndRecord(&historyLog, NULL) && ok;
+    if (!ok) historyLogTruncate(&historyLog, 0);
+    LightLock_Unlock(&historyLogLock);
+}
+
+// O(1): release the oldest record and advance the ring head. With spill the
+// record goes to the worker (no bytes are freed yet); without, it is freed
+// and the spilled records, now cut off from the ring, are dropped too.
+static size_t dropOldestHistoryEntry(bool spill) {
+    if (historyCount <= 0) return 0;
+    if (historyIndex < 0) {
+        // Everything left is redo; without its oldest step the rest cannot be replayed.
+        size_t freed = 0;
+        for (int i = 0; i < historyCount; i++) {
+            freed += freeHistoryEntry(historyAt(i));
+        }
+        historyCount = 0;
+        return freed;
+    }
+    size_t freed = 0;
+    if (!spill || !queueSpill()) {
+        if (historySpilledTotal() > 0) {
+            size_t before = historyRawBytes + historyPackedBytes;
+            resetHistoryLog();
+            freed = before - (historyRawBytes + historyPackedBytes);
+        }
+        freed += freeHistoryEntry(historyAt(0));
+    }
+    historyHead = (historyHead + 1) % HISTORY_RING_SIZE;
+    historyCount--;
+    if (historyIndex >= 0) historyIndex--;
+    return freed;
+}
+
+// Bytes of the records in the ring, which the budget applies to.
+static size_t historyRingBytes(void) {
+    return historyRawBytes + historyPackedBytes - historySpillBytes;
+}
+
+static bool ensureHistoryEntryBuffers(HistoryEntry* entry, u32 layerMask, size_t bufferSize) {
+    for (int j = 0; j < MAX_LAYERS; j++) {
+        LayerSnapshot* snap = &entry->layers[j];
+        freeSnapshotData(snap);
+        if (!(layerMask & (1u << j)) || !layers[j].buffer) continue;
+
+        snap->buffer = (u32*)malloc(bufferSize);
+        if (!snap->buffer) {
+            freeHistoryEntry(entry);
+            return false;
+        }
+        historyRawBytes += bufferSize;
     }
     return true;
 }
 
 static void clearHistoryEntries(void) {
-    for (int i = 0; i < HISTORY_MAX; i++) {
-        freeHistoryEntry(i);
+    waitSpillIdle();
+    resetHistoryLog();
+    for (int i = 0; i < HISTORY_RING_SIZE; i++) {
+        freeHistoryEntry(&historyRing[i]);
     }
+    // Snapshots may predate a canvas resize, so the counters cannot be trusted here.
+    historyRawBytes = 0;
+    historyPackedBytes = 0;
+    historySpillBytes = 0;
+    historyHead = 0;
     historyCount = 0;
     historyIndex = -1;
 }
 
-static void copyLayerToSnapshot(u32* dst, const u32* src) {
-    for (int y = 0; y < CANVAS_HEIGHT; y++) {
-        memcpy(&dst[y * CANVAS_WIDTH], &src[y * TEX_WIDTH], CANVAS_WIDTH * sizeof(u32));
+// Budget in effect right now: the configured ceiling, clamped to what the
+// heap can give while keeping room for stroke/fill buffers. It grows back
+// automatically as memory is freed elsewhere.
+static size_t getEffectiveBudget(void) {
+    size_t held = historyRawBytes + historyPackedBytes;
+    size_t available = held + memGetFreeBytes();
+    size_t reserve = getHistoryBufferSize() * HISTORY_RESERVE_LAYERS;
+    size_t budget = (available > reserve) ? available - reserve : 0;
+    if (budget > historyByteBudget) budget = historyByteBudget;
+    return budget;
+}
+
+static void captureLayerProps(LayerProps* props, const Layer* layer) {
+    props->visible = layer->visible;
+    props->opacity = layer->opacity;
+    props->blendMode = layer->blendMode;
+    props->alphaLock = layer->alphaLock;
+    props->clipping = layer->clipping;
+    memcpy(props->name, layer->name, sizeof(props->name));
+    props->name[sizeof(props->name) - 1] = '\0';
+}
+
+static void swapLayerProps(Layer* layer, LayerProps* props) {
+    LayerProps temp;
+    captureLayerProps(&temp, layer);
+    layer->visible = props->visible;
+    layer->opacity = props->opacity;
+    layer->blendMode = props->blendMode;
+    layer->alphaLock = props->alphaLock;
+    layer->clipping = props->clipping;
+    memcpy(layer->name, props->name, sizeof(layer->name));
+    layer->name[sizeof(layer->name) - 1] = '\0';
+    *props = temp;
+}
+
+// Oldest raw snapshot first: the newest entries are the most likely to be undone.
+static LayerSnapshot* findPackCandidate(void) {
+    for (int i = 0; i < historyCount; i++) {
+        for (int j = 0; j < MAX_LAYERS; j++) {
+            LayerSnapshot* snap = &historyAt(i)->layers[j];
+            if (snap->buffer && !snap->packBusy && !snap->packSkip) {
+                return snap;
+            }
+        }
     }
+    return NULL;
+}
+
+static void updateLoadProgress(size_t done, size_t total, void* user) {
+    (void)user;
+    historyLoadProgress = total ? (float)done / (float)total : 1.0f;
 }
 
-static void copySnapshotToLayer(u32* dst, const u32* src) {
-    for (int y = 0; y < CANVAS_HEIGHT; y++) {
-        memcpy(&dst[y * TEX_WIDTH], &src[y * CANVAS_WIDTH], CANVAS_WIDTH * sizeof(u32));
+// Rebuild a record from its spilled form. Snapshots stay packed (raw ones
+// carry the HISTORY_CODEC_RAW tag) and are decoded by the regular undo path.
+static bool parseSpilledEntry(const u8* blob, size_t size, HistoryEntry* entry, SpillHeader* header) {
+    memset(entry, 0, sizeof(*entry));
+    if (size < sizeof(*header)) return false;
+    memcpy(header, blob, sizeof(*header));
+    size_t pos = sizeof(*header);
+
+    entry->type = (HistoryType)header->type;
+    entry->currentLayerIndex = header->currentLayerIndex;
+    entry->layerMask = header->layerMask & ((1u << MAX_LAYERS) - 1);
+    entry->reorderA = header->reorderA;
+    entry->reorderB = header->reorderB;
+
+    for (int j = 0; j < MAX_LAYERS; j++) {
+        if (!(entry->layerMask & (1u << j))) continue;
+        LayerSnapshot* snap = &entry->layers[j];
+        u32 dataSize;
+        if (size - pos < sizeof(snap->props) + sizeof(dataSize)) goto fail;
+        memcpy(&snap->props, blob + pos, sizeof(snap->props));
+        pos += sizeof(snap->props);
+        memcpy(&dataSize, blob + pos, sizeof(dataSize));
+        pos += sizeof(dataSize);
+        if (dataSize == 0) continue;
+        if (dataSize > size - pos) goto fail;
+
+        // Plain malloc: memAlloc may call back into history while we run on the worker.
+        snap->packed = (u8*)malloc(dataSize);
+        if (!snap->packed) goto fail;
+        memcpy(snap->packed, blob + pos, dataSize);
+        snap->packedSize = dataSize;
+        pos += dataSize;
+    }
+
+    if (entry->type == HISTORY_OP) {
+        if (size - pos < sizeof(entry->op)) goto fail;
+        memcpy(&entry->op, blob + pos, sizeof(entry->op));
+        pos += sizeof(entry->op);
+        entry->op.samples = NULL;
+        entry->op.sampleCapacity = 0;
+        size_t sampleBytes = (size_t)entry->op.sampleCount * sizeof(StrokeSample);
+        if (sampleBytes > size - pos) goto fail;
+        if (sampleBytes > 0) {
+            entry->op.samples = (StrokeSample*)malloc(sampleBytes);
+            if (!entry->op.samples) goto fail;
+            memcpy(entry->op.samples, blob + pos, sampleBytes);
+            entry->op.sampleCapacity = entry->op.sampleCount;
+        }
     }
+    return true;
+
+fail:
+    freeDetachedEntry(entry);
+    return false;
 }
 
-static void swapLayerWithSnapshot(u32* layerBuf, u32* snapshotBuf, u32* tempBuf) {
-    copyLayerToSnapshot(tempBuf, layerBuf);
-    copySnapshotToLayer(layerBuf, snapshotBuf);
-    memcpy(snapshotBuf, tempBuf, getHistoryBufferSize());
+// Put an evicted record back in front of the ring as the newest applied step
+// before the RAM window; its bytes are already counted. Caller holds historyLock.
+static void prependHistoryEntry(const HistoryEntry* loaded) {
+    if (historyCount >= HISTORY_RING_SIZE) {
+        freeHistoryEntry(historyAt(historyCount - 1));
+        historyCount--;
+    }
+    historyHead = (historyHead + HISTORY_RING_SIZE - 1) % HISTORY_RING_SIZE;
+    *historyAt(0) = *loaded;
+    historyCount++;
+    historyIndex++;
+
+    // Make room by giving up the newest redo steps, not the record just loaded.
+    size_t budget = getEffectiveBudget();
+    while (historyCount - 1 > historyIndex && historyRingBytes() > budget) {
+        freeHistoryEntry(historyAt(historyCount - 1));
+        historyCount--;
+    }
+}
+
+// Undo past the RAM window, cheap case: the newest evicted record is still
+// queued, so it goes straight back without touching the card.
+static bool takeBackQueuedEntry(void) {
+    if (historySpillQueued == 0 || historyCount >= HISTORY_RING_SIZE) return false;
+    historySpillQueued--;
+    SpilledRecord* record = &historySpillQueue[(historySpillHead + historySpillQueued) % HISTORY_SPILL_QUEUE];
+    historySpillBytes -= record->rawBytes + record->packedBytes;
+    prependHistoryEntry(&record->entry);
+    return true;
+}
+
+// Worker side of undo past the RAM window: read the newest spilled record.
+static void loadSpilledEntry(void) {
+    LightLock_Lock(&historyLogLock);
+    u32 count = historyLogCount(&historyLog);
+    u32 id = count > 0 ? count - 1 : 0;
+    size_t size = count > 0 ? historyLogRecordSize(&historyLog, id) : 0;
+    u8* blob = size > 0 ? (u8*)malloc(size) : NULL;
+    bool ok = blob && historyLogRead(&historyLog, id, blob, size, updateLoadProgress, NULL, &historyLoadCancel);
+    LightLock_Unlock(&historyLogLock);
+
+    HistoryEntry loaded;
+    SpillHeader header;
+    ok = ok && parseSpilledEntry(blob, size, &loaded, &header);
+    free(blob);
+
+    LightLock_Lock(&historyLock);
+    bool cancelled = historyLoadCancel;
+    if (ok && !cancelled && historySpilledCount == count &&
+        header.canvasWidth == (u32)historyCanvasWidth && header.canvasHeight == (u32)historyCanvasHeight) {
+        LightLock_Lock(&historyLogLock);
+        historyLogTruncate(&historyLog, id);
+        historySpilledCount = historyLogCount(&historyLog);
+        LightLock_Unlock(&historyLogLock);
+        for (int j = 0; j < MAX_LAYERS; j++) {
+            historyPackedBytes += loaded.layers[j].packedSize;
+        }
+        historyRawBytes += loaded.op.sampleCapacity * sizeof(StrokeSample);
+        prependHistoryEntry(&loaded);
+        historyLoadState = HISTORY_LOAD_DONE;
+    } else {
+        if (ok) freeDetachedEntry(&loaded);
+        // An unreadable record cuts off everything older than it.
+        if (!cancelled) resetHistoryLog();
+        historyLoadState = HISTORY_LOAD_IDLE;
+        historyUndoPending = false;
+    }
+    historyLoadCancel = false;
+    LightLock_Unlock(&historyLock);
+}
+
+static void historyWorkerMain(void* arg) {
+    (void)arg;
+    while (!historyWorkerQuit) {
+        LightEvent_Wait(&historyWorkEvent);
+
+        while (!historyWorkerQuit) {
+            LightLock_Lock(&historyLock);
+            // Evicted records first: their memory is only released once written.
+            if (historySpillQueued > 0) {
+                SpilledRecord record = historySpillQueue[historySpillHead];
+                historySpillHead = (historySpillHead + 1) % HISTORY_SPILL_QUEUE;
+                historySpillQueued--;
+                historySpillWriting = true;
+                u32 epoch = historySpillEpoch;
+                LightLock_Unlock(&historyLock);
+
+                writeSpilledRecord(&record);
+
+                LightLock_Lock(&historyLock);
+                LightLock_Lock(&historyLogLock);
+                if (epoch != historySpillEpoch) historyLogTruncate(&historyLog, 0);
+                historySpilledCount = historyLogCount(&historyLog);
+                LightLock_Unlock(&historyLogLock);
+                releaseSpilledRecord(&record);
+                historySpillWriting = false;
+                LightLock_Unlock(&historyLock);
+                continue;
+            }
+            if (historyLoadState == HISTORY_LOAD_REQUESTED) {
+                historyLoadState = HISTORY_LOAD_RUNNING;
+                LightLock_Unlock(&historyLock);
+                loadSpilledEntry();
+                continue;
+            }
+            LayerSnapshot* snap = findPackCandidate();
+            if (!snap) {
+                LightLock_Unlock(&historyLock);
+                break;
+            }
+            snap->packBusy = true;
+            historyPackCancel = false;
+            const u32* raw = snap->buffer;
+            size_t count = getHistoryBufferSize() / sizeof(u32);
+            LightLock_Unlock(&historyLock);
+
+            u64 start = svcGetSystemTick();
+            size_t packedSize = 0;
+            u8* packed = historyCodecCompress(raw, count, &packedSize, &historyPackCancel);
+            u64 elapsed = svcGetSystemTick() - start;
+
+            LightLock_Lock(&historyLock);
+            if (packed && !historyPackCancel) {
+                free(snap->buffer);
+                snap->buffer = NULL;
+                historyRawBytes -= count * sizeof(u32);
+                snap->packed = packed;
+                snap->packedSize = packedSize;
+                historyPackedBytes += packedSize;
+                historyPackInBytes += count * sizeof(u32);
+                historyPackOutBytes += packedSize;
+                historyPackTicks += elapsed;
+            } else {
+                free(packed);
+                if (!historyPackCancel) snap->packSkip = true;
+            }
+            snap->packBusy = false;
+            LightLock_Unlock(&historyLock);
+        }
+    }
+}
+
+static void startHistoryWorker(void) {
+    if (historyWorker) return;
+    historyWorkerQuit = false;
+    historyWorker = workerThreadCreate(historyWorkerMain, NULL, 1);
+}
+
+static void stopHistoryWorker(void) {
+    if (!historyWorker) return;
+    historyWorkerQuit = true;
+    historyPackCancel = true;
+    LightEvent_Signal(&historyWorkEvent);
+    threadJoin(historyWorker, U64_MAX);
+    threadFree(historyWorker);
+    historyWorker = NULL;
+}
+
+void updateHistory(void) {
+    if (!historyInitialized) return;
+
+    LightLock_Lock(&historyLock);
+    bool apply = false;
+    if (historyLoadState == HISTORY_LOAD_DONE) {
+        apply = historyUndoPending;
+        historyUndoPending = false;
+        historyLoadState = HISTORY_LOAD_IDLE;
+    }
+    LightLock_Unlock(&historyLock);
+
+    if (apply) undo();
+}
+
+bool historyIsLoading(float* progress) {
+    if (!historyInitialized) return false;
+    bool loading = historyLoadState != HISTORY_LOAD_IDLE;
+    if (loading && progress) *progress = historyLoadProgress;
+    return loading;
+}
+
+// Memory manager hook: give bytes back to painting, oldest records first.
+// The newest record is kept so the action in progress stays undoable.
+static size_t reclaimHistoryMemory(size_t bytesNeeded) {
+    if (!historyInitialized) return 0;
+
+    u32 threadId = 0;
+    svcGetThreadId(&threadId, CUR_THREAD_HANDLE);
+    if (historyReplayFloor && threadId == historyReplayThreadId) {
+        // Re-entered from a replay on this thread: the lock is already held.
+        size_t freed = 0;
+        while (freed < bytesNeeded && historyCount > 0 && historyAt(0) != historyReplayFloor) {
+            freed += dropOldestHistoryEntry(false);
+        }
+        return freed;
+    }
+
+    LightLock_Lock(&historyLock);
+    size_t freed = 0;
+    if (historyCanvasWidth != CANVAS_WIDTH || historyCanvasHeight != CANVAS_HEIGHT) {
+        // Canvas is being resized: the old snapshots are unusable anyway.
+        freed = historyRawBytes + historyPackedBytes;
+        clearHistoryEntries();
+    }
+    while (freed < bytesNeeded && historyCount > 1) {
+        freed += dropOldestHistoryEntry(false);
+    }
+    LightLock_Unlock(&historyLock);
+    return freed;
 }
 
 void initHistory(void) {
+    static bool syncInitialized = false;
+    if (!syncInitialized) {
+        LightLock_Init(&historyLock);
+        LightLock_Init(&historyLogLock);
+        LightEvent_Init(&historyWorkEvent, RESET_ONESHOT);
+        memRegisterReclaimer(reclaimHistoryMemory);
+        syncInitialized = true;
+    }
+
+    LightLock_Lock(&historyLock);
     clearHistoryEntries();
     historyCanvasWidth = CANVAS_WIDTH;
     historyCanvasHeight = CANVAS_HEIGHT;
+    if (!historyLogReady) {
+        ensureDirectoryExists(SAVE_DIR);
+        historyLogReady = historyLogOpen(&historyLog, SAVE_DIR, HISTORY_LOG_NAME, true);
+    }
     historyInitialized = true;
+    LightLock_Unlock(&historyLock);
+
+    startHistoryWorker();
 }
 
 void exitHistory(void) {
+    if (!historyInitialized) return;
+    stopHistoryWorker();
+
+    LightLock_Lock(&historyLock);
     clearHistoryEntries();
+    if (historyLogReady) {
+        historyLogClose(&historyLog, true);
+        historyLogReady = false;
+    }
     historyCanvasWidth = 0;
     historyCanvasHeight = 0;
     historyInitialized = false;
+    LightLock_Unlock(&historyLock);
 }
 
-void pushHistory(void) {
-    if (!historyInitialized) return;
-
+// Start a new record at the top of the ring. Caller holds historyLock.
+// bytesNeeded is the pixel payload the record is about to allocate.
+static HistoryEntry* beginHistoryRecord(HistoryType type, size_t bytesNeeded) {
     if (historyCanvasWidth != CANVAS_WIDTH || historyCanvasHeight != CANVAS_HEIGHT) {
         clearHistoryEntries();
         historyCanvasWidth = CANVAS_WIDTH;
         historyCanvasHeight = CANVAS_HEIGHT;
     }
-
-    size_t bufferSize = getHistoryBufferSize();
+    cancelHistoryLoad();
+    historyActiveStroke = NULL;
 
     if (historyIndex < historyCount - 1) {
         for (int i = historyIndex + 1; i < historyCount; i++) {
-            freeHistoryEntry(i);
+            freeHistoryEntry(historyAt(i));
         }
         historyCount = historyIndex + 1;
     }
 
-    while (historyCount >= HISTORY_MAX) {
-        dropOldestHistoryEntry();
+    // Evict oldest-first until the new payload fits the byte budget.
+    // Metadata records carry no pixels, so they practically never evict anything.
+    size_t budget = getEffectiveBudget();
+    while (historyCount > 0 && historyRingBytes() + bytesNeeded > budget) {
+        dropOldestHistoryEntry(true);
+    }
+    if (historyCount >= HISTORY_RING_SIZE) {
+        dropOldestHistoryEntry(true);
     }
 
-    while (!ensureHistoryEntryBuffers(historyCount, bufferSize)) {
-        if (historyCount > 0) {
-            dropOldestHistoryEntry();
-        } else {
-            return;
+    HistoryEntry* entry = historyAt(historyCount);
+    entry->type = type;
+    entry->currentLayerIndex = currentLayerIndex;
+    entry->layerMask = 0;
+    entry->reorderA = -1;
+    entry->reorderB = -1;
+    memset(&entry->op, 0, sizeof(entry->op));
+    return entry;
+}
+
+static void commitHistoryRecord(void) {
+    historyCount++;
+    historyIndex = historyCount - 1;
+}
+
+bool pushLayersHistory(u32 layerMask) {
+    if (!historyInitialized) return false;
+    layerMask &= (1u << MAX_LAYERS) - 1;
+    if (layerMask == 0) return false;
+    projectStreamWaitLayers(layerMask);
+
+    LightLock_Lock(&historyLock);
+
+    size_t bufferSize = getHistoryBufferSize();
+    size_t bytesNeeded = 0;
+    for (int j = 0; j < MAX_LAYERS; j++) {
+        if ((layerMask & (1u << j)) && layers[j].buffer) bytesNeeded += bufferSize;
+    }
+
+    HistoryEntry* entry = beginHistoryRecord(HISTORY_PIXELS, bytesNeeded);
+    while (!ensureHistoryEntryBuffers(entry, layerMask, bufferSize)) {
+        if (historyCount == 0) {
+            LightLock_Unlock(&historyLock);
+            return false;
         }
+        dropOldestHistoryEntry(false);
+        entry = historyAt(historyCount);
+        entry->type = HISTORY_PIXELS;
+        entry->currentLayerIndex = currentLayerIndex;
+        entry->reorderA = -1;
+        entry->reorderB = -1;
     }
 
-    historyStack[historyCount].currentLayerIndex = currentLayerIndex;
+    entry->layerMask = layerMask;
     for (int j = 0; j < MAX_LAYERS; j++) {
-        copyLayerToSnapshot(historyStack[historyCount].layers[j].buffer, layers[j].buffer);
-        historyStack[historyCount].layers[j].visible = layers[j].visible;
-        historyStack[historyCount].layers[j].opacity = layers[j].opacity;
-        historyStack[historyCount].layers[j].blendMode = layers[j].blendMode;
-        historyStack[historyCount].layers[j].alphaLock = layers[j].alphaLock;
-        historyStack[historyCount].layers[j].clipping = layers[j].clipping;
-        strncpy(historyStack[historyCount].layers[j].name, layers[j].name, sizeof(historyStack[historyCount].layers[j].name));
-        historyStack[historyCount].layers[j].name[sizeof(historyStack[historyCount].layers[j].name) - 1] = '\0';
+        if (!(layerMask & (1u << j))) continue;
+        if (entry->layers[j].buffer) {
+            memcpy(entry->layers[j].buffer, layers[j].buffer, bufferSize);
+        }
+        captureLayerProps(&entry->layers[j].props, &layers[j]);
     }
-    historyCount++;
-    historyIndex = historyCount - 1;
+    commitHistoryRecord();
+
+    LightLock_Unlock(&historyLock);
+    LightEvent_Signal(&historyWorkEvent);
+    return true;
+}
+
+void pushHistory(void) {
+    pushLayersHistory((1u << MAX_LAYERS) - 1);
+}
+
+bool pushLayerHistory(int layerIndex) {
+    if (layerIndex < 0 || layerIndex >= MAX_LAYERS) return false;
+    return pushLayersHistory(1u << layerIndex);
+}
+
+void pushLayerPropsHistory(int layerIndex) {
+    if (!historyInitialized) return;
+    if (layerIndex < 0 || layerIndex >= MAX_LAYERS) return;
+
+    LightLock_Lock(&historyLock);
+    HistoryEntry* entry = beginHistoryRecord(HISTORY_PROPS, 0);
+    entry->layerMask = 1u << layerIndex;
+    captureLayerProps(&entry->layers[layerIndex].props, &layers[layerIndex]);
+    commitHistoryRecord();
+    LightLock_Unlock(&historyLock);
+}
+
+void pushLayerReorderHistory(int indexA, int indexB) {
+    if (!historyInitialized) return;
+    if (indexA < 0 || indexA >= MAX_LAYERS || indexB < 0 || indexB >= MAX_LAYERS) return;
+    if (indexA == indexB) return;
+
+    LightLock_Lock(&historyLock);
+    HistoryEntry* entry = beginHistoryRecord(HISTORY_REORDER, 0);
+    entry->reorderA = indexA;
+    entry->reorderB = indexB;
+    // Fields are kept too, since a reorder may also reset clipping.
+    entry->layerMask = (1u << indexA) | (1u << indexB);
+    captureLayerProps(&entry->layers[indexA].props, &layers[indexA]);
+    captureLayerProps(&entry->layers[indexB].props, &layers[indexB]);
+    commitHistoryRecord();
+    LightLock_Unlock(&historyLock);
+}
+
+static u32 journalOpLayerMask(const JournalOp* op) {
+    if (op->layerIndex < 0 || op->layerIndex >= MAX_LAYERS) return 0;
+    u32 mask = 1u << op->layerIndex;
+    if (op->type == JOURNAL_MERGE_DOWN && op->layerIndex > 0) mask |= 1u << (op->layerIndex - 1);
+    return mask;
+}
+
+// Scan back from index over journal ops to the keyframe that starts their
+// chain. Returns its logical index, -1 when the chain runs past the start of
+// the RAM window, -2 when it hits any other record type.
+static int findChainKeyframe(int index, int* opCount) {
+    int ops = 0;
+    int result = -1;
+    for (int i = index; i >= 0; i--) {
+        HistoryType type = historyAt(i)->type;
+        if (type == HISTORY_KEYFRAME) { result = i; break; }
+        if (type != HISTORY_OP) { result = -2; break; }
+        ops++;
+    }
+    if (opCount) *opCount = ops;
+    return result;
+}
+
+// Snapshot the layers the chain touches for the first time. Nothing in the
+// chain has modified them yet, so the live pixels are the keyframe state.
+// The keyframe may also be the uncommitted record just past the ring's top.
+static bool addKeyframeLayers(HistoryEntry* keyframe, u32 layerMask) {
+    size_t bufferSize = getHistoryBufferSize();
+    u32 missing = 0;
+    size_t bytesNeeded = 0;
+    for (int j = 0; j < MAX_LAYERS; j++) {
+        u32 bit = 1u << j;
+        if ((layerMask & bit) && !(keyframe->layerMask & bit) && layers[j].buffer) {
+            missing |= bit;
+            bytesNeeded += bufferSize;
+        }
+    }
+    if (!missing) return true;
+    projectStreamWaitLayers(missing);
+
+    size_t budget = getEffectiveBudget();
+    while (historyAt(0) != keyframe && historyRingBytes() + bytesNeeded > budget) {
+        dropOldestHistoryEntry(true);
+    }
+
+    for (int j = 0; j < MAX_LAYERS; j++) {
+        if (!(missing & (1u << j))) continue;
+        LayerSnapshot* snap = &keyframe->layers[j];
+        snap->buffer = (u32*)malloc(bufferSize);
+        while (!snap->buffer && historyAt(0) != keyframe) {
+            dropOldestHistoryEntry(false);
+            snap->buffer = (u32*)malloc(bufferSize);
+        }
+        if (!snap->buffer) return false;
+        historyRawBytes += bufferSize;
+        memcpy(snap->buffer, layers[j].buffer, bufferSize);
+        captureLayerProps(&snap->props, &layers[j]);
+        keyframe->layerMask |= 1u << j;
+    }
+    return true;
+}
+
+// Record a journal op at the top of the history, opening a new keyframe when
+// the chain is broken or long enough. Caller holds historyLock.
+// Returns NULL when the keyframe pixels could not be kept.
+static HistoryEntry* pushJournalOp(const JournalOp* op) {
+    HistoryEntry* keyframe = beginHistoryRecord(HISTORY_KEYFRAME, 0);
+
+    int opCount = 0;
+    int key = findChainKeyframe(historyIndex, &opCount);
+    bool brokenTail = historyIndex >= 0 && historyAt(historyIndex)->type == HISTORY_OP &&
+                      historyAt(historyIndex)->op.incomplete;
+    if (key < 0 || opCount >= HISTORY_KEYFRAME_INTERVAL || brokenTail) {
+        // Capture before committing: a keyframe without its pixels would
+        // linger as an undo step that does nothing.
+        if (!addKeyframeLayers(keyframe, journalOpLayerMask(op))) {
+            freeHistoryEntry(keyframe);
+            return NULL;
+        }
+        commitHistoryRecord();
+    } else if (!addKeyframeLayers(historyAt(key), journalOpLayerMask(op))) {
+        return NULL;
+    }
+
+    HistoryEntry* entry = beginHistoryRecord(HISTORY_OP, 0);
+    entry->op = *op;
+    entry->op.samples = NULL;
+    entry->op.sampleCount = 0;
+    entry->op.sampleCapacity = 0;
+    commitHistoryRecord();
+    if (op->type == JOURNAL_STROKE) historyActiveStroke = entry;
+    return entry;
+}
+
+static void recordJournalOp(const JournalOp* op) {
+    if (!historyInitialized) return;
+
+    LightLock_Lock(&historyLock);
+    HistoryEntry* entry = pushJournalOp(op);
+    LightLock_Unlock(&historyLock);
+
+    if (!entry) {
+        // No room for the keyframe: fall back to a plain pixel record.
+        pushLayersHistory(journalOpLayerMask(op));
+        return;
+    }
+    LightEvent_Signal(&historyWorkEvent);
+}
+
+void historyBeginStroke(int layerIndex, BrushType brushType) {
+    if (layerIndex < 0 || layerIndex >= MAX_LAYERS) return;
+    JournalOp op;
+    memset(&op, 0, sizeof(op));
+    op.type = JOURNAL_STROKE;
+    op.layerIndex = (s8)layerIndex;
+    op.brushType = (u8)brushType;
+    recordJournalOp(&op);
+}
+
+static void appendStrokeSample(const StrokeSample* sample) {
+    if (!historyInitialized) return;
+
+    LightLock_Lock(&historyLock);
+    HistoryEntry* entry = historyActiveStroke;
+    if (entry) {
+        JournalOp* op = &entry->op;
+        if (op->sampleCount == op->sampleCapacity) {
+            u32 capacity = op->sampleCapacity ? op->sampleCapacity * 2 : 64;
+            StrokeSample* grown = (StrokeSample*)realloc(op->samples, capacity * sizeof(StrokeSample));
+            if (grown) {
+                historyRawBytes += (capacity - op->sampleCapacity) * sizeof(StrokeSample);
+                op->samples = grown;
+                op->sampleCapacity = capacity;
+            } else {
+                // The stroke can no longer be replayed; undo still works
+                // (replay stops before it) and the next op starts a new keyframe.
+                op->incomplete = 1;
+                historyActiveStroke = NULL;
+            }
+        }
+        if (historyActiveStroke) {
+            op->samples[op->sampleCount++] = *sample;
+        }
+    }
+    LightLock_Unlock(&historyLock);
+}
+
+void historyAddStrokeDot(int x, int y, int size, u32 color) {
+    StrokeSample sample = {(s16)x, (s16)y, (s16)x, (s16)y, (s16)size, 0, color};
+    appendStrokeSample(&sample);
+}
+
+void historyAddStrokeLine(int x0, int y0, int x1, int y1, int size, u32 color) {
+    StrokeSample sample = {(s16)x0, (s16)y0, (s16)x1, (s16)y1, (s16)size, 1, color};
+    appendStrokeSample(&sample);
+}
+
+void historyEndStroke(void) {
+    if (!historyInitialized) return;
+    LightLock_Lock(&historyLock);
+    historyActiveStroke = NULL;
+    LightLock_Unlock(&historyLock);
+}
+
+void pushFillHistory(int layerIndex, int x, int y, u32 color, int expand, int tolerancePct) {
+    if (layerIndex < 0 || layerIndex >= MAX_LAYERS) return;
+    JournalOp op;
+    memset(&op, 0, sizeof(op));
+    op.type = JOURNAL_FILL;
+    op.layerIndex = (s8)layerIndex;
+    op.x = (s16)x;
+    op.y = (s16)y;
+    op.color = color;
+    op.expand = (s16)expand;
+    op.tolerance = (s16)tolerancePct;
+    recordJournalOp(&op);
+}
+
+void pushClearHistory(int layerIndex, u32 color) {
+    if (layerIndex < 0 || layerIndex >= MAX_LAYERS) return;
+    JournalOp op;
+    memset(&op, 0, sizeof(op));
+    op.type = JOURNAL_CLEAR;
+    op.layerIndex = (s8)layerIndex;
+    op.color = color;
+    recordJournalOp(&op);
+}
+
+void pushMergeDownHistory(int layerIndex) {
+    if (layerIndex <= 0 || layerIndex >= MAX_LAYERS) return;
+    JournalOp op;
+    memset(&op, 0, sizeof(op));
+    op.type = JOURNAL_MERGE_DOWN;
+    op.layerIndex = (s8)layerIndex;
+    recordJournalOp(&op);
 }
 
 bool canUndo(void) {
     if (!historyInitialized) return false;
     if (historyCanvasWidth != CANVAS_WIDTH || historyCanvasHeight != CANVAS_HEIGHT) return false;
-    return historyIndex >= 0;
+    for (int i = historyIndex; i >= 0; i--) {
+        if (historyAt(i)->type != HISTORY_KEYFRAME) return true;
+    }
+    return historySpilledTotal() > 0;
 }
 
 bool canRedo(void) {
     if (!historyInitialized) return false;
     if (historyCanvasWidth != CANVAS_WIDTH || historyCanvasHeight != CANVAS_HEIGHT) return false;
-    return historyIndex < historyCount - 1;
+    if (historyLoadState != HISTORY_LOAD_IDLE) return false;
+    for (int i = historyIndex + 1; i < historyCount; i++) {
+        if (historyAt(i)->type != HISTORY_KEYFRAME) return true;
+    }
+    return false;
 }
 
-void undo(void) {
-    if (!historyInitialized) return;
-    if (historyIndex < 0) return;
-    if (historyCanvasWidth != CANVAS_WIDTH || historyCanvasHeight != CANVAS_HEIGHT) {
-        clearHistoryEntries();
-        return;
-    }
+static void swapReorderedLayers(const HistoryEntry* entry) {
+    swapLayers(entry->reorderA, entry->reorderB);
+}
 
-    HistoryEntry* entry = &historyStack[historyIndex];
-    size_t bufferSize = getHistoryBufferSize();
-    u32* tempBuffer = (u32*)malloc(bufferSize);
-    if (!tempBuffer) return;
+// Decompress every snapshot of a pixel record. Decoding needs memory, so older
+// records are dropped until it fits; *index follows the record as the head moves.
+static bool prepareHistoryEntry(int* index) {
+    HistoryEntry* entry = historyAt(*index);
+    if (entry->type != HISTORY_PIXELS) return true;
 
+    for (int j = 0; j < MAX_LAYERS; j++) {
+        while (layers[j].buffer && snapshotHasData(&entry->layers[j]) &&
+               !ensureSnapshotRaw(&entry->layers[j])) {
+            if (*index == 0) return false;
+            dropOldestHistoryEntry(false);
+            (*index)--;
+        }
+    }
+    return true;
+}
+
+// Exchange the live layers with a history entry (shared by undo and redo).
+// Pixels move by trading buffer pointers, so this never copies or allocates.
+static void swapWithHistoryEntry(HistoryEntry* entry, bool isUndo) {
     int tempLayerIndex = currentLayerIndex;
     currentLayerIndex = entry->currentLayerIndex;
     entry->currentLayerIndex = tempLayerIndex;
 
+    // Reorder undo restores positions before fields, redo the other way round,
+    // so the held fields always line up with the pre-reorder stack.
+    if (entry->type == HISTORY_REORDER && isUndo) swapReorderedLayers(entry);
+
     for (int j = 0; j < MAX_LAYERS; j++) {
-        if (layers[j].buffer && entry->layers[j].buffer) {
-            swapLayerWithSnapshot(layers[j].buffer, entry->layers[j].buffer, tempBuffer);
+        if (!(entry->layerMask & (1u << j))) continue;
+        if (entry->type == HISTORY_PIXELS && layers[j].buffer && entry->layers[j].buffer) {
+            u32* temp = layers[j].buffer;
+            layers[j].buffer = entry->layers[j].buffer;
+            entry->layers[j].buffer = temp;
+            entry->layers[j].packSkip = false;
+            markLayerDirtyFull(j);
         }
+        swapLayerProps(&layers[j], &entry->layers[j].props);
+    }
 
-        bool tempVisible = layers[j].visible;
-        layers[j].visible = entry->layers[j].visible;
-        entry->layers[j].visible = tempVisible;
+    if (entry->type == HISTORY_REORDER && !isUndo) swapReorderedLayers(entry);
+}
 
-        u8 tempOpacity = layers[j].opacity;
-        layers[j].opacity = entry->layers[j].opacity;
-        entry->layers[j].opacity = tempOpacity;
+typedef enum {
+    REPLAY_DONE,
+    REPLAY_NEED_LOAD,  /**< The chain's keyframe is in the spill log. */
+    REPLAY_FAILED
+} ReplayResult;
 
-        BlendMode tempBlend = layers[j].blendMode;
-        layers[j].blendMode = entry->layers[j].blendMode;
-        entry->layers[j].blendMode = tempBlend;
+// Replays run the regular painting code; see historyReplayFloor.
+static void beginReplay(HistoryEntry* floor) {
+    svcGetThreadId(&historyReplayThreadId, CUR_THREAD_HANDLE);
+    historyReplayFloor = floor;
+}
 
-        bool tempAlphaLock = layers[j].alphaLock;
-        layers[j].alphaLock = entry->layers[j].alphaLock;
-        entry->layers[j].alphaLock = tempAlphaLock;
+static void endReplay(void) {
+    historyReplayFloor = NULL;
+}
+
+static void replayJournalOp(const JournalOp* op) {
+    int layerIndex = op->layerIndex;
+    switch (op->type) {
+        case JOURNAL_STROKE:
+            startStroke(layerIndex, (BrushType)op->brushType);
+            for (u32 i = 0; i < op->sampleCount; i++) {
+                const StrokeSample* sample = &op->samples[i];
+                if (sample->isLine) {
+                    drawLineToLayer(layerIndex, sample->x0, sample->y0, sample->x1, sample->y1,
+                                    sample->size, sample->color);
+                } else {
+                    drawBrushToLayer(layerIndex, sample->x0, sample->y0, sample->size, sample->color);
+                }
+            }
+            endStroke();
+            break;
+        case JOURNAL_FILL:
+            // The fill composites the layers itself, as on the live tap.
+            floodFill(layerIndex, op->x, op->y, op->color, op->expand, op->tolerance);
+            break;
+        case JOURNAL_CLEAR:
+            clearLayer(layerIndex, op->color);
+            break;
+        case JOURNAL_MERGE_DOWN:
+            mergeLayerDown(layerIndex);
+            break;
+    }
+}
 
-        bool tempClipping = layers[j].clipping;
-        layers[j].clipping = entry->layers[j].clipping;
-        entry->layers[j].clipping = tempClipping;
+static bool restoreKeyframeLayers(HistoryEntry* keyframe, u32 layerMask) {
+    size_t count = getHistoryBufferSize() / sizeof(u32);
+    for (int j = 0; j < MAX_LAYERS; j++) {
+        if (!(layerMask & (1u << j)) || !layers[j].buffer) continue;
+        if (!(keyframe->layerMask & (1u << j))) return false;
 
-        char tempName[32];
-        memcpy(tempName, layers[j].name, sizeof(tempName));
-        memcpy(layers[j].name, entry->layers[j].name, sizeof(layers[j].name));
-        memcpy(entry->layers[j].name, tempName, sizeof(entry->layers[j].name));
-        layers[j].name[sizeof(layers[j].name) - 1] = '\0';
-        entry->layers[j].name[sizeof(entry->layers[j].name) - 1] = '\0';
+        LayerSnapshot* snap = &keyframe->layers[j];
+        waitSnapshotIdle(snap);
+        markLayerDirtyFull(j);
+        if (snap->buffer) {
+            memcpy(layers[j].buffer, snap->buffer, count * sizeof(u32));
+        } else if (!snap->packed ||
+                   !historyCodecDecompress(snap->packed, snap->packedSize, layers[j].buffer, count)) {
+            return false;
+        }
     }
+    return true;
+}
+
+bool revertLastHistory(void) {
+    if (!historyInitialized) return false;
 
-    free(tempBuffer);
-    historyIndex--;
-    canvasNeedsUpdate = true;
+    LightLock_Lock(&historyLock);
+    bool ok = historyCanvasWidth == CANVAS_WIDTH && historyCanvasHeight == CANVAS_HEIGHT &&
+              historyCount > 0 && historyIndex == historyCount - 1;
+    HistoryEntry* entry = ok ? historyAt(historyIndex) : NULL;
+    ok = ok && entry->type == HISTORY_PIXELS && restoreKeyframeLayers(entry, entry->layerMask);
+    if (ok) {
+        // The record is dropped right after, so trading the fields restores them.
+        currentLayerIndex = entry->currentLayerIndex;
+        for (int j = 0; j < MAX_LAYERS; j++) {
+            if (entry->layerMask & (1u << j)) swapLayerProps(&layers[j], &entry->layers[j].props);
+        }
+        historyActiveStroke = NULL;
+        freeHistoryEntry(entry);
+        historyCount--;
+        historyIndex--;
+        markCanvasDirtyFull();
+    }
+    LightLock_Unlock(&historyLock);
+    return ok;
 }
 
-void redo(void) {
+// Undo the journal op at index: restore its chain keyframe, then replay the
+// ops between the keyframe and the target.
+static ReplayResult undoJournalOp(int index) {
+    int key = findChainKeyframe(index - 1, NULL);
+    if (key == -1 && historySpilledTotal() > 0) return REPLAY_NEED_LOAD;
+    if (key < 0) return REPLAY_FAILED;
+
+    // Slots stay put while the reclaimer moves the head, so hold pointers.
+    HistoryEntry* chain[HISTORY_RING_SIZE];
+    int chainLength = index - key;
+    u32 layerMask = 0;
+    for (int i = 0; i < chainLength; i++) {
+        chain[i] = historyAt(key + 1 + i);
+        layerMask |= journalOpLayerMask(&chain[i]->op);
+    }
+
+    HistoryEntry* keyframe = historyAt(key);
+    beginReplay(keyframe);
+    bool ok = restoreKeyframeLayers(keyframe, layerMask);
+    for (int i = 0; ok && i < chainLength - 1; i++) {
+        replayJournalOp(&chain[i]->op);
+    }
+    endReplay();
+    if (!ok) return REPLAY_FAILED;
+
+    HistoryEntry* target = chain[chainLength - 1];
+    swapWithHistoryEntry(target, true);
+    historyIndex = historyIndexOf(target) - 1;
+    return REPLAY_DONE;
+}
+
+static ReplayResult redoJournalOp(int index) {
+    HistoryEntry* target = historyAt(index);
+    if (target->op.incomplete) return REPLAY_FAILED;
+
+    beginReplay(target);
+    replayJournalOp(&target->op);
+    endReplay();
+
+    swapWithHistoryEntry(target, false);
+    historyIndex = historyIndexOf(target);
+    return REPLAY_DONE;
+}
+
+// Records whose keyframe is gone cannot be undone; forget them and everything older.
+static void discardHistoryThrough(int index) {
+    for (int i = 0; i <= index; i++) {
+        freeHistoryEntry(historyAt(i));
+    }
+    historyHead = (historyHead + index + 1) % HISTORY_RING_SIZE;
+    historyCount -= index + 1;
+    historyIndex -= index + 1;
+    resetHistoryLog();
+}
+
+// Past the RAM window: have the worker read the next record back.
+static void requestHistoryLoad(void) {
+    if (historySpilledTotal() == 0 || historyLoadState != HISTORY_LOAD_IDLE) return;
+    historyLoadState = HISTORY_LOAD_REQUESTED;
+    historyLoadCancel = false;
+    historyLoadProgress = 0.0f;
+    historyUndoPending = true;
+    historyPackCancel = true;
+}
+
+void undo(void) {
     if (!historyInitialized) return;
-    if (historyIndex >= historyCount - 1) return;
+
+    LightLock_Lock(&historyLock);
     if (historyCanvasWidth != CANVAS_WIDTH || historyCanvasHeight != CANVAS_HEIGHT) {
         clearHistoryEntries();
+        LightLock_Unlock(&historyLock);
         return;
     }
+    historyActiveStroke = NULL;
 
-    historyIndex++;
+    // Keyframes are not user steps. Past the RAM window, records that are
+    // still queued for the spill log come straight back.
+    int index;
+    do {
+        index = historyIndex;
+        while (index >= 0 && historyAt(index)->type == HISTORY_KEYFRAME) index--;
+    } while (index < 0 && takeBackQueuedEntry());
 
-    HistoryEntry* entry = &historyStack[historyIndex];
-    size_t bufferSize = getHistoryBufferSize();
-    u32* tempBuffer = (u32*)malloc(bufferSize);
-    if (!tempBuffer) {
-        historyIndex--;
+    if (index < 0) {
+        requestHistoryLoad();
+    } else if (historyAt(index)->type == HISTORY_OP) {
+        ReplayResult result = undoJournalOp(index);
+        while (result == REPLAY_NEED_LOAD && takeBackQueuedEntry()) {
+            // The chain's keyframe was queued; the target moved up by one.
+            result = undoJournalOp(++index);
+        }
+        if (result == REPLAY_NEED_LOAD) {
+            requestHistoryLoad();
+        } else if (result == REPLAY_FAILED) {
+            discardHistoryThrough(index);
+        }
+        markCanvasDirtyFull();
+    } else if (prepareHistoryEntry(&index)) {
+        swapWithHistoryEntry(historyAt(index), true);
+        historyIndex = index - 1;
+        markCanvasDirtyFull();
+    }
+    LightLock_Unlock(&historyLock);
+    LightEvent_Signal(&historyWorkEvent);
+}
+
+void redo(void) {
+    if (!historyInitialized) return;
+
+    LightLock_Lock(&historyLock);
+    if (historyLoadState != HISTORY_LOAD_IDLE) {
+        LightLock_Unlock(&historyLock);
+        return;
+    }
+    if (historyCanvasWidth != CANVAS_WIDTH || historyCanvasHeight != CANVAS_HEIGHT) {
+        clearHistoryEntries();
+        LightLock_Unlock(&historyLock);
         return;
     }
+    historyActiveStroke = NULL;
 
-    int tempLayerIndex = currentLayerIndex;
-    currentLayerIndex = entry->currentLayerIndex;
-    entry->currentLayerIndex = tempLayerIndex;
+    int index = historyIndex + 1;
+    while (index < historyCount && historyAt(index)->type == HISTORY_KEYFRAME) index++;
 
-    for (int j = 0; j < MAX_LAYERS; j++) {
-        if (layers[j].buffer && entry->layers[j].buffer) {
-            swapLayerWithSnapshot(layers[j].buffer, entry->layers[j].buffer, tempBuffer);
+    if (index >= historyCount) {
+        // Nothing to redo.
+    } else if (historyAt(index)->type == HISTORY_OP) {
+        if (redoJournalOp(index) == REPLAY_FAILED) {
+            // An incomplete stroke cannot be replayed; drop it and what follows.
+            for (int i = index; i < historyCount; i++) {
+                freeHistoryEntry(historyAt(i));
+            }
+            historyCount = index;
         }
+        markCanvasDirtyFull();
+    } else if (prepareHistoryEntry(&index)) {
+        swapWithHistoryEntry(historyAt(index), false);
+        historyIndex = index;
+        markCanvasDirtyFull();
+    }
+    LightLock_Unlock(&historyLock);
+    LightEvent_Signal(&historyWorkEvent);
+}
 
-        bool tempVisible = layers[j].visible;
-        layers[j].visible = entry->layers[j].visible;
-        entry->layers[j].visible = tempVisible;
-
-        u8 tempOpacity = layers[j].opacity;
-        layers[j].opacity = entry->layers[j].opacity;
-        entry->layers[j].opacity = tempOpacity;
+void historySetByteBudget(size_t bytes) {
+    if (!historyInitialized) {
+        historyByteBudget = bytes;
+        return;
+    }
 
-        BlendMode tempBlend = layers[j].blendMode;
-        layers[j].blendMode = entry->layers[j].blendMode;
-        entry->layers[j].blendMode = tempBlend;
+    LightLock_Lock(&historyLock);
+    historyByteBudget = bytes;
+    size_t budget = getEffectiveBudget();
+    while (historyCount > 1 && historyRingBytes() > budget) {
+        dropOldestHistoryEntry(true);
+    }
+    LightLock_Unlock(&historyLock);
+}
 
-        bool tempAlphaLock = layers[j].alphaLock;
-        layers[j].alphaLock = entry->layers[j].alphaLock;
-        entry->layers[j].alphaLock = tempAlphaLock;
+size_t historyGetByteBudget(void) {
+    return historyByteBudget;
+}
 
-        bool tempClipping = layers[j].clipping;
-        layers[j].clipping = entry->layers[j].clipping;
-        entry->layers[j].clipping = tempClipping;
+void getHistoryStats(HistoryStats* stats) {
+    if (!stats) return;
+    memset(stats, 0, sizeof(*stats));
+    if (!historyInitialized) return;
 
-        char tempName[32];
-        memcpy(tempName, layers[j].name, sizeof(tempName));
-        memcpy(layers[j].name, entry->layers[j].name, sizeof(layers[j].name));
-        memcpy(entry->layers[j].name, tempName, sizeof(entry->layers[j].name));
-        layers[j].name[sizeof(layers[j].name) - 1] = '\0';
-        entry->layers[j].name[sizeof(entry->layers[j].name) - 1] = '\0';
+    LightLock_Lock(&historyLock);
+    stats->rawBytes = historyRawBytes;
+    stats->packedBytes = historyPackedBytes;
+    stats->budgetBytes = getEffectiveBudget();
+    stats->entryCount = historyCount;
+    stats->spilledCount = (int)historySpilledTotal();
+    stats->compressedInBytes = historyPackInBytes;
+    stats->compressedOutBytes = historyPackOutBytes;
+    float seconds = workerTicksToMs(historyPackTicks) / 1000.0f;
+    if (seconds > 0.0f) {
+        stats->compressMBps = (float)historyPackInBytes / (1024.0f * 1024.0f) / seconds;
     }
-
-    free(tempBuffer);
-    canvasNeedsUpdate = true;
+    LightLock_Unlock(&historyLock);
 }
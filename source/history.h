@@ -7,10 +7,124 @@
  * @brief Undo/redo history management.
  */
 
+/** @brief History memory and compression counters. */
+typedef struct {
+    size_t rawBytes;          /**< Bytes held in uncompressed snapshots. */
+    size_t packedBytes;       /**< Bytes held in compressed snapshots. */
+    size_t budgetBytes;       /**< Byte budget currently in effect (shrinks when the heap is low). */
+    int entryCount;           /**< Number of history entries in RAM. */
+    int spilledCount;         /**< Number of older entries spilled to the SD card. */
+    u64 compressedInBytes;    /**< Total snapshot bytes fed to the compressor. */
+    u64 compressedOutBytes;   /**< Total compressed bytes produced. */
+    float compressMBps;       /**< Average compression throughput in MB/s. */
+} HistoryStats;
+
 void initHistory(void);
 void exitHistory(void);
+
+/** @brief Record a pixel snapshot of every layer (plus layer fields). */
 void pushHistory(void);
+
+/**
+ * @brief Record a pixel snapshot of a single layer before painting on it.
+ * @return false if no record was taken (no memory even with the history emptied).
+ */
+bool pushLayerHistory(int layerIndex);
+
+/**
+ * @brief Record a pixel snapshot of the layers set in layerMask (bit i = layer i).
+ * @return false if no record was taken.
+ */
+bool pushLayersHistory(u32 layerMask);
+
+/**
+ * @brief Put back the layers of the pixel record just pushed and forget it.
+ *
+ * For an operation that failed midway: unlike undo(), no redo step is left.
+ * @return false if the newest applied record is not a pixel record or could
+ *         not be restored; it is then kept.
+ */
+bool revertLastHistory(void);
+
+/**
+ * @brief Record a layer's fields (visibility, opacity, blend mode, locks, name).
+ *
+ * Costs a few bytes and practically never evicts pixel records.
+ */
+void pushLayerPropsHistory(int layerIndex);
+
+/**
+ * @brief Record a swap of two layers in the stack.
+ *
+ * Call before swapping; the fields of both layers are kept so that follow-up
+ * field changes in the same action (e.g. clipping reset) are undone too.
+ */
+void pushLayerReorderHistory(int indexA, int indexB);
+
+/**
+ * @name Journal records
+ * Painting operations are recorded by their parameters instead of pixels.
+ * Every few operations a keyframe keeps the pre-chain pixels of the layers
+ * the chain touches; undo restores the keyframe and replays forward, redo
+ * replays the operation. Call these before performing the operation.
+ * @{
+ */
+
+/** @brief Open a stroke record; samples follow via historyAddStrokeDot/Line. */
+void historyBeginStroke(int layerIndex, BrushType brushType);
+
+/** @brief Record a drawBrushToLayer() call of the open stroke. */
+void historyAddStrokeDot(int x, int y, int size, u32 color);
+
+/** @brief Record a drawLineToLayer() call of the open stroke. */
+void historyAddStrokeLine(int x0, int y0, int x1, int y1, int size, u32 color);
+
+/** @brief Close the open stroke record. */
+void historyEndStroke(void);
+
+/** @brief Record a floodFill() tap (replayed against a fresh composite). */
+void pushFillHistory(int layerIndex, int x, int y, u32 color, int expand, int tolerancePct);
+
+/** @brief Record clearLayer(layerIndex, color). */
+void pushClearHistory(int layerIndex, u32 color);
+
+/** @brief Record mergeLayerDown(layerIndex). */
+void pushMergeDownHistory(int layerIndex);
+
+/** @} */
+
 bool canUndo(void);
 bool canRedo(void);
+
+/**
+ * @brief Undo the most recent applied record.
+ *
+ * Records older than the RAM window live in a log under SAVE_DIR. Undoing
+ * into them starts an asynchronous read-back; the undo itself is applied by
+ * updateHistory() once the record is in memory.
+ */
 void undo(void);
 void redo(void);
+
+/** @brief Per-frame hook: finish an undo whose record was read back from the SD card. */
+void updateHistory(void);
+
+/**
+ * @brief Check whether a spilled record is being read back.
+ * @param progress Receives 0..1 read progress while loading; may be NULL.
+ */
+bool historyIsLoading(float* progress);
+
+/**
+ * @brief Set the upper bound on bytes held by history snapshots.
+ *
+ * The budget in effect is the smaller of this value and what the heap can
+ * spare while leaving room for painting. Oldest records are evicted first.
+ */
+void historySetByteBudget(size_t bytes);
+
+/** @brief Get the configured history byte budget. */
+size_t historyGetByteBudget(void);
+
+/** @brief Read history memory usage and background compression throughput. */
+void getHistoryStats(HistoryStats* stats);
@@ -0,0 +1,128 @@
+#include "history_codec.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define CODEC_CHUNK_BYTES (64 * 1024)
+
+static bool isUniform(const uint32_t* pixels, size_t count) {
+    uint32_t first = pixels[0];
+    for (size_t i = 1; i < count; i++) {
+        if (pixels[i] != first) return false;
+    }
+    return true;
+}
+
+uint8_t* historyCodecCompress(const uint32_t* pixels, size_t count, size_t* outSize,
+                              volatile bool* cancel) {
+    if (!pixels || count == 0 || !outSize) return NULL;
+
+    if (isUniform(pixels, count)) {
+        uint8_t* out = (uint8_t*)malloc(1 + sizeof(uint32_t));
+        if (!out) return NULL;
+        out[0] = HISTORY_CODEC_UNIFORM;
+        memcpy(out + 1, &pixels[0], sizeof(uint32_t));
+        *outSize = 1 + sizeof(uint32_t);
+        return out;
+    }
+
+    size_t rawBytes = count * sizeof(uint32_t);
+    // Anything that does not shrink below 3/4 is not worth the decode cost.
+    size_t limit = rawBytes - rawBytes / 4;
+    size_t capacity = rawBytes / 16 + 64;
+    if (capacity > limit) capacity = limit;
+
+    uint8_t* out = (uint8_t*)malloc(capacity);
+    if (!out) return NULL;
+    out[0] = HISTORY_CODEC_DEFLATE;
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit(&zs, 1) != Z_OK) {
+        free(out);
+        return NULL;
+    }
+
+    const uint8_t* src = (const uint8_t*)pixels;
+    size_t consumed = 0;
+    size_t produced = 1;
+    bool ok = true;
+    int ret = Z_OK;
+
+    while (ret != Z_STREAM_END) {
+        if (cancel && *cancel) { ok = false; break; }
+
+        if (zs.avail_in == 0 && consumed < rawBytes) {
+            size_t chunk = rawBytes - consumed;
+            if (chunk > CODEC_CHUNK_BYTES) chunk = CODEC_CHUNK_BYTES;
+            zs.next_in = (Bytef*)(src + consumed);
+            zs.avail_in = (uInt)chunk;
+            consumed += chunk;
+        }
+
+        if (produced == capacity) {
+            if (capacity >= limit) { ok = false; break; }
+            size_t newCapacity = capacity * 2;
+            if (newCapacity > limit) newCapacity = limit;
+            uint8_t* grown = (uint8_t*)realloc(out, newCapacity);
+            if (!grown) { ok = false; break; }
+            out = grown;
+            capacity = newCapacity;
+        }
+
+        zs.next_out = out + produced;
+        zs.avail_out = (uInt)(capacity - produced);
+        ret = deflate(&zs, consumed == rawBytes ? Z_FINISH : Z_NO_FLUSH);
+        if (ret == Z_STREAM_ERROR) { ok = false; break; }
+        produced = capacity - zs.avail_out;
+    }
+
+    deflateEnd(&zs);
+
+    if (!ok) {
+        free(out);
+        return NULL;
+    }
+
+    uint8_t* shrunk = (uint8_t*)realloc(out, produced);
+    if (shrunk) out = shrunk;
+    *outSize = produced;
+    return out;
+}
+
+bool historyCodecDecompress(const uint8_t* packed, size_t packedSize, uint32_t* pixels, size_t count) {
+    if (!packed || packedSize < 1 || !pixels) return false;
+
+    if (packed[0] == HISTORY_CODEC_UNIFORM) {
+        if (packedSize != 1 + sizeof(uint32_t)) return false;
+        uint32_t value;
+        memcpy(&value, packed + 1, sizeof(uint32_t));
+        for (size_t i = 0; i < count; i++) {
+            pixels[i] = value;
+        }
+        return true;
+    }
+
+    if (packed[0] == HISTORY_CODEC_RAW) {
+        if (packedSize != 1 + count * sizeof(uint32_t)) return false;
+        memcpy(pixels, packed + 1, count * sizeof(uint32_t));
+        return true;
+    }
+
+    if (packed[0] != HISTORY_CODEC_DEFLATE) return false;
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit(&zs) != Z_OK) return false;
+
+    zs.next_in = (Bytef*)(packed + 1);
+    zs.avail_in = (uInt)(packedSize - 1);
+    zs.next_out = (Bytef*)pixels;
+    zs.avail_out = (uInt)(count * sizeof(uint32_t));
+
+    int ret = inflate(&zs, Z_FINISH);
+    bool ok = (ret == Z_STREAM_END && zs.avail_out == 0);
+    inflateEnd(&zs);
+    return ok;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file history_codec.h
+ * @brief Compression codec for history snapshots.
+ *
+ * Platform independent (depends only on zlib) so it can be built on a host.
+ * Packed format: one tag byte followed by the payload.
+ *  - HISTORY_CODEC_UNIFORM: a single 32-bit pixel repeated for the whole buffer.
+ *  - HISTORY_CODEC_DEFLATE: raw pixels as a zlib stream (level 1).
+ *  - HISTORY_CODEC_RAW: pixels stored as-is (used when spilling uncompressed snapshots).
+ */
+
+#define HISTORY_CODEC_UNIFORM 0
+#define HISTORY_CODEC_DEFLATE 1
+#define HISTORY_CODEC_RAW 2
+
+/**
+ * @brief Compress a pixel buffer.
+ * @param pixels Source pixels.
+ * @param count Number of pixels.
+ * @param outSize Receives the packed size in bytes.
+ * @param cancel Optional flag polled between chunks; compression aborts when it becomes true.
+ * @return malloc'd packed data, or NULL when cancelled, out of memory, or the data did not shrink.
+ */
+uint8_t* historyCodecCompress(const uint32_t* pixels, size_t count, size_t* outSize,
+                              volatile bool* cancel);
+
+/**
+ * @brief Decompress packed data produced by historyCodecCompress.
+ * @param packed Packed data.
+ * @param packedSize Packed size in bytes.
+ * @param pixels Destination pixels.
+ * @param count Number of pixels expected.
+ * @return true on success.
+ */
+bool historyCodecDecompress(const uint8_t* packed, size_t packedSize, uint32_t* pixels, size_t count);
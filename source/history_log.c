@@ -0,0 +1,270 @@
+#include "history_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define HISTORY_LOG_READ_CHUNK (32 * 1024)
+
+static void put32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool seekTo(FILE* f, uint64_t offset) {
+    return fseek(f, (long)offset, SEEK_SET) == 0;
+}
+
+static bool writeFileHeader(FILE* f, uint32_t magic) {
+    uint8_t header[HISTORY_LOG_FILE_HEADER_SIZE];
+    put32(header, magic);
+    put32(header + 4, HISTORY_LOG_VERSION);
+    return fwrite(header, 1, sizeof(header), f) == sizeof(header);
+}
+
+static bool checkFileHeader(FILE* f, uint32_t magic) {
+    uint8_t header[HISTORY_LOG_FILE_HEADER_SIZE];
+    if (!seekTo(f, 0)) return false;
+    if (fread(header, 1, sizeof(header), f) != sizeof(header)) return false;
+    return get32(header) == magic && get32(header + 4) == HISTORY_LOG_VERSION;
+}
+
+static bool writeIndexEntry(HistoryLog* log, uint32_t id, uint64_t offset, uint32_t size, uint32_t crc) {
+    uint8_t entry[HISTORY_LOG_INDEX_ENTRY_SIZE];
+    put32(entry, id);
+    put32(entry + 4, (uint32_t)offset);
+    put32(entry + 8, (uint32_t)(offset >> 32));
+    put32(entry + 12, size);
+    put32(entry + 16, crc);
+    if (fwrite(entry, 1, sizeof(entry), log->index) != sizeof(entry)) return false;
+    return fflush(log->index) == 0;
+}
+
+static bool reserveEntries(HistoryLog* log, uint32_t count) {
+    if (count <= log->capacity) return true;
+    uint32_t capacity = log->capacity ? log->capacity * 2 : 64;
+    while (capacity < count) capacity *= 2;
+    HistoryLogEntry* grown = (HistoryLogEntry*)realloc(log->entries, capacity * sizeof(HistoryLogEntry));
+    if (!grown) return false;
+    log->entries = grown;
+    log->capacity = capacity;
+    return true;
+}
+
+// Rebuild the in-memory index from an existing index file, keeping only
+// records whose header is intact in the data file.
+static void loadExistingIndex(HistoryLog* log) {
+    FILE* index = fopen(log->indexPath, "rb");
+    if (!index) return;
+    if (!checkFileHeader(index, HISTORY_LOG_INDEX_MAGIC)) {
+        fclose(index);
+        return;
+    }
+
+    uint8_t raw[HISTORY_LOG_INDEX_ENTRY_SIZE];
+    while (fread(raw, 1, sizeof(raw), index) == sizeof(raw)) {
+        uint32_t id = get32(raw);
+        uint32_t size = get32(raw + 12);
+        if (size == HISTORY_LOG_TRUNCATE_MARK) {
+            if (id < log->count) log->count = id;
+            continue;
+        }
+        if (id > log->count || !reserveEntries(log, id + 1)) break;
+        log->entries[id].offset = (uint64_t)get32(raw + 4) | ((uint64_t)get32(raw + 8) << 32);
+        log->entries[id].size = size;
+        log->entries[id].crc = get32(raw + 16);
+        log->count = id + 1;
+    }
+    fclose(index);
+
+    uint32_t valid = 0;
+    for (; valid < log->count; valid++) {
+        const HistoryLogEntry* entry = &log->entries[valid];
+        uint8_t header[HISTORY_LOG_RECORD_HEADER_SIZE];
+        if (!seekTo(log->data, entry->offset)) break;
+        if (fread(header, 1, sizeof(header), log->data) != sizeof(header)) break;
+        if (get32(header) != HISTORY_LOG_RECORD_MAGIC || get32(header + 4) != valid ||
+            get32(header + 8) != entry->size || get32(header + 12) != entry->crc) {
+            break;
+        }
+    }
+    log->count = valid;
+}
+
+bool historyLogOpen(HistoryLog* log, const char* dir, const char* name, bool truncate) {
+    if (!log || !dir || !name) return false;
+    memset(log, 0, sizeof(*log));
+    snprintf(log->dataPath, sizeof(log->dataPath), "%s/%s.log", dir, name);
+    snprintf(log->indexPath, sizeof(log->indexPath), "%s/%s.idx", dir, name);
+
+    log->data = truncate ? NULL : fopen(log->dataPath, "r+b");
+    if (log->data && !checkFileHeader(log->data, HISTORY_LOG_DATA_MAGIC)) {
+        fclose(log->data);
+        log->data = NULL;
+    }
+    if (log->data) {
+        loadExistingIndex(log);
+    } else {
+        log->data = fopen(log->dataPath, "w+b");
+        if (!log->data || !writeFileHeader(log->data, HISTORY_LOG_DATA_MAGIC)) {
+            historyLogClose(log, true);
+            return false;
+        }
+    }
+
+    log->writeOffset = HISTORY_LOG_FILE_HEADER_SIZE;
+    if (log->count > 0) {
+        const HistoryLogEntry* last = &log->entries[log->count - 1];
+        log->writeOffset = last->offset + HISTORY_LOG_RECORD_HEADER_SIZE + last->size;
+    }
+
+    // The index is rewritten compacted, which also drops any torn tail entry.
+    log->index = fopen(log->indexPath, "wb");
+    if (!log->index || !writeFileHeader(log->index, HISTORY_LOG_INDEX_MAGIC)) {
+        historyLogClose(log, true);
+        return false;
+    }
+    for (uint32_t i = 0; i < log->count; i++) {
+        const HistoryLogEntry* entry = &log->entries[i];
+        if (!writeIndexEntry(log, i, entry->offset, entry->size, entry->crc)) {
+            historyLogClose(log, true);
+            return false;
+        }
+    }
+    return true;
+}
+
+void historyLogClose(HistoryLog* log, bool removeFiles) {
+    if (!log) return;
+    if (log->data) fclose(log->data);
+    if (log->index) fclose(log->index);
+    if (removeFiles) {
+        if (log->dataPath[0]) remove(log->dataPath);
+        if (log->indexPath[0]) remove(log->indexPath);
+    }
+    free(log->entries);
+    memset(log, 0, sizeof(*log));
+}
+
+bool historyLogBeginRecord(HistoryLog* log) {
+    if (!log || !log->data || log->appending) return false;
+    if (!reserveEntries(log, log->count + 1)) return false;
+
+    log->appending = true;
+    log->appendFailed = false;
+    log->appendSize = 0;
+    log->appendCrc = crc32(0L, Z_NULL, 0);
+
+    // Placeholder header; size and crc are filled in by historyLogEndRecord.
+    uint8_t header[HISTORY_LOG_RECORD_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    if (!seekTo(log->data, log->writeOffset) ||
+        fwrite(header, 1, sizeof(header), log->data) != sizeof(header)) {
+        log->appendFailed = true;
+    }
+    return !log->appendFailed;
+}
+
+bool historyLogWrite(HistoryLog* log, const void* data, size_t size) {
+    if (!log || !log->appending) return false;
+    if (log->appendFailed) return false;
+    if (size == 0) return true;
+    if ((uint64_t)log->appendSize + size >= HISTORY_LOG_TRUNCATE_MARK ||
+        fwrite(data, 1, size, log->data) != size) {
+        log->appendFailed = true;
+        return false;
+    }
+    log->appendCrc = crc32(log->appendCrc, (const Bytef*)data, (uInt)size);
+    log->appendSize += (uint32_t)size;
+    return true;
+}
+
+bool historyLogEndRecord(HistoryLog* log, uint32_t* outId) {
+    if (!log || !log->appending) return false;
+    log->appending = false;
+    if (log->appendFailed) return false;
+
+    uint32_t id = log->count;
+    uint8_t header[HISTORY_LOG_RECORD_HEADER_SIZE];
+    put32(header, HISTORY_LOG_RECORD_MAGIC);
+    put32(header + 4, id);
+    put32(header + 8, log->appendSize);
+    put32(header + 12, log->appendCrc);
+    if (!seekTo(log->data, log->writeOffset) ||
+        fwrite(header, 1, sizeof(header), log->data) != sizeof(header) ||
+        fflush(log->data) != 0) {
+        return false;
+    }
+
+    // Data is flushed before it is indexed, so the index never points at a torn record.
+    if (!writeIndexEntry(log, id, log->writeOffset, log->appendSize, log->appendCrc)) {
+        return false;
+    }
+
+    log->entries[id].offset = log->writeOffset;
+    log->entries[id].size = log->appendSize;
+    log->entries[id].crc = log->appendCrc;
+    log->count++;
+    log->writeOffset += HISTORY_LOG_RECORD_HEADER_SIZE + log->appendSize;
+    if (outId) *outId = id;
+    return true;
+}
+
+uint32_t historyLogCount(const HistoryLog* log) {
+    return log ? log->count : 0;
+}
+
+size_t historyLogRecordSize(const HistoryLog* log, uint32_t id) {
+    if (!log || id >= log->count) return 0;
+    return log->entries[id].size;
+}
+
+bool historyLogRead(HistoryLog* log, uint32_t id, void* dst, size_t dstSize,
+                    HistoryLogProgressFunc progress, void* user, volatile bool* cancel) {
+    if (!log || !log->data || log->appending || id >= log->count || !dst) return false;
+    const HistoryLogEntry* entry = &log->entries[id];
+    if (dstSize < entry->size) return false;
+    if (!seekTo(log->data, entry->offset + HISTORY_LOG_RECORD_HEADER_SIZE)) return false;
+
+    uint8_t* out = (uint8_t*)dst;
+    size_t done = 0;
+    uint32_t crc = crc32(0L, Z_NULL, 0);
+    while (done < entry->size) {
+        if (cancel && *cancel) return false;
+        size_t chunk = entry->size - done;
+        if (chunk > HISTORY_LOG_READ_CHUNK) chunk = HISTORY_LOG_READ_CHUNK;
+        if (fread(out + done, 1, chunk, log->data) != chunk) return false;
+        crc = crc32(crc, out + done, (uInt)chunk);
+        done += chunk;
+        if (progress) progress(done, entry->size, user);
+    }
+    return crc == entry->crc;
+}
+
+// Shrink a file to size and leave its position there.
+static bool cutFile(FILE* f, uint64_t size) {
+    if (fflush(f) != 0 || ftruncate(fileno(f), (off_t)size) != 0) return false;
+    return seekTo(f, size);
+}
+
+bool historyLogTruncate(HistoryLog* log, uint32_t count) {
+    if (!log || !log->index || log->appending) return false;
+    if (count >= log->count) return true;
+
+    log->writeOffset = log->entries[count].offset;
+    log->count = count;
+
+    // Both files are cut back, so reading records back does not grow them.
+    // Trimming the data file is only a courtesy: the index decides what is live.
+    cutFile(log->data, log->writeOffset);
+    uint64_t indexSize = HISTORY_LOG_FILE_HEADER_SIZE + (uint64_t)count * HISTORY_LOG_INDEX_ENTRY_SIZE;
+    if (cutFile(log->index, indexSize)) return true;
+    return writeIndexEntry(log, count, 0, HISTORY_LOG_TRUNCATE_MARK, 0);
+}
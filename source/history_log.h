@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @file history_log.h
+ * @brief Append-only record log used to spill undo history to storage.
+ *
+ * Platform independent (stdio + zlib crc32) so it can be built on a host.
+ * A log is a pair of files in one directory:
+ *  - <name>.log: file header, then records (header + payload).
+ *  - <name>.idx: file header, then fixed-size index entries.
+ *
+ * Records are appended to both files; truncation cuts both files back to
+ * the last kept record, so a log never holds more than its live records.
+ * The index is the authority: where the file system cannot shrink a file,
+ * an index entry with size HISTORY_LOG_TRUNCATE_MARK is appended instead and
+ * drops every record with an id >= its id. Records are checked against their
+ * crc32 when read, and a reopened log keeps only the intact prefix.
+ *
+ * All multi-byte fields are little-endian.
+ */
+
+#define HISTORY_LOG_DATA_MAGIC 0x4C48474D   /**< "MGHL" */
+#define HISTORY_LOG_INDEX_MAGIC 0x4948474D  /**< "MGHI" */
+#define HISTORY_LOG_RECORD_MAGIC 0x52484C47 /**< "GLHR" */
+#define HISTORY_LOG_VERSION 1
+#define HISTORY_LOG_FILE_HEADER_SIZE 8      /**< magic + version */
+#define HISTORY_LOG_RECORD_HEADER_SIZE 16   /**< magic + id + size + crc */
+#define HISTORY_LOG_INDEX_ENTRY_SIZE 20     /**< id + offset(64) + size + crc */
+#define HISTORY_LOG_TRUNCATE_MARK 0xFFFFFFFFu
+
+/** @brief Location of one record in the data file. */
+typedef struct {
+    uint64_t offset;  /**< Offset of the record header. */
+    uint32_t size;    /**< Payload size in bytes. */
+    uint32_t crc;     /**< crc32 of the payload. */
+} HistoryLogEntry;
+
+/** @brief Open log state. Zero-initialize before first use. */
+typedef struct {
+    FILE* data;
+    FILE* index;
+    char dataPath[256];
+    char indexPath[256];
+    HistoryLogEntry* entries;
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t writeOffset;      /**< Where the next record goes. */
+    bool appending;
+    bool appendFailed;
+    uint32_t appendSize;
+    uint32_t appendCrc;
+} HistoryLog;
+
+/**
+ * @brief Progress callback for historyLogRead.
+ * @param done Payload bytes read so far.
+ * @param total Payload size.
+ */
+typedef void (*HistoryLogProgressFunc)(size_t done, size_t total, void* user);
+
+/**
+ * @brief Open a log in dir.
+ * @param truncate true to start empty, false to keep the intact records of an existing log.
+ * @return true on success.
+ */
+bool historyLogOpen(HistoryLog* log, const char* dir, const char* name, bool truncate);
+
+/** @brief Close the log, optionally deleting its files. */
+void historyLogClose(HistoryLog* log, bool removeFiles);
+
+/** @brief Start a record at the end of the log. */
+bool historyLogBeginRecord(HistoryLog* log);
+
+/** @brief Append payload bytes to the record in progress. */
+bool historyLogWrite(HistoryLog* log, const void* data, size_t size);
+
+/**
+ * @brief Finish the record in progress and index it.
+ * @param outId Receives the record id (its position in the log); may be NULL.
+ * @return false when any write failed; the record is then discarded.
+ */
+bool historyLogEndRecord(HistoryLog* log, uint32_t* outId);
+
+/** @brief Number of live records. */
+uint32_t historyLogCount(const HistoryLog* log);
+
+/** @brief Payload size of a record, or 0 when id is out of range. */
+size_t historyLogRecordSize(const HistoryLog* log, uint32_t id);
+
+/**
+ * @brief Read and verify a record payload.
+ * @param dst Destination, at least historyLogRecordSize() bytes.
+ * @param progress Optional progress callback, called after every chunk.
+ * @param cancel Optional flag polled between chunks.
+ * @return true when the whole payload was read and its crc matches.
+ */
+bool historyLogRead(HistoryLog* log, uint32_t id, void* dst, size_t dstSize,
+                    HistoryLogProgressFunc progress, void* user, volatile bool* cancel);
+
+/** @brief Drop every record with an id >= count, shrinking both files. */
+bool historyLogTruncate(HistoryLog* log, uint32_t count);
@@ -0,0 +1,239 @@
+#include "import.h"
+
+#include "canvas.h"
+#include "history.h"
+#include "layers.h"
+#include "worker.h"
+
+#include <3ds.h>
+#include <png.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static ImportStats lastImportStats;
+
+void getImportStats(ImportStats* stats) {
+    *stats = lastImportStats;
+}
+
+typedef struct {
+    png_structp png;
+    png_infop info;
+    int sourceWidth;
+    int sourceHeight;
+    int passes;                         // 7 for interlaced images
+    u32* layerBuffer;
+    int x;                              // Placement on the canvas
+    int y;
+    int width;
+    int height;
+
+    // Downscaling only
+    u32* row;                           // One decoded source row
+    int* columnMap;                     // Output column of each source column
+    u64* sums;                          // Alpha-weighted R, G, B per output column
+    u32* alphaSums;
+    u32* counts;
+} ImportContext;
+
+static void freeImportContext(ImportContext* ctx) {
+    png_destroy_read_struct(&ctx->png, &ctx->info, NULL);
+    free(ctx->row);
+    free(ctx->columnMap);
+    free(ctx->sums);
+    free(ctx->alphaSums);
+    free(ctx->counts);
+}
+
+// libpng reports errors by longjmp; the context lives in the caller so
+// nothing here needs to survive the jump.
+static bool readHeader(ImportContext* ctx, FILE* fp) {
+    if (setjmp(png_jmpbuf(ctx->png))) return false;
+
+    png_init_io(ctx->png, fp);
+    png_set_sig_bytes(ctx->png, 8);
+    png_read_info(ctx->png, ctx->info);
+    ctx->sourceWidth = png_get_image_width(ctx->png, ctx->info);
+    ctx->sourceHeight = png_get_image_height(ctx->png, ctx->info);
+
+    // Whatever the source format, rows arrive as 8-bit RGBA...
+    png_set_expand(ctx->png);
+#ifdef PNG_READ_SCALE_16_TO_8_SUPPORTED
+    png_set_scale_16(ctx->png);
+#else
+    png_set_strip_16(ctx->png);
+#endif
+    png_set_gray_to_rgb(ctx->png);
+    // ...in the byte order A, B, G, R: layer pixels are little-endian
+    // 0xRRGGBBAA words, so a decoded row is a row of layer pixels. libpng
+    // adds filler after swapping alpha, so opaque sources get it in front.
+    png_set_bgr(ctx->png);
+    int colorType = png_get_color_type(ctx->png, ctx->info);
+    if ((colorType & PNG_COLOR_MASK_ALPHA) || png_get_valid(ctx->png, ctx->info, PNG_INFO_tRNS)) {
+        png_set_swap_alpha(ctx->png);
+    } else {
+        png_set_add_alpha(ctx->png, 0xFF, PNG_FILLER_BEFORE);
+    }
+    ctx->passes = png_set_interlace_handling(ctx->png);
+    png_read_update_info(ctx->png, ctx->info);
+    return true;
+}
+
+// Centre the image, shrunk to fit (keeping the aspect ratio) when it is
+// larger than the canvas.
+static void placeImage(ImportContext* ctx) {
+    u64 sourceWidth = ctx->sourceWidth;
+    u64 sourceHeight = ctx->sourceHeight;
+    ctx->width = ctx->sourceWidth;
+    ctx->height = ctx->sourceHeight;
+    if (ctx->width > CANVAS_WIDTH || ctx->height > CANVAS_HEIGHT) {
+        if (sourceWidth * CANVAS_HEIGHT > sourceHeight * CANVAS_WIDTH) {
+            ctx->width = CANVAS_WIDTH;
+            ctx->height = (int)(sourceHeight * CANVAS_WIDTH / sourceWidth);
+        } else {
+            ctx->height = CANVAS_HEIGHT;
+            ctx->width = (int)(sourceWidth * CANVAS_HEIGHT / sourceHeight);
+        }
+        if (ctx->width < 1) ctx->width = 1;
+        if (ctx->height < 1) ctx->height = 1;
+    }
+    ctx->x = (CANVAS_WIDTH - ctx->width) / 2;
+    ctx->y = (CANVAS_HEIGHT - ctx->height) / 2;
+}
+
+static bool allocBoxFilter(ImportContext* ctx) {
+    ctx->row = (u32*)malloc(ctx->sourceWidth * sizeof(u32));
+    ctx->columnMap = (int*)malloc(ctx->sourceWidth * sizeof(int));
+    ctx->sums = (u64*)calloc(ctx->width * 3, sizeof(u64));
+    ctx->alphaSums = (u32*)calloc(ctx->width, sizeof(u32));
+    ctx->counts = (u32*)calloc(ctx->width, sizeof(u32));
+    if (!ctx->row || !ctx->columnMap || !ctx->sums || !ctx->alphaSums || !ctx->counts) return false;
+    for (int x = 0; x < ctx->sourceWidth; x++) {
+        ctx->columnMap[x] = (int)((u64)x * ctx->width / ctx->sourceWidth);
+    }
+    return true;
+}
+
+// Each source pixel lands in exactly one output pixel; colour is averaged
+// weighted by alpha so transparent pixels do not darken the edges.
+static void accumulateRow(ImportContext* ctx) {
+    for (int x = 0; x < ctx->sourceWidth; x++) {
+        u32 pixel = ctx->row[x];
+        int column = ctx->columnMap[x];
+        u32 alpha = pixel & 0xFF;
+        ctx->sums[column * 3 + 0] += (u64)((pixel >> 24) & 0xFF) * alpha;
+        ctx->sums[column * 3 + 1] += (u64)((pixel >> 16) & 0xFF) * alpha;
+        ctx->sums[column * 3 + 2] += (u64)((pixel >> 8) & 0xFF) * alpha;
+        ctx->alphaSums[column] += alpha;
+        ctx->counts[column]++;
+    }
+}
+
+static void flushOutputRow(ImportContext* ctx, int outputRow) {
+    u32* out = &ctx->layerBuffer[(ctx->y + outputRow) * LAYER_STRIDE + ctx->x];
+    for (int x = 0; x < ctx->width; x++) {
+        u32 alphaSum = ctx->alphaSums[x];
+        u32 pixel = 0;
+        if (alphaSum > 0 && ctx->counts[x] > 0) {
+            u32 r = (u32)((ctx->sums[x * 3 + 0] + alphaSum / 2) / alphaSum);
+            u32 g = (u32)((ctx->sums[x * 3 + 1] + alphaSum / 2) / alphaSum);
+            u32 b = (u32)((ctx->sums[x * 3 + 2] + alphaSum / 2) / alphaSum);
+            u32 a = (alphaSum + ctx->counts[x] / 2) / ctx->counts[x];
+            pixel = (r << 24) | (g << 16) | (b << 8) | a;
+        }
+        out[x] = pixel;
+    }
+    memset(ctx->sums, 0, ctx->width * 3 * sizeof(u64));
+    memset(ctx->alphaSums, 0, ctx->width * sizeof(u32));
+    memset(ctx->counts, 0, ctx->width * sizeof(u32));
+}
+
+static bool decodeRows(ImportContext* ctx) {
+    if (setjmp(png_jmpbuf(ctx->png))) return false;
+
+    if (!ctx->row) {
+        // Same size: decode into the layer rows, once per interlace pass.
+        for (int pass = 0; pass < ctx->passes; pass++) {
+            for (int y = 0; y < ctx->sourceHeight; y++) {
+                u32* out = &ctx->layerBuffer[(ctx->y + y) * LAYER_STRIDE + ctx->x];
+                png_read_row(ctx->png, (png_bytep)out, NULL);
+            }
+        }
+        return true;
+    }
+
+    int outputRow = 0;
+    for (int y = 0; y < ctx->sourceHeight; y++) {
+        png_read_row(ctx->png, (png_bytep)ctx->row, NULL);
+        int rowFor = (int)((u64)y * ctx->height / ctx->sourceHeight);
+        if (rowFor != outputRow) {
+            flushOutputRow(ctx, outputRow);
+            outputRow = rowFor;
+        }
+        accumulateRow(ctx);
+    }
+    flushOutputRow(ctx, outputRow);
+    return true;
+}
+
+bool importPNGToLayer(const char* filePath, int layerIndex) {
+    if (layerIndex < 0 || layerIndex >= numLayers || !layers[layerIndex].buffer) return false;
+    u64 start = svcGetSystemTick();
+
+    FILE* fp = fopen(filePath, "rb");
+    if (!fp) return false;
+    u8 signature[8];
+    if (fread(signature, 1, sizeof(signature), fp) != sizeof(signature) ||
+        png_sig_cmp(signature, 0, sizeof(signature)) != 0) {
+        fclose(fp);
+        return false;
+    }
+
+    ImportContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    ctx.info = ctx.png ? png_create_info_struct(ctx.png) : NULL;
+    bool ok = ctx.info && readHeader(&ctx, fp) && ctx.sourceWidth > 0 && ctx.sourceHeight > 0;
+    bool downscale = false;
+    if (ok) {
+        placeImage(&ctx);
+        downscale = ctx.width != ctx.sourceWidth || ctx.height != ctx.sourceHeight;
+        // A shrunk interlaced image would need every pass at once.
+        ok = !downscale || (ctx.passes == 1 && allocBoxFilter(&ctx));
+    }
+    // The normal history path: snapshot the layer, then replace its pixels.
+    // Without a snapshot a failed decode could not be put back.
+    ok = ok && pushLayerHistory(layerIndex);
+    if (!ok) {
+        freeImportContext(&ctx);
+        fclose(fp);
+        return false;
+    }
+
+    clearLayer(layerIndex, 0x00000000);
+    ctx.layerBuffer = layers[layerIndex].buffer;
+    ok = decodeRows(&ctx);
+    markLayerDirtyFull(layerIndex);
+    markCanvasDirtyFull();
+
+    freeImportContext(&ctx);
+    fclose(fp);
+    if (!ok) {
+        // Put the layer back as it was, leaving nothing to redo.
+        revertLastHistory();
+        return false;
+    }
+    projectHasUnsavedChanges = true;
+
+    lastImportStats.valid = true;
+    lastImportStats.sourceWidth = ctx.sourceWidth;
+    lastImportStats.sourceHeight = ctx.sourceHeight;
+    lastImportStats.x = ctx.x;
+    lastImportStats.y = ctx.y;
+    lastImportStats.width = ctx.width;
+    lastImportStats.height = ctx.height;
+    lastImportStats.downscaled = downscale;
+    lastImportStats.ms = workerTicksToMs(svcGetSystemTick() - start);
+    return true;
+}
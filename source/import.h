@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "app_state.h"
+
+/**
+ * @file import.h
+ * @brief PNG import into a layer.
+ */
+
+#define IMPORT_DIR SAVE_DIR "/imports"
+
+/** @brief Sizes and timing of the most recent import. */
+typedef struct {
+    bool valid;               /**< false until an import has completed. */
+    int sourceWidth;
+    int sourceHeight;
+    int x;                    /**< Placement on the canvas. */
+    int y;
+    int width;
+    int height;
+    bool downscaled;
+    float ms;
+} ImportStats;
+
+/**
+ * @brief Replace a layer's pixels with a PNG image, centred on the canvas.
+ *
+ * Rows are decoded one at a time with libpng, converted to RGBA on the fly
+ * (palette, grayscale, 16-bit and missing alpha) and written straight into
+ * the layer. Images larger than the canvas are shrunk to fit with a
+ * streaming box filter that keeps one accumulator row, never the full image
+ * (interlaced images must fit as they are). The layer is recorded in history
+ * first, so the import is one undo step; a decoding error midway restores
+ * the layer and drops that record, leaving nothing to redo.
+ *
+ * @return true on success, false if the file is not a readable PNG or the
+ *         layer could not be recorded in history.
+ */
+bool importPNGToLayer(const char* filePath, int layerIndex);
+
+/** @brief Statistics of the last successful import. */
+void getImportStats(ImportStats* stats);
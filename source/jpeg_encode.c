@@ -0,0 +1,412 @@
+#include "jpeg_encode.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define JPEG_MCU_SIZE 16
+
+//---------------------------------------------------------------------------
+// Tables
+//---------------------------------------------------------------------------
+
+// Natural (row-major) index of each coefficient in zig-zag order.
+static const uint8_t zigzagOrder[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// Annex K.1 quantization tables for quality 50, natural order.
+static const uint8_t baseQuantizers[2][64] = {
+    {
+        16, 11, 10, 16,  24,  40,  51,  61,
+        12, 12, 14, 19,  26,  58,  60,  55,
+        14, 13, 16, 24,  40,  57,  69,  56,
+        14, 17, 22, 29,  51,  87,  80,  62,
+        18, 22, 37, 56,  68, 109, 103,  77,
+        24, 35, 55, 64,  81, 104, 113,  92,
+        49, 64, 78, 87, 103, 121, 120, 101,
+        72, 92, 95, 98, 112, 100, 103,  99,
+    },
+    {
+        17, 18, 24, 47, 99, 99, 99, 99,
+        18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99,
+        47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+    },
+};
+
+// The AAN DCT leaves coefficient (u, v) multiplied by 8 * aanScale[u] *
+// aanScale[v], with aanScale[0] = 1 and aanScale[k] = cos(k * pi / 16) * sqrt(2).
+static const double aanScale[8] = {
+    1.0, 1.387039845, 1.306562965, 1.175875602,
+    1.0, 0.785694958, 0.541196100, 0.275899379,
+};
+
+// Annex K.3 Huffman tables: code counts per length 1-16, then the symbols.
+static const uint8_t dcLumaBits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t dcChromaBits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t dcValues[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const uint8_t acLumaBits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D};
+static const uint8_t acLumaValues[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+    0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+    0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+    0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+    0xF9, 0xFA,
+};
+
+static const uint8_t acChromaBits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t acChromaValues[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+    0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+    0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+    0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+    0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+    0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+    0xF9, 0xFA,
+};
+
+// Canonical codes from the code counts (Annex C).
+static void buildHuffmanCodes(const uint8_t* bits, const uint8_t* values, JpegHuffmanCodes* codes) {
+    memset(codes, 0, sizeof(*codes));
+    int code = 0;
+    int k = 0;
+    for (int length = 1; length <= 16; length++) {
+        for (int i = 0; i < bits[length - 1]; i++) {
+            codes->code[values[k]] = (uint16_t)code;
+            codes->size[values[k]] = (uint8_t)length;
+            k++;
+            code++;
+        }
+        code <<= 1;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Output
+//---------------------------------------------------------------------------
+
+static void flushOutput(JpegEncoder* encoder) {
+    if (encoder->ok && encoder->outCount > 0 &&
+        fwrite(encoder->out, 1, encoder->outCount, encoder->fp) != (size_t)encoder->outCount) {
+        encoder->ok = false;
+    }
+    encoder->outCount = 0;
+}
+
+static void putByte(JpegEncoder* encoder, uint8_t value) {
+    if (encoder->outCount == JPEG_ENCODE_OUT_SIZE) flushOutput(encoder);
+    encoder->out[encoder->outCount++] = value;
+}
+
+static void putWord(JpegEncoder* encoder, uint16_t value) {
+    putByte(encoder, (uint8_t)(value >> 8));
+    putByte(encoder, (uint8_t)value);
+}
+
+// Entropy-coded bits, MSB first; a 0xFF byte is followed by a stuffed 0.
+static void putBits(JpegEncoder* encoder, uint32_t bits, int count) {
+    encoder->bitBuffer = (encoder->bitBuffer << count) | (bits & ((1u << count) - 1));
+    encoder->bitCount += count;
+    while (encoder->bitCount >= 8) {
+        encoder->bitCount -= 8;
+        uint8_t byte = (uint8_t)(encoder->bitBuffer >> encoder->bitCount);
+        putByte(encoder, byte);
+        if (byte == 0xFF) putByte(encoder, 0);
+    }
+    encoder->bitBuffer &= (1u << encoder->bitCount) - 1;
+}
+
+static void writeHuffmanTable(JpegEncoder* encoder, int classAndId, const uint8_t* bits, const uint8_t* values) {
+    int count = 0;
+    for (int i = 0; i < 16; i++) count += bits[i];
+    putByte(encoder, (uint8_t)classAndId);
+    for (int i = 0; i < 16; i++) putByte(encoder, bits[i]);
+    for (int i = 0; i < count; i++) putByte(encoder, values[i]);
+}
+
+static void writeHeaders(JpegEncoder* encoder, const uint8_t quantizers[2][64]) {
+    putWord(encoder, 0xFFD8);                       // SOI
+
+    static const uint8_t jfif[14] = {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+    putWord(encoder, 0xFFE0);                       // APP0
+    putWord(encoder, 2 + sizeof(jfif));
+    for (size_t i = 0; i < sizeof(jfif); i++) putByte(encoder, jfif[i]);
+
+    putWord(encoder, 0xFFDB);                       // DQT, both tables
+    putWord(encoder, 2 + 2 * 65);
+    for (int table = 0; table < 2; table++) {
+        putByte(encoder, (uint8_t)table);
+        for (int i = 0; i < 64; i++) putByte(encoder, quantizers[table][zigzagOrder[i]]);
+    }
+
+    putWord(encoder, 0xFFC0);                       // SOF0: Y 2x2, Cb and Cr 1x1
+    putWord(encoder, 8 + 3 * 3);
+    putByte(encoder, 8);
+    putWord(encoder, (uint16_t)encoder->height);
+    putWord(encoder, (uint16_t)encoder->width);
+    putByte(encoder, 3);
+    static const uint8_t components[9] = {1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1};
+    for (int i = 0; i < 9; i++) putByte(encoder, components[i]);
+
+    putWord(encoder, 0xFFC4);                       // DHT, all four tables
+    putWord(encoder, 2 + 4 * 17 + 2 * 12 + 2 * 162);
+    writeHuffmanTable(encoder, 0x00, dcLumaBits, dcValues);
+    writeHuffmanTable(encoder, 0x10, acLumaBits, acLumaValues);
+    writeHuffmanTable(encoder, 0x01, dcChromaBits, dcValues);
+    writeHuffmanTable(encoder, 0x11, acChromaBits, acChromaValues);
+
+    putWord(encoder, 0xFFDA);                       // SOS
+    putWord(encoder, 6 + 2 * 3);
+    putByte(encoder, 3);
+    static const uint8_t scan[6] = {1, 0x00, 2, 0x11, 3, 0x11};
+    for (int i = 0; i < 6; i++) putByte(encoder, scan[i]);
+    putByte(encoder, 0);                            // Spectral selection 0-63
+    putByte(encoder, 63);
+    putByte(encoder, 0);
+}
+
+//---------------------------------------------------------------------------
+// Blocks
+//---------------------------------------------------------------------------
+
+#define DCT_CONST_BITS 13
+#define DCT_FIX_0_382683433 3135
+#define DCT_FIX_0_541196100 4433
+#define DCT_FIX_0_707106781 5793
+#define DCT_FIX_1_306562965 10703
+#define DCT_MULTIPLY(value, constant) \
+    (((value) * (constant) + (1 << (DCT_CONST_BITS - 1))) >> DCT_CONST_BITS)
+
+// One 8-point AAN pass over data[0], data[stride], ... data[7 * stride].
+static void dctPass(int32_t* data, int stride) {
+    int32_t tmp0 = data[0 * stride] + data[7 * stride];
+    int32_t tmp7 = data[0 * stride] - data[7 * stride];
+    int32_t tmp1 = data[1 * stride] + data[6 * stride];
+    int32_t tmp6 = data[1 * stride] - data[6 * stride];
+    int32_t tmp2 = data[2 * stride] + data[5 * stride];
+    int32_t tmp5 = data[2 * stride] - data[5 * stride];
+    int32_t tmp3 = data[3 * stride] + data[4 * stride];
+    int32_t tmp4 = data[3 * stride] - data[4 * stride];
+
+    // Even part
+    int32_t tmp10 = tmp0 + tmp3;
+    int32_t tmp13 = tmp0 - tmp3;
+    int32_t tmp11 = tmp1 + tmp2;
+    int32_t tmp12 = tmp1 - tmp2;
+    data[0 * stride] = tmp10 + tmp11;
+    data[4 * stride] = tmp10 - tmp11;
+    int32_t z1 = DCT_MULTIPLY(tmp12 + tmp13, DCT_FIX_0_707106781);
+    data[2 * stride] = tmp13 + z1;
+    data[6 * stride] = tmp13 - z1;
+
+    // Odd part
+    tmp10 = tmp4 + tmp5;
+    tmp11 = tmp5 + tmp6;
+    tmp12 = tmp6 + tmp7;
+    int32_t z5 = DCT_MULTIPLY(tmp10 - tmp12, DCT_FIX_0_382683433);
+    int32_t z2 = DCT_MULTIPLY(tmp10, DCT_FIX_0_541196100) + z5;
+    int32_t z4 = DCT_MULTIPLY(tmp12, DCT_FIX_1_306562965) + z5;
+    int32_t z3 = DCT_MULTIPLY(tmp11, DCT_FIX_0_707106781);
+    int32_t z11 = tmp7 + z3;
+    int32_t z13 = tmp7 - z3;
+    data[5 * stride] = z13 + z2;
+    data[3 * stride] = z13 - z2;
+    data[1 * stride] = z11 + z4;
+    data[7 * stride] = z11 - z4;
+}
+
+static int bitLength(uint32_t value) {
+    return value ? 32 - __builtin_clz(value) : 0;
+}
+
+// DCT, quantize and Huffman code one block of level-shifted samples.
+static void encodeBlock(JpegEncoder* encoder, int32_t* block, int component) {
+    int table = component == 0 ? 0 : 1;
+    for (int i = 0; i < 8; i++) dctPass(&block[i * 8], 1);
+    for (int i = 0; i < 8; i++) dctPass(&block[i], 8);
+
+    const uint32_t* reciprocals = encoder->reciprocals[table];
+    int32_t quantized[64];
+    for (int i = 0; i < 64; i++) {
+        int natural = zigzagOrder[i];
+        int32_t value = block[natural];
+        uint32_t magnitude = (uint32_t)(value < 0 ? -value : value);
+        int32_t level = (int32_t)(((uint64_t)magnitude * reciprocals[natural] + (1u << 23)) >> 24);
+        if (level > 1023) level = 1023;
+        quantized[i] = value < 0 ? -level : level;
+    }
+
+    // A negative value is sent as its ones' complement in the low bits.
+    int32_t diff = quantized[0] - encoder->lastDc[component];
+    encoder->lastDc[component] = quantized[0];
+    int size = bitLength((uint32_t)(diff < 0 ? -diff : diff));
+    const JpegHuffmanCodes* dc = &encoder->dc[table];
+    putBits(encoder, dc->code[size], dc->size[size]);
+    if (size) putBits(encoder, (uint32_t)(diff < 0 ? diff - 1 : diff), size);
+
+    const JpegHuffmanCodes* ac = &encoder->ac[table];
+    int run = 0;
+    for (int i = 1; i < 64; i++) {
+        int32_t value = quantized[i];
+        if (value == 0) {
+            run++;
+            continue;
+        }
+        while (run > 15) {
+            putBits(encoder, ac->code[0xF0], ac->size[0xF0]);     // ZRL: 16 zeros
+            run -= 16;
+        }
+        size = bitLength((uint32_t)(value < 0 ? -value : value));
+        int symbol = (run << 4) | size;
+        putBits(encoder, ac->code[symbol], ac->size[symbol]);
+        putBits(encoder, (uint32_t)(value < 0 ? value - 1 : value), size);
+        run = 0;
+    }
+    if (run > 0) putBits(encoder, ac->code[0x00], ac->size[0x00]);  // EOB
+}
+
+// Four luma blocks and one 2x2-averaged block of each chroma plane per MCU.
+static void encodeMcuRow(JpegEncoder* encoder) {
+    int stride = encoder->paddedWidth;
+    size_t planeSize = (size_t)stride * JPEG_MCU_SIZE;
+    const uint8_t* luma = encoder->planes;
+    int32_t block[64];
+
+    for (int mcuX = 0; mcuX < stride; mcuX += JPEG_MCU_SIZE) {
+        for (int b = 0; b < 4; b++) {
+            const uint8_t* source = &luma[(b >> 1) * 8 * stride + mcuX + (b & 1) * 8];
+            for (int y = 0; y < 8; y++) {
+                for (int x = 0; x < 8; x++) block[y * 8 + x] = source[y * stride + x] - 128;
+            }
+            encodeBlock(encoder, block, 0);
+        }
+        for (int component = 1; component < 3; component++) {
+            const uint8_t* source = &encoder->planes[component * planeSize + mcuX];
+            for (int y = 0; y < 8; y++) {
+                const uint8_t* top = &source[y * 2 * stride];
+                const uint8_t* bottom = top + stride;
+                for (int x = 0; x < 8; x++) {
+                    int sum = top[x * 2] + top[x * 2 + 1] + bottom[x * 2] + bottom[x * 2 + 1];
+                    block[y * 8 + x] = ((sum + 2) >> 2) - 128;
+                }
+            }
+            encodeBlock(encoder, block, component);
+        }
+    }
+    encoder->rowsEncoded += JPEG_MCU_SIZE;
+    encoder->rowsBuffered = 0;
+}
+
+//---------------------------------------------------------------------------
+// Encoder
+//---------------------------------------------------------------------------
+
+bool jpegEncodeBegin(JpegEncoder* encoder, FILE* fp, int width, int height, int quality) {
+    memset(encoder, 0, sizeof(*encoder));
+    if (width < 1 || height < 1 || width > JPEG_ENCODE_MAX_SIZE || height > JPEG_ENCODE_MAX_SIZE) return false;
+    encoder->fp = fp;
+    encoder->width = width;
+    encoder->height = height;
+    encoder->paddedWidth = (width + JPEG_MCU_SIZE - 1) / JPEG_MCU_SIZE * JPEG_MCU_SIZE;
+    encoder->planes = (uint8_t*)malloc((size_t)encoder->paddedWidth * JPEG_MCU_SIZE * 3);
+    if (!encoder->planes) return false;
+    encoder->ok = true;
+
+    // libjpeg's quality scaling of the Annex K tables.
+    if (quality < 1) quality = 1;
+    if (quality > 100) quality = 100;
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    uint8_t quantizers[2][64];
+    for (int table = 0; table < 2; table++) {
+        for (int i = 0; i < 64; i++) {
+            int value = (baseQuantizers[table][i] * scale + 50) / 100;
+            if (value < 1) value = 1;
+            if (value > 255) value = 255;
+            quantizers[table][i] = (uint8_t)value;
+            double divisor = value * aanScale[i / 8] * aanScale[i % 8] * 8.0;
+            encoder->reciprocals[table][i] = (uint32_t)(16777216.0 / divisor + 0.5);
+        }
+    }
+    buildHuffmanCodes(dcLumaBits, dcValues, &encoder->dc[0]);
+    buildHuffmanCodes(dcChromaBits, dcValues, &encoder->dc[1]);
+    buildHuffmanCodes(acLumaBits, acLumaValues, &encoder->ac[0]);
+    buildHuffmanCodes(acChromaBits, acChromaValues, &encoder->ac[1]);
+
+    writeHeaders(encoder, quantizers);
+    return encoder->ok;
+}
+
+bool jpegEncodeRow(JpegEncoder* encoder, const uint8_t* rgba) {
+    if (!encoder->ok || encoder->rowsEncoded + encoder->rowsBuffered >= encoder->height) return false;
+    int stride = encoder->paddedWidth;
+    size_t planeSize = (size_t)stride * JPEG_MCU_SIZE;
+    uint8_t* luma = &encoder->planes[encoder->rowsBuffered * stride];
+    uint8_t* blue = luma + planeSize;
+    uint8_t* red = blue + planeSize;
+
+    // BT.601 full range, 16-bit fixed point.
+    for (int x = 0; x < encoder->width; x++) {
+        int32_t r = rgba[x * 4];
+        int32_t g = rgba[x * 4 + 1];
+        int32_t b = rgba[x * 4 + 2];
+        luma[x] = (uint8_t)((19595 * r + 38470 * g + 7471 * b + 32768) >> 16);
+        blue[x] = (uint8_t)((-11059 * r - 21709 * g + 32768 * b + (128 << 16) + 32767) >> 16);
+        red[x] = (uint8_t)((32768 * r - 27439 * g - 5329 * b + (128 << 16) + 32767) >> 16);
+    }
+    // Partial MCUs repeat the edge pixel.
+    for (int x = encoder->width; x < stride; x++) {
+        luma[x] = luma[x - 1];
+        blue[x] = blue[x - 1];
+        red[x] = red[x - 1];
+    }
+
+    if (++encoder->rowsBuffered == JPEG_MCU_SIZE) encodeMcuRow(encoder);
+    return encoder->ok;
+}
+
+bool jpegEncodeEnd(JpegEncoder* encoder) {
+    if (!encoder->ok) return false;
+    if (encoder->rowsEncoded + encoder->rowsBuffered != encoder->height) {
+        encoder->ok = false;
+        return false;
+    }
+    if (encoder->rowsBuffered > 0) {
+        // The last partial MCU row repeats the bottom row.
+        int stride = encoder->paddedWidth;
+        size_t planeSize = (size_t)stride * JPEG_MCU_SIZE;
+        for (int component = 0; component < 3; component++) {
+            uint8_t* plane = &encoder->planes[component * planeSize];
+            const uint8_t* last = &plane[(encoder->rowsBuffered - 1) * stride];
+            for (int y = encoder->rowsBuffered; y < JPEG_MCU_SIZE; y++) memcpy(&plane[y * stride], last, stride);
+        }
+        encodeMcuRow(encoder);
+    }
+    // Fill the last byte with one bits.
+    if (encoder->bitCount > 0) putBits(encoder, 0x7F, 8 - encoder->bitCount);
+    putWord(encoder, 0xFFD9);                       // EOI
+    flushOutput(encoder);
+    return encoder->ok;
+}
+
+void jpegEncodeFree(JpegEncoder* encoder) {
+    free(encoder->planes);
+    encoder->planes = NULL;
+}
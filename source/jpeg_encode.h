@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @file jpeg_encode.h
+ * @brief Streaming baseline JPEG encoder.
+ *
+ * Platform independent (stdio only) so it can be built on a host.
+ *
+ * Writes a JFIF file with YCbCr 4:2:0 subsampling, the quality-scaled
+ * quantization tables and the standard Huffman tables of the JPEG spec
+ * (Annex K). The forward DCT is the fixed-point AAN one, its scale factors
+ * folded into the quantizer reciprocals. Rows are fed one at a time; only
+ * one row of 16x16 MCUs is buffered, so memory stays at 48 bytes per pixel
+ * of width.
+ */
+
+#define JPEG_ENCODE_MAX_SIZE 65535
+#define JPEG_ENCODE_OUT_SIZE 4096
+
+typedef struct {
+    uint16_t code[256];
+    uint8_t size[256];
+} JpegHuffmanCodes;
+
+typedef struct {
+    FILE* fp;
+    int width;
+    int height;
+    int paddedWidth;                    /**< width rounded up to whole MCUs. */
+    uint8_t* planes;                    /**< Y, Cb and Cr of one MCU row, paddedWidth x 16 each. */
+    int rowsBuffered;
+    int rowsEncoded;
+    uint32_t reciprocals[2][64];        /**< Luma / chroma quantizers, 2^24 / scaled divisor, natural order. */
+    JpegHuffmanCodes dc[2];
+    JpegHuffmanCodes ac[2];
+    int lastDc[3];                      /**< DC prediction per component. */
+    uint32_t bitBuffer;
+    int bitCount;
+    uint8_t out[JPEG_ENCODE_OUT_SIZE];
+    int outCount;
+    bool ok;                            /**< false after any failed write; later calls do nothing. */
+} JpegEncoder;
+
+/**
+ * @brief Write the headers and allocate the MCU row.
+ * @param quality 1 (smallest) to 100 (best), scaled like libjpeg.
+ */
+bool jpegEncodeBegin(JpegEncoder* encoder, FILE* fp, int width, int height, int quality);
+
+/** @brief Add the next row: width pixels of R, G, B, A bytes (alpha is ignored). */
+bool jpegEncodeRow(JpegEncoder* encoder, const uint8_t* rgba);
+
+/** @brief Encode the last partial MCU row and write the end marker. The caller closes fp. */
+bool jpegEncodeEnd(JpegEncoder* encoder);
+
+/** @brief Release the MCU row (after End, or instead of it on failure). */
+void jpegEncodeFree(JpegEncoder* encoder);
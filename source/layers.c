@@ -5,19 +5,156 @@
 #include <string.h>
 
 #include "blend.h"
-#include "util.h"
+#include "canvas.h"
+#include "history.h"
+#include "memory.h"
+#include "project_format.h"
+#include "project_stream.h"
+
+static u32* tileGenerations = NULL;   // MAX_LAYERS * tileGenerationCount
+static int tileGenerationCount = 0;   // Tiles per layer
+static int tileGenerationCols = 0;
+static u32 layerGeneration = 0;
+
+// Content bounds of one tile in tile coordinates, valid while generation
+// matches the tile's; minX > maxX marks a fully transparent tile.
+typedef struct {
+    u32 generation;
+    s8 minX, minY, maxX, maxY;
+} TileContent;
+
+static TileContent* tileContents = NULL;   // Parallel to tileGenerations
+
+// Size the tile generation table for the current canvas; every tile starts out modified.
+static void resetTileGenerations(void) {
+    free(tileGenerations);
+    tileGenerationCols = (CANVAS_WIDTH + PROJECT_TILE_SIZE - 1) / PROJECT_TILE_SIZE;
+    tileGenerationCount = projectTileCount(CANVAS_WIDTH, CANVAS_HEIGHT, PROJECT_TILE_SIZE);
+    tileGenerations = (u32*)memAlloc(MAX_LAYERS * tileGenerationCount * sizeof(u32));
+    // Generation 0 is never a tile's, so every entry starts out stale.
+    free(tileContents);
+    tileContents = (TileContent*)memCalloc(MAX_LAYERS * tileGenerationCount, sizeof(TileContent));
+
+    layerGeneration++;
+    if (tileGenerations) {
+        for (int i = 0; i < MAX_LAYERS * tileGenerationCount; i++) {
+            tileGenerations[i] = layerGeneration;
+        }
+    }
+}
 
-void initLayers(void) {
-    texWidth = nextPowerOf2(canvasWidth);
-    texHeight = nextPowerOf2(canvasHeight);
+void markLayerTilesDirty(int layerIndex, int minX, int minY, int maxX, int maxY) {
+    if (layerIndex < 0 || layerIndex >= MAX_LAYERS || !tileGenerations) return;
+    if (minX < 0) minX = 0;
+    if (minY < 0) minY = 0;
+    if (maxX >= CANVAS_WIDTH) maxX = CANVAS_WIDTH - 1;
+    if (maxY >= CANVAS_HEIGHT) maxY = CANVAS_HEIGHT - 1;
+    if (minX > maxX || minY > maxY) return;
+
+    layerGeneration++;
+    u32* gens = &tileGenerations[layerIndex * tileGenerationCount];
+    for (int ty = minY / PROJECT_TILE_SIZE; ty <= maxY / PROJECT_TILE_SIZE; ty++) {
+        for (int tx = minX / PROJECT_TILE_SIZE; tx <= maxX / PROJECT_TILE_SIZE; tx++) {
+            gens[ty * tileGenerationCols + tx] = layerGeneration;
+        }
+    }
+}
+
+void markLayerDirtyFull(int layerIndex) {
+    markLayerTilesDirty(layerIndex, 0, 0, CANVAS_WIDTH - 1, CANVAS_HEIGHT - 1);
+}
+
+u32 getLayerGeneration(void) {
+    return layerGeneration;
+}
+
+u32 getLayerTileGeneration(int layerIndex, int tileIndex) {
+    // Without a table every tile counts as modified.
+    if (!tileGenerations || layerIndex < 0 || layerIndex >= MAX_LAYERS ||
+        tileIndex < 0 || tileIndex >= tileGenerationCount) {
+        return layerGeneration;
+    }
+    return tileGenerations[layerIndex * tileGenerationCount + tileIndex];
+}
 
-    size_t bufferSize = TEX_WIDTH * TEX_HEIGHT * sizeof(u32);
+static void scanTileContent(const u32* buffer, int tileX, int tileY, TileContent* content) {
+    int x0 = tileX * PROJECT_TILE_SIZE;
+    int y0 = tileY * PROJECT_TILE_SIZE;
+    int w = CANVAS_WIDTH - x0 < PROJECT_TILE_SIZE ? CANVAS_WIDTH - x0 : PROJECT_TILE_SIZE;
+    int h = CANVAS_HEIGHT - y0 < PROJECT_TILE_SIZE ? CANVAS_HEIGHT - y0 : PROJECT_TILE_SIZE;
+
+    int minX = w, minY = h, maxX = -1, maxY = -1;
+    for (int y = 0; y < h; y++) {
+        const u32* row = &buffer[(y0 + y) * LAYER_STRIDE + x0];
+        int first = 0;
+        while (first < w && (row[first] & 0xFF) == 0) first++;
+        if (first == w) continue;
+        int last = w - 1;
+        while ((row[last] & 0xFF) == 0) last--;
+
+        if (first < minX) minX = first;
+        if (last > maxX) maxX = last;
+        if (minY > y) minY = y;
+        maxY = y;
+    }
+    content->minX = (s8)minX;
+    content->minY = (s8)minY;
+    content->maxX = (s8)maxX;
+    content->maxY = (s8)maxY;
+}
 
-    compositeBuffer = (u32*)linearAlloc(bufferSize);
-    if (!compositeBuffer) return;
+bool getLayerContentBounds(int layerIndex, int* minX, int* minY, int* maxX, int* maxY) {
+    if (layerIndex < 0 || layerIndex >= MAX_LAYERS || !layers[layerIndex].buffer) return false;
+    // Tiles still streaming in are not tracked by generation.
+    projectStreamWaitLayers(1u << layerIndex);
+
+    int tileRows = (CANVAS_HEIGHT + PROJECT_TILE_SIZE - 1) / PROJECT_TILE_SIZE;
+    int tileCols = (CANVAS_WIDTH + PROJECT_TILE_SIZE - 1) / PROJECT_TILE_SIZE;
+    int boundsMinX = CANVAS_WIDTH, boundsMinY = CANVAS_HEIGHT, boundsMaxX = -1, boundsMaxY = -1;
+    for (int ty = 0; ty < tileRows; ty++) {
+        for (int tx = 0; tx < tileCols; tx++) {
+            int tileIndex = ty * tileCols + tx;
+            TileContent scratch = {0};
+            TileContent* content = tileContents ? &tileContents[layerIndex * tileGenerationCount + tileIndex]
+                                                : &scratch;
+            u32 generation = getLayerTileGeneration(layerIndex, tileIndex);
+            if (!tileContents || content->generation != generation) {
+                scanTileContent(layers[layerIndex].buffer, tx, ty, content);
+                content->generation = generation;
+            }
+            if (content->minX > content->maxX) continue;
+
+            int x0 = tx * PROJECT_TILE_SIZE;
+            int y0 = ty * PROJECT_TILE_SIZE;
+            if (x0 + content->minX < boundsMinX) boundsMinX = x0 + content->minX;
+            if (y0 + content->minY < boundsMinY) boundsMinY = y0 + content->minY;
+            if (x0 + content->maxX > boundsMaxX) boundsMaxX = x0 + content->maxX;
+            if (y0 + content->maxY > boundsMaxY) boundsMaxY = y0 + content->maxY;
+        }
+    }
+    if (boundsMaxX < 0) return false;
 
+    *minX = boundsMinX;
+    *minY = boundsMinY;
+    *maxX = boundsMaxX;
+    *maxY = boundsMaxY;
+    return true;
+}
+
+void swapLayers(int indexA, int indexB) {
+    // A streaming load writes into the buffer at each stack position.
+    projectStreamWaitLayers((1u << indexA) | (1u << indexB));
+    Layer temp = layers[indexA];
+    layers[indexA] = layers[indexB];
+    layers[indexB] = temp;
+    // Saved tiles belong to a stack position, so both positions changed.
+    markLayerDirtyFull(indexA);
+    markLayerDirtyFull(indexB);
+}
+
+void initLayers(void) {
     for (int i = 0; i < MAX_LAYERS; i++) {
-        layers[i].buffer = (u32*)malloc(bufferSize);
+        layers[i].buffer = (u32*)memAlloc(LAYER_BUFFER_SIZE);
         layers[i].visible = true;
         layers[i].opacity = 255;
         layers[i].blendMode = BLEND_NORMAL;
@@ -26,33 +163,16 @@ void initLayers(void) {
         layers[i].clipping = false;
 
         if (layers[i].buffer) {
-            u32 clearColor = 0x00000000;
-            for (int y = 0; y < TEX_HEIGHT; y++) {
-                for (int x = 0; x < TEX_WIDTH; x++) {
-                    layers[i].buffer[y * TEX_WIDTH + x] = clearColor;
-                }
-            }
+            memset(layers[i].buffer, 0, LAYER_BUFFER_SIZE);
         }
     }
 
-    C3D_TexInit(&canvasTex, TEX_WIDTH, TEX_HEIGHT, GPU_RGBA8);
-    C3D_TexSetFilter(&canvasTex, GPU_LINEAR, GPU_LINEAR);
-    C3D_TexSetWrap(&canvasTex, GPU_CLAMP_TO_EDGE, GPU_CLAMP_TO_EDGE);
-
-    canvasSubTex.width = CANVAS_WIDTH;
-    canvasSubTex.height = CANVAS_HEIGHT;
-    canvasSubTex.left = 0.0f;
-    canvasSubTex.top = (float)CANVAS_HEIGHT / TEX_HEIGHT;
-    canvasSubTex.right = (float)CANVAS_WIDTH / TEX_WIDTH;
-    canvasSubTex.bottom = 0.0f;
-
-    canvasImage.tex = &canvasTex;
-    canvasImage.subtex = &canvasSubTex;
-
-    compositeAllLayers();
+    resetTileGenerations();
+    markCanvasDirtyFull();
 }
 
 void resetLayersForNewProject(void) {
+    projectStreamCancel();
     for (int i = 0; i < MAX_LAYERS; i++) {
         layers[i].visible = true;
         layers[i].opacity = 255;
@@ -62,64 +182,61 @@ void resetLayersForNewProject(void) {
         snprintf(layers[i].name, sizeof(layers[i].name), "Layer %d", i + 1);
 
         if (layers[i].buffer) {
-            u32 clearColor = 0x00000000;
-            for (int y = 0; y < TEX_HEIGHT; y++) {
-                for (int x = 0; x < TEX_WIDTH; x++) {
-                    layers[i].buffer[y * TEX_WIDTH + x] = clearColor;
-                }
-            }
+            memset(layers[i].buffer, 0, LAYER_BUFFER_SIZE);
         }
     }
     currentLayerIndex = 0;
+    resetTileGenerations();
 }
 
 void applyCanvasSize(int width, int height) {
+    projectStreamCancel();
+    bool sizeChanged = width != canvasWidth || height != canvasHeight;
     canvasWidth = width;
     canvasHeight = height;
 
-    int newTexW = nextPowerOf2(width);
-    int newTexH = nextPowerOf2(height);
-
-    if (newTexW != texWidth || newTexH != texHeight) {
-        texWidth = newTexW;
-        texHeight = newTexH;
-        size_t bufferSize = TEX_WIDTH * TEX_HEIGHT * sizeof(u32);
-
-        if (compositeBuffer) {
-            linearFree(compositeBuffer);
-        }
-        compositeBuffer = (u32*)linearAlloc(bufferSize);
-
+    // Layers follow the canvas size exactly; a new size means new buffers.
+    if (sizeChanged) {
         for (int i = 0; i < MAX_LAYERS; i++) {
             if (layers[i].buffer) {
                 free(layers[i].buffer);
             }
-            layers[i].buffer = (u32*)malloc(bufferSize);
+            layers[i].buffer = (u32*)memAlloc(LAYER_BUFFER_SIZE);
             if (layers[i].buffer) {
-                memset(layers[i].buffer, 0, bufferSize);
+                memset(layers[i].buffer, 0, LAYER_BUFFER_SIZE);
             }
         }
-
-        C3D_TexDelete(&canvasTex);
-        C3D_TexInit(&canvasTex, TEX_WIDTH, TEX_HEIGHT, GPU_RGBA8);
-        C3D_TexSetFilter(&canvasTex, GPU_LINEAR, GPU_LINEAR);
-        C3D_TexSetWrap(&canvasTex, GPU_CLAMP_TO_EDGE, GPU_CLAMP_TO_EDGE);
     }
 
-    canvasSubTex.width = canvasWidth;
-    canvasSubTex.height = canvasHeight;
-    canvasSubTex.left = 0.0f;
-    canvasSubTex.top = (float)canvasHeight / TEX_HEIGHT;
-    canvasSubTex.right = (float)canvasWidth / TEX_WIDTH;
-    canvasSubTex.bottom = 0.0f;
+    // The display tiles sample the old grid.
+    if (sizeChanged) resetCanvasDisplay();
 
-    canvasImage.tex = &canvasTex;
-    canvasImage.subtex = &canvasSubTex;
+    resetTileGenerations();
+    markCanvasDirtyFull();
+}
+
+bool canvasSizeFits(int width, int height) {
+    if (width <= 0 || width > MAX_CANVAS_DIM || height <= 0 || height > MAX_CANVAS_DIM) return false;
 
-    canvasNeedsUpdate = true;
+    // The current layers and the undo history are given back for the new size.
+    size_t available = memGetFreeBytes();
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        if (layers[i].buffer) available += LAYER_BUFFER_SIZE;
+    }
+    HistoryStats history;
+    getHistoryStats(&history);
+    available += history.rawBytes + history.packedBytes;
+
+    // Layers, plus a stroke's backup and alpha map, plus a fill's one-bit
+    // region mask, plus room to work in.
+    size_t pixels = (size_t)width * (size_t)height;
+    size_t needed = pixels * sizeof(u32) * (MAX_LAYERS + 1) + pixels + pixels / 8 + CANVAS_MEMORY_HEADROOM;
+    return needed <= available;
 }
 
 void exitLayers(void) {
+    projectStreamCancel();
+    resetCanvasDisplay();
     for (int i = 0; i < MAX_LAYERS; i++) {
         if (layers[i].buffer) {
             free(layers[i].buffer);
@@ -127,59 +244,62 @@ void exitLayers(void) {
         }
     }
 
-    if (compositeBuffer) {
-        linearFree(compositeBuffer);
-        compositeBuffer = NULL;
-    }
-
-    C3D_TexDelete(&canvasTex);
+    free(tileGenerations);
+    tileGenerations = NULL;
+    free(tileContents);
+    tileContents = NULL;
+    tileGenerationCount = 0;
 }
 
 void clearLayer(int layerIndex, u32 color) {
     projectHasUnsavedChanges = true;
     if (layerIndex < 0 || layerIndex >= MAX_LAYERS) return;
     if (!layers[layerIndex].buffer) return;
+    projectStreamWaitLayers(1u << layerIndex);
 
-    for (int y = 0; y < TEX_HEIGHT; y++) {
-        for (int x = 0; x < TEX_WIDTH; x++) {
-            layers[layerIndex].buffer[y * TEX_WIDTH + x] = color;
-        }
+    u32* buffer = layers[layerIndex].buffer;
+    size_t count = (size_t)CANVAS_WIDTH * CANVAS_HEIGHT;
+    for (size_t i = 0; i < count; i++) {
+        buffer[i] = color;
     }
+    markLayerDirtyFull(layerIndex);
 }
 
-void compositeAllLayers(void) {
-    if (!compositeBuffer) return;
-
-    int minX = 0;
-    int minY = 0;
-    int maxX = CANVAS_WIDTH - 1;
-    int maxY = CANVAS_HEIGHT - 1;
-    if (canvasDirtyValid) {
-        minX = canvasDirtyMinX;
-        minY = canvasDirtyMinY;
-        maxX = canvasDirtyMaxX;
-        maxY = canvasDirtyMaxY;
-
-        if (minX < 0) minX = 0;
-        if (minY < 0) minY = 0;
-        if (maxX >= CANVAS_WIDTH) maxX = CANVAS_WIDTH - 1;
-        if (maxY >= CANVAS_HEIGHT) maxY = CANVAS_HEIGHT - 1;
-        if (minX > maxX || minY > maxY) return;
+void mergeLayerDown(int layerIndex) {
+    if (layerIndex <= 0 || layerIndex >= MAX_LAYERS) return;
+    int srcIdx = layerIndex;
+    int dstIdx = layerIndex - 1;
+    if (!layers[srcIdx].buffer || !layers[dstIdx].buffer) return;
+    projectHasUnsavedChanges = true;
+    projectStreamWaitLayers((1u << srcIdx) | (1u << dstIdx));
+
+    for (int y = 0; y < CANVAS_HEIGHT; y++) {
+        for (int x = 0; x < CANVAS_WIDTH; x++) {
+            int idx = y * LAYER_STRIDE + x;
+            u32 srcColor = layers[srcIdx].buffer[idx];
+            u32 dstColor = layers[dstIdx].buffer[idx];
+            layers[dstIdx].buffer[idx] = blendPixel(dstColor, srcColor, BLEND_NORMAL, 255);
+        }
     }
+    markLayerDirtyFull(dstIdx);
+    clearLayer(srcIdx, 0x00000000);
+}
 
-    int firstVisibleLayer = -1;
+// Composite over white for the canvas pixels at columns[i], rows[j]; NULL
+// tables stand for the contiguous run starting at minX / minY.
+static void compositeSamples(u32* dst, int dstStride, const int* columns, int minX, int width,
+                             const int* rows, int minY, int height) {
     int visibleCount = 0;
     for (int i = 0; i < numLayers; i++) {
         if (layers[i].visible && layers[i].buffer && layers[i].opacity > 0) {
-            if (firstVisibleLayer < 0) firstVisibleLayer = i;
             visibleCount++;
         }
     }
 
-    for (int y = minY; y <= maxY; y++) {
-        int rowStart = y * TEX_WIDTH;
-        for (int x = minX; x <= maxX; x++) {
-            compositeBuffer[rowStart + x] = 0xFFFFFFFF;
+    for (int j = 0; j < height; j++) {
+        u32* out = &dst[j * dstStride];
+        for (int x = 0; x < width; x++) {
+            out[x] = 0xFFFFFFFF;
         }
     }
 
@@ -197,10 +317,12 @@ void compositeAllLayers(void) {
         bool isClipped = layers[i].clipping && i > 0 && layers[i - 1].buffer;
         u32* clipBuf = isClipped ? layers[i - 1].buffer : NULL;
 
-        for (int y = minY; y <= maxY; y++) {
-            int rowStart = y * TEX_WIDTH;
-            for (int x = minX; x <= maxX; x++) {
-                int idx = rowStart + x;
+        for (int j = 0; j < height; j++) {
+            int y = rows ? rows[j] : minY + j;
+            int rowStart = y * LAYER_STRIDE;
+            u32* out = &dst[j * dstStride];
+            for (int k = 0; k < width; k++) {
+                int idx = rowStart + (columns ? columns[k] : minX + k);
                 u32 src = layerBuf[idx];
 
                 u8 srcA = src & 0xFF;
@@ -214,9 +336,16 @@ void compositeAllLayers(void) {
                     src = (src & 0xFFFFFF00) | srcA;
                 }
 
-                u32 dst = compositeBuffer[idx];
-                compositeBuffer[idx] = blendPixel(dst, src, blendMode, layerOpacity);
+                out[k] = blendPixel(out[k], src, blendMode, layerOpacity);
             }
         }
     }
 }
+
+void compositeLayerRect(u32* dst, int dstStride, int minX, int minY, int maxX, int maxY) {
+    compositeSamples(dst, dstStride, NULL, minX, maxX - minX + 1, NULL, minY, maxY - minY + 1);
+}
+
+void compositeLayerSamples(u32* dst, int dstStride, const int* columns, int width, const int* rows, int height) {
+    compositeSamples(dst, dstStride, columns, 0, width, rows, 0, height);
+}
@@ -11,5 +11,72 @@ void initLayers(void);
 void exitLayers(void);
 void resetLayersForNewProject(void);
 void applyCanvasSize(int width, int height);
+
+/** @brief Heap kept free beyond the layers when checking a canvas size (undo, fills, saving). */
+#define CANVAS_MEMORY_HEADROOM (4 * 1024 * 1024)
+
+/**
+ * @brief Check whether a canvas of this size can be allocated.
+ *
+ * Counts the heap that applyCanvasSize would have after dropping the current
+ * layers and the undo history, against MAX_LAYERS layers plus the stroke
+ * buffers, the fill mask and CANVAS_MEMORY_HEADROOM.
+ */
+bool canvasSizeFits(int width, int height);
+
 void clearLayer(int layerIndex, u32 color);
-void compositeAllLayers(void);
+
+/** @brief Blend a layer onto the one below (normal, full opacity) and clear it. */
+void mergeLayerDown(int layerIndex);
+
+/**
+ * @brief Composite the visible layers over white for a canvas rectangle (inclusive).
+ *
+ * dst receives pixel (minX, minY) at index 0, rows dstStride pixels apart.
+ * Export composites strips of rows with it; the flood fill composites single
+ * rows into its row cache.
+ */
+void compositeLayerRect(u32* dst, int dstStride, int minX, int minY, int maxX, int maxY);
+
+/**
+ * @brief Composite the visible layers over white at a grid of canvas pixels.
+ *
+ * dst[j * dstStride + i] receives pixel (columns[i], rows[j]). The display
+ * tiles use it to sample the canvas at their level of detail, the project
+ * thumbnail to shrink it.
+ */
+void compositeLayerSamples(u32* dst, int dstStride, const int* columns, int width, const int* rows, int height);
+
+/** @brief Swap two layers in the stack (fields and pixels). */
+void swapLayers(int indexA, int indexB);
+
+/**
+ * @name Tile generations
+ * Each PROJECT_TILE_SIZE tile of each layer remembers the generation at which
+ * its pixels last changed. Code that writes layer pixels marks the touched
+ * area; incremental saves rewrite only tiles newer than the last save.
+ * @{
+ */
+
+/** @brief Mark the tiles overlapping a canvas rectangle (inclusive) as modified. */
+void markLayerTilesDirty(int layerIndex, int minX, int minY, int maxX, int maxY);
+
+/** @brief Mark every tile of a layer as modified. */
+void markLayerDirtyFull(int layerIndex);
+
+/** @brief Generation of the most recent modification of any tile. */
+u32 getLayerGeneration(void);
+
+/** @brief Generation at which a tile last changed. */
+u32 getLayerTileGeneration(int layerIndex, int tileIndex);
+
+/**
+ * @brief Bounding box (inclusive) of a layer's non-transparent pixels.
+ *
+ * Per-tile bounds are cached against the tile generations, so only tiles
+ * modified since the previous call are scanned again.
+ * @return false if the layer has no such pixels.
+ */
+bool getLayerContentBounds(int layerIndex, int* minX, int* minY, int* maxX, int* maxY);
+
+/** @} */
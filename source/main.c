@@ -7,15 +7,18 @@
 #include <string.h>
 
 #include "app_state.h"
-#include "blend.h"
+#include "autosave.h"
 #include "brush.h"
 #include "canvas.h"
 #include "color_utils.h"
 #include "export.h"
 #include "history.h"
+#include "import.h"
 #include "layers.h"
 #include "preview.h"
+#include "project_index.h"
 #include "project_io.h"
+#include "project_stream.h"
 #include "ui_components.h"
 #include "ui_screens.h"
 #include "ui_theme.h"
@@ -32,6 +35,15 @@ static int getDrawingUpdateInterval(void) {
     return UPDATE_INTERVAL_DRAWING;
 }
 
+// End the stroke in progress (if any) so its history record matches what was drawn.
+static void finishStroke(void) {
+    if (isDrawing) {
+        endStroke();
+        historyEndStroke();
+    }
+    isDrawing = false;
+}
+
 //---------------------------------------------------------------------------------
 // Main function
 //---------------------------------------------------------------------------------
@@ -64,12 +76,36 @@ int main(int argc, char* argv[]) {
     // Initialize history system
     initHistory();
 
+    // Start the autosave worker
+    initAutosave();
+
+    // Start the browser preview loader
+    initPreviewLoader();
+
     // Initialize color palette
     initPalette();
 
     // Initialize HSV from current color
     rgbToHsv(currentColor, &currentHue, &currentSaturation, &currentValue);
 
+    // Offer to restore work that was autosaved but never saved
+    char recoveredName[PROJECT_NAME_MAX];
+    char recoveredPath[256];
+    if (findNewestAutosave(recoveredName, recoveredPath, sizeof(recoveredPath))) {
+        char message[96];
+        snprintf(message, sizeof(message), "Restore unsaved work on\n\"%s\"?", recoveredName);
+        if (showConfirmDialog(topScreen, bottomScreen, "Recover Autosave", message) &&
+            loadRecoveredProject(recoveredPath, recoveredName)) {
+            if (strcmp(recoveredName, AUTOSAVE_UNNAMED) == 0) {
+                currentProjectName[0] = '\0';
+                projectHasName = false;
+            }
+            currentMode = MODE_DRAW;
+        } else {
+            remove(recoveredPath);
+        }
+    }
+
     // Initialize frame time for FPS calculation
     lastFrameTime = osGetTime();
 
@@ -89,6 +125,15 @@ int main(int argc, char* argv[]) {
         u32 kHeld = hidKeysHeld();
         u32 kUp = hidKeysUp();
 
+        // Finish an undo that had to read its record back from the SD card
+        updateHistory();
+
+        // Show tiles a progressive load decoded in the background
+        updateProjectStream();
+
+        // Collect a finished autosave, start the next one when due
+        updateAutosave(isDrawing);
+
         // START: exit on home/new/open/settings, quick save elsewhere
         if (kDown & KEY_START) {
             if (currentMode == MODE_HOME ||
@@ -138,7 +183,7 @@ int main(int argc, char* argv[]) {
                     openSelectedIndex = -1;
                     openListScrollY = 0;
                     openListDragging = false;
-                    openPreviewValid = false;
+                    selectOpenPreview(-1);
                     currentMode = MODE_OPEN;
                 }
 
@@ -251,6 +296,9 @@ int main(int argc, char* argv[]) {
                             // Show error dialog
                             showDialog(topScreen, bottomScreen, "Project Exists",
                                       "A project with this name\nalready exists.");
+                        } else if (!canvasSizeFits(newProjectWidth, newProjectHeight)) {
+                            showDialog(topScreen, bottomScreen, "Canvas Too Large",
+                                      "Not enough memory for\na canvas this size.");
                         } else {
                             strncpy(currentProjectName, newProjectName, PROJECT_NAME_MAX);
                             currentProjectName[PROJECT_NAME_MAX - 1] = '\0';
@@ -337,38 +385,37 @@ int main(int argc, char* argv[]) {
                     if (touchedIndex >= 0 && touchedIndex < openProjectCount) {
                         if (openSelectedIndex != touchedIndex) {
                             openSelectedIndex = touchedIndex;
-                            openPreviewValid = false;  // プレビューを無効化
-
-                            // "Loading..." 表示のために1フレームレンダリング
-                            C3D_FrameBegin(C3D_FRAME_SYNCDRAW);
-                            C2D_TargetClear(topScreen, C2D_Color32(0x2A, 0x2A, 0x2A, 0xFF));
-                            C2D_SceneBegin(topScreen);
-                            // "Loading..." テキストを中央に表示
-                            C2D_TextBufClear(g_textBuf);
-                            C2D_Text text;
-                            C2D_TextParse(&text, g_textBuf, "Loading...");
-                            C2D_TextOptimize(&text);
-                            float tw, th;
-                            C2D_TextGetDimensions(&text, 0.7f, 0.7f, &tw, &th);
-                            C2D_DrawText(&text, C2D_WithColor, (TOP_SCREEN_WIDTH - tw) / 2, (TOP_SCREEN_HEIGHT - th) / 2, 0, 0.7f, 0.7f, UI_COLOR_WHITE);
-                            renderOpenMenu(bottomScreen);
-                            C3D_FrameEnd(0);
-
-                            // プレビュー読み込み
-                            loadProjectPreview(openProjectNames[openSelectedIndex]);
+                            selectOpenPreview(openSelectedIndex);
                         }
                     }
                 }
                 // Check Open button
-                else if (releaseX >= SAVE_EXIT_BTN_X && releaseX < SAVE_EXIT_BTN_X + SAVE_EXIT_BTN_WIDTH &&
+                else if (releaseX >= SAVE_EXIT_BTN_X && releaseX < SAVE_EXIT_BTN_X + OPEN_BTN_WIDTH &&
                          releaseY >= SAVE_EXIT_BTN_Y && releaseY < SAVE_EXIT_BTN_Y + SAVE_EXIT_BTN_HEIGHT) {
                     if (openSelectedIndex >= 0 && openSelectedIndex < openProjectCount) {
-                        if (loadProject(openProjectNames[openSelectedIndex])) {
+                        if (loadProject(openProjects[openSelectedIndex].name)) {
                             freeOpenPreview();
                             currentMode = MODE_DRAW;
                         }
                     }
                 }
+                // Check Sort button: toggle date/name, keeping the selection
+                else if (releaseX >= OPEN_SORT_BTN_X && releaseX < OPEN_SORT_BTN_X + OPEN_SORT_BTN_WIDTH &&
+                         releaseY >= SAVE_EXIT_BTN_Y && releaseY < SAVE_EXIT_BTN_Y + SAVE_EXIT_BTN_HEIGHT) {
+                    char selectedName[PROJECT_NAME_MAX] = "";
+                    if (openSelectedIndex >= 0 && openSelectedIndex < openProjectCount) {
+                        memcpy(selectedName, openProjects[openSelectedIndex].name, PROJECT_NAME_MAX);
+                    }
+                    sortOpenProjects(openSortMode == OPEN_SORT_DATE ? OPEN_SORT_NAME : OPEN_SORT_DATE);
+                    for (int i = 0; i < openProjectCount; i++) {
+                        if (selectedName[0] != '\0' && strcmp(openProjects[i].name, selectedName) == 0) {
+                            openSelectedIndex = i;
+                            break;
+                        }
+                    }
+                    selectOpenPreview(openSelectedIndex);
+                    openListScrollY = 0;
+                }
                 // Check Back button
                 else if (releaseX >= MENU_BTN_X && releaseX < MENU_BTN_X + MENU_BTN_SIZE &&
                          releaseY >= MENU_BTN_Y && releaseY < MENU_BTN_Y + MENU_BTN_SIZE) {
@@ -379,12 +426,29 @@ int main(int argc, char* argv[]) {
                 openListDragging = false;
             }
 
+            // D-Pad steps through the list; neighbours are prefetched
+            if ((kDown & (KEY_DUP | KEY_DDOWN)) && openProjectCount > 0) {
+                int step = (kDown & KEY_DDOWN) ? 1 : -1;
+                int index = openSelectedIndex < 0 ? 0 : openSelectedIndex + step;
+                if (index < 0) index = 0;
+                if (index >= openProjectCount) index = openProjectCount - 1;
+                openSelectedIndex = index;
+                selectOpenPreview(openSelectedIndex);
+
+                float itemTop = index * itemHeight;
+                if (itemTop < openListScrollY) openListScrollY = itemTop;
+                if (itemTop + itemHeight > openListScrollY + listHeight) openListScrollY = itemTop + itemHeight - listHeight;
+            }
+
             // B button goes back
             if (kDown & KEY_B) {
                 freeOpenPreview();
                 currentMode = MODE_HOME;
             }
 
+            // Pick up decoded previews and start the next one
+            updateOpenPreview();
+
             // Render frame
             C3D_FrameBegin(C3D_FRAME_SYNCDRAW);
             // Top screen: show preview if available
@@ -399,6 +463,14 @@ int main(int argc, char* argv[]) {
                 float drawX = (TOP_SCREEN_WIDTH - drawW) / 2;
                 float drawY = (TOP_SCREEN_HEIGHT - drawH) / 2;
                 C2D_DrawImageAt(openPreviewImage, drawX, drawY, 0, NULL, scale, scale);
+            } else if (openPreviewIsLoading()) {
+                C2D_TextBufClear(g_textBuf);
+                C2D_Text text;
+                C2D_TextParse(&text, g_textBuf, "Loading...");
+                C2D_TextOptimize(&text);
+                float tw, th;
+                C2D_TextGetDimensions(&text, 0.7f, 0.7f, &tw, &th);
+                C2D_DrawText(&text, C2D_WithColor, (TOP_SCREEN_WIDTH - tw) / 2, (TOP_SCREEN_HEIGHT - th) / 2, 0, 0.7f, 0.7f, UI_COLOR_WHITE);
             }
             renderOpenMenu(bottomScreen);
             C3D_FrameEnd(0);
@@ -410,7 +482,7 @@ int main(int argc, char* argv[]) {
             if (kDown & KEY_DUP) {
                 currentMode = MODE_MENU;
                 currentMenuTab = TAB_TOOL;
-                isDrawing = false;
+                finishStroke();
             }
 
             // Undo with D-Pad Left
@@ -496,7 +568,7 @@ int main(int argc, char* argv[]) {
                     isPanning = false;
                 }
 
-                isDrawing = false;
+                finishStroke();
             } else {
                 // Normal drawing mode
                 isPanning = false;
@@ -519,23 +591,19 @@ int main(int argc, char* argv[]) {
 
                         if (currentTool == TOOL_FILL) {
                             // Fill tool: flood fill on tap
-                            pushHistory();
-
-                            // Update composite buffer first to get current canvas state
-                            forceUpdateCanvasTexture();
-
-                            // Get fill color
                             u8 r = (currentColor >> 24) & 0xFF;
                             u8 g = (currentColor >> 16) & 0xFF;
                             u8 b = (currentColor >> 8) & 0xFF;
                             u32 fillColor = (r << 24) | (g << 16) | (b << 8) | brushAlpha;
+                            pushFillHistory(currentLayerIndex, drawX, drawY, fillColor, fillExpand, fillTolerance);
 
                             floodFill(currentLayerIndex, drawX, drawY, fillColor, fillExpand, fillTolerance);
                             markCanvasDirtyFull();
                             isDrawing = false;  // No dragging for fill tool
                         } else {
                             // Brush/Eraser tool: start drawing
-                            pushHistory();
+                            BrushType brushType = brushDefs[currentBrushType].type;
+                            historyBeginStroke(currentLayerIndex, brushType);
 
                             // Initialize last position for smooth line drawing
                             lastCanvasX = canvasX;
@@ -543,7 +611,7 @@ int main(int argc, char* argv[]) {
                             isDrawing = true;
 
                             // Start new stroke (for G-Pen pressure)
-                            startStroke(currentLayerIndex);
+                            startStroke(currentLayerIndex, brushType);
 
                             // Draw initial point
                             u32 drawColor;
@@ -559,6 +627,7 @@ int main(int argc, char* argv[]) {
                             }
                             int brushSize = getCurrentBrushSize();
                             drawBrushToLayer(currentLayerIndex, drawX, drawY, brushSize, drawColor);
+                            historyAddStrokeDot(drawX, drawY, brushSize, drawColor);
                             markCanvasDirtyRect(drawX - brushSize - 1,
                                                 drawY - brushSize - 1,
                                                 drawX + brushSize + 1,
@@ -601,6 +670,7 @@ int main(int argc, char* argv[]) {
                         // Draw line from last position to current position
                         int brushSize = getCurrentBrushSize();
                         drawLineToLayer(currentLayerIndex, lastDrawX, lastDrawY, drawX, drawY, brushSize, drawColor);
+                        historyAddStrokeLine(lastDrawX, lastDrawY, drawX, drawY, brushSize, drawColor);
                         int minX = (drawX < lastDrawX) ? drawX : lastDrawX;
                         int minY = (drawY < lastDrawY) ? drawY : lastDrawY;
                         int maxX = (drawX > lastDrawX) ? drawX : lastDrawX;
@@ -612,16 +682,13 @@ int main(int argc, char* argv[]) {
                         lastCanvasX = canvasX;
                         lastCanvasY = canvasY;
                     } else {
-                        isDrawing = false;
+                        finishStroke();
                     }
                 }
 
                 // Reset drawing state when touch is released
                 if (kUp & KEY_TOUCH) {
-                    if (isDrawing) {
-                        endStroke();  // End stroke (for G-Pen)
-                    }
-                    isDrawing = false;
+                    finishStroke();  // End stroke (for G-Pen)
                     // Force immediate update when stroke ends for final result
                     if (canvasNeedsUpdate) {
                         forceUpdateCanvasTexture();
@@ -644,6 +711,7 @@ int main(int argc, char* argv[]) {
 
             // Render frame
             C3D_FrameBegin(C3D_FRAME_SYNCDRAW);
+            queueCanvasUploads();
             if (isDrawing) {
                 renderPreviewTop(topScreen);
             } else {
@@ -887,7 +955,13 @@ int main(int argc, char* argv[]) {
                         if (ratio > 1) ratio = 1;
                         u8 newOpacity = (u8)(ratio * 255 + 0.5f);
                         if (newOpacity != layers[currentLayerIndex].opacity) {
+                            if (!layerOpacitySliderActive) {
+                                // One history record per drag
+                                pushLayerPropsHistory(currentLayerIndex);
+                                layerOpacitySliderActive = true;
+                            }
                             layers[currentLayerIndex].opacity = newOpacity;
+                            projectHasUnsavedChanges = true;
                             canvasNeedsUpdate = true;  // Opacity changed
                         }
                     }
@@ -897,6 +971,7 @@ int main(int argc, char* argv[]) {
             // Reset brush size preview when touch is released
             if (kUp & KEY_TOUCH) {
                 brushSizeSliderActive = false;
+                layerOpacitySliderActive = false;
             }
 
             // Handle color tab kDown touch (for palette and buttons)
@@ -986,6 +1061,7 @@ int main(int argc, char* argv[]) {
                         // Check if touching eye icon area
                         if (touch.px >= eyeBtnX && touch.px < eyeBtnX + eyeBtnSize &&
                             touch.py >= itemY && touch.py < itemY + listItemHeight) {
+                            pushLayerPropsHistory(i);
                             layers[i].visible = !layers[i].visible;
                             projectHasUnsavedChanges = true;  // Mark as changed
                             canvasNeedsUpdate = true;  // Visibility change affects display
@@ -1012,13 +1088,8 @@ int main(int argc, char* argv[]) {
                     if (touch.px >= col1X && touch.px < col1X + opBtnSize &&
                         touch.py >= opY && touch.py < opY + opBtnSize) {
                         if (currentLayerIndex < MAX_LAYERS - 1) {
-                            pushHistory();
-                            int src = currentLayerIndex;
-                            int dst = currentLayerIndex + 1;
-                            // Swap all layer properties
-                            Layer tempLayer = layers[src];
-                            layers[src] = layers[dst];
-                            layers[dst] = tempLayer;
+                            pushLayerReorderHistory(currentLayerIndex, currentLayerIndex + 1);
+                            swapLayers(currentLayerIndex, currentLayerIndex + 1);
                             // Move selection up
                             currentLayerIndex++;
                             canvasNeedsUpdate = true;
@@ -1029,13 +1100,8 @@ int main(int argc, char* argv[]) {
                     if (touch.px >= col2X && touch.px < col2X + opBtnSize &&
                         touch.py >= opY && touch.py < opY + opBtnSize) {
                         if (currentLayerIndex > 0) {
-                            pushHistory();
-                            int src = currentLayerIndex;
-                            int dst = currentLayerIndex - 1;
-                            // Swap all layer properties
-                            Layer tempLayer = layers[src];
-                            layers[src] = layers[dst];
-                            layers[dst] = tempLayer;
+                            pushLayerReorderHistory(currentLayerIndex, currentLayerIndex - 1);
+                            swapLayers(currentLayerIndex, currentLayerIndex - 1);
                             // Move selection down
                             currentLayerIndex--;
                             if (currentLayerIndex == 0 && layers[currentLayerIndex].clipping) {
@@ -1049,27 +1115,11 @@ int main(int argc, char* argv[]) {
                     if (touch.px >= col3X && touch.px < col3X + opBtnSize &&
                         touch.py >= opY && touch.py < opY + opBtnSize) {
                         if (currentLayerIndex > 0) {
-                            pushHistory();
+                            pushMergeDownHistory(currentLayerIndex);
                             // Merge current layer onto layer below
-                            int srcIdx = currentLayerIndex;
-                            int dstIdx = currentLayerIndex - 1;
-                            for (int y = 0; y < TEX_HEIGHT; y++) {
-                                for (int x = 0; x < TEX_WIDTH; x++) {
-                                    int idx = y * TEX_WIDTH + x;
-                                    u32 srcColor = layers[srcIdx].buffer[idx];
-                                    u32 dstColor = layers[dstIdx].buffer[idx];
-                                    layers[dstIdx].buffer[idx] = blendPixel(dstColor, srcColor, BLEND_NORMAL, 255);
-                                }
-                            }
-                            // Clear source layer
-                            u32 clearColor = 0x00000000;
-                            for (int y = 0; y < TEX_HEIGHT; y++) {
-                                for (int x = 0; x < TEX_WIDTH; x++) {
-                                    layers[srcIdx].buffer[y * TEX_WIDTH + x] = clearColor;
-                                }
-                            }
+                            mergeLayerDown(currentLayerIndex);
                             // Select destination layer
-                            currentLayerIndex = dstIdx;
+                            currentLayerIndex = currentLayerIndex - 1;
                             canvasNeedsUpdate = true;
                         }
                     }
@@ -1077,7 +1127,7 @@ int main(int argc, char* argv[]) {
                     // Row 1: Clear button
                     if (touch.px >= col4X && touch.px < col4X + opBtnSize &&
                         touch.py >= opY && touch.py < opY + opBtnSize) {
-                        pushHistory();
+                        pushClearHistory(currentLayerIndex, 0x00000000);
                         clearLayer(currentLayerIndex, 0x00000000);
                         canvasNeedsUpdate = true;
                     }
@@ -1085,7 +1135,7 @@ int main(int argc, char* argv[]) {
                     // Row 2: Alpha Lock toggle
                     if (touch.px >= col1X && touch.px < col1X + opBtnSize &&
                         touch.py >= row2Y && touch.py < row2Y + opBtnSize) {
-                        pushHistory();
+                        pushLayerPropsHistory(currentLayerIndex);
                         projectHasUnsavedChanges = true;  // Mark as changed
                         layers[currentLayerIndex].alphaLock = !layers[currentLayerIndex].alphaLock;
                     }
@@ -1094,7 +1144,7 @@ int main(int argc, char* argv[]) {
                     if (touch.px >= col2X && touch.px < col2X + opBtnSize &&
                         touch.py >= row2Y && touch.py < row2Y + opBtnSize) {
                         if (currentLayerIndex > 0) {
-                            pushHistory();
+                            pushLayerPropsHistory(currentLayerIndex);
                             projectHasUnsavedChanges = true;  // Mark as changed
                             layers[currentLayerIndex].clipping = !layers[currentLayerIndex].clipping;
                             canvasNeedsUpdate = true;
@@ -1112,11 +1162,29 @@ int main(int argc, char* argv[]) {
                             snprintf(nameBuf, sizeof(nameBuf), "Layer %d", currentLayerIndex + 1);
                         }
                         if (showKeyboard("Layer name", nameBuf, sizeof(nameBuf))) {
+                            pushLayerPropsHistory(currentLayerIndex);
+                            projectHasUnsavedChanges = true;  // Mark as changed
                             strncpy(layers[currentLayerIndex].name, nameBuf, sizeof(layers[currentLayerIndex].name));
                             layers[currentLayerIndex].name[sizeof(layers[currentLayerIndex].name) - 1] = '\0';
                         }
                     }
 
+                    // Row 2: Import PNG button
+                    if (touch.px >= col4X && touch.px < col4X + opBtnSize &&
+                        touch.py >= row2Y && touch.py < row2Y + opBtnSize) {
+                        char fileName[64] = "image.png";
+                        if (showKeyboard("PNG in " IMPORT_DIR, fileName, sizeof(fileName))) {
+                            char importPath[256];
+                            ensureDirectoryExists(IMPORT_DIR);
+                            snprintf(importPath, sizeof(importPath), "%s/%s", IMPORT_DIR, fileName);
+                            if (importPNGToLayer(importPath, currentLayerIndex)) {
+                                canvasNeedsUpdate = true;
+                            } else {
+                                showDialog(topScreen, bottomScreen, "Import Failed", "Could not read the PNG.");
+                            }
+                        }
+                    }
+
                     // Blend mode button touch
                     float sliderX = opX;
                     float sliderY = row2Y + opBtnSize + 15;
@@ -1127,7 +1195,7 @@ int main(int argc, char* argv[]) {
 
                     if (touch.px >= sliderX && touch.px < sliderX + blendBtnWidth &&
                         touch.py >= blendBtnY && touch.py < blendBtnY + blendBtnHeight) {
-                        pushHistory();
+                        pushLayerPropsHistory(currentLayerIndex);
                         projectHasUnsavedChanges = true;  // Mark as changed
                         // Cycle blend mode: Normal -> Add -> Multiply -> Normal
                         layers[currentLayerIndex].blendMode = (layers[currentLayerIndex].blendMode + 1) % 3;
@@ -1146,6 +1214,7 @@ int main(int argc, char* argv[]) {
 
             // Render frame
             C3D_FrameBegin(C3D_FRAME_SYNCDRAW);
+            queueCanvasUploads();
             renderUI(topScreen);
             renderMenu(bottomScreen);
             C3D_FrameEnd(0);
@@ -1227,18 +1296,38 @@ int main(int argc, char* argv[]) {
                 float item3X = startX + (BTN_SIZE_LARGE + SAVE_MENU_ITEM_SPACING) * 2;
                 if (touch.px >= item3X && touch.px < item3X + BTN_SIZE_LARGE &&
                     touch.py >= itemY && touch.py < itemY + BTN_SIZE_LARGE) {
+                    // Holding L exports every layer as an OpenRaster archive
+                    // instead, holding R a JPEG.
+                    bool layered = (kHeld & KEY_L) != 0;
+                    bool jpeg = !layered && (kHeld & KEY_R) != 0;
                     char exportPath[256];
-                    if (exportCanvasPNG(exportPath, sizeof(exportPath))) {
+                    bool exported = layered ? exportCanvasLayers(EXPORT_LAYERS_ORA, NULL, exportPath, sizeof(exportPath))
+                                  : jpeg ? exportCanvasJPEG(NULL, exportPath, sizeof(exportPath))
+                                  : exportCanvasPNG(NULL, exportPath, sizeof(exportPath));
+                    if (exported) {
                         const char* filename = exportPath;
                         const char* slash = strrchr(exportPath, '/');
                         if (slash && *(slash + 1) != '\0') {
                             filename = slash + 1;
                         }
+                        ExportStats stats;
+                        getExportStats(&stats);
+                        char format[32] = "RGBA";
+                        if (layered) {
+                            snprintf(format, sizeof(format), "%d layers", numLayers);
+                        } else if (jpeg) {
+                            snprintf(format, sizeof(format), "JPEG q%d", stats.jpegQuality);
+                        } else if (stats.paletteSize > 0) {
+                            snprintf(format, sizeof(format), "%d colours", stats.paletteSize);
+                        }
                         char msg[300];
-                        snprintf(msg, sizeof(msg), "Exported to\n%s", filename);
+                        snprintf(msg, sizeof(msg), "Exported to\n%s\n%s, %.0fKB in %.0fms", filename,
+                                 format, stats.bytes / 1024.0f, stats.ms);
                         showDialog(g_topScreen, g_bottomScreen, "Export Complete", msg);
                     } else {
-                        showDialog(g_topScreen, g_bottomScreen, "Export Failed", "Failed to export PNG.");
+                        showDialog(g_topScreen, g_bottomScreen, "Export Failed",
+                                   layered ? "Failed to export layers."
+                                   : jpeg ? "Failed to export JPEG." : "Failed to export PNG.");
                     }
                 }
             }
@@ -1253,6 +1342,7 @@ int main(int argc, char* argv[]) {
 
             // Render frame
             C3D_FrameBegin(C3D_FRAME_SYNCDRAW);
+            queueCanvasUploads();
             renderUI(topScreen);
             renderSaveMenu(bottomScreen);
             C3D_FrameEnd(0);
@@ -1262,6 +1352,9 @@ int main(int argc, char* argv[]) {
     // Cleanup
     C2D_TextBufDelete(g_textBuf);
     exitIcons();
+    exitPreviewLoader();
+    freeProjectIndex();
+    exitAutosave();
     exitHistory();
     exitLayers();
     C2D_Fini();
@@ -0,0 +1,56 @@
+#include "memory.h"
+
+#include <3ds.h>
+#include <malloc.h>
+#include <stdlib.h>
+
+#define MEM_MAX_RECLAIMERS 4
+
+extern u32 __ctru_heap_size;
+
+static MemReclaimFunc memReclaimers[MEM_MAX_RECLAIMERS];
+static int memReclaimerCount = 0;
+
+void memRegisterReclaimer(MemReclaimFunc func) {
+    if (!func) return;
+    for (int i = 0; i < memReclaimerCount; i++) {
+        if (memReclaimers[i] == func) return;
+    }
+    if (memReclaimerCount < MEM_MAX_RECLAIMERS) {
+        memReclaimers[memReclaimerCount++] = func;
+    }
+}
+
+// Ask reclaimers for memory; returns false once none can release anything.
+// Reclaimers drop main-thread state, so workers just see the failure.
+static bool reclaimMemory(size_t bytesNeeded) {
+    if (threadGetCurrent() != NULL) return false;
+    for (int i = 0; i < memReclaimerCount; i++) {
+        if (memReclaimers[i](bytesNeeded) > 0) return true;
+    }
+    return false;
+}
+
+void* memAlloc(size_t size) {
+    void* ptr = malloc(size);
+    while (!ptr && size > 0 && reclaimMemory(size)) {
+        ptr = malloc(size);
+    }
+    return ptr;
+}
+
+void* memCalloc(size_t count, size_t size) {
+    void* ptr = calloc(count, size);
+    while (!ptr && count > 0 && size > 0 && reclaimMemory(count * size)) {
+        ptr = calloc(count, size);
+    }
+    return ptr;
+}
+
+size_t memGetFreeBytes(void) {
+    struct mallinfo info = mallinfo();
+    // Heap pages are reserved up front, so free = reserved heap - live blocks.
+    size_t used = (size_t)info.uordblks;
+    if (used >= __ctru_heap_size) return 0;
+    return (size_t)__ctru_heap_size - used;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @file memory.h
+ * @brief Heap allocation with reclaimable caches (e.g. undo history).
+ *
+ * Subsystems holding memory that can be dropped on demand register a
+ * reclaimer. memAlloc()/memCalloc() retry through the reclaimers when the
+ * heap is exhausted, so painting always wins over cached data. Reclaiming
+ * only happens on the main thread; on worker threads they behave like
+ * malloc()/calloc().
+ */
+
+/**
+ * @brief Reclaimer callback.
+ * @param bytesNeeded Bytes the failed allocation asked for.
+ * @return Bytes released (0 when nothing more can be freed).
+ */
+typedef size_t (*MemReclaimFunc)(size_t bytesNeeded);
+
+/** @brief Register a reclaimer (called in registration order). */
+void memRegisterReclaimer(MemReclaimFunc func);
+
+/** @brief malloc() that reclaims cached memory and retries on failure. */
+void* memAlloc(size_t size);
+
+/** @brief calloc() that reclaims cached memory and retries on failure. */
+void* memCalloc(size_t count, size_t size);
+
+/** @brief Bytes still available in the application heap. */
+size_t memGetFreeBytes(void);
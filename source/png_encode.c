@@ -0,0 +1,229 @@
+#include "png_encode.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+static void putBigEndian32(uint8_t* out, uint32_t value) {
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
+
+bool pngEncodeWriteChunk(FILE* fp, const char* type, const void* const* parts, const size_t* sizes, int count) {
+    size_t length = 0;
+    for (int i = 0; i < count; i++) length += sizes[i];
+    if (length > 0x7FFFFFFFu) return false;
+
+    uint8_t head[8];
+    putBigEndian32(head, (uint32_t)length);
+    memcpy(&head[4], type, 4);
+    if (fwrite(head, 1, sizeof(head), fp) != sizeof(head)) return false;
+
+    uLong crc = crc32(0L, &head[4], 4);
+    for (int i = 0; i < count; i++) {
+        if (sizes[i] == 0) continue;
+        if (fwrite(parts[i], 1, sizes[i], fp) != sizes[i]) return false;
+        crc = crc32(crc, (const Bytef*)parts[i], (uInt)sizes[i]);
+    }
+
+    uint8_t tail[4];
+    putBigEndian32(tail, (uint32_t)crc);
+    return fwrite(tail, 1, sizeof(tail), fp) == sizeof(tail);
+}
+
+bool pngEncodeWriteHeader(FILE* fp, uint32_t width, uint32_t height, int bitDepth, int colorType) {
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    if (fwrite(signature, 1, sizeof(signature), fp) != sizeof(signature)) return false;
+
+    uint8_t ihdr[13];
+    putBigEndian32(&ihdr[0], width);
+    putBigEndian32(&ihdr[4], height);
+    ihdr[8] = (uint8_t)bitDepth;
+    ihdr[9] = (uint8_t)colorType;
+    ihdr[10] = 0;   // Deflate
+    ihdr[11] = 0;   // Adaptive filtering (per-row filter byte)
+    ihdr[12] = 0;   // Not interlaced
+
+    const void* parts[1] = {ihdr};
+    size_t sizes[1] = {sizeof(ihdr)};
+    return pngEncodeWriteChunk(fp, "IHDR", parts, sizes, 1);
+}
+
+bool pngEncodeWritePalette(FILE* fp, const uint32_t* colors, int count) {
+    if (count < 1 || count > 256) return false;
+    uint8_t rgb[256 * 3];
+    uint8_t alpha[256];
+    int alphaCount = 0;   // tRNS may stop after the last non-opaque entry
+    for (int i = 0; i < count; i++) {
+        rgb[i * 3 + 0] = (uint8_t)(colors[i] >> 24);
+        rgb[i * 3 + 1] = (uint8_t)(colors[i] >> 16);
+        rgb[i * 3 + 2] = (uint8_t)(colors[i] >> 8);
+        alpha[i] = (uint8_t)colors[i];
+        if (alpha[i] != 0xFF) alphaCount = i + 1;
+    }
+
+    const void* parts[1] = {rgb};
+    size_t sizes[1] = {(size_t)count * 3};
+    if (!pngEncodeWriteChunk(fp, "PLTE", parts, sizes, 1)) return false;
+    if (alphaCount == 0) return true;
+    parts[0] = alpha;
+    sizes[0] = (size_t)alphaCount;
+    return pngEncodeWriteChunk(fp, "tRNS", parts, sizes, 1);
+}
+
+bool pngEncodeWriteEnd(FILE* fp) {
+    return pngEncodeWriteChunk(fp, "IEND", NULL, NULL, 0);
+}
+
+//---------------------------------------------------------------------------
+// Row filters
+//---------------------------------------------------------------------------
+
+static uint8_t paethPredictor(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return (uint8_t)a;
+    if (pb <= pc) return (uint8_t)b;
+    return (uint8_t)c;
+}
+
+// The first bpp bytes have no left neighbour and the first row no upper
+// one; both read as zero, which lets the inner loops skip the checks.
+static void filterRow(int filter, const uint8_t* row, const uint8_t* prev, size_t rowBytes, int bpp, uint8_t* out) {
+    size_t lead = (size_t)bpp < rowBytes ? (size_t)bpp : rowBytes;
+    if (!prev && (filter == PNG_ENCODE_FILTER_UP || filter == PNG_ENCODE_FILTER_PAETH)) {
+        // Up of a zero row is none; Paeth of a zero row is sub. Keep the
+        // type byte so the output matches what was asked for.
+        out[0] = (uint8_t)filter;
+        if (filter == PNG_ENCODE_FILTER_UP) {
+            memcpy(&out[1], row, rowBytes);
+            return;
+        }
+        memcpy(&out[1], row, lead);
+        for (size_t i = lead; i < rowBytes; i++) out[1 + i] = (uint8_t)(row[i] - row[i - bpp]);
+        return;
+    }
+
+    out[0] = (uint8_t)filter;
+    out++;
+    switch (filter) {
+        case PNG_ENCODE_FILTER_SUB:
+            memcpy(out, row, lead);
+            for (size_t i = lead; i < rowBytes; i++) {
+                out[i] = (uint8_t)(row[i] - row[i - bpp]);
+            }
+            break;
+        case PNG_ENCODE_FILTER_UP:
+            for (size_t i = 0; i < rowBytes; i++) {
+                out[i] = (uint8_t)(row[i] - prev[i]);
+            }
+            break;
+        case PNG_ENCODE_FILTER_AVERAGE:
+            for (size_t i = 0; i < lead; i++) {
+                out[i] = (uint8_t)(row[i] - ((prev ? prev[i] : 0) >> 1));
+            }
+            for (size_t i = lead; i < rowBytes; i++) {
+                int up = prev ? prev[i] : 0;
+                out[i] = (uint8_t)(row[i] - ((row[i - bpp] + up) >> 1));
+            }
+            break;
+        case PNG_ENCODE_FILTER_PAETH:
+            for (size_t i = 0; i < lead; i++) {
+                out[i] = (uint8_t)(row[i] - prev[i]);
+            }
+            for (size_t i = lead; i < rowBytes; i++) {
+                out[i] = (uint8_t)(row[i] - paethPredictor(row[i - bpp], prev[i], prev[i - bpp]));
+            }
+            break;
+        default:
+            memcpy(out, row, rowBytes);
+            break;
+    }
+}
+
+// Filtered bytes read as signed values; smaller sums usually deflate better.
+static uint32_t filteredCost(const uint8_t* filtered, size_t rowBytes) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < rowBytes; i++) {
+        sum += filtered[i] < 128 ? filtered[i] : 256 - filtered[i];
+    }
+    return sum;
+}
+
+void pngEncodeFilterRow(int filter, const uint8_t* row, const uint8_t* prev, size_t rowBytes, int bpp, uint8_t* out) {
+    if (filter != PNG_ENCODE_FILTER_ADAPTIVE) {
+        filterRow(filter, row, prev, rowBytes, bpp, out);
+        return;
+    }
+
+    // Try each filter in place, keep the cheapest (re-filtering into out if needed).
+    // Without an upper row, up and Paeth reduce to none and sub.
+    int lastFilter = prev ? PNG_ENCODE_FILTER_PAETH : PNG_ENCODE_FILTER_SUB;
+    int best = PNG_ENCODE_FILTER_NONE;
+    uint32_t bestCost = UINT32_MAX;
+    for (int f = PNG_ENCODE_FILTER_NONE; f <= lastFilter; f++) {
+        filterRow(f, row, prev, rowBytes, bpp, out);
+        uint32_t cost = filteredCost(&out[1], rowBytes);
+        if (cost < bestCost) {
+            bestCost = cost;
+            best = f;
+        }
+    }
+    if (best != lastFilter) {
+        filterRow(best, row, prev, rowBytes, bpp, out);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Segmented deflate
+//---------------------------------------------------------------------------
+
+size_t pngEncodeSegmentBound(size_t size) {
+    // deflateBound covers a finished stream; a sync flush adds an empty
+    // stored block (5 bytes) and may add a partial block header.
+    return compressBound((uLong)size) + 16;
+}
+
+bool pngEncodeDeflateSegment(PngDeflateSegment* segment) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // Filtered rows are mostly small values, which Z_FILTERED favours.
+    int strategy = segment->filtered ? Z_FILTERED : Z_DEFAULT_STRATEGY;
+    if (deflateInit2(&stream, segment->level, Z_DEFLATED, -15, 8, strategy) != Z_OK) return false;
+
+    bool ok = true;
+    if (segment->dict && segment->dictSize > 0) {
+        ok = deflateSetDictionary(&stream, segment->dict, (uInt)segment->dictSize) == Z_OK;
+    }
+
+    stream.next_in = (Bytef*)segment->data;
+    stream.avail_in = (uInt)segment->size;
+    stream.next_out = segment->out;
+    stream.avail_out = (uInt)pngEncodeSegmentBound(segment->size);
+    if (ok) {
+        int result = deflate(&stream, segment->last ? Z_FINISH : Z_SYNC_FLUSH);
+        ok = segment->last ? result == Z_STREAM_END : (result == Z_OK && stream.avail_in == 0);
+    }
+    segment->outSize = stream.total_out;
+    deflateEnd(&stream);
+
+    segment->adler = (uint32_t)adler32(adler32(0L, Z_NULL, 0), segment->data, (uInt)segment->size);
+    return ok;
+}
+
+void pngEncodeZlibHeader(int level, uint8_t out[2]) {
+    // CMF: deflate with a 32 KB window. FLG: compression level hint, then
+    // check bits making the big-endian pair a multiple of 31.
+    int levelHint = level < 0 ? 2 : level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+    out[0] = 0x78;
+    out[1] = (uint8_t)(levelHint << 6);
+    out[1] += (uint8_t)(31 - ((out[0] << 8) | out[1]) % 31);
+}
+
+uint32_t pngEncodeCombineAdler(uint32_t adlerA, uint32_t adlerB, size_t sizeB) {
+    return (uint32_t)adler32_combine(adlerA, adlerB, (z_off_t)sizeB);
+}
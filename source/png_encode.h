@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @file png_encode.h
+ * @brief PNG building blocks for encoders that split compression across threads.
+ *
+ * Platform independent (stdio + zlib) so it can be built on a host.
+ *
+ * The image data (filtered rows) is cut into segments that are deflated
+ * independently, pigz style:
+ *  - each segment is a raw deflate stream primed with the last 32 KB of the
+ *    previous segment as its dictionary,
+ *  - every segment but the last ends with a sync flush (byte aligned, no
+ *    final block), the last one with Z_FINISH,
+ *  - the IDAT data is the zlib header, the segments in order, and the
+ *    Adler-32 of all filtered bytes, combined from the per-segment sums.
+ * The result is one ordinary zlib stream that any PNG decoder reads.
+ */
+
+#define PNG_ENCODE_DICT_SIZE 32768
+
+#define PNG_ENCODE_COLOR_GRAY 0
+#define PNG_ENCODE_COLOR_RGB 2
+#define PNG_ENCODE_COLOR_PALETTE 3
+#define PNG_ENCODE_COLOR_RGBA 6
+
+/** @name Row filters (PNG filter types 0-4, plus a per-row choice). @{ */
+#define PNG_ENCODE_FILTER_NONE 0
+#define PNG_ENCODE_FILTER_SUB 1
+#define PNG_ENCODE_FILTER_UP 2
+#define PNG_ENCODE_FILTER_AVERAGE 3
+#define PNG_ENCODE_FILTER_PAETH 4
+#define PNG_ENCODE_FILTER_ADAPTIVE 5   /**< Per row, the filter with the smallest sum of absolute differences. */
+/** @} */
+
+/** @brief Write the PNG signature and IHDR chunk. */
+bool pngEncodeWriteHeader(FILE* fp, uint32_t width, uint32_t height, int bitDepth, int colorType);
+
+/**
+ * @brief Write one chunk whose data is the concatenation of count parts.
+ * @param type Four-character chunk type, e.g. "IDAT".
+ */
+bool pngEncodeWriteChunk(FILE* fp, const char* type, const void* const* parts, const size_t* sizes, int count);
+
+/**
+ * @brief Write the PLTE chunk, and tRNS when any entry is not opaque.
+ * @param colors count entries in the layer format (0xRRGGBBAA), 1 to 256.
+ */
+bool pngEncodeWritePalette(FILE* fp, const uint32_t* colors, int count);
+
+/** @brief Write the IEND chunk. */
+bool pngEncodeWriteEnd(FILE* fp);
+
+/**
+ * @brief Filter one row.
+ * @param prev The previous unfiltered row, or NULL for the first row.
+ * @param bpp Bytes per complete pixel (at least 1).
+ * @param out rowBytes + 1 bytes: the filter type followed by the filtered row.
+ */
+void pngEncodeFilterRow(int filter, const uint8_t* row, const uint8_t* prev, size_t rowBytes, int bpp, uint8_t* out);
+
+/** @brief One independently deflated piece of the IDAT stream. */
+typedef struct {
+    const uint8_t* data;      /**< Filtered bytes of this segment. */
+    size_t size;
+    const uint8_t* dict;      /**< Tail of the previous segment's data, or NULL for the first. */
+    size_t dictSize;          /**< At most PNG_ENCODE_DICT_SIZE. */
+    int level;
+    bool filtered;            /**< Rows use filters other than none (deflates with Z_FILTERED, like libpng). */
+    bool last;                /**< Finish the stream instead of sync flushing. */
+    uint8_t* out;             /**< At least pngEncodeSegmentBound(size) bytes. */
+    size_t outSize;           /**< Set on success. */
+    uint32_t adler;           /**< Adler-32 of data, set on success. */
+} PngDeflateSegment;
+
+/** @brief Output capacity a segment of size filtered bytes needs. */
+size_t pngEncodeSegmentBound(size_t size);
+
+/** @brief Deflate one segment (thread safe; segments can run concurrently). */
+bool pngEncodeDeflateSegment(PngDeflateSegment* segment);
+
+/** @brief The two-byte zlib header that starts the IDAT data. */
+void pngEncodeZlibHeader(int level, uint8_t out[2]);
+
+/** @brief Adler-32 of A followed by B, from the sums of both and B's length. */
+uint32_t pngEncodeCombineAdler(uint32_t adlerA, uint32_t adlerB, size_t sizeB);
@@ -1,146 +1,516 @@
 #include "preview.h"
 
-#include <dirent.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "blend.h"
+#include "project_index.h"
 #include "project_io.h"
 #include "util.h"
+#include "worker.h"
 
 void scanProjectFiles(void) {
-    openProjectCount = 0;
-    DIR* dir = opendir(SAVE_DIR);
-    if (!dir) return;
-
-    struct dirent* entry;
-    while ((entry = readdir(dir)) != NULL && openProjectCount < OPEN_MAX_PROJECTS) {
-        const char* name = entry->d_name;
-        size_t len = strlen(name);
-        if (len > 5 && strcmp(name + len - 5, ".mgdw") == 0) {
-            size_t nameLen = len - 5;
-            if (nameLen >= PROJECT_NAME_MAX) nameLen = PROJECT_NAME_MAX - 1;
-            memcpy(openProjectNames[openProjectCount], name, nameLen);
-            openProjectNames[openProjectCount][nameLen] = '\0';
-            openProjectCount++;
-        }
-    }
-    closedir(dir);
+    recoverInterruptedSaves();
+    refreshProjectIndex();
 }
 
-void freeOpenPreview(void) {
-    if (openPreviewValid) {
-        C3D_TexDelete(&openPreviewTex);
-        openPreviewValid = false;
+//---------------------------------------------------------------------------------
+// Decoding (worker thread: plain malloc, no GPU calls)
+//---------------------------------------------------------------------------------
+
+// A decoded preview, padded to its texture size.
+typedef struct {
+    void* pixels;       // texWidth x texHeight texels, RGB565 or RGBA8.
+    int width;
+    int height;
+    int texWidth;
+    int texHeight;
+    bool rgb565;
+} PreviewPixels;
+
+static void previewTextureSize(int width, int height, int* texWidth, int* texHeight) {
+    *texWidth = nextPowerOf2(width);
+    *texHeight = nextPowerOf2(height);
+    if (*texWidth < 8) *texWidth = 8;
+    if (*texHeight < 8) *texHeight = 8;
+}
+
+// Pad a decoded RGB565 thumbnail to its texture size (takes ownership of thumb).
+static bool padThumbnail(u16* thumb, int w, int h, PreviewPixels* out) {
+    previewTextureSize(w, h, &out->texWidth, &out->texHeight);
+    u16* pixels = (u16*)malloc(out->texWidth * out->texHeight * sizeof(u16));
+    if (!pixels) {
+        free(thumb);
+        return false;
+    }
+    memset(pixels, 0xFF, out->texWidth * out->texHeight * sizeof(u16));
+    for (int y = 0; y < h; y++) {
+        memcpy(&pixels[y * out->texWidth], &thumb[y * w], w * sizeof(u16));
     }
+    free(thumb);
+
+    out->pixels = pixels;
+    out->width = w;
+    out->height = h;
+    out->rgb565 = true;
+    return true;
 }
 
-bool loadProjectPreview(const char* projectName) {
-    char filePath[256];
-    snprintf(filePath, sizeof(filePath), "%s/%s.mgdw", SAVE_DIR, projectName);
+// Read the thumbnail straight from the offset the index recorded: one seek, no chunk table.
+static u16* readIndexedThumbnail(const ProjectIndexEntry* project, int* w, int* h) {
+    if (project->thumbOffset == 0 || project->thumbSize == 0) return NULL;
 
+    char filePath[256];
+    snprintf(filePath, sizeof(filePath), "%s/%s.mgdw", SAVE_DIR, project->name);
     FILE* fp = fopen(filePath, "rb");
-    if (!fp) return false;
+    if (!fp) return NULL;
 
-    ProjectHeader header;
-    if (fread(&header, sizeof(ProjectHeader), 1, fp) != 1) { fclose(fp); return false; }
-    if (header.magic != PROJECT_FILE_MAGIC) { fclose(fp); return false; }
+    u16* thumb = NULL;
+    u8* payload = (u8*)malloc(project->thumbSize);
+    if (payload && fseek(fp, project->thumbOffset, SEEK_SET) == 0 &&
+        fread(payload, 1, project->thumbSize, fp) == project->thumbSize) {
+        thumb = projectDecodeThumbnail(payload, project->thumbSize, w, h);
+    }
+    free(payload);
+    fclose(fp);
+    return thumb;
+}
 
-    int cw = header.canvasWidth;
-    int ch = header.canvasHeight;
-    if (cw <= 0 || cw > MAX_CANVAS_DIM || ch <= 0 || ch > MAX_CANVAS_DIM) { fclose(fp); return false; }
+// Box-filters one layer down to preview size as its rows stream in, so no
+// canvas-sized buffer is needed.
+typedef struct {
+    int srcWidth;
+    int srcHeight;
+    int width;
+    int height;
+    int* columnOf;      // Preview column of each canvas column.
+    u32* columnCount;   // Canvas columns per preview column.
+    u32* sums;          // Premultiplied r, g, b and alpha sums of the pending preview row.
+    int row;            // Preview row being accumulated, -1 before the first.
+    u32 rowCount;       // Canvas rows accumulated into it.
+    u32* layer;         // Reduced layer, straight alpha.
+    volatile bool* cancel;
+} PreviewScaler;
+
+static void freePreviewScaler(PreviewScaler* scaler) {
+    free(scaler->columnOf);
+    free(scaler->columnCount);
+    free(scaler->sums);
+    free(scaler->layer);
+}
+
+static bool initPreviewScaler(PreviewScaler* scaler, int srcWidth, int srcHeight, int width, int height) {
+    memset(scaler, 0, sizeof(*scaler));
+    scaler->srcWidth = srcWidth;
+    scaler->srcHeight = srcHeight;
+    scaler->width = width;
+    scaler->height = height;
+    scaler->columnOf = (int*)malloc(srcWidth * sizeof(int));
+    scaler->columnCount = (u32*)calloc(width, sizeof(u32));
+    scaler->sums = (u32*)malloc(width * 4 * sizeof(u32));
+    scaler->layer = (u32*)malloc(width * height * sizeof(u32));
+    if (!scaler->columnOf || !scaler->columnCount || !scaler->sums || !scaler->layer) {
+        freePreviewScaler(scaler);
+        return false;
+    }
+    for (int x = 0; x < srcWidth; x++) {
+        scaler->columnOf[x] = (int)((s64)x * width / srcWidth);
+        scaler->columnCount[scaler->columnOf[x]]++;
+    }
+    scaler->row = -1;
+    return true;
+}
+
+static void flushPreviewRow(PreviewScaler* scaler) {
+    if (scaler->row < 0) return;
+    u32* out = &scaler->layer[scaler->row * scaler->width];
+    for (int x = 0; x < scaler->width; x++) {
+        const u32* sum = &scaler->sums[x * 4];
+        if (sum[3] == 0) continue;
+        u32 r = sum[0] / sum[3];
+        u32 g = sum[1] / sum[3];
+        u32 b = sum[2] / sum[3];
+        u32 a = sum[3] / (scaler->columnCount[x] * scaler->rowCount);
+        out[x] = (r << 24) | (g << 16) | (b << 8) | a;
+    }
+    scaler->row = -1;
+}
 
-    int tw = nextPowerOf2(cw);
-    int th = nextPowerOf2(ch);
+static bool scalePreviewRows(void* ctx, const ProjectLayerInfo* info, int y, const u32* rows, int count, int stride) {
+    PreviewScaler* scaler = (PreviewScaler*)ctx;
+    if (!info->visible || info->opacity == 0 || *scaler->cancel) return false;
 
-    u32* tempLayer = (u32*)malloc(tw * th * sizeof(u32));
+    for (int r = 0; r < count; r++) {
+        int row = (int)((s64)(y + r) * scaler->height / scaler->srcHeight);
+        if (row != scaler->row) {
+            flushPreviewRow(scaler);
+            memset(scaler->sums, 0, scaler->width * 4 * sizeof(u32));
+            scaler->row = row;
+            scaler->rowCount = 0;
+        }
+        scaler->rowCount++;
+
+        const u32* src = &rows[r * stride];
+        for (int x = 0; x < scaler->srcWidth; x++) {
+            u32 p = src[x];
+            u32 a = p & 0xFF;
+            if (a == 0) continue;
+            u32* sum = &scaler->sums[scaler->columnOf[x] * 4];
+            sum[0] += (p >> 24) * a;
+            sum[1] += ((p >> 16) & 0xFF) * a;
+            sum[2] += ((p >> 8) & 0xFF) * a;
+            sum[3] += a;
+        }
+    }
+    return true;
+}
+
+// No thumbnail: stream the layers and composite at preview size.
+static bool compositePreview(ProjectReader* reader, PreviewPixels* out, volatile bool* cancel) {
+    int pw, ph;
+    projectThumbnailSize(reader->header.canvasWidth, reader->header.canvasHeight, &pw, &ph);
+    int tw, th;
+    previewTextureSize(pw, ph, &tw, &th);
+
+    PreviewScaler scaler;
     u32* composite = (u32*)malloc(tw * th * sizeof(u32));
-    if (!tempLayer || !composite) {
-        free(tempLayer);
+    if (!composite || !initPreviewScaler(&scaler, reader->header.canvasWidth, reader->header.canvasHeight, pw, ph)) {
         free(composite);
-        fclose(fp);
         return false;
     }
+    scaler.cancel = cancel;
 
-    for (int y = 0; y < ch; y++) {
-        for (int x = 0; x < cw; x++) {
-            composite[y * tw + x] = 0xFFFFFFFF;
-        }
+    for (int i = 0; i < tw * th; i++) {
+        composite[i] = 0xFFFFFFFF;
     }
 
-    int numLayersLocal = header.numLayers;
+    int numLayersLocal = reader->header.numLayers;
     if (numLayersLocal > MAX_LAYERS) numLayersLocal = MAX_LAYERS;
 
-    for (int i = 0; i < (int)header.numLayers; i++) {
-        bool visible;
-        u8 opacity;
-        BlendMode blendMode;
-        bool alphaLock, clipping;
-        char layerName[32];
+    for (int i = 0; i < numLayersLocal && !*cancel; i++) {
+        ProjectLayerInfo info;
+        memset(scaler.layer, 0, pw * ph * sizeof(u32));
+        scaler.row = -1;
+        if (!projectReaderReadLayerRows(reader, &info, scalePreviewRows, &scaler)) break;
+        if (!info.visible || info.opacity == 0 || *cancel) continue;
+        flushPreviewRow(&scaler);
+
+        for (int y = 0; y < ph; y++) {
+            const u32* src = &scaler.layer[y * pw];
+            u32* dst = &composite[y * tw];
+            for (int x = 0; x < pw; x++) {
+                if ((src[x] & 0xFF) == 0) continue;
+                dst[x] = blendPixel(dst[x], src[x], (BlendMode)info.blendMode, info.opacity);
+            }
+        }
+    }
+    freePreviewScaler(&scaler);
+
+    if (*cancel) {
+        free(composite);
+        return false;
+    }
+    out->pixels = composite;
+    out->width = pw;
+    out->height = ph;
+    out->texWidth = tw;
+    out->texHeight = th;
+    out->rgb565 = false;
+    return true;
+}
+
+static bool decodeProjectPreview(const ProjectIndexEntry* project, PreviewPixels* out, volatile bool* cancel) {
+    int w, h;
+    u16* thumb = readIndexedThumbnail(project, &w, &h);
+    if (thumb) return padThumbnail(thumb, w, h, out);
+    if (*cancel) return false;
+
+    ProjectReader reader;
+    if (!projectReaderOpen(&reader, project->name)) return false;
+
+    thumb = projectReaderReadThumbnail(&reader, &w, &h);
+    bool ok = thumb ? padThumbnail(thumb, w, h, out) : compositePreview(&reader, out, cancel);
+    projectReaderClose(&reader);
+    return ok;
+}
+
+//---------------------------------------------------------------------------------
+// Loader worker
+//---------------------------------------------------------------------------------
+
+static LightLock previewLock;
+static LightEvent previewWorkEvent;
+static Thread previewWorker = NULL;
+static volatile bool previewWorkerQuit = false;
+
+// Guarded by previewLock (previewJobCancel is only ever set by the main thread).
+static bool previewJobPending = false;
+static bool previewJobBusy = false;
+static ProjectIndexEntry previewJob;
+static volatile bool previewJobCancel = false;
+static bool previewResultReady = false;
+static bool previewResultOk = false;
+static ProjectIndexEntry previewResultProject;
+static PreviewPixels previewResult;
 
-        fread(&visible, sizeof(bool), 1, fp);
-        fread(&opacity, sizeof(u8), 1, fp);
-        fread(&blendMode, sizeof(BlendMode), 1, fp);
-        fread(&alphaLock, sizeof(bool), 1, fp);
-        fread(&clipping, sizeof(bool), 1, fp);
-        fread(layerName, sizeof(layerName), 1, fp);
+static void previewWorkerMain(void* arg) {
+    (void)arg;
+    while (!previewWorkerQuit) {
+        LightEvent_Wait(&previewWorkEvent);
+        if (previewWorkerQuit) break;
 
-        memset(tempLayer, 0, tw * th * sizeof(u32));
+        LightLock_Lock(&previewLock);
+        bool run = previewJobPending;
+        ProjectIndexEntry project = previewJob;
+        previewJobPending = false;
+        previewJobBusy = run;
+        LightLock_Unlock(&previewLock);
+        if (!run) continue;
 
-        for (int y = 0; y < ch; y++) {
-            fread(&tempLayer[y * tw], sizeof(u32), cw, fp);
+        PreviewPixels pixels;
+        memset(&pixels, 0, sizeof(pixels));
+        bool ok = decodeProjectPreview(&project, &pixels, &previewJobCancel);
+
+        LightLock_Lock(&previewLock);
+        if (previewJobCancel) {
+            free(pixels.pixels);
+        } else {
+            previewResultReady = true;
+            previewResultOk = ok;
+            previewResultProject = project;
+            previewResult = pixels;
         }
+        previewJobBusy = false;
+        LightLock_Unlock(&previewLock);
+    }
+}
+
+//---------------------------------------------------------------------------------
+// Texture cache (main thread)
+//---------------------------------------------------------------------------------
+
+typedef struct {
+    bool used;
+    bool ok;                  // false: decoding failed, do not retry.
+    char name[PROJECT_NAME_MAX];
+    u64 mtime;
+    u64 fileSize;
+    C3D_Tex tex;
+    Tex3DS_SubTexture subtex;
+    int width;
+    int height;
+    size_t bytes;
+    u32 lastUse;
+} PreviewCacheEntry;
+
+static PreviewCacheEntry previewCache[PREVIEW_CACHE_SLOTS];
+static size_t previewCacheBytes = 0;
+static u32 previewUseClock = 0;
+static int previewSelected = -1;
+
+static bool sameProject(const PreviewCacheEntry* entry, const ProjectIndexEntry* project) {
+    return entry->used && entry->mtime == project->mtime && entry->fileSize == project->fileSize &&
+           strcmp(entry->name, project->name) == 0;
+}
+
+static PreviewCacheEntry* findCachedPreview(const ProjectIndexEntry* project) {
+    for (int i = 0; i < PREVIEW_CACHE_SLOTS; i++) {
+        if (sameProject(&previewCache[i], project)) return &previewCache[i];
+    }
+    return NULL;
+}
+
+static void dropCachedPreview(PreviewCacheEntry* entry) {
+    if (entry->used && entry->ok) {
+        C3D_TexDelete(&entry->tex);
+    }
+    previewCacheBytes -= entry->bytes;
+    memset(entry, 0, sizeof(*entry));
+}
 
-        if (!visible || opacity == 0) continue;
-        if (i >= numLayersLocal) continue;
-
-        for (int y = 0; y < ch; y++) {
-            for (int x = 0; x < cw; x++) {
-                int idx = y * tw + x;
-                u32 src = tempLayer[idx];
-                u8 srcA = src & 0xFF;
-                if (srcA == 0) continue;
-                u32 dst = composite[idx];
-                composite[idx] = blendPixel(dst, src, blendMode, opacity);
+// Evict least recently used previews until bytes more fit; returns a free slot.
+static PreviewCacheEntry* makeCacheRoom(size_t bytes) {
+    for (;;) {
+        PreviewCacheEntry* freeSlot = NULL;
+        PreviewCacheEntry* oldest = NULL;
+        for (int i = 0; i < PREVIEW_CACHE_SLOTS; i++) {
+            PreviewCacheEntry* entry = &previewCache[i];
+            if (!entry->used) {
+                if (!freeSlot) freeSlot = entry;
+            } else if (!oldest || entry->lastUse < oldest->lastUse) {
+                oldest = entry;
             }
         }
+        if (freeSlot && previewCacheBytes + bytes <= PREVIEW_CACHE_BUDGET) return freeSlot;
+        if (!oldest) return freeSlot;
+        dropCachedPreview(oldest);
     }
+}
 
-    fclose(fp);
-    free(tempLayer);
+static void cachePreview(const ProjectIndexEntry* project, const PreviewPixels* pixels, bool ok) {
+    size_t texelSize = pixels->rgb565 ? sizeof(u16) : sizeof(u32);
+    size_t bytes = ok ? (size_t)pixels->texWidth * pixels->texHeight * texelSize : 0;
+    PreviewCacheEntry* entry = makeCacheRoom(bytes);
+    if (!entry) return;
+
+    memset(entry, 0, sizeof(*entry));
+    entry->used = true;
+    snprintf(entry->name, sizeof(entry->name), "%s", project->name);
+    entry->mtime = project->mtime;
+    entry->fileSize = project->fileSize;
+    entry->lastUse = ++previewUseClock;
+    if (!ok) return;
+
+    int tw = pixels->texWidth;
+    int th = pixels->texHeight;
+    void* gpuBuf = linearAlloc(bytes);
+    if (!gpuBuf || !C3D_TexInit(&entry->tex, tw, th, pixels->rgb565 ? GPU_RGB565 : GPU_RGBA8)) {
+        if (gpuBuf) linearFree(gpuBuf);
+        return;  // Kept as a failed entry so the project is not decoded again.
+    }
+    u32 format = pixels->rgb565 ? GX_TRANSFER_FMT_RGB565 : GX_TRANSFER_FMT_RGBA8;
+    memcpy(gpuBuf, pixels->pixels, bytes);
+    GSPGPU_FlushDataCache(gpuBuf, bytes);
+    C3D_SyncDisplayTransfer(
+        (u32*)gpuBuf, GX_BUFFER_DIM(tw, th),
+        (u32*)entry->tex.data, GX_BUFFER_DIM(tw, th),
+        (GX_TRANSFER_FLIP_VERT(1) | GX_TRANSFER_OUT_TILED(1) | GX_TRANSFER_RAW_COPY(0) |
+         GX_TRANSFER_IN_FORMAT(format) | GX_TRANSFER_OUT_FORMAT(format) |
+         GX_TRANSFER_SCALING(GX_TRANSFER_SCALE_NO))
+    );
+    linearFree(gpuBuf);
+    C3D_TexSetFilter(&entry->tex, GPU_LINEAR, GPU_LINEAR);
+
+    entry->ok = true;
+    entry->bytes = bytes;
+    entry->width = pixels->width;
+    entry->height = pixels->height;
+    entry->subtex.width = pixels->width;
+    entry->subtex.height = pixels->height;
+    entry->subtex.left = 0.0f;
+    entry->subtex.top = (float)pixels->height / th;
+    entry->subtex.right = (float)pixels->width / tw;
+    entry->subtex.bottom = 0.0f;
+    previewCacheBytes += bytes;
+}
+
+//---------------------------------------------------------------------------------
+// Public interface
+//---------------------------------------------------------------------------------
+
+void initPreviewLoader(void) {
+    static bool syncInitialized = false;
+    if (!syncInitialized) {
+        LightLock_Init(&previewLock);
+        LightEvent_Init(&previewWorkEvent, RESET_ONESHOT);
+        syncInitialized = true;
+    }
+    if (!previewWorker) {
+        previewWorkerQuit = false;
+        previewWorker = workerThreadCreate(previewWorkerMain, NULL, 1);
+    }
+}
 
+void exitPreviewLoader(void) {
+    if (previewWorker) {
+        previewJobCancel = true;
+        previewWorkerQuit = true;
+        LightEvent_Signal(&previewWorkEvent);
+        threadJoin(previewWorker, U64_MAX);
+        threadFree(previewWorker);
+        previewWorker = NULL;
+    }
     freeOpenPreview();
-    C3D_TexInit(&openPreviewTex, tw, th, GPU_RGBA8);
-    C3D_TexSetFilter(&openPreviewTex, GPU_LINEAR, GPU_LINEAR);
-
-    u32* gpuBuf = (u32*)linearAlloc(tw * th * sizeof(u32));
-    if (gpuBuf) {
-        memcpy(gpuBuf, composite, tw * th * sizeof(u32));
-        GSPGPU_FlushDataCache(gpuBuf, tw * th * sizeof(u32));
-        C3D_SyncDisplayTransfer(
-            gpuBuf, GX_BUFFER_DIM(tw, th),
-            (u32*)openPreviewTex.data, GX_BUFFER_DIM(tw, th),
-            (GX_TRANSFER_FLIP_VERT(1) | GX_TRANSFER_OUT_TILED(1) | GX_TRANSFER_RAW_COPY(0) |
-             GX_TRANSFER_IN_FORMAT(GX_TRANSFER_FMT_RGBA8) | GX_TRANSFER_OUT_FORMAT(GX_TRANSFER_FMT_RGBA8) |
-             GX_TRANSFER_SCALING(GX_TRANSFER_SCALE_NO))
-        );
-        linearFree(gpuBuf);
-    }
-    free(composite);
-
-    openPreviewSubTex.width = cw;
-    openPreviewSubTex.height = ch;
-    openPreviewSubTex.left = 0.0f;
-    openPreviewSubTex.top = (float)ch / th;
-    openPreviewSubTex.right = (float)cw / tw;
-    openPreviewSubTex.bottom = 0.0f;
-
-    openPreviewImage.tex = &openPreviewTex;
-    openPreviewImage.subtex = &openPreviewSubTex;
+}
+
+void selectOpenPreview(int index) {
+    previewSelected = index;
+    updateOpenPreview();
+}
+
+bool openPreviewIsLoading(void) {
+    if (!previewWorker || previewSelected < 0 || previewSelected >= openProjectCount) return false;
+    return findCachedPreview(&openProjects[previewSelected]) == NULL;
+}
+
+void updateOpenPreview(void) {
+    LightLock_Lock(&previewLock);
+    bool resultReady = previewResultReady;
+    bool resultOk = previewResultOk;
+    ProjectIndexEntry resultProject = previewResultProject;
+    PreviewPixels result = previewResult;
+    previewResultReady = false;
+    bool busy = previewJobBusy || previewJobPending;
+    ProjectIndexEntry job = previewJob;
+    LightLock_Unlock(&previewLock);
+
+    if (resultReady) {
+        cachePreview(&resultProject, &result, resultOk);
+        free(result.pixels);
+    }
+
+    // The selection first, then its neighbours.
+    int candidates[3] = {previewSelected, previewSelected + 1, previewSelected - 1};
+    int wanted[3];
+    int wantedCount = 0;
+    for (int i = 0; i < 3 && previewSelected >= 0; i++) {
+        if (candidates[i] >= 0 && candidates[i] < openProjectCount) {
+            wanted[wantedCount++] = candidates[i];
+        }
+    }
+
+    if (busy) {
+        // Keep decoding only what is still wanted.
+        bool stillWanted = false;
+        for (int i = 0; i < wantedCount; i++) {
+            if (strcmp(openProjects[wanted[i]].name, job.name) == 0) stillWanted = true;
+        }
+        if (!stillWanted) previewJobCancel = true;
+    } else if (previewWorker) {
+        for (int i = 0; i < wantedCount; i++) {
+            const ProjectIndexEntry* project = &openProjects[wanted[i]];
+            if (findCachedPreview(project)) continue;
+
+            LightLock_Lock(&previewLock);
+            previewJob = *project;
+            previewJobPending = true;
+            previewJobCancel = false;
+            LightLock_Unlock(&previewLock);
+            LightEvent_Signal(&previewWorkEvent);
+            break;
+        }
+    }
+
+    openPreviewValid = false;
+    if (previewSelected < 0 || previewSelected >= openProjectCount) return;
+    PreviewCacheEntry* entry = findCachedPreview(&openProjects[previewSelected]);
+    if (!entry || !entry->ok) return;
+
+    entry->lastUse = ++previewUseClock;
+    openPreviewImage.tex = &entry->tex;
+    openPreviewImage.subtex = &entry->subtex;
+    openPreviewWidth = entry->width;
+    openPreviewHeight = entry->height;
     openPreviewValid = true;
-    openPreviewWidth = cw;
-    openPreviewHeight = ch;
+}
 
-    return true;
+void freeOpenPreview(void) {
+    previewSelected = -1;
+    openPreviewValid = false;
+
+    // A running decode is stopped and its result discarded.
+    LightLock_Lock(&previewLock);
+    previewJobCancel = true;
+    previewJobPending = false;
+    if (previewResultReady) {
+        free(previewResult.pixels);
+        previewResultReady = false;
+    }
+    LightLock_Unlock(&previewLock);
+
+    for (int i = 0; i < PREVIEW_CACHE_SLOTS; i++) {
+        dropCachedPreview(&previewCache[i]);
+    }
+    previewCacheBytes = 0;
 }
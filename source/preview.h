@@ -7,8 +7,30 @@
 /**
  * @file preview.h
  * @brief Project browser list and preview rendering data.
+ *
+ * Previews are decoded on a worker thread (embedded thumbnail, or streamed
+ * layers for files without one) and kept as textures in a small LRU cache.
+ * The neighbours of the selection are prefetched, and a decode that is no
+ * longer wanted is cancelled.
  */
 
+#define PREVIEW_CACHE_SLOTS 16
+#define PREVIEW_CACHE_BUDGET (2 * 1024 * 1024)  /**< Texture bytes kept across selections. */
+
+/** @brief Refresh the browser list (openProjects) through the project index. */
 void scanProjectFiles(void);
+
+void initPreviewLoader(void);
+void exitPreviewLoader(void);
+
+/** @brief Show openProjects[index] (-1 for none); decoding starts in the background when it is not cached. */
+void selectOpenPreview(int index);
+
+/** @brief Per-frame hook: cache finished decodes, start the next one, refresh openPreviewImage. */
+void updateOpenPreview(void);
+
+/** @brief Check whether the selected preview is still being decoded. */
+bool openPreviewIsLoading(void);
+
+/** @brief Drop the selection and all cached previews (leaving the browser). */
 void freeOpenPreview(void);
-bool loadProjectPreview(const char* projectName);
@@ -0,0 +1,376 @@
+#include "project_format.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "history_codec.h"
+
+static bool flushBlock(ProjectBlockWriter* writer) {
+    if (writer->used == 0) return true;
+    if (fwrite(writer->block, 1, writer->used, writer->fp) != writer->used) {
+        writer->failed = true;
+        return false;
+    }
+    writer->offset += writer->used;
+    writer->used = 0;
+    return true;
+}
+
+bool projectWriterOpen(ProjectBlockWriter* writer, const char* path) {
+    memset(writer, 0, sizeof(*writer));
+    writer->block = (uint8_t*)malloc(PROJECT_IO_BLOCK_SIZE);
+    if (!writer->block) return false;
+    writer->fp = fopen(path, "wb");
+    if (!writer->fp) {
+        free(writer->block);
+        writer->block = NULL;
+        return false;
+    }
+    // Our blocks are already large; a second stdio buffer would only add a copy.
+    setvbuf(writer->fp, NULL, _IONBF, 0);
+    return true;
+}
+
+bool projectWriterWrite(ProjectBlockWriter* writer, const void* data, size_t size) {
+    if (writer->failed) return false;
+    const uint8_t* src = (const uint8_t*)data;
+    while (size > 0) {
+        size_t room = PROJECT_IO_BLOCK_SIZE - writer->used;
+        size_t part = size < room ? size : room;
+        memcpy(writer->block + writer->used, src, part);
+        writer->used += part;
+        src += part;
+        size -= part;
+        if (writer->used == PROJECT_IO_BLOCK_SIZE && !flushBlock(writer)) return false;
+    }
+    return true;
+}
+
+bool projectWriterOpenAt(ProjectBlockWriter* writer, const char* path, uint64_t offset) {
+    memset(writer, 0, sizeof(*writer));
+    writer->block = (uint8_t*)malloc(PROJECT_IO_BLOCK_SIZE);
+    if (!writer->block) return false;
+    writer->fp = fopen(path, "r+b");
+    if (!writer->fp) {
+        free(writer->block);
+        writer->block = NULL;
+        return false;
+    }
+    setvbuf(writer->fp, NULL, _IONBF, 0);
+    if (fseek(writer->fp, (long)offset, SEEK_SET) != 0) {
+        projectWriterClose(writer);
+        return false;
+    }
+    writer->offset = offset;
+    return true;
+}
+
+bool projectWriterFlush(ProjectBlockWriter* writer) {
+    if (writer->failed) return false;
+    if (!flushBlock(writer) || fflush(writer->fp) != 0) {
+        writer->failed = true;
+        return false;
+    }
+    return true;
+}
+
+uint64_t projectWriterTell(const ProjectBlockWriter* writer) {
+    return writer->offset + writer->used;
+}
+
+bool projectWriterPatch(ProjectBlockWriter* writer, uint64_t offset, const void* data, size_t size) {
+    if (writer->failed) return false;
+    if (offset + size > projectWriterTell(writer)) return false;
+
+    const uint8_t* src = (const uint8_t*)data;
+    // Part that already reached the file.
+    if (offset < writer->offset) {
+        size_t part = (size_t)(writer->offset - offset);
+        if (part > size) part = size;
+        if (fseek(writer->fp, (long)offset, SEEK_SET) != 0 ||
+            fwrite(src, 1, part, writer->fp) != part ||
+            fseek(writer->fp, (long)writer->offset, SEEK_SET) != 0) {
+            writer->failed = true;
+            return false;
+        }
+        src += part;
+        offset += part;
+        size -= part;
+    }
+    // Part still pending in the block.
+    if (size > 0) {
+        memcpy(writer->block + (offset - writer->offset), src, size);
+    }
+    return true;
+}
+
+bool projectWriterClose(ProjectBlockWriter* writer) {
+    bool ok = false;
+    if (writer->fp) {
+        ok = flushBlock(writer) && !writer->failed;
+        if (fclose(writer->fp) != 0) ok = false;
+    }
+    free(writer->block);
+    memset(writer, 0, sizeof(*writer));
+    return ok;
+}
+
+bool projectChunkListAdd(ProjectChunkList* list, const ProjectChunk* chunk) {
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity ? list->capacity * 2 : 256;
+        ProjectChunk* grown = (ProjectChunk*)realloc(list->entries, capacity * sizeof(ProjectChunk));
+        if (!grown) return false;
+        list->entries = grown;
+        list->capacity = capacity;
+    }
+    list->entries[list->count++] = *chunk;
+    return true;
+}
+
+bool projectWriteChunk(ProjectBlockWriter* writer, ProjectChunkList* list, uint32_t type,
+                       uint32_t layer, uint32_t index, const void* data, size_t size) {
+    ProjectChunk chunk;
+    chunk.type = type;
+    chunk.layer = layer;
+    chunk.index = index;
+    chunk.offset = (uint32_t)projectWriterTell(writer);
+    chunk.size = (uint32_t)size;
+    return projectWriterWrite(writer, data, size) && projectChunkListAdd(list, &chunk);
+}
+
+int* projectMapTileChunks(const ProjectChunk* chunks, uint32_t count, int layerCount, int tileCount) {
+    int* slots = (int*)malloc((size_t)layerCount * tileCount * sizeof(int));
+    if (!slots) return NULL;
+    for (int i = 0; i < layerCount * tileCount; i++) {
+        slots[i] = -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        const ProjectChunk* chunk = &chunks[i];
+        if (chunk->type == PROJECT_CHUNK_TILE && chunk->layer < (uint32_t)layerCount &&
+            chunk->index < (uint32_t)tileCount) {
+            slots[chunk->layer * tileCount + chunk->index] = (int)i;
+        }
+    }
+    return slots;
+}
+
+uint64_t projectLiveBytes(const ProjectChunk* chunks, uint32_t count, size_t headerBytes) {
+    uint64_t bytes = headerBytes + (uint64_t)count * sizeof(ProjectChunk);
+    for (uint32_t i = 0; i < count; i++) {
+        bytes += chunks[i].size;
+    }
+    return bytes;
+}
+
+int projectTileCount(int width, int height, int tileSize) {
+    int cols = (width + tileSize - 1) / tileSize;
+    int rows = (height + tileSize - 1) / tileSize;
+    return cols * rows;
+}
+
+void projectTileRect(int width, int height, int tileSize, int index, int* x, int* y, int* w, int* h) {
+    int cols = (width + tileSize - 1) / tileSize;
+    int tx = (index % cols) * tileSize;
+    int ty = (index / cols) * tileSize;
+    *x = tx;
+    *y = ty;
+    *w = (tx + tileSize <= width) ? tileSize : width - tx;
+    *h = (ty + tileSize <= height) ? tileSize : height - ty;
+}
+
+bool projectPackTile(const uint32_t* pixels, int stride, int x, int y, int w, int h,
+                     uint32_t* scratch, uint8_t** outPacked, size_t* outSize) {
+    *outPacked = NULL;
+    *outSize = 0;
+
+    bool empty = true;
+    for (int row = 0; row < h; row++) {
+        const uint32_t* src = &pixels[(y + row) * stride + x];
+        uint32_t* dst = &scratch[row * w];
+        for (int col = 0; col < w; col++) {
+            dst[col] = src[col];
+            if (src[col]) empty = false;
+        }
+    }
+    if (empty) return true;
+
+    size_t count = (size_t)w * h;
+    uint8_t* packed = historyCodecCompress(scratch, count, outSize, NULL);
+    if (!packed) {
+        // Noisy tiles do not shrink; store them as-is.
+        *outSize = 1 + count * sizeof(uint32_t);
+        packed = (uint8_t*)malloc(*outSize);
+        if (!packed) return false;
+        packed[0] = HISTORY_CODEC_RAW;
+        memcpy(packed + 1, scratch, count * sizeof(uint32_t));
+    }
+    *outPacked = packed;
+    return true;
+}
+
+bool projectUnpackTile(const uint8_t* packed, size_t packedSize, uint32_t* pixels, int stride,
+                       int x, int y, int w, int h, uint32_t* scratch) {
+    if (!historyCodecDecompress(packed, packedSize, scratch, (size_t)w * h)) return false;
+    for (int row = 0; row < h; row++) {
+        memcpy(&pixels[(y + row) * stride + x], &scratch[row * w], w * sizeof(uint32_t));
+    }
+    return true;
+}
+
+void projectThumbnailSize(int width, int height, int* outWidth, int* outHeight) {
+    int w = width;
+    int h = height;
+    if (w > PROJECT_THUMB_MAX_WIDTH || h > PROJECT_THUMB_MAX_HEIGHT) {
+        // Scale by the tighter of the two limits.
+        if ((int64_t)width * PROJECT_THUMB_MAX_HEIGHT > (int64_t)height * PROJECT_THUMB_MAX_WIDTH) {
+            w = PROJECT_THUMB_MAX_WIDTH;
+            h = (int)((int64_t)height * PROJECT_THUMB_MAX_WIDTH / width);
+        } else {
+            h = PROJECT_THUMB_MAX_HEIGHT;
+            w = (int)((int64_t)width * PROJECT_THUMB_MAX_HEIGHT / height);
+        }
+    }
+    *outWidth = w > 0 ? w : 1;
+    *outHeight = h > 0 ? h : 1;
+}
+
+uint8_t* projectBuildThumbnail(const uint32_t* pixels, int stride, int width, int height, size_t* outSize) {
+    int tw, th;
+    projectThumbnailSize(width, height, &tw, &th);
+
+    size_t rawSize = (size_t)tw * th * sizeof(uint16_t);
+    uLong bound = compressBound((uLong)rawSize);
+    uint16_t* thumb = (uint16_t*)malloc(rawSize);
+    uint32_t* sums = (uint32_t*)malloc((size_t)tw * 3 * sizeof(uint32_t));
+    int* columnOf = (int*)malloc((size_t)width * sizeof(int));
+    uint8_t* payload = (uint8_t*)malloc(sizeof(ProjectThumbnailHeader) + bound);
+    if (!thumb || !sums || !columnOf || !payload) {
+        free(thumb);
+        free(sums);
+        free(columnOf);
+        free(payload);
+        return NULL;
+    }
+
+    for (int x = 0; x < width; x++) {
+        columnOf[x] = (int)((int64_t)x * tw / width);
+    }
+
+    // Each output row averages the source rows [y0, y1) over its columns.
+    int y0 = 0;
+    for (int ty = 0; ty < th; ty++) {
+        int y1 = (int)((int64_t)(ty + 1) * height / th);
+        if (y1 <= y0) y1 = y0 + 1;
+        memset(sums, 0, (size_t)tw * 3 * sizeof(uint32_t));
+        for (int y = y0; y < y1; y++) {
+            const uint32_t* row = &pixels[(size_t)y * stride];
+            for (int x = 0; x < width; x++) {
+                uint32_t p = row[x];
+                uint32_t* sum = &sums[columnOf[x] * 3];
+                sum[0] += p >> 24;
+                sum[1] += (p >> 16) & 0xFF;
+                sum[2] += (p >> 8) & 0xFF;
+            }
+        }
+
+        int x0 = 0;
+        for (int tx = 0; tx < tw; tx++) {
+            int x1 = x0;
+            while (x1 < width && columnOf[x1] == tx) x1++;
+            uint32_t count = (uint32_t)(x1 - x0) * (uint32_t)(y1 - y0);
+            if (count == 0) count = 1;
+            uint32_t r = sums[tx * 3] / count;
+            uint32_t g = sums[tx * 3 + 1] / count;
+            uint32_t b = sums[tx * 3 + 2] / count;
+            thumb[ty * tw + tx] = (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+            x0 = x1;
+        }
+        y0 = y1;
+    }
+    free(sums);
+    free(columnOf);
+
+    ProjectThumbnailHeader header = {(uint16_t)tw, (uint16_t)th, PROJECT_THUMB_RGB565, 0};
+    memcpy(payload, &header, sizeof(header));
+    uLongf packedSize = bound;
+    int result = compress2(payload + sizeof(header), &packedSize, (const Bytef*)thumb, (uLong)rawSize, 1);
+    free(thumb);
+    if (result != Z_OK) {
+        free(payload);
+        return NULL;
+    }
+
+    *outSize = sizeof(header) + packedSize;
+    return payload;
+}
+
+uint16_t* projectDecodeThumbnail(const uint8_t* payload, size_t size, int* outWidth, int* outHeight) {
+    ProjectThumbnailHeader header;
+    if (size < sizeof(header)) return NULL;
+    memcpy(&header, payload, sizeof(header));
+    if (header.format != PROJECT_THUMB_RGB565 || header.width == 0 || header.height == 0 ||
+        header.width > PROJECT_THUMB_MAX_WIDTH || header.height > PROJECT_THUMB_MAX_HEIGHT) {
+        return NULL;
+    }
+
+    size_t rawSize = (size_t)header.width * header.height * sizeof(uint16_t);
+    uint16_t* thumb = (uint16_t*)malloc(rawSize);
+    if (!thumb) return NULL;
+    uLongf unpackedSize = (uLongf)rawSize;
+    if (uncompress((Bytef*)thumb, &unpackedSize, payload + sizeof(header), (uLong)(size - sizeof(header))) != Z_OK ||
+        unpackedSize != rawSize) {
+        free(thumb);
+        return NULL;
+    }
+
+    *outWidth = header.width;
+    *outHeight = header.height;
+    return thumb;
+}
+
+uint32_t projectChunkTableCrc(const ProjectChunk* chunks, uint32_t count) {
+    uint32_t crc = crc32(0L, Z_NULL, 0);
+    if (count == 0) return crc;
+    return crc32(crc, (const Bytef*)chunks, (uInt)(count * sizeof(ProjectChunk)));
+}
+
+bool projectWriteChunkTable(ProjectBlockWriter* writer, const ProjectChunk* chunks, uint32_t count,
+                            ProjectChunkHeader* header) {
+    header->tableOffset = (uint32_t)projectWriterTell(writer);
+    header->chunkCount = count;
+    header->tableCrc = projectChunkTableCrc(chunks, count);
+    return projectWriterWrite(writer, chunks, (size_t)count * sizeof(ProjectChunk));
+}
+
+bool projectReadChunkTable(FILE* fp, const ProjectChunkHeader* header, long fileSize,
+                           ProjectChunk** outChunks) {
+    *outChunks = NULL;
+    if (header->chunkCount == 0 || header->chunkCount > PROJECT_MAX_CHUNKS) return false;
+    if (header->tileSize == 0) return false;
+
+    size_t tableBytes = (size_t)header->chunkCount * sizeof(ProjectChunk);
+    if ((uint64_t)header->tableOffset + tableBytes > (uint64_t)fileSize) return false;
+
+    ProjectChunk* chunks = (ProjectChunk*)malloc(tableBytes);
+    if (!chunks) return false;
+    if (fseek(fp, (long)header->tableOffset, SEEK_SET) != 0 ||
+        fread(chunks, sizeof(ProjectChunk), header->chunkCount, fp) != header->chunkCount) {
+        free(chunks);
+        return false;
+    }
+    if (projectChunkTableCrc(chunks, header->chunkCount) != header->tableCrc) {
+        free(chunks);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < header->chunkCount; i++) {
+        if ((uint64_t)chunks[i].offset + chunks[i].size > header->tableOffset) {
+            free(chunks);
+            return false;
+        }
+    }
+
+    *outChunks = chunks;
+    return true;
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @file project_format.h
+ * @brief Chunked layout of version 3 project files.
+ *
+ * Platform independent (stdio + zlib) so it can be built on a host.
+ * A v3 file is laid out as:
+ *  - ProjectHeader (see project_io.h), version 3.
+ *  - ProjectChunkHeader, pointing at the chunk table.
+ *  - Chunk payloads, in any order.
+ *  - The chunk table: chunkCount ProjectChunk entries.
+ *
+ * Incremental saves append changed chunks and a new table after the old
+ * table, then repoint the headers; bytes no table refers to are dead space
+ * that a later full rewrite drops. Since the old table and payloads are never
+ * overwritten, a save interrupted before the header update leaves the
+ * previous state intact.
+ *
+ * Full saves write the thumbnail chunk first, right after the headers, so
+ * the browser can show a project without touching its layers.
+ *
+ * Layer pixels are cut into PROJECT_TILE_SIZE square tiles (row-major, edge
+ * tiles are clipped to the canvas). Each non-empty tile is one chunk packed
+ * with the history codec; tiles that are fully zero (transparent) have no
+ * chunk at all. Multi-byte fields use the native (little-endian) byte order,
+ * like the rest of the project file.
+ */
+
+#define PROJECT_TILE_SIZE 64
+#define PROJECT_IO_BLOCK_SIZE (256 * 1024)
+#define PROJECT_MAX_CHUNKS (1u << 20)
+
+#define PROJECT_CHUNK_LAYER 1     /**< ProjectLayerInfo of layer `layer`. */
+#define PROJECT_CHUNK_TILE 2      /**< Packed pixels of tile `index` of layer `layer`. */
+#define PROJECT_CHUNK_SETTINGS 3  /**< Brush sizes and palette. */
+#define PROJECT_CHUNK_THUMBNAIL 4 /**< Downscaled composite for the project browser. */
+
+#define PROJECT_THUMB_MAX_WIDTH 400   /**< Thumbnails fit the top screen. */
+#define PROJECT_THUMB_MAX_HEIGHT 240
+#define PROJECT_THUMB_RGB565 1        /**< Deflated RGB565 rows. */
+
+/** @brief Follows the ProjectHeader in v3 files. */
+typedef struct {
+    uint32_t tableOffset;  /**< File offset of the chunk table. */
+    uint32_t chunkCount;   /**< Number of chunk table entries. */
+    uint32_t tileSize;     /**< Tile edge length in pixels. */
+    uint32_t tableCrc;     /**< crc32 of the chunk table. */
+} ProjectChunkHeader;
+
+/** @brief One chunk table entry. */
+typedef struct {
+    uint32_t type;    /**< PROJECT_CHUNK_* */
+    uint32_t layer;   /**< Layer index (LAYER and TILE chunks). */
+    uint32_t index;   /**< Tile index (TILE chunks). */
+    uint32_t offset;  /**< File offset of the payload. */
+    uint32_t size;    /**< Payload size in bytes. */
+} ProjectChunk;
+
+/** @brief Payload of a PROJECT_CHUNK_LAYER chunk. */
+typedef struct {
+    uint8_t visible;
+    uint8_t opacity;
+    uint8_t blendMode;
+    uint8_t alphaLock;
+    uint8_t clipping;
+    uint8_t reserved[3];
+    char name[32];
+} ProjectLayerInfo;
+
+/** @brief Start of a PROJECT_CHUNK_THUMBNAIL payload; the pixel data follows. */
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    uint16_t format;    /**< PROJECT_THUMB_* */
+    uint16_t reserved;
+} ProjectThumbnailHeader;
+
+/**
+ * @brief Sequential file writer that hands the file system whole blocks.
+ *
+ * Payloads are gathered into a PROJECT_IO_BLOCK_SIZE buffer and written one
+ * full block at a time (stdio buffering is disabled), so the SD card sees
+ * few large, block-aligned writes instead of one call per field or row.
+ */
+typedef struct {
+    FILE* fp;
+    uint8_t* block;
+    size_t used;          /**< Bytes pending in block. */
+    uint64_t offset;      /**< File offset of block[0]. */
+    bool failed;
+} ProjectBlockWriter;
+
+/** @brief Create (truncate) path for writing. */
+bool projectWriterOpen(ProjectBlockWriter* writer, const char* path);
+
+/** @brief Open an existing file and continue writing at offset (its current size). */
+bool projectWriterOpenAt(ProjectBlockWriter* writer, const char* path, uint64_t offset);
+
+/** @brief Append bytes. */
+bool projectWriterWrite(ProjectBlockWriter* writer, const void* data, size_t size);
+
+/** @brief Current end offset (bytes written so far, including pending ones). */
+uint64_t projectWriterTell(const ProjectBlockWriter* writer);
+
+/** @brief Push pending bytes to the file; later patches land after them. */
+bool projectWriterFlush(ProjectBlockWriter* writer);
+
+/**
+ * @brief Overwrite bytes already written at offset (e.g. a header placeholder).
+ *
+ * Bytes that already reached the file are written immediately, pending ones
+ * with the next block; flush first when the order matters.
+ */
+bool projectWriterPatch(ProjectBlockWriter* writer, uint64_t offset, const void* data, size_t size);
+
+/**
+ * @brief Flush pending bytes and close the file.
+ * @return false when any write since open failed.
+ */
+bool projectWriterClose(ProjectBlockWriter* writer);
+
+/** @brief Growable chunk table. Zero-initialize before use. */
+typedef struct {
+    ProjectChunk* entries;
+    uint32_t count;
+    uint32_t capacity;
+} ProjectChunkList;
+
+/** @brief Add an entry (e.g. one carried over from a previous table). */
+bool projectChunkListAdd(ProjectChunkList* list, const ProjectChunk* chunk);
+
+/** @brief Append a payload at the writer's position and add its entry. */
+bool projectWriteChunk(ProjectBlockWriter* writer, ProjectChunkList* list, uint32_t type,
+                       uint32_t layer, uint32_t index, const void* data, size_t size);
+
+/**
+ * @brief Map tiles to their entries in a chunk table.
+ * @return malloc'd array of layerCount * tileCount table indices (-1 for no chunk), or NULL.
+ */
+int* projectMapTileChunks(const ProjectChunk* chunks, uint32_t count, int layerCount, int tileCount);
+
+/** @brief Bytes of a file that a table refers to: headerBytes, payloads and the table itself. */
+uint64_t projectLiveBytes(const ProjectChunk* chunks, uint32_t count, size_t headerBytes);
+
+/** @brief Number of tiles covering a width x height canvas. */
+int projectTileCount(int width, int height, int tileSize);
+
+/** @brief Canvas rectangle covered by tile index (clipped to the canvas). */
+void projectTileRect(int width, int height, int tileSize, int index, int* x, int* y, int* w, int* h);
+
+/**
+ * @brief Pack one tile of a strided pixel buffer.
+ * @param scratch Room for tileSize * tileSize pixels.
+ * @param outPacked Receives malloc'd packed data, or NULL when the tile is empty.
+ * @param outSize Receives the packed size in bytes.
+ * @return false when out of memory.
+ */
+bool projectPackTile(const uint32_t* pixels, int stride, int x, int y, int w, int h,
+                     uint32_t* scratch, uint8_t** outPacked, size_t* outSize);
+
+/**
+ * @brief Unpack a tile produced by projectPackTile into a strided pixel buffer.
+ * @param scratch Room for tileSize * tileSize pixels.
+ * @return false when the packed data is corrupt.
+ */
+bool projectUnpackTile(const uint8_t* packed, size_t packedSize, uint32_t* pixels, int stride,
+                       int x, int y, int w, int h, uint32_t* scratch);
+
+/** @brief Thumbnail size for a canvas: fits PROJECT_THUMB_MAX_*, keeps the aspect, never enlarges. */
+void projectThumbnailSize(int width, int height, int* outWidth, int* outHeight);
+
+/**
+ * @brief Box-filter an opaque RGBA composite down to a thumbnail payload.
+ * @param outSize Receives the payload size in bytes.
+ * @return malloc'd ProjectThumbnailHeader plus packed pixels, or NULL when out of memory.
+ */
+uint8_t* projectBuildThumbnail(const uint32_t* pixels, int stride, int width, int height, size_t* outSize);
+
+/**
+ * @brief Decode a thumbnail payload.
+ * @return malloc'd RGB565 pixels (outWidth * outHeight, row-major), or NULL when corrupt.
+ */
+uint16_t* projectDecodeThumbnail(const uint8_t* payload, size_t size, int* outWidth, int* outHeight);
+
+/** @brief crc32 of a chunk table, as stored in ProjectChunkHeader::tableCrc. */
+uint32_t projectChunkTableCrc(const ProjectChunk* chunks, uint32_t count);
+
+/**
+ * @brief Append a chunk table.
+ * @param header Receives tableOffset, chunkCount and tableCrc for the table.
+ */
+bool projectWriteChunkTable(ProjectBlockWriter* writer, const ProjectChunk* chunks, uint32_t count,
+                            ProjectChunkHeader* header);
+
+/**
+ * @brief Read and validate the chunk table described by header.
+ * @param fileSize Size of the file; entries pointing past it are rejected.
+ * @param outChunks Receives a malloc'd table of header->chunkCount entries.
+ * @return true on success.
+ */
+bool projectReadChunkTable(FILE* fp, const ProjectChunkHeader* header, long fileSize,
+                           ProjectChunk** outChunks);
@@ -0,0 +1,182 @@
+#include "project_index.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "project_io.h"
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 count;
+    u32 crc;          // crc32 of the entries.
+} ProjectIndexHeader;
+
+static int compareEntryNames(const void* a, const void* b) {
+    return strcmp(((const ProjectIndexEntry*)a)->name, ((const ProjectIndexEntry*)b)->name);
+}
+
+static int compareEntryNamesNoCase(const void* a, const void* b) {
+    const ProjectIndexEntry* ea = (const ProjectIndexEntry*)a;
+    const ProjectIndexEntry* eb = (const ProjectIndexEntry*)b;
+    int result = strcasecmp(ea->name, eb->name);
+    return result != 0 ? result : strcmp(ea->name, eb->name);
+}
+
+static int compareEntryDates(const void* a, const void* b) {
+    const ProjectIndexEntry* ea = (const ProjectIndexEntry*)a;
+    const ProjectIndexEntry* eb = (const ProjectIndexEntry*)b;
+    if (ea->mtime != eb->mtime) return ea->mtime > eb->mtime ? -1 : 1;
+    return compareEntryNamesNoCase(a, b);
+}
+
+static u32 entriesCrc(const ProjectIndexEntry* entries, u32 count) {
+    uLong crc = crc32(0L, Z_NULL, 0);
+    if (count == 0) return (u32)crc;
+    return (u32)crc32(crc, (const Bytef*)entries, (uInt)(count * sizeof(ProjectIndexEntry)));
+}
+
+// Read the index file; a missing, outdated or corrupt index reads as empty.
+static ProjectIndexEntry* readIndexFile(u32* outCount) {
+    *outCount = 0;
+    FILE* fp = fopen(PROJECT_INDEX_PATH, "rb");
+    if (!fp) return NULL;
+
+    ProjectIndexHeader header;
+    ProjectIndexEntry* entries = NULL;
+    if (fread(&header, sizeof(header), 1, fp) == 1 &&
+        header.magic == PROJECT_INDEX_MAGIC &&
+        header.version == PROJECT_INDEX_VERSION &&
+        header.count > 0 && header.count <= (1u << 20)) {
+        entries = (ProjectIndexEntry*)malloc(header.count * sizeof(ProjectIndexEntry));
+        if (entries && (fread(entries, sizeof(ProjectIndexEntry), header.count, fp) != header.count ||
+                        entriesCrc(entries, header.count) != header.crc)) {
+            free(entries);
+            entries = NULL;
+        }
+    }
+    fclose(fp);
+
+    if (entries) *outCount = header.count;
+    return entries;
+}
+
+static void writeIndexFile(const ProjectIndexEntry* entries, u32 count) {
+    FILE* fp = fopen(PROJECT_INDEX_PATH, "wb");
+    if (!fp) return;
+    ProjectIndexHeader header = {PROJECT_INDEX_MAGIC, PROJECT_INDEX_VERSION, count, entriesCrc(entries, count)};
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(entries, sizeof(ProjectIndexEntry), count, fp) == count;
+    // A torn index fails its crc and is rebuilt on the next refresh.
+    if (fclose(fp) != 0 || !ok) remove(PROJECT_INDEX_PATH);
+}
+
+// Open a new or changed project to fill in what the browser needs.
+static void indexProjectFile(const char* filePath, ProjectIndexEntry* entry) {
+    entry->width = 0;
+    entry->height = 0;
+    entry->thumbOffset = 0;
+    entry->thumbSize = 0;
+
+    ProjectReader reader;
+    if (!projectReaderOpenFile(&reader, filePath)) return;
+    entry->width = reader.header.canvasWidth;
+    entry->height = reader.header.canvasHeight;
+    for (u32 i = 0; i < reader.chunkCount; i++) {
+        if (reader.chunks[i].type == PROJECT_CHUNK_THUMBNAIL) {
+            entry->thumbOffset = reader.chunks[i].offset;
+            entry->thumbSize = reader.chunks[i].size;
+            break;
+        }
+    }
+    projectReaderClose(&reader);
+}
+
+static bool growEntries(ProjectIndexEntry** entries, int count, int* capacity) {
+    if (count < *capacity) return true;
+    int grown = *capacity ? *capacity * 2 : 64;
+    ProjectIndexEntry* larger = (ProjectIndexEntry*)realloc(*entries, grown * sizeof(ProjectIndexEntry));
+    if (!larger) return false;
+    *entries = larger;
+    *capacity = grown;
+    return true;
+}
+
+void refreshProjectIndex(void) {
+    freeProjectIndex();
+
+    u32 cachedCount;
+    ProjectIndexEntry* cached = readIndexFile(&cachedCount);
+    if (cached) qsort(cached, cachedCount, sizeof(ProjectIndexEntry), compareEntryNames);
+
+    ProjectIndexEntry* entries = NULL;
+    int count = 0;
+    int capacity = 0;
+    bool changed = false;
+
+    DIR* dir = opendir(SAVE_DIR);
+    if (dir) {
+        struct dirent* ent;
+        while ((ent = readdir(dir)) != NULL) {
+            const char* name = ent->d_name;
+            size_t len = strlen(name);
+            // Longer names could not be opened by name anyway.
+            if (len <= 5 || len - 5 >= PROJECT_NAME_MAX || strcmp(name + len - 5, ".mgdw") != 0) continue;
+            if (!growEntries(&entries, count, &capacity)) break;
+
+            ProjectIndexEntry* entry = &entries[count];
+            memset(entry, 0, sizeof(*entry));
+            memcpy(entry->name, name, len - 5);
+
+            char filePath[256];
+            snprintf(filePath, sizeof(filePath), "%s/%s", SAVE_DIR, name);
+            struct stat st;
+            if (stat(filePath, &st) != 0) continue;
+            entry->mtime = (u64)st.st_mtime;
+            entry->fileSize = (u64)st.st_size;
+
+            const ProjectIndexEntry* old = cached
+                ? (const ProjectIndexEntry*)bsearch(entry, cached, cachedCount, sizeof(ProjectIndexEntry), compareEntryNames)
+                : NULL;
+            if (old && old->mtime == entry->mtime && old->fileSize == entry->fileSize) {
+                *entry = *old;
+            } else {
+                indexProjectFile(filePath, entry);
+                changed = true;
+            }
+            count++;
+        }
+        closedir(dir);
+    }
+
+    // Projects deleted since the index was written.
+    if ((u32)count != cachedCount) changed = true;
+    free(cached);
+
+    if (changed) {
+        qsort(entries, count, sizeof(ProjectIndexEntry), compareEntryNames);
+        writeIndexFile(entries, count);
+    }
+
+    openProjects = entries;
+    openProjectCount = count;
+    sortOpenProjects(openSortMode);
+}
+
+void sortOpenProjects(OpenSortMode mode) {
+    openSortMode = mode;
+    if (openProjectCount < 2) return;
+    qsort(openProjects, openProjectCount, sizeof(ProjectIndexEntry),
+          mode == OPEN_SORT_NAME ? compareEntryNamesNoCase : compareEntryDates);
+}
+
+void freeProjectIndex(void) {
+    free(openProjects);
+    openProjects = NULL;
+    openProjectCount = 0;
+}
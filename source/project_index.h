@@ -0,0 +1,31 @@
+#pragma once
+
+#include "app_state.h"
+
+/**
+ * @file project_index.h
+ * @brief Persistent index of saved projects for the open browser.
+ *
+ * PROJECT_INDEX_PATH caches name, modification time, file size, canvas size
+ * and thumbnail location of every project in SAVE_DIR. A refresh still lists
+ * the directory and stats each file, but only opens projects whose mtime or
+ * size no longer match their cached entry.
+ */
+
+#define PROJECT_INDEX_PATH SAVE_DIR "/.index"
+#define PROJECT_INDEX_MAGIC 0x4D474449  /**< "MGDI" */
+#define PROJECT_INDEX_VERSION 1
+
+/**
+ * @brief Fill openProjects from the index, revalidating against SAVE_DIR.
+ *
+ * The index file is rewritten when any entry was added, changed or removed.
+ * The list is left in openSortMode order.
+ */
+void refreshProjectIndex(void);
+
+/** @brief Sort openProjects and remember the order in openSortMode. */
+void sortOpenProjects(OpenSortMode mode);
+
+/** @brief Release openProjects. */
+void freeProjectIndex(void);
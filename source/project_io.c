@@ -5,10 +5,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
+#include "canvas.h"
 #include "history.h"
 #include "layers.h"
+#include "memory.h"
+#include "project_stream.h"
 #include "util.h"
+#include "worker.h"
 
 int findNextUntitledIndex(void) {
     const char* prefix = "Untitled ";
@@ -59,6 +64,345 @@ int findNextUntitledIndex(void) {
     return candidate;
 }
 
+void projectFillHeader(ProjectHeader* header) {
+    header->magic = PROJECT_FILE_MAGIC;
+    header->version = PROJECT_FILE_VERSION;
+    header->canvasWidth = CANVAS_WIDTH;
+    header->canvasHeight = CANVAS_HEIGHT;
+    header->numLayers = MAX_LAYERS;
+    header->currentLayer = currentLayerIndex;
+    header->currentTool = currentTool;
+    header->brushSize = getCurrentBrushSize();
+    header->currentColor = currentColor;
+    header->brushAlpha = brushAlpha;
+    header->currentBrushType = (u32)currentBrushType;
+    header->hue = currentHue;
+    header->saturation = currentSaturation;
+    header->value = currentValue;
+
+    header->paletteCount = 0;
+    for (int i = 0; i < PALETTE_MAX_COLORS; i++) {
+        if (paletteUsed[i]) header->paletteCount++;
+    }
+}
+
+// The project file as last written or loaded, so that quick saves can append
+// only the tiles modified since.
+static struct {
+    bool valid;
+    char path[256];
+    int width;
+    int height;
+    u32 generation;       // Layer generation the file is current with.
+    ProjectChunk* chunks;
+    u32 chunkCount;
+    u64 fileSize;
+    u64 liveBytes;        // Headers, referenced payloads and the table.
+} savedFile;
+
+static void forgetSavedFile(void) {
+    free(savedFile.chunks);
+    memset(&savedFile, 0, sizeof(savedFile));
+}
+
+// Takes ownership of chunks.
+static void rememberSavedFile(const char* path, u32 generation, ProjectChunk* chunks, u32 chunkCount,
+                              u64 fileSize) {
+    forgetSavedFile();
+    savedFile.valid = true;
+    snprintf(savedFile.path, sizeof(savedFile.path), "%s", path);
+    savedFile.width = CANVAS_WIDTH;
+    savedFile.height = CANVAS_HEIGHT;
+    savedFile.generation = generation;
+    savedFile.chunks = chunks;
+    savedFile.chunkCount = chunkCount;
+    savedFile.fileSize = fileSize;
+    savedFile.liveBytes = projectLiveBytes(chunks, chunkCount,
+                                           sizeof(ProjectHeader) + sizeof(ProjectChunkHeader));
+}
+
+void projectFillLayerInfo(int layerIndex, ProjectLayerInfo* info) {
+    const Layer* layer = &layers[layerIndex];
+    memset(info, 0, sizeof(*info));
+    info->visible = layer->visible;
+    info->opacity = layer->opacity;
+    info->blendMode = (u8)layer->blendMode;
+    info->alphaLock = layer->alphaLock;
+    info->clipping = layer->clipping;
+    memcpy(info->name, layer->name, sizeof(info->name));
+}
+
+void projectFillSettings(u8* out) {
+    memcpy(out, brushSizesByType, sizeof(brushSizesByType));
+    out += sizeof(brushSizesByType);
+    memcpy(out, paletteUsed, sizeof(paletteUsed));
+    out += sizeof(paletteUsed);
+    memcpy(out, paletteColors, sizeof(paletteColors));
+}
+
+// savedSlots (optional) maps layer * tileCount + tile to the tile's entry in
+// savedFile.chunks, or -1; unmodified tiles then keep their saved payload.
+static bool writeLayerChunks(ProjectBlockWriter* writer, ProjectChunkList* list, int layerIndex,
+                             u32* scratch, const int* savedSlots) {
+    ProjectLayerInfo info;
+    projectFillLayerInfo(layerIndex, &info);
+    if (!projectWriteChunk(writer, list, PROJECT_CHUNK_LAYER, layerIndex, 0, &info, sizeof(info))) {
+        return false;
+    }
+
+    const u32* pixels = layers[layerIndex].buffer;
+    int tileCount = projectTileCount(CANVAS_WIDTH, CANVAS_HEIGHT, PROJECT_TILE_SIZE);
+    for (int t = 0; t < tileCount; t++) {
+        if (savedSlots && getLayerTileGeneration(layerIndex, t) <= savedFile.generation) {
+            int slot = savedSlots[layerIndex * tileCount + t];
+            if (slot >= 0 && !projectChunkListAdd(list, &savedFile.chunks[slot])) return false;
+            continue;
+        }
+
+        int x, y, w, h;
+        projectTileRect(CANVAS_WIDTH, CANVAS_HEIGHT, PROJECT_TILE_SIZE, t, &x, &y, &w, &h);
+
+        u8* packed;
+        size_t packedSize;
+        if (!projectPackTile(pixels, LAYER_STRIDE, x, y, w, h, scratch, &packed, &packedSize)) {
+            return false;
+        }
+        if (!packed) continue;
+
+        bool ok = projectWriteChunk(writer, list, PROJECT_CHUNK_TILE, layerIndex, t, packed, packedSize);
+        free(packed);
+        if (!ok) return false;
+    }
+    return true;
+}
+
+// Thumbnail payload from a grid of composited samples a few times the
+// thumbnail size, which the box filter averages down. Nothing canvas sized
+// is allocated, so it works for any canvas.
+#define THUMB_SOURCE_SCALE 4
+
+static u8* buildProjectThumbnail(size_t* outSize) {
+    int thumbWidth, thumbHeight;
+    projectThumbnailSize(CANVAS_WIDTH, CANVAS_HEIGHT, &thumbWidth, &thumbHeight);
+    int width = thumbWidth * THUMB_SOURCE_SCALE < CANVAS_WIDTH ? thumbWidth * THUMB_SOURCE_SCALE : CANVAS_WIDTH;
+    int height = thumbHeight * THUMB_SOURCE_SCALE < CANVAS_HEIGHT ? thumbHeight * THUMB_SOURCE_SCALE : CANVAS_HEIGHT;
+
+    int* columns = (int*)memAlloc(width * sizeof(int));
+    int* rows = (int*)memAlloc(height * sizeof(int));
+    u32* pixels = (u32*)memAlloc((size_t)width * height * sizeof(u32));
+    u8* thumb = NULL;
+    if (columns && rows && pixels) {
+        for (int i = 0; i < width; i++) {
+            columns[i] = (int)(((u64)i * 2 + 1) * CANVAS_WIDTH / (width * 2));
+        }
+        for (int j = 0; j < height; j++) {
+            rows[j] = (int)(((u64)j * 2 + 1) * CANVAS_HEIGHT / (height * 2));
+        }
+        compositeLayerSamples(pixels, width, columns, width, rows, height);
+        projectStreamFillPending(pixels, width, columns, width, rows, height);
+        thumb = projectBuildThumbnail(pixels, width, width, height, outSize);
+    }
+    free(pixels);
+    free(rows);
+    free(columns);
+    return thumb;
+}
+
+// Write every layer and the settings, then the chunk table. The headers are
+// left to the caller since their position in the write order matters.
+static bool writeProjectChunks(ProjectBlockWriter* writer, ProjectChunkList* list, const int* savedSlots,
+                               ProjectChunkHeader* chunkHeader) {
+    // Thumbnail first, so full saves keep it next to the headers.
+    size_t thumbSize;
+    u8* thumb = buildProjectThumbnail(&thumbSize);
+    // A save without thumbnail is still complete; the browser falls back to the layers.
+    bool thumbOk = !thumb || projectWriteChunk(writer, list, PROJECT_CHUNK_THUMBNAIL, 0, 0, thumb, thumbSize);
+    free(thumb);
+    if (!thumbOk) return false;
+
+    u32* scratch = (u32*)memAlloc(PROJECT_TILE_SIZE * PROJECT_TILE_SIZE * sizeof(u32));
+    bool ok = scratch != NULL;
+    for (int i = 0; ok && i < MAX_LAYERS; i++) {
+        ok = writeLayerChunks(writer, list, i, scratch, savedSlots);
+    }
+    free(scratch);
+    if (!ok) return false;
+
+    u8 settings[PROJECT_SETTINGS_SIZE];
+    projectFillSettings(settings);
+    chunkHeader->tileSize = PROJECT_TILE_SIZE;
+    return projectWriteChunk(writer, list, PROJECT_CHUNK_SETTINGS, 0, 0, settings, sizeof(settings)) &&
+           projectWriteChunkTable(writer, list->entries, list->count, chunkHeader);
+}
+
+static ProjectIoStats lastIoStats;
+
+static void recordIoStats(bool save, u64 bytes, u64 ticks) {
+    lastIoStats.valid = true;
+    lastIoStats.save = save;
+    lastIoStats.bytes = bytes;
+    lastIoStats.ms = workerTicksToMs(ticks);
+    lastIoStats.MBps = lastIoStats.ms > 0.0f
+        ? (float)bytes / (1024.0f * 1024.0f) / (lastIoStats.ms / 1000.0f)
+        : 0.0f;
+    lastIoStats.readyMs = lastIoStats.ms;
+}
+
+void getProjectIoStats(ProjectIoStats* stats) {
+    *stats = lastIoStats;
+}
+
+// Write the current canvas and settings as a complete v3 project file. The
+// file is built next to the target and renamed over it, so an interrupted
+// save never leaves a half-written project behind.
+static bool writeProjectFile(const char* filePath) {
+    projectStreamWaitAll();
+    u64 start = svcGetSystemTick();
+    u32 generation = getLayerGeneration();
+
+    char tempPath[256 + 8];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", filePath);
+
+    ProjectBlockWriter writer;
+    if (!projectWriterOpen(&writer, tempPath)) return false;
+
+    ProjectChunkList list = {0};
+    ProjectHeader header;
+    projectFillHeader(&header);
+    ProjectChunkHeader chunkHeader = {0, 0, PROJECT_TILE_SIZE, 0};
+
+    bool ok = projectWriterWrite(&writer, &header, sizeof(header)) &&
+              projectWriterWrite(&writer, &chunkHeader, sizeof(chunkHeader)) &&
+              writeProjectChunks(&writer, &list, NULL, &chunkHeader) &&
+              projectWriterPatch(&writer, sizeof(header), &chunkHeader, sizeof(chunkHeader));
+
+    u64 bytes = projectWriterTell(&writer);
+    if (!projectWriterClose(&writer)) ok = false;
+
+    if (!ok) {
+        remove(tempPath);
+        free(list.entries);
+        forgetSavedFile();
+        return false;
+    }
+
+    // FAT rename does not replace. If we stop between the two calls, the
+    // complete temp file is renamed by recoverInterruptedSaves().
+    remove(filePath);
+    if (rename(tempPath, filePath) != 0) {
+        free(list.entries);
+        forgetSavedFile();
+        return false;
+    }
+
+    rememberSavedFile(filePath, generation, list.entries, list.count, bytes);
+    recordIoStats(true, bytes, svcGetSystemTick() - start);
+    return true;
+}
+
+static bool canAppendToSavedFile(const char* filePath) {
+    if (!savedFile.valid || strcmp(savedFile.path, filePath) != 0) return false;
+    if (savedFile.width != CANVAS_WIDTH || savedFile.height != CANVAS_HEIGHT) return false;
+
+    // Compact once dead space outgrows the live data.
+    if (savedFile.fileSize - savedFile.liveBytes > savedFile.liveBytes) return false;
+
+    // Someone else touched the file.
+    struct stat st;
+    return stat(filePath, &st) == 0 && (u64)st.st_size == savedFile.fileSize;
+}
+
+// Append the tiles modified since the last save plus a new chunk table, then
+// repoint the headers. Until the final header write the file still describes
+// the previous save.
+static bool appendProjectChanges(void) {
+    u64 start = svcGetSystemTick();
+    u32 generation = getLayerGeneration();
+    int tileCount = projectTileCount(CANVAS_WIDTH, CANVAS_HEIGHT, PROJECT_TILE_SIZE);
+
+    int* savedSlots = projectMapTileChunks(savedFile.chunks, savedFile.chunkCount, MAX_LAYERS, tileCount);
+    if (!savedSlots) return false;
+
+    ProjectBlockWriter writer;
+    if (!projectWriterOpenAt(&writer, savedFile.path, savedFile.fileSize)) {
+        free(savedSlots);
+        return false;
+    }
+
+    ProjectChunkList list = {0};
+    struct {
+        ProjectHeader header;
+        ProjectChunkHeader chunkHeader;
+    } headers;
+    projectFillHeader(&headers.header);
+
+    bool ok = writeProjectChunks(&writer, &list, savedSlots, &headers.chunkHeader) &&
+              projectWriterFlush(&writer) &&
+              projectWriterPatch(&writer, 0, &headers, sizeof(headers));
+    free(savedSlots);
+
+    u64 fileSize = projectWriterTell(&writer);
+    if (!projectWriterClose(&writer)) ok = false;
+    if (!ok) {
+        free(list.entries);
+        return false;
+    }
+
+    u64 written = fileSize - savedFile.fileSize;
+    char path[256];
+    snprintf(path, sizeof(path), "%s", savedFile.path);
+    rememberSavedFile(path, generation, list.entries, list.count, fileSize);
+    recordIoStats(true, written, svcGetSystemTick() - start);
+    return true;
+}
+
+// Leftover temp files are rare; any beyond this are handled by the next scan.
+#define RECOVER_MAX_FILES 16
+
+// A temp file is complete once its headers point at a chunk table that reads
+// back with the right crc: the table is written last and the headers patched
+// over their placeholder just before the file is closed.
+static bool isCompleteProjectFile(const char* filePath) {
+    ProjectReader reader;
+    if (!projectReaderOpenFile(&reader, filePath)) return false;
+    bool complete = reader.header.version >= 3;
+    projectReaderClose(&reader);
+    return complete;
+}
+
+void recoverInterruptedSaves(void) {
+    char names[RECOVER_MAX_FILES][PROJECT_NAME_MAX + 16];
+    int count = 0;
+
+    DIR* dir = opendir(SAVE_DIR);
+    if (!dir) return;
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL && count < RECOVER_MAX_FILES) {
+        size_t len = strlen(ent->d_name);
+        if (len > 9 && len < sizeof(names[0]) && strcmp(ent->d_name + len - 9, ".mgdw.tmp") == 0) {
+            memcpy(names[count], ent->d_name, len - 4);
+            names[count][len - 4] = '\0';
+            count++;
+        }
+    }
+    closedir(dir);
+
+    for (int i = 0; i < count; i++) {
+        char filePath[256];
+        char tempPath[256 + 8];
+        snprintf(filePath, sizeof(filePath), "%s/%s", SAVE_DIR, names[i]);
+        snprintf(tempPath, sizeof(tempPath), "%s.tmp", filePath);
+        // With the original still there, the save stopped before the rename
+        // and the original is intact. Without it, the save may have been the
+        // project's first and stopped anywhere; install only a complete file.
+        if (fileExists(filePath) || !isCompleteProjectFile(tempPath)) {
+            remove(tempPath);
+        } else {
+            rename(tempPath, filePath);
+        }
+    }
+}
+
 bool saveProject(const char* projectName) {
     ensureDirectoryExists(SAVE_DIR);
 
@@ -77,54 +421,10 @@ bool saveProject(const char* projectName) {
         }
     }
 
-    FILE* fp = fopen(filePath, "wb");
-    if (!fp) {
+    if (!writeProjectFile(filePath)) {
         return false;
     }
 
-    ProjectHeader header;
-    header.magic = PROJECT_FILE_MAGIC;
-    header.version = PROJECT_FILE_VERSION;
-    header.canvasWidth = CANVAS_WIDTH;
-    header.canvasHeight = CANVAS_HEIGHT;
-    header.numLayers = MAX_LAYERS;
-    header.currentLayer = currentLayerIndex;
-    header.currentTool = currentTool;
-    header.brushSize = getCurrentBrushSize();
-    header.currentColor = currentColor;
-    header.brushAlpha = brushAlpha;
-    header.currentBrushType = (u32)currentBrushType;
-    header.hue = currentHue;
-    header.saturation = currentSaturation;
-    header.value = currentValue;
-
-    header.paletteCount = 0;
-    for (int i = 0; i < PALETTE_MAX_COLORS; i++) {
-        if (paletteUsed[i]) header.paletteCount++;
-    }
-
-    fwrite(&header, sizeof(ProjectHeader), 1, fp);
-
-    for (int i = 0; i < MAX_LAYERS; i++) {
-        fwrite(&layers[i].visible, sizeof(bool), 1, fp);
-        fwrite(&layers[i].opacity, sizeof(u8), 1, fp);
-        fwrite(&layers[i].blendMode, sizeof(BlendMode), 1, fp);
-        fwrite(&layers[i].alphaLock, sizeof(bool), 1, fp);
-        fwrite(&layers[i].clipping, sizeof(bool), 1, fp);
-        fwrite(layers[i].name, sizeof(layers[i].name), 1, fp);
-
-        for (int y = 0; y < CANVAS_HEIGHT; y++) {
-            fwrite(&layers[i].buffer[y * TEX_WIDTH], sizeof(u32), CANVAS_WIDTH, fp);
-        }
-    }
-
-    fwrite(brushSizesByType, sizeof(brushSizesByType[0]), BRUSH_TYPE_COUNT, fp);
-
-    fwrite(paletteUsed, sizeof(bool), PALETTE_MAX_COLORS, fp);
-    fwrite(paletteColors, sizeof(u32), PALETTE_MAX_COLORS, fp);
-
-    fclose(fp);
-
     strncpy(currentProjectName, projectName, PROJECT_NAME_MAX - 1);
     currentProjectName[PROJECT_NAME_MAX - 1] = '\0';
     projectHasName = true;
@@ -143,134 +443,393 @@ bool quickSaveProject(void) {
     char filePath[256];
     snprintf(filePath, sizeof(filePath), "%s/%s.mgdw", SAVE_DIR, currentProjectName);
 
-    FILE* fp = fopen(filePath, "wb");
-    if (!fp) {
+    // The loaded file becomes the append base once it has finished streaming in.
+    projectStreamWaitAll();
+    bool saved = canAppendToSavedFile(filePath) && appendProjectChanges();
+    if (!saved && !writeProjectFile(filePath)) {
         return false;
     }
 
-    ProjectHeader header;
-    header.magic = PROJECT_FILE_MAGIC;
-    header.version = PROJECT_FILE_VERSION;
-    header.canvasWidth = CANVAS_WIDTH;
-    header.canvasHeight = CANVAS_HEIGHT;
-    header.numLayers = MAX_LAYERS;
-    header.currentLayer = currentLayerIndex;
-    header.currentTool = currentTool;
-    header.brushSize = getCurrentBrushSize();
-    header.currentColor = currentColor;
-    header.brushAlpha = brushAlpha;
-    header.currentBrushType = (u32)currentBrushType;
-    header.hue = currentHue;
-    header.saturation = currentSaturation;
-    header.value = currentValue;
-
-    header.paletteCount = 0;
-    for (int i = 0; i < PALETTE_MAX_COLORS; i++) {
-        if (paletteUsed[i]) header.paletteCount++;
+    projectHasUnsavedChanges = false;
+
+    return true;
+}
+
+// Size of one layer record in v1/v2 files: fields then raw canvas rows.
+static long legacyLayerSize(const ProjectHeader* header) {
+    long fields = sizeof(bool) + sizeof(u8) + sizeof(BlendMode) + sizeof(bool) + sizeof(bool) + 32;
+    return fields + (long)header->canvasWidth * header->canvasHeight * sizeof(u32);
+}
+
+bool projectReaderOpen(ProjectReader* reader, const char* projectName) {
+    char filePath[256];
+    snprintf(filePath, sizeof(filePath), "%s/%s.mgdw", SAVE_DIR, projectName);
+    return projectReaderOpenFile(reader, filePath);
+}
+
+bool projectReaderOpenFile(ProjectReader* reader, const char* filePath) {
+    memset(reader, 0, sizeof(*reader));
+
+    reader->fp = fopen(filePath, "rb");
+    if (!reader->fp) return false;
+
+    // One large stdio buffer turns the per-row and per-chunk reads into few SD accesses.
+    reader->ioBuffer = (char*)memAlloc(PROJECT_IO_BLOCK_SIZE);
+    if (reader->ioBuffer) {
+        setvbuf(reader->fp, reader->ioBuffer, _IOFBF, PROJECT_IO_BLOCK_SIZE);
     }
 
-    fwrite(&header, sizeof(ProjectHeader), 1, fp);
+    ProjectHeader* header = &reader->header;
+    if (fread(header, sizeof(ProjectHeader), 1, reader->fp) != 1 ||
+        header->magic != PROJECT_FILE_MAGIC ||
+        header->version > PROJECT_FILE_VERSION) {
+        projectReaderClose(reader);
+        return false;
+    }
 
-    for (int i = 0; i < MAX_LAYERS; i++) {
-        fwrite(&layers[i].visible, sizeof(bool), 1, fp);
-        fwrite(&layers[i].opacity, sizeof(u8), 1, fp);
-        fwrite(&layers[i].blendMode, sizeof(BlendMode), 1, fp);
-        fwrite(&layers[i].alphaLock, sizeof(bool), 1, fp);
-        fwrite(&layers[i].clipping, sizeof(bool), 1, fp);
-        fwrite(layers[i].name, sizeof(layers[i].name), 1, fp);
+    int cw = header->canvasWidth;
+    int ch = header->canvasHeight;
+    if (cw <= 0 || cw > MAX_CANVAS_DIM || ch <= 0 || ch > MAX_CANVAS_DIM) {
+        projectReaderClose(reader);
+        return false;
+    }
 
-        for (int y = 0; y < CANVAS_HEIGHT; y++) {
-            fwrite(&layers[i].buffer[y * TEX_WIDTH], sizeof(u32), CANVAS_WIDTH, fp);
+    if (header->version >= 3) {
+        ProjectChunkHeader chunkHeader;
+        long fileSize = 0;
+        bool ok = fread(&chunkHeader, sizeof(chunkHeader), 1, reader->fp) == 1 &&
+                  fseek(reader->fp, 0, SEEK_END) == 0 &&
+                  (fileSize = ftell(reader->fp)) > 0 &&
+                  chunkHeader.tileSize <= MAX_CANVAS_DIM &&
+                  projectReadChunkTable(reader->fp, &chunkHeader, fileSize, &reader->chunks);
+        if (ok) {
+            reader->chunkCount = chunkHeader.chunkCount;
+            reader->tileSize = chunkHeader.tileSize;
+            reader->tileScratch = (u32*)memAlloc(reader->tileSize * reader->tileSize * sizeof(u32));
+            ok = reader->tileScratch != NULL;
+        }
+        if (!ok) {
+            projectReaderClose(reader);
+            return false;
         }
     }
 
-    fwrite(brushSizesByType, sizeof(brushSizesByType[0]), BRUSH_TYPE_COUNT, fp);
+    return true;
+}
 
-    fwrite(paletteUsed, sizeof(bool), PALETTE_MAX_COLORS, fp);
-    fwrite(paletteColors, sizeof(u32), PALETTE_MAX_COLORS, fp);
+static const u8* readChunkPayload(ProjectReader* reader, const ProjectChunk* chunk) {
+    if (chunk->size > reader->payloadCapacity) {
+        u8* grown = (u8*)realloc(reader->payload, chunk->size);
+        if (!grown) return NULL;
+        reader->payload = grown;
+        reader->payloadCapacity = chunk->size;
+    }
+    if (fseek(reader->fp, chunk->offset, SEEK_SET) != 0 ||
+        fread(reader->payload, 1, chunk->size, reader->fp) != chunk->size) {
+        return NULL;
+    }
+    return reader->payload;
+}
 
-    fclose(fp);
+static const ProjectChunk* findChunk(const ProjectReader* reader, u32 type, u32 layer) {
+    for (u32 i = 0; i < reader->chunkCount; i++) {
+        const ProjectChunk* chunk = &reader->chunks[i];
+        if (chunk->type == type && chunk->layer == layer) return chunk;
+    }
+    return NULL;
+}
 
-    projectHasUnsavedChanges = false;
+u16* projectReaderReadThumbnail(ProjectReader* reader, int* outWidth, int* outHeight) {
+    const ProjectChunk* chunk = findChunk(reader, PROJECT_CHUNK_THUMBNAIL, 0);
+    if (!chunk) return NULL;
+    const u8* payload = readChunkPayload(reader, chunk);
+    if (!payload) return NULL;
+    return projectDecodeThumbnail(payload, chunk->size, outWidth, outHeight);
+}
 
+static bool readLegacyLayer(ProjectReader* reader, ProjectLayerInfo* info, u32* pixels, int stride) {
+    FILE* fp = reader->fp;
+    int cw = reader->header.canvasWidth;
+    int ch = reader->header.canvasHeight;
+
+    long offset = sizeof(ProjectHeader) + legacyLayerSize(&reader->header) * reader->nextLayer;
+    if (fseek(fp, offset, SEEK_SET) != 0) return false;
+
+    bool visible, alphaLock, clipping;
+    u8 opacity;
+    BlendMode blendMode;
+    memset(info, 0, sizeof(*info));
+
+    bool ok = fread(&visible, sizeof(bool), 1, fp) == 1 &&
+              fread(&opacity, sizeof(u8), 1, fp) == 1 &&
+              fread(&blendMode, sizeof(BlendMode), 1, fp) == 1 &&
+              fread(&alphaLock, sizeof(bool), 1, fp) == 1 &&
+              fread(&clipping, sizeof(bool), 1, fp) == 1 &&
+              fread(info->name, sizeof(info->name), 1, fp) == 1;
+    if (!ok) return false;
+
+    info->visible = visible;
+    info->opacity = opacity;
+    info->blendMode = (u8)blendMode;
+    info->alphaLock = alphaLock;
+    info->clipping = clipping;
+
+    if (!pixels) return true;
+    for (int y = 0; y < ch; y++) {
+        if (fread(&pixels[y * stride], sizeof(u32), cw, fp) != (size_t)cw) return false;
+    }
     return true;
 }
 
-bool loadProject(const char* projectName) {
-    char filePath[256];
-    snprintf(filePath, sizeof(filePath), "%s/%s.mgdw", SAVE_DIR, projectName);
+static bool readChunkedLayer(ProjectReader* reader, ProjectLayerInfo* info, u32* pixels, int stride) {
+    int cw = reader->header.canvasWidth;
+    int ch = reader->header.canvasHeight;
+    u32 layer = (u32)reader->nextLayer;
 
-    FILE* fp = fopen(filePath, "rb");
-    if (!fp) return false;
+    const ProjectChunk* infoChunk = findChunk(reader, PROJECT_CHUNK_LAYER, layer);
+    if (!infoChunk || infoChunk->size != sizeof(ProjectLayerInfo)) return false;
+    const u8* payload = readChunkPayload(reader, infoChunk);
+    if (!payload) return false;
+    memcpy(info, payload, sizeof(ProjectLayerInfo));
+    info->name[sizeof(info->name) - 1] = '\0';
 
-    ProjectHeader header;
-    if (fread(&header, sizeof(ProjectHeader), 1, fp) != 1) { fclose(fp); return false; }
-    if (header.magic != PROJECT_FILE_MAGIC) { fclose(fp); return false; }
-
-    int cw = header.canvasWidth;
-    int ch = header.canvasHeight;
-    if (cw <= 0 || cw > MAX_CANVAS_DIM || ch <= 0 || ch > MAX_CANVAS_DIM) { fclose(fp); return false; }
-
-    applyCanvasSize(cw, ch);
-
-    int numLayersLocal = header.numLayers;
-    if (numLayersLocal > MAX_LAYERS) numLayersLocal = MAX_LAYERS;
-
-    for (int i = 0; i < (int)header.numLayers; i++) {
-        bool visible;
-        u8 opacity;
-        BlendMode blendMode;
-        bool alphaLock, clipping;
-        char layerName[32];
-
-        fread(&visible, sizeof(bool), 1, fp);
-        fread(&opacity, sizeof(u8), 1, fp);
-        fread(&blendMode, sizeof(BlendMode), 1, fp);
-        fread(&alphaLock, sizeof(bool), 1, fp);
-        fread(&clipping, sizeof(bool), 1, fp);
-        fread(layerName, sizeof(layerName), 1, fp);
-
-        if (i < numLayersLocal && layers[i].buffer) {
-            layers[i].visible = visible;
-            layers[i].opacity = opacity;
-            layers[i].blendMode = blendMode;
-            layers[i].alphaLock = alphaLock;
-            layers[i].clipping = clipping;
-            memcpy(layers[i].name, layerName, sizeof(layers[i].name));
-
-            memset(layers[i].buffer, 0, TEX_WIDTH * TEX_HEIGHT * sizeof(u32));
-
-            for (int y = 0; y < ch; y++) {
-                fread(&layers[i].buffer[y * TEX_WIDTH], sizeof(u32), cw, fp);
-            }
-        } else {
-            fseek(fp, cw * ch * sizeof(u32), SEEK_CUR);
+    if (!pixels) return true;
+
+    // Tiles without a chunk are transparent.
+    for (int y = 0; y < ch; y++) {
+        memset(&pixels[y * stride], 0, cw * sizeof(u32));
+    }
+
+    int tileCount = projectTileCount(cw, ch, reader->tileSize);
+    for (u32 i = 0; i < reader->chunkCount; i++) {
+        const ProjectChunk* chunk = &reader->chunks[i];
+        if (chunk->type != PROJECT_CHUNK_TILE || chunk->layer != layer) continue;
+        if (chunk->index >= (u32)tileCount) return false;
+
+        payload = readChunkPayload(reader, chunk);
+        if (!payload) return false;
+
+        int x, y, w, h;
+        projectTileRect(cw, ch, reader->tileSize, chunk->index, &x, &y, &w, &h);
+        if (!projectUnpackTile(payload, chunk->size, pixels, stride, x, y, w, h, reader->tileScratch)) {
+            return false;
         }
     }
+    return true;
+}
+
+bool projectReaderReadLayer(ProjectReader* reader, ProjectLayerInfo* info, u32* pixels, int stride) {
+    if (!reader->fp || reader->nextLayer >= (int)reader->header.numLayers) return false;
+
+    bool ok = reader->header.version >= 3
+        ? readChunkedLayer(reader, info, pixels, stride)
+        : readLegacyLayer(reader, info, pixels, stride);
+    reader->nextLayer++;
+    return ok;
+}
 
-    if (header.version >= 2) {
-        fread(brushSizesByType, sizeof(brushSizesByType[0]), BRUSH_TYPE_COUNT, fp);
-        fread(paletteUsed, sizeof(bool), PALETTE_MAX_COLORS, fp);
-        fread(paletteColors, sizeof(u32), PALETTE_MAX_COLORS, fp);
+bool projectReaderReadTile(ProjectReader* reader, const ProjectChunk* chunk, u32* pixels, int stride) {
+    int cw = reader->header.canvasWidth;
+    int ch = reader->header.canvasHeight;
+    if (chunk->type != PROJECT_CHUNK_TILE ||
+        chunk->index >= (u32)projectTileCount(cw, ch, reader->tileSize)) {
+        return false;
     }
 
-    fclose(fp);
+    const u8* payload = readChunkPayload(reader, chunk);
+    if (!payload) return false;
+
+    int x, y, w, h;
+    projectTileRect(cw, ch, reader->tileSize, chunk->index, &x, &y, &w, &h);
+    return projectUnpackTile(payload, chunk->size, pixels, stride, x, y, w, h, reader->tileScratch);
+}
+
+static bool readLegacyLayerRows(ProjectReader* reader, ProjectLayerInfo* info, ProjectRowFunc func, void* ctx) {
+    // Reading the fields leaves the file at the first row.
+    if (!readLegacyLayer(reader, info, NULL, 0)) return false;
+
+    int cw = reader->header.canvasWidth;
+    int ch = reader->header.canvasHeight;
+    u32* row = (u32*)memAlloc(cw * sizeof(u32));
+    if (!row) return false;
 
-    currentLayerIndex = header.currentLayer;
+    bool ok = true;
+    for (int y = 0; y < ch; y++) {
+        if (fread(row, sizeof(u32), cw, reader->fp) != (size_t)cw) {
+            ok = false;
+            break;
+        }
+        if (!func(ctx, info, y, row, 1, cw)) break;
+    }
+    free(row);
+    return ok;
+}
+
+static bool readChunkedLayerRows(ProjectReader* reader, ProjectLayerInfo* info, ProjectRowFunc func, void* ctx) {
+    if (!readChunkedLayer(reader, info, NULL, 0)) return false;
+
+    int cw = reader->header.canvasWidth;
+    int ch = reader->header.canvasHeight;
+    int tileSize = reader->tileSize;
+    int tileCount = projectTileCount(cw, ch, tileSize);
+    int cols = (cw + tileSize - 1) / tileSize;
+
+    int* slots = projectMapTileChunks(reader->chunks, reader->chunkCount, reader->nextLayer + 1, tileCount);
+    u32* band = (u32*)memAlloc(cw * tileSize * sizeof(u32));
+    bool ok = slots && band;
+
+    const int* layerSlots = slots ? &slots[reader->nextLayer * tileCount] : NULL;
+    for (int bandY = 0; ok && bandY < ch; bandY += tileSize) {
+        int bandH = (bandY + tileSize <= ch) ? tileSize : ch - bandY;
+        memset(band, 0, cw * bandH * sizeof(u32));
+
+        int firstTile = (bandY / tileSize) * cols;
+        for (int t = firstTile; ok && t < firstTile + cols; t++) {
+            if (layerSlots[t] < 0) continue;
+            const ProjectChunk* chunk = &reader->chunks[layerSlots[t]];
+            const u8* payload = readChunkPayload(reader, chunk);
+            int x, y, w, h;
+            projectTileRect(cw, ch, tileSize, t, &x, &y, &w, &h);
+            ok = payload && projectUnpackTile(payload, chunk->size, band, cw, x, 0, w, h, reader->tileScratch);
+        }
+        if (ok && !func(ctx, info, bandY, band, bandH, cw)) break;
+    }
+
+    free(band);
+    free(slots);
+    return ok;
+}
+
+bool projectReaderReadLayerRows(ProjectReader* reader, ProjectLayerInfo* info, ProjectRowFunc func, void* ctx) {
+    if (!reader->fp || reader->nextLayer >= (int)reader->header.numLayers) return false;
+
+    bool ok = reader->header.version >= 3
+        ? readChunkedLayerRows(reader, info, func, ctx)
+        : readLegacyLayerRows(reader, info, func, ctx);
+    reader->nextLayer++;
+    return ok;
+}
+
+bool projectReaderReadSettings(ProjectReader* reader) {
+    if (!reader->fp) return false;
+
+    const size_t settingsSize = PROJECT_SETTINGS_SIZE;
+    u8 settings[PROJECT_SETTINGS_SIZE];
+
+    if (reader->header.version >= 3) {
+        const ProjectChunk* chunk = findChunk(reader, PROJECT_CHUNK_SETTINGS, 0);
+        if (!chunk || chunk->size != settingsSize) return false;
+        const u8* payload = readChunkPayload(reader, chunk);
+        if (!payload) return false;
+        memcpy(settings, payload, settingsSize);
+    } else if (reader->header.version == 2) {
+        long offset = sizeof(ProjectHeader) + legacyLayerSize(&reader->header) * reader->header.numLayers;
+        if (fseek(reader->fp, offset, SEEK_SET) != 0 ||
+            fread(settings, 1, settingsSize, reader->fp) != settingsSize) {
+            return false;
+        }
+    } else {
+        return true;
+    }
+
+    const u8* p = settings;
+    memcpy(brushSizesByType, p, sizeof(brushSizesByType));
+    p += sizeof(brushSizesByType);
+    memcpy(paletteUsed, p, sizeof(paletteUsed));
+    p += sizeof(paletteUsed);
+    memcpy(paletteColors, p, sizeof(paletteColors));
+    return true;
+}
+
+void projectReaderClose(ProjectReader* reader) {
+    if (reader->fp) fclose(reader->fp);
+    free(reader->ioBuffer);
+    free(reader->chunks);
+    free(reader->tileScratch);
+    free(reader->payload);
+    memset(reader, 0, sizeof(*reader));
+}
+
+void projectFinishLoad(ProjectReader* reader, const char* filePath, u32 generation, u64 startTick, u64 readyTick) {
+    long bytes = 0;
+    if (reader->fp && fseek(reader->fp, 0, SEEK_END) == 0) bytes = ftell(reader->fp);
+
+    if (filePath && bytes > 0) {
+        rememberSavedFile(filePath, generation, reader->chunks, reader->chunkCount, (u64)bytes);
+        reader->chunks = NULL;
+    } else {
+        forgetSavedFile();
+    }
+    projectReaderClose(reader);
+
+    if (bytes > 0) {
+        recordIoStats(false, (u64)bytes, svcGetSystemTick() - startTick);
+        lastIoStats.readyMs = workerTicksToMs(readyTick - startTick);
+    }
+}
+
+// Read every layer's fields, and its pixels when withPixels is set.
+static bool readProjectLayers(ProjectReader* reader, bool withPixels) {
+    for (int i = 0; i < (int)reader->header.numLayers; i++) {
+        bool keep = i < MAX_LAYERS && layers[i].buffer;
+        if (keep) {
+            memset(layers[i].buffer, 0, LAYER_BUFFER_SIZE);
+        }
+
+        ProjectLayerInfo info;
+        u32* pixels = keep && withPixels ? layers[i].buffer : NULL;
+        if (!projectReaderReadLayer(reader, &info, pixels, LAYER_STRIDE)) return false;
+        if (!keep) continue;
+
+        layers[i].visible = info.visible;
+        layers[i].opacity = info.opacity;
+        layers[i].blendMode = (BlendMode)info.blendMode;
+        layers[i].alphaLock = info.alphaLock;
+        layers[i].clipping = info.clipping;
+        memcpy(layers[i].name, info.name, sizeof(layers[i].name));
+    }
+    return true;
+}
+
+// Load filePath as projectName. A recovered file stands in for the project
+// file, so the project stays unsaved and the next save is a full rewrite.
+//
+// v3 files open progressively: only the tiles in view are decoded here and
+// project_stream fills in the rest while the user works. Older versions are
+// read in full.
+static bool loadProjectFile(const char* filePath, const char* projectName, bool recovered) {
+    u64 start = svcGetSystemTick();
+    ProjectReader reader;
+    if (!projectReaderOpenFile(&reader, filePath)) return false;
+
+    const ProjectHeader* header = &reader.header;
+    // Fail before touching the open project when the layers would not fit.
+    if (!canvasSizeFits(header->canvasWidth, header->canvasHeight)) {
+        projectReaderClose(&reader);
+        return false;
+    }
+    applyCanvasSize(header->canvasWidth, header->canvasHeight);
+
+    bool chunked = header->version >= 3;
+    bool complete = readProjectLayers(&reader, !chunked);
+
+    projectReaderReadSettings(&reader);
+
+    currentLayerIndex = header->currentLayer;
     if (currentLayerIndex >= MAX_LAYERS) currentLayerIndex = 0;
-    currentTool = (ToolType)header.currentTool;
-    setCurrentBrushSize(header.brushSize);
-    currentColor = header.currentColor;
-    brushAlpha = header.brushAlpha;
-    currentBrushType = header.currentBrushType;
-    currentHue = header.hue;
-    currentSaturation = header.saturation;
-    currentValue = header.value;
+    currentTool = (ToolType)header->currentTool;
+    setCurrentBrushSize(header->brushSize);
+    currentColor = header->currentColor;
+    brushAlpha = header->brushAlpha;
+    currentBrushType = header->currentBrushType;
+    currentHue = header->hue;
+    currentSaturation = header->saturation;
+    currentValue = header->value;
 
     strncpy(currentProjectName, projectName, PROJECT_NAME_MAX - 1);
     currentProjectName[PROJECT_NAME_MAX - 1] = '\0';
     projectHasName = true;
-    projectHasUnsavedChanges = false;
+    projectHasUnsavedChanges = recovered;
 
     exitHistory();
     initHistory();
@@ -279,5 +838,32 @@ bool loadProject(const char* projectName) {
     canvasZoom = 1.0f;
     canvasNeedsUpdate = true;
 
+    // A fully read v3 file is the base for the next incremental save; older
+    // versions are rewritten as v3 on the first save.
+    bool remember = !recovered && complete && header->version == PROJECT_FILE_VERSION;
+    forgetSavedFile();
+    if (chunked && complete &&
+        projectStreamStart(&reader, remember ? filePath : NULL, getLayerGeneration(), start)) {
+        return true;
+    }
+    if (chunked) {
+        // Streaming needs every layer's fields and memory for its tile tables;
+        // otherwise read whatever the file has in full.
+        reader.nextLayer = 0;
+        complete = readProjectLayers(&reader, true);
+        remember = remember && complete;
+    }
+
+    projectFinishLoad(&reader, remember ? filePath : NULL, getLayerGeneration(), start, svcGetSystemTick());
     return true;
 }
+
+bool loadProject(const char* projectName) {
+    char filePath[256];
+    snprintf(filePath, sizeof(filePath), "%s/%s.mgdw", SAVE_DIR, projectName);
+    return loadProjectFile(filePath, projectName, false);
+}
+
+bool loadRecoveredProject(const char* filePath, const char* projectName) {
+    return loadProjectFile(filePath, projectName, true);
+}
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 
 #include "app_state.h"
+#include "project_format.h"
 
 /**
  * @file project_io.h
@@ -27,7 +28,127 @@ typedef struct {
     u32 paletteCount;
 } ProjectHeader;
 
+/** @brief Size and speed of the most recent project save or load. */
+typedef struct {
+    bool valid;       /**< false until a save or load has completed. */
+    bool save;        /**< true for a save, false for a load. */
+    u64 bytes;        /**< Bytes written (incremental saves) or file size. */
+    float ms;         /**< Wall time including compression / decompression. */
+    float MBps;       /**< bytes / ms, in MB/s. */
+    float readyMs;    /**< Loads: time until the canvas could be used (less than ms when streamed). */
+} ProjectIoStats;
+
+/**
+ * @brief Layer-by-layer reader for project files of any version.
+ *
+ * Layers are read in order with projectReaderReadLayer(); the brush and
+ * palette settings can be read at any point afterwards.
+ */
+typedef struct {
+    FILE* fp;
+    ProjectHeader header;
+    ProjectChunk* chunks;     /**< v3 chunk table (NULL for v1/v2 files). */
+    u32 chunkCount;
+    u32 tileSize;
+    char* ioBuffer;           /**< stdio buffer of PROJECT_IO_BLOCK_SIZE bytes. */
+    u32* tileScratch;         /**< v3 tile decode buffer. */
+    u8* payload;              /**< v3 chunk payload buffer. */
+    size_t payloadCapacity;
+    int nextLayer;
+} ProjectReader;
+
+/**
+ * @brief Open a project in SAVE_DIR and validate its header.
+ * @return false when the file is missing, not a project, or too large.
+ */
+bool projectReaderOpen(ProjectReader* reader, const char* projectName);
+
+/** @brief Open a project file by path (e.g. an autosave). */
+bool projectReaderOpenFile(ProjectReader* reader, const char* filePath);
+
+/**
+ * @brief Read the next layer.
+ * @param info Receives the layer fields.
+ * @param pixels Canvas-sized destination with the given row stride, or NULL to skip the pixels.
+ */
+bool projectReaderReadLayer(ProjectReader* reader, ProjectLayerInfo* info, u32* pixels, int stride);
+
+/**
+ * @brief Receives a band of rows of the layer being read.
+ * @param y Canvas row of the first row in the band.
+ * @param rows count rows of canvas width, stride pixels apart.
+ * @return false to skip the rest of the layer.
+ */
+typedef bool (*ProjectRowFunc)(void* ctx, const ProjectLayerInfo* info, int y, const u32* rows, int count, int stride);
+
+/**
+ * @brief Read the next layer top to bottom in bands, without a canvas-sized buffer.
+ *
+ * Bands are one row for v1/v2 files and one tile row for v3 files.
+ * @param info Receives the layer fields; they are also passed to func.
+ */
+bool projectReaderReadLayerRows(ProjectReader* reader, ProjectLayerInfo* info, ProjectRowFunc func, void* ctx);
+
+/**
+ * @brief Decode one tile chunk of a v3 file into a canvas-sized layer buffer.
+ *
+ * Unlike the layer functions this does not advance the reader, so tiles can
+ * be read in any order once the layer fields are known.
+ */
+bool projectReaderReadTile(ProjectReader* reader, const ProjectChunk* chunk, u32* pixels, int stride);
+
+/**
+ * @brief Read the embedded thumbnail (v3 files saved with one).
+ * @return malloc'd RGB565 pixels (outWidth * outHeight), or NULL when the file has none.
+ */
+u16* projectReaderReadThumbnail(ProjectReader* reader, int* outWidth, int* outHeight);
+
+/** @brief Read brush sizes and palette into the app state (no-op for v1 files). */
+bool projectReaderReadSettings(ProjectReader* reader);
+
+void projectReaderClose(ProjectReader* reader);
+
+/**
+ * @brief Close the reader of a completed load and record its statistics.
+ * @param filePath Kept as the base for incremental saves together with the
+ *                 reader's chunk table, or NULL to keep none.
+ * @param generation Layer generation the loaded pixels correspond to.
+ * @param readyTick When the canvas became usable (the load can finish later in the background).
+ */
+void projectFinishLoad(ProjectReader* reader, const char* filePath, u32 generation, u64 startTick, u64 readyTick);
+
 bool saveProject(const char* projectName);
+
+/**
+ * @brief Save the named project in place.
+ *
+ * When the file on disk is the one last saved or loaded, only tiles modified
+ * since then are appended along with a new chunk table; otherwise (or once
+ * dead space outweighs live data) the file is rewritten through a temp file.
+ */
 bool quickSaveProject(void);
 bool loadProject(const char* projectName);
+
+/**
+ * @brief Load a recovery copy of a project.
+ *
+ * The canvas takes the name projectName and stays marked unsaved, so the
+ * next save writes the real project file.
+ */
+bool loadRecoveredProject(const char* filePath, const char* projectName);
+
+/** @brief Size of the settings payload (brush sizes and palette). */
+#define PROJECT_SETTINGS_SIZE (sizeof(brushSizesByType) + sizeof(paletteUsed) + sizeof(paletteColors))
+
+/** @name Snapshot helpers for writers outside this module (e.g. autosave). @{ */
+void projectFillHeader(ProjectHeader* header);
+void projectFillLayerInfo(int layerIndex, ProjectLayerInfo* info);
+void projectFillSettings(u8* out);
+/** @} */
 int findNextUntitledIndex(void);
+
+/** @brief Finish full rewrites interrupted before the rename; temp files that are not complete projects are deleted. */
+void recoverInterruptedSaves(void);
+
+/** @brief Read throughput of the last project save or load. */
+void getProjectIoStats(ProjectIoStats* stats);
@@ -0,0 +1,419 @@
+#include "project_stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "canvas.h"
+#include "layers.h"
+#include "memory.h"
+#include "worker.h"
+
+enum {
+    TILE_PENDING,   // Not decoded yet
+    TILE_LOADED,    // Decoded by the worker, canvas not yet marked dirty
+    TILE_SHOWN,     // Decoded and composited (or never stored in the file)
+};
+
+static bool streamActive = false;
+static ProjectReader streamReader;
+static char streamPath[256];
+static bool streamRemember = false;
+static u32 streamGeneration = 0;
+static u64 streamStartTick = 0;
+static u64 streamReadyTick = 0;
+
+static int* streamSlots = NULL;   // Chunk index per layer tile, -1 when the tile has none
+static u8* streamTiles = NULL;    // Tile state per layer tile
+static int streamLayers = 0;
+static int streamTileSize = 0;
+static int streamTileCount = 0;
+static int streamCols = 0;
+static int streamRows = 0;
+
+static u16* streamThumb = NULL;   // RGB565 stand-in for tiles not loaded yet
+static int streamThumbWidth = 0;
+static int streamThumbHeight = 0;
+
+// Guarded by streamLock.
+static LightLock streamLock;
+static int streamPending = 0;
+static int streamTotal = 0;
+static int streamLayerPending[MAX_LAYERS];
+static int streamUnshown = 0;
+static int streamFallbackNext = 0;
+static u32 streamWaitMask = 0;
+static int streamFocusLayer = 0;
+static u32 streamVisibleMask = 0;
+static int streamViewX0 = 0, streamViewY0 = 0, streamViewX1 = -1, streamViewY1 = -1;
+static bool streamFailed = false;
+
+static LightEvent streamProgressEvent;
+static Thread streamThread = NULL;
+static volatile bool streamCancel = false;
+
+//---------------------------------------------------------------------------
+// Tile bookkeeping
+//---------------------------------------------------------------------------
+
+// Tiles of the bottom screen view, in tile coordinates (empty when off canvas).
+static void getViewTiles(int* x0, int* y0, int* x1, int* y1) {
+    CanvasView view;
+    getCanvasBottomView(&view);
+    int left, top, right, bottom;
+    if (!getCanvasViewRect(&view, &left, &top, &right, &bottom)) {
+        *x0 = 0;
+        *y0 = 0;
+        *x1 = -1;
+        *y1 = -1;
+        return;
+    }
+    *x0 = left / streamTileSize;
+    *y0 = top / streamTileSize;
+    *x1 = right / streamTileSize;
+    *y1 = bottom / streamTileSize;
+}
+
+static bool layerShowsInComposite(int layer) {
+    return layers[layer].visible && layers[layer].opacity > 0;
+}
+
+static u32 getVisibleLayerMask(void) {
+    u32 mask = 0;
+    for (int l = 0; l < streamLayers; l++) {
+        if (layerShowsInComposite(l)) mask |= 1u << l;
+    }
+    return mask;
+}
+
+// Next tile to decode: layers someone waits for, then visible layers in view,
+// then the current layer, then everything else. Caller holds streamLock.
+static int pickPendingTile(void) {
+    if (streamPending == 0) return -1;
+
+    for (int l = 0; l < streamLayers; l++) {
+        if (!(streamWaitMask & (1u << l)) || streamLayerPending[l] == 0) continue;
+        const u8* states = &streamTiles[l * streamTileCount];
+        for (int t = 0; t < streamTileCount; t++) {
+            if (states[t] == TILE_PENDING) return l * streamTileCount + t;
+        }
+    }
+
+    for (int ty = streamViewY0; ty <= streamViewY1; ty++) {
+        for (int tx = streamViewX0; tx <= streamViewX1; tx++) {
+            int t = ty * streamCols + tx;
+            for (int l = 0; l < streamLayers; l++) {
+                if (!(streamVisibleMask & (1u << l))) continue;
+                if (streamTiles[l * streamTileCount + t] == TILE_PENDING) return l * streamTileCount + t;
+            }
+        }
+    }
+
+    int focus = streamFocusLayer;
+    if (focus >= 0 && focus < streamLayers && streamLayerPending[focus] > 0) {
+        const u8* states = &streamTiles[focus * streamTileCount];
+        for (int t = 0; t < streamTileCount; t++) {
+            if (states[t] == TILE_PENDING) return focus * streamTileCount + t;
+        }
+    }
+
+    // Everything before the cursor is loaded, since this pass always takes the first pending tile.
+    int total = streamLayers * streamTileCount;
+    while (streamFallbackNext < total && streamTiles[streamFallbackNext] != TILE_PENDING) {
+        streamFallbackNext++;
+    }
+    return streamFallbackNext < total ? streamFallbackNext : -1;
+}
+
+static bool decodeTile(int index) {
+    int layer = index / streamTileCount;
+    const ProjectChunk* chunk = &streamReader.chunks[streamSlots[index]];
+    if (!layers[layer].buffer) return true;
+    return projectReaderReadTile(&streamReader, chunk, layers[layer].buffer, LAYER_STRIDE);
+}
+
+// Caller holds streamLock. A tile that fails to decode counts as loaded so
+// nothing waits on it forever; the file is not kept as a save base.
+static void finishTile(int index, bool ok, u8 state) {
+    streamTiles[index] = state;
+    streamPending--;
+    streamLayerPending[index / streamTileCount]--;
+    if (state == TILE_LOADED) streamUnshown++;
+    if (!ok) streamFailed = true;
+}
+
+static void markTileDirty(int tile) {
+    int x, y, w, h;
+    projectTileRect(CANVAS_WIDTH, CANVAS_HEIGHT, streamTileSize, tile, &x, &y, &w, &h);
+    markCanvasDirtyRect(x, y, x + w - 1, y + h - 1);
+}
+
+// Composite tiles the worker finished since the last call.
+static void showLoadedTiles(void) {
+    LightLock_Lock(&streamLock);
+    if (streamUnshown > 0) {
+        int total = streamLayers * streamTileCount;
+        for (int i = 0; i < total; i++) {
+            if (streamTiles[i] != TILE_LOADED) continue;
+            streamTiles[i] = TILE_SHOWN;
+            markTileDirty(i % streamTileCount);
+        }
+        streamUnshown = 0;
+    }
+    LightLock_Unlock(&streamLock);
+}
+
+//---------------------------------------------------------------------------
+// Worker
+//---------------------------------------------------------------------------
+
+static void streamWorkerMain(void* arg) {
+    (void)arg;
+    while (!streamCancel) {
+        LightLock_Lock(&streamLock);
+        int index = pickPendingTile();
+        LightLock_Unlock(&streamLock);
+        if (index < 0) break;
+
+        bool ok = decodeTile(index);
+
+        LightLock_Lock(&streamLock);
+        finishTile(index, ok, TILE_LOADED);
+        LightLock_Unlock(&streamLock);
+        LightEvent_Signal(&streamProgressEvent);
+    }
+    LightEvent_Signal(&streamProgressEvent);
+}
+
+//---------------------------------------------------------------------------
+// Stream lifetime
+//---------------------------------------------------------------------------
+
+static void freeStream(void) {
+    free(streamSlots);
+    free(streamTiles);
+    free(streamThumb);
+    streamSlots = NULL;
+    streamTiles = NULL;
+    streamThumb = NULL;
+    streamActive = false;
+}
+
+static void joinStreamWorker(void) {
+    if (!streamThread) return;
+    threadJoin(streamThread, U64_MAX);
+    threadFree(streamThread);
+    streamThread = NULL;
+}
+
+// All tiles are loaded: hand the reader back to project_io.
+static void finishStream(void) {
+    joinStreamWorker();
+    showLoadedTiles();
+    projectFinishLoad(&streamReader, streamRemember && !streamFailed ? streamPath : NULL,
+                      streamGeneration, streamStartTick, streamReadyTick);
+    freeStream();
+}
+
+bool projectStreamStart(ProjectReader* reader, const char* filePath, u32 generation, u64 startTick) {
+    static bool syncInitialized = false;
+    if (!syncInitialized) {
+        LightLock_Init(&streamLock);
+        LightEvent_Init(&streamProgressEvent, RESET_ONESHOT);
+        syncInitialized = true;
+    }
+    projectStreamCancel();
+
+    int layerCount = (int)reader->header.numLayers;
+    if (layerCount > MAX_LAYERS) layerCount = MAX_LAYERS;
+    streamTileSize = reader->tileSize;
+    streamTileCount = projectTileCount(CANVAS_WIDTH, CANVAS_HEIGHT, streamTileSize);
+    streamCols = (CANVAS_WIDTH + streamTileSize - 1) / streamTileSize;
+    streamRows = (CANVAS_HEIGHT + streamTileSize - 1) / streamTileSize;
+    streamLayers = layerCount;
+
+    streamSlots = projectMapTileChunks(reader->chunks, reader->chunkCount, layerCount, streamTileCount);
+    streamTiles = (u8*)memAlloc(layerCount * streamTileCount);
+    if (!streamSlots || !streamTiles) {
+        freeStream();
+        return false;
+    }
+
+    streamReader = *reader;
+    memset(reader, 0, sizeof(*reader));
+    snprintf(streamPath, sizeof(streamPath), "%s", filePath ? filePath : "");
+    streamRemember = filePath != NULL;
+    streamGeneration = generation;
+    streamStartTick = startTick;
+    streamThumb = projectReaderReadThumbnail(&streamReader, &streamThumbWidth, &streamThumbHeight);
+
+    streamPending = 0;
+    streamUnshown = 0;
+    streamFallbackNext = 0;
+    streamWaitMask = 0;
+    streamFailed = false;
+    streamCancel = false;
+    for (int l = 0; l < MAX_LAYERS; l++) streamLayerPending[l] = 0;
+    for (int i = 0; i < layerCount * streamTileCount; i++) {
+        bool stored = streamSlots[i] >= 0;
+        streamTiles[i] = stored ? TILE_PENDING : TILE_SHOWN;
+        if (stored) {
+            streamPending++;
+            streamLayerPending[i / streamTileCount]++;
+        }
+    }
+    streamTotal = streamPending;
+    streamFocusLayer = currentLayerIndex;
+    streamVisibleMask = getVisibleLayerMask();
+    getViewTiles(&streamViewX0, &streamViewY0, &streamViewX1, &streamViewY1);
+    streamActive = true;
+
+    // What is on screen decodes before the first frame; the rest follows in the background.
+    for (int ty = streamViewY0; ty <= streamViewY1; ty++) {
+        for (int tx = streamViewX0; tx <= streamViewX1; tx++) {
+            int t = ty * streamCols + tx;
+            for (int l = 0; l < layerCount; l++) {
+                int index = l * streamTileCount + t;
+                if (!layerShowsInComposite(l) || streamTiles[index] != TILE_PENDING) continue;
+                finishTile(index, decodeTile(index), TILE_SHOWN);
+            }
+        }
+    }
+    streamReadyTick = svcGetSystemTick();
+    markCanvasDirtyFull();
+
+    if (streamPending > 0) {
+        streamThread = workerThreadCreate(streamWorkerMain, NULL, 1);
+    }
+    if (!streamThread) {
+        // No worker: finish the load in place.
+        int index;
+        while ((index = pickPendingTile()) >= 0) {
+            finishTile(index, decodeTile(index), TILE_SHOWN);
+        }
+        finishStream();
+    }
+    return true;
+}
+
+void updateProjectStream(void) {
+    if (!streamActive) return;
+
+    int x0, y0, x1, y1;
+    getViewTiles(&x0, &y0, &x1, &y1);
+    u32 visibleMask = getVisibleLayerMask();
+    LightLock_Lock(&streamLock);
+    streamFocusLayer = currentLayerIndex;
+    streamVisibleMask = visibleMask;
+    streamViewX0 = x0;
+    streamViewY0 = y0;
+    streamViewX1 = x1;
+    streamViewY1 = y1;
+    bool done = streamPending == 0;
+    LightLock_Unlock(&streamLock);
+
+    showLoadedTiles();
+    if (done) finishStream();
+}
+
+bool projectStreamIsActive(void) {
+    return streamActive;
+}
+
+float projectStreamProgress(void) {
+    if (!streamActive) return 1.0f;
+    LightLock_Lock(&streamLock);
+    float progress = streamTotal > 0 ? (float)(streamTotal - streamPending) / streamTotal : 1.0f;
+    LightLock_Unlock(&streamLock);
+    return progress;
+}
+
+void projectStreamWaitLayers(u32 layerMask) {
+    if (!streamActive) return;
+    layerMask &= (1u << streamLayers) - 1;
+
+    while (true) {
+        LightLock_Lock(&streamLock);
+        bool ready = true;
+        for (int l = 0; l < streamLayers; l++) {
+            if ((layerMask & (1u << l)) && streamLayerPending[l] > 0) ready = false;
+        }
+        streamWaitMask = ready ? 0 : layerMask;
+        LightLock_Unlock(&streamLock);
+        if (ready) break;
+        LightEvent_Wait(&streamProgressEvent);
+    }
+    showLoadedTiles();
+}
+
+bool projectStreamWaitAll(void) {
+    if (!streamActive) return false;
+    projectStreamWaitLayers((1u << MAX_LAYERS) - 1);
+    finishStream();
+    return true;
+}
+
+void projectStreamCancel(void) {
+    if (!streamActive) return;
+    streamCancel = true;
+    joinStreamWorker();
+    projectReaderClose(&streamReader);
+    freeStream();
+}
+
+//---------------------------------------------------------------------------
+// Compositor hook
+//---------------------------------------------------------------------------
+
+static u32 thumbToRgba(u16 p) {
+    u32 r = (p >> 11) & 0x1F;
+    u32 g = (p >> 5) & 0x3F;
+    u32 b = p & 0x1F;
+    r = (r << 3) | (r >> 2);
+    g = (g << 2) | (g >> 4);
+    b = (b << 3) | (b >> 2);
+    return (r << 24) | (g << 16) | (b << 8) | 0xFF;
+}
+
+void projectStreamFillPending(u32* composite, int stride, const int* columns, int width, const int* rows, int height) {
+    if (!streamActive || !streamThumb || width <= 0 || height <= 0) return;
+
+    // The samples increase, so their tiles form one rectangle; take its
+    // pending state in one go. A tile that finishes meanwhile is marked
+    // dirty and composited again.
+    int tx0 = columns[0] / streamTileSize;
+    int ty0 = rows[0] / streamTileSize;
+    int spanCols = columns[width - 1] / streamTileSize - tx0 + 1;
+    int spanRows = rows[height - 1] / streamTileSize - ty0 + 1;
+    u8* pending = (u8*)malloc(spanCols * spanRows);
+    if (!pending) return;
+
+    bool anyPending = false;
+    LightLock_Lock(&streamLock);
+    for (int ty = 0; ty < spanRows; ty++) {
+        for (int tx = 0; tx < spanCols; tx++) {
+            int t = (ty0 + ty) * streamCols + tx0 + tx;
+            bool tilePending = false;
+            for (int l = 0; l < streamLayers && !tilePending; l++) {
+                tilePending = layerShowsInComposite(l) && streamTiles[l * streamTileCount + t] == TILE_PENDING;
+            }
+            pending[ty * spanCols + tx] = tilePending;
+            anyPending |= tilePending;
+        }
+    }
+    LightLock_Unlock(&streamLock);
+
+    u32 stepX = ((u32)streamThumbWidth << 16) / CANVAS_WIDTH;
+    for (int j = 0; anyPending && j < height; j++) {
+        int y = rows[j];
+        const u8* tileRow = &pending[(y / streamTileSize - ty0) * spanCols];
+        const u16* src = &streamThumb[(y * streamThumbHeight / CANVAS_HEIGHT) * streamThumbWidth];
+        u32* dst = &composite[j * stride];
+        for (int i = 0; i < width; i++) {
+            int x = columns[i];
+            if (!tileRow[x / streamTileSize - tx0]) continue;
+            dst[i] = thumbToRgba(src[((u32)x * stepX) >> 16]);
+        }
+    }
+    free(pending);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "app_state.h"
+#include "project_io.h"
+
+/**
+ * @file project_stream.h
+ * @brief Progressive loading of v3 project files.
+ *
+ * Loading a v3 project only decodes the tiles in view before returning; a
+ * worker fills in the rest of the layer buffers in the background. It takes
+ * tiles in the following order:
+ *  - layers someone is waiting for,
+ *  - tiles in the current view,
+ *  - the current layer,
+ *  - everything else.
+ * Until every layer of a tile is loaded, the composite shows the project
+ * thumbnail there.
+ *
+ * Code that reads or writes layer pixels outside the compositor waits for
+ * what it touches first (projectStreamWaitLayers / projectStreamWaitAll).
+ * Layer buffers must not be freed or reallocated while a stream is running
+ * (projectStreamCancel).
+ */
+
+/**
+ * @brief Load the tiles in view and stream the rest.
+ *
+ * Layer fields and settings must already be applied and the layer buffers cleared.
+ * @param reader Open v3 reader positioned after the last layer; owned by the stream on success.
+ * @param filePath Remembered as base for incremental saves once complete (NULL: do not remember).
+ * @param generation Layer generation the loaded pixels correspond to.
+ * @param startTick System tick when the load started, for the load statistics.
+ */
+bool projectStreamStart(ProjectReader* reader, const char* filePath, u32 generation, u64 startTick);
+
+/** @brief Per-frame hook: show newly loaded tiles, finish the stream once complete. */
+void updateProjectStream(void);
+
+/** @brief Check whether a project is still streaming in. */
+bool projectStreamIsActive(void);
+
+/** @brief Fraction of tiles loaded (1 when no stream is active). */
+float projectStreamProgress(void);
+
+/** @brief Block until every tile of the layers in layerMask is loaded. */
+void projectStreamWaitLayers(u32 layerMask);
+
+/**
+ * @brief Block until the whole project is loaded and finish the stream.
+ * @return true when a stream had to be finished (the canvas was marked dirty).
+ */
+bool projectStreamWaitAll(void);
+
+/** @brief Stop streaming; tiles not loaded yet stay empty. */
+void projectStreamCancel(void);
+
+/**
+ * @brief Paint the thumbnail over samples whose tile is not fully loaded.
+ *
+ * Takes the sample grid of compositeLayerSamples (columns and rows in
+ * increasing order); called after compositing it.
+ */
+void projectStreamFillPending(u32* composite, int stride, const int* columns, int width, const int* rows, int height);
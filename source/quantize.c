@@ -0,0 +1,307 @@
+#include "quantize.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//---------------------------------------------------------------------------
+// Exact colour set
+//---------------------------------------------------------------------------
+
+static uint32_t hashColor(uint32_t color) {
+    return (color * 2654435761u) >> 22;   // 10 bits: QUANTIZE_SET_SLOTS
+}
+
+void quantizeSetInit(QuantizeColorSet* set) {
+    memset(set->used, 0, sizeof(set->used));
+    set->count = 0;
+    set->overflow = false;
+    set->lastIndex = -1;
+}
+
+// Slot holding color, or the empty slot where it belongs.
+static int findSlot(const QuantizeColorSet* set, uint32_t color) {
+    uint32_t slot = hashColor(color);
+    while (set->used[slot] && set->keys[slot] != color) {
+        slot = (slot + 1) & (QUANTIZE_SET_SLOTS - 1);
+    }
+    return (int)slot;
+}
+
+bool quantizeSetAddPixels(QuantizeColorSet* set, const uint32_t* pixels, int count) {
+    if (set->overflow) return false;
+    for (int i = 0; i < count; i++) {
+        uint32_t color = pixels[i];
+        if (set->lastIndex >= 0 && color == set->lastColor) continue;
+
+        int slot = findSlot(set, color);
+        if (!set->used[slot]) {
+            if (set->count == QUANTIZE_MAX_COLORS) {
+                set->overflow = true;
+                return false;
+            }
+            set->used[slot] = 1;
+            set->keys[slot] = color;
+            set->indices[slot] = (uint8_t)set->count;
+            set->colors[set->count++] = color;
+        }
+        set->lastColor = color;
+        set->lastIndex = set->indices[slot];
+    }
+    return true;
+}
+
+void quantizeSetMapPixels(QuantizeColorSet* set, const uint32_t* pixels, int count, uint8_t* out) {
+    for (int i = 0; i < count; i++) {
+        uint32_t color = pixels[i];
+        if (set->lastIndex < 0 || color != set->lastColor) {
+            int slot = findSlot(set, color);
+            set->lastColor = color;
+            set->lastIndex = set->used[slot] ? set->indices[slot] : 0;
+        }
+        out[i] = (uint8_t)set->lastIndex;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Octree
+//---------------------------------------------------------------------------
+
+#define OCTREE_DEPTH 8
+#define OCTREE_NONE (-1)
+
+typedef struct {
+    uint64_t sumR, sumG, sumB;
+    uint32_t pixelCount;
+    int16_t children[8];
+    int16_t nextReducible;                  // Next internal node on the same level
+    uint8_t level;
+    bool leaf;
+} OctreeNode;
+
+struct QuantizeOctree {
+    OctreeNode* nodes;
+    int capacity;
+    int freeList;                           // Chained through children[0]
+    int root;
+    int16_t reducible[OCTREE_DEPTH];        // Internal nodes per level
+    int leafCount;
+    int maxColors;
+};
+
+// Every insertion is followed by reductions, so the tree never holds more
+// than maxColors + 1 leaves, each with at most OCTREE_DEPTH ancestors.
+QuantizeOctree* quantizeOctreeCreate(int maxColors) {
+    if (maxColors < 2 || maxColors > QUANTIZE_MAX_COLORS) return NULL;
+    QuantizeOctree* tree = (QuantizeOctree*)calloc(1, sizeof(QuantizeOctree));
+    if (!tree) return NULL;
+    tree->capacity = (maxColors + 1) * (OCTREE_DEPTH + 1) + 1;
+    tree->nodes = (OctreeNode*)malloc(tree->capacity * sizeof(OctreeNode));
+    if (!tree->nodes) {
+        free(tree);
+        return NULL;
+    }
+    for (int i = 0; i < tree->capacity; i++) {
+        tree->nodes[i].children[0] = (int16_t)(i + 1 < tree->capacity ? i + 1 : OCTREE_NONE);
+    }
+    tree->freeList = 0;
+    tree->root = OCTREE_NONE;
+    for (int i = 0; i < OCTREE_DEPTH; i++) tree->reducible[i] = OCTREE_NONE;
+    tree->maxColors = maxColors;
+    return tree;
+}
+
+void quantizeOctreeDestroy(QuantizeOctree* tree) {
+    if (!tree) return;
+    free(tree->nodes);
+    free(tree);
+}
+
+static int allocNode(QuantizeOctree* tree, int level) {
+    int index = tree->freeList;
+    if (index == OCTREE_NONE) return OCTREE_NONE;
+    OctreeNode* node = &tree->nodes[index];
+    tree->freeList = node->children[0];
+
+    memset(node, 0, sizeof(*node));
+    for (int i = 0; i < 8; i++) node->children[i] = OCTREE_NONE;
+    node->level = (uint8_t)level;
+    node->leaf = level == OCTREE_DEPTH;
+    if (node->leaf) {
+        tree->leafCount++;
+    } else {
+        node->nextReducible = tree->reducible[level];
+        tree->reducible[level] = (int16_t)index;
+    }
+    return index;
+}
+
+static void freeNode(QuantizeOctree* tree, int index) {
+    tree->nodes[index].children[0] = (int16_t)tree->freeList;
+    tree->freeList = index;
+}
+
+// Fold the children of the most recently added node on the deepest level
+// that has internal nodes; those children are all leaves.
+static void reduceOctree(QuantizeOctree* tree) {
+    int level = OCTREE_DEPTH - 1;
+    while (level > 0 && tree->reducible[level] == OCTREE_NONE) level--;
+    int index = tree->reducible[level];
+    if (index == OCTREE_NONE) return;
+
+    OctreeNode* node = &tree->nodes[index];
+    tree->reducible[level] = node->nextReducible;
+    int merged = 0;
+    for (int i = 0; i < 8; i++) {
+        int child = node->children[i];
+        if (child == OCTREE_NONE) continue;
+        node->sumR += tree->nodes[child].sumR;
+        node->sumG += tree->nodes[child].sumG;
+        node->sumB += tree->nodes[child].sumB;
+        node->pixelCount += tree->nodes[child].pixelCount;
+        freeNode(tree, child);
+        node->children[i] = OCTREE_NONE;
+        merged++;
+    }
+    node->leaf = true;
+    tree->leafCount -= merged - 1;
+}
+
+static void insertColor(QuantizeOctree* tree, uint32_t color, uint32_t weight) {
+    int r = (color >> 24) & 0xFF;
+    int g = (color >> 16) & 0xFF;
+    int b = (color >> 8) & 0xFF;
+
+    if (tree->root == OCTREE_NONE) tree->root = allocNode(tree, 0);
+    int index = tree->root;
+    while (index != OCTREE_NONE && !tree->nodes[index].leaf) {
+        int level = tree->nodes[index].level;
+        int shift = 7 - level;
+        int branch = (((r >> shift) & 1) << 2) | (((g >> shift) & 1) << 1) | ((b >> shift) & 1);
+        int child = tree->nodes[index].children[branch];
+        if (child == OCTREE_NONE) {
+            child = allocNode(tree, level + 1);
+            if (child == OCTREE_NONE) return;
+            tree->nodes[index].children[branch] = (int16_t)child;
+        }
+        index = child;
+    }
+    if (index == OCTREE_NONE) return;
+
+    OctreeNode* leaf = &tree->nodes[index];
+    leaf->sumR += (uint64_t)r * weight;
+    leaf->sumG += (uint64_t)g * weight;
+    leaf->sumB += (uint64_t)b * weight;
+    leaf->pixelCount += weight;
+
+    while (tree->leafCount > tree->maxColors) reduceOctree(tree);
+}
+
+void quantizeOctreeAddPixels(QuantizeOctree* tree, const uint32_t* pixels, int count) {
+    // Runs of one colour go in as a single weighted insertion.
+    int i = 0;
+    while (i < count) {
+        uint32_t color = pixels[i];
+        int run = 1;
+        while (i + run < count && pixels[i + run] == color) run++;
+        insertColor(tree, color, (uint32_t)run);
+        i += run;
+    }
+}
+
+static void collectLeaves(const QuantizeOctree* tree, int index, uint32_t* palette, int* count) {
+    const OctreeNode* node = &tree->nodes[index];
+    if (node->leaf) {
+        if (node->pixelCount == 0) return;
+        uint32_t r = (uint32_t)((node->sumR + node->pixelCount / 2) / node->pixelCount);
+        uint32_t g = (uint32_t)((node->sumG + node->pixelCount / 2) / node->pixelCount);
+        uint32_t b = (uint32_t)((node->sumB + node->pixelCount / 2) / node->pixelCount);
+        palette[(*count)++] = (r << 24) | (g << 16) | (b << 8) | 0xFF;
+        return;
+    }
+    for (int i = 0; i < 8; i++) {
+        if (node->children[i] != OCTREE_NONE) collectLeaves(tree, node->children[i], palette, count);
+    }
+}
+
+int quantizeOctreePalette(const QuantizeOctree* tree, uint32_t* palette) {
+    int count = 0;
+    if (tree->root != OCTREE_NONE) collectLeaves(tree, tree->root, palette, &count);
+    return count;
+}
+
+//---------------------------------------------------------------------------
+// Nearest-colour mapping
+//---------------------------------------------------------------------------
+
+#define MAPPER_CACHE_SIZE 32768
+#define MAPPER_UNSET 0xFFFF
+
+// 4x4 Bayer matrix; (value - 8) spreads each channel by -8..+7.
+static const uint8_t bayer4[4][4] = {
+    { 0,  8,  2, 10},
+    {12,  4, 14,  6},
+    { 3, 11,  1,  9},
+    {15,  7, 13,  5},
+};
+
+bool quantizeMapperInit(QuantizeMapper* mapper, const uint32_t* palette, int count, bool dither) {
+    if (count < 1 || count > QUANTIZE_MAX_COLORS) return false;
+    memcpy(mapper->palette, palette, count * sizeof(uint32_t));
+    mapper->count = count;
+    mapper->dither = dither;
+    mapper->cache = (uint16_t*)malloc(MAPPER_CACHE_SIZE * sizeof(uint16_t));
+    if (!mapper->cache) return false;
+    memset(mapper->cache, 0xFF, MAPPER_CACHE_SIZE * sizeof(uint16_t));
+    return true;
+}
+
+void quantizeMapperFree(QuantizeMapper* mapper) {
+    free(mapper->cache);
+    mapper->cache = NULL;
+}
+
+static int nearestColor(const QuantizeMapper* mapper, int r, int g, int b) {
+    int best = 0;
+    int bestDistance = 0x7FFFFFFF;
+    for (int i = 0; i < mapper->count; i++) {
+        uint32_t color = mapper->palette[i];
+        int dr = (int)((color >> 24) & 0xFF) - r;
+        int dg = (int)((color >> 16) & 0xFF) - g;
+        int db = (int)((color >> 8) & 0xFF) - b;
+        int distance = dr * dr + dg * dg + db * db;
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = i;
+        }
+    }
+    return best;
+}
+
+static int clampChannel(int value) {
+    return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+void quantizeMapPixels(QuantizeMapper* mapper, const uint32_t* pixels, int count, int x, int y, uint8_t* out) {
+    const uint8_t* pattern = bayer4[y & 3];
+    for (int i = 0; i < count; i++) {
+        uint32_t color = pixels[i];
+        int r = (color >> 24) & 0xFF;
+        int g = (color >> 16) & 0xFF;
+        int b = (color >> 8) & 0xFF;
+        if (mapper->dither) {
+            int offset = pattern[(x + i) & 3] - 8;
+            r = clampChannel(r + offset);
+            g = clampChannel(g + offset);
+            b = clampChannel(b + offset);
+        }
+
+        // Colours sharing the top 5 bits per channel share a palette entry.
+        int key = ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+        uint16_t index = mapper->cache[key];
+        if (index == MAPPER_UNSET) {
+            index = (uint16_t)nearestColor(mapper, (r & 0xF8) | 4, (g & 0xF8) | 4, (b & 0xF8) | 4);
+            mapper->cache[key] = index;
+        }
+        out[i] = (uint8_t)index;
+    }
+}
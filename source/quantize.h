@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @file quantize.h
+ * @brief Colour counting and palette reduction for indexed images.
+ *
+ * Platform independent so it can be built on a host. Pixels use the layer
+ * format, 0xRRGGBBAA.
+ *
+ * - QuantizeColorSet collects the exact colours of an image while they are
+ *   at most QUANTIZE_MAX_COLORS, and maps them to palette indices.
+ * - The octree reduces any number of colours to a palette (alpha ignored,
+ *   entries are opaque).
+ * - QuantizeMapper maps arbitrary colours to the nearest palette entry,
+ *   optionally with a 4x4 ordered dither.
+ */
+
+#define QUANTIZE_MAX_COLORS 256
+#define QUANTIZE_SET_SLOTS 1024   // Power of two, at least 4x QUANTIZE_MAX_COLORS
+
+/** @brief Open-addressing set of up to QUANTIZE_MAX_COLORS colours. */
+typedef struct {
+    uint32_t keys[QUANTIZE_SET_SLOTS];
+    uint8_t indices[QUANTIZE_SET_SLOTS];
+    uint8_t used[QUANTIZE_SET_SLOTS];
+    uint32_t colors[QUANTIZE_MAX_COLORS];   /**< In first-seen order (the palette). */
+    int count;
+    bool overflow;                          /**< More than QUANTIZE_MAX_COLORS were added. */
+    uint32_t lastColor;                     /**< Runs of one colour skip the lookup. */
+    int lastIndex;                          /**< -1 when lastColor is unset. */
+} QuantizeColorSet;
+
+void quantizeSetInit(QuantizeColorSet* set);
+
+/** @brief Add count pixels; returns false once the set has overflowed. */
+bool quantizeSetAddPixels(QuantizeColorSet* set, const uint32_t* pixels, int count);
+
+/** @brief Palette index of each pixel (all must be in the set). */
+void quantizeSetMapPixels(QuantizeColorSet* set, const uint32_t* pixels, int count, uint8_t* out);
+
+typedef struct QuantizeOctree QuantizeOctree;
+
+/** @brief Octree reducing to at most maxColors (up to QUANTIZE_MAX_COLORS) leaves. */
+QuantizeOctree* quantizeOctreeCreate(int maxColors);
+void quantizeOctreeDestroy(QuantizeOctree* tree);
+void quantizeOctreeAddPixels(QuantizeOctree* tree, const uint32_t* pixels, int count);
+
+/** @brief Average colour of each leaf; returns the palette size. */
+int quantizeOctreePalette(const QuantizeOctree* tree, uint32_t* palette);
+
+/** @brief Nearest-colour lookup with a lazily filled 15-bit cache. */
+typedef struct {
+    uint32_t palette[QUANTIZE_MAX_COLORS];
+    int count;
+    bool dither;
+    uint16_t* cache;                        /**< 32768 entries, 0xFFFF until looked up. */
+} QuantizeMapper;
+
+bool quantizeMapperInit(QuantizeMapper* mapper, const uint32_t* palette, int count, bool dither);
+void quantizeMapperFree(QuantizeMapper* mapper);
+
+/**
+ * @brief Palette index of each pixel of a row.
+ * @param x, y Image position of the first pixel, which anchors the dither pattern.
+ */
+void quantizeMapPixels(QuantizeMapper* mapper, const uint32_t* pixels, int count, int x, int y, uint8_t* out);
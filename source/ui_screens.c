@@ -3,8 +3,12 @@
 #include <stdio.h>
 
 #include "app_state.h"
+#include "autosave.h"
+#include "canvas.h"
 #include "color_utils.h"
 #include "history.h"
+#include "project_io.h"
+#include "project_stream.h"
 #include "ui_components.h"
 #include "ui_theme.h"
 
@@ -147,16 +151,15 @@ void renderUI(C3D_RenderTarget* target) {
     C2D_TargetClear(target, C2D_Color32(0x30, 0x30, 0x30, 0xFF));
     C2D_SceneBegin(target);
 
-    float scaleX = (float)TOP_SCREEN_WIDTH / CANVAS_WIDTH;
-    float scaleY = (float)TOP_SCREEN_HEIGHT / CANVAS_HEIGHT;
-    float scale = (scaleX < scaleY) ? scaleX : scaleY;
+    CanvasView preview;
+    getCanvasTopView(&preview);
+    drawCanvasView(&preview);
 
+    float scale = preview.zoom;
     float previewWidth = CANVAS_WIDTH * scale;
     float previewHeight = CANVAS_HEIGHT * scale;
-    float previewX = (TOP_SCREEN_WIDTH - previewWidth) / 2;
-    float previewY = (TOP_SCREEN_HEIGHT - previewHeight) / 2;
-
-    C2D_DrawImageAt(canvasImage, previewX, previewY, 0, NULL, scale, scale);
+    float previewX = preview.x;
+    float previewY = preview.y;
 
     float drawX = canvasPanX + (BOTTOM_SCREEN_WIDTH - CANVAS_WIDTH * canvasZoom) / 2;
     float drawY = canvasPanY + (BOTTOM_SCREEN_HEIGHT - CANVAS_HEIGHT * canvasZoom) / 2;
@@ -232,6 +235,60 @@ void renderUI(C3D_RenderTarget* target) {
     C2D_DrawText(&text, C2D_WithColor, TOP_SCREEN_WIDTH - textWidth - rightMargin, infoY, 0, textScale, textScale, textColor);
     infoY += lineHeight;
 
+    HistoryStats histStats;
+    getHistoryStats(&histStats);
+    C2D_TextBufClear(g_textBuf);
+    float historyLoadProgress = 0.0f;
+    if (historyIsLoading(&historyLoadProgress)) {
+        snprintf(textBuf, sizeof(textBuf), "Undo: loading %d%%", (int)(historyLoadProgress * 100.0f));
+    } else {
+        snprintf(textBuf, sizeof(textBuf), "History: %.1f/%.1fMB +%d SD",
+                 (histStats.rawBytes + histStats.packedBytes) / (1024.0f * 1024.0f),
+                 histStats.budgetBytes / (1024.0f * 1024.0f), histStats.spilledCount);
+    }
+    C2D_TextParse(&text, g_textBuf, textBuf);
+    C2D_TextOptimize(&text);
+    C2D_TextGetDimensions(&text, textScale, textScale, &textWidth, &textHeight);
+    C2D_DrawText(&text, C2D_WithColor, TOP_SCREEN_WIDTH - textWidth - rightMargin, infoY, 0, textScale, textScale, textColor);
+    infoY += lineHeight;
+
+    ProjectIoStats ioStats;
+    getProjectIoStats(&ioStats);
+    if (ioStats.valid) {
+        C2D_TextBufClear(g_textBuf);
+        if (!ioStats.save && ioStats.readyMs < ioStats.ms) {
+            snprintf(textBuf, sizeof(textBuf), "Load: %.1fMB %.1fMB/s (ready %.0fms)",
+                     ioStats.bytes / (1024.0f * 1024.0f), ioStats.MBps, ioStats.readyMs);
+        } else {
+            snprintf(textBuf, sizeof(textBuf), "%s: %.1fMB %.1fMB/s", ioStats.save ? "Save" : "Load",
+                     ioStats.bytes / (1024.0f * 1024.0f), ioStats.MBps);
+        }
+        C2D_TextParse(&text, g_textBuf, textBuf);
+        C2D_TextOptimize(&text);
+        C2D_TextGetDimensions(&text, textScale, textScale, &textWidth, &textHeight);
+        C2D_DrawText(&text, C2D_WithColor, TOP_SCREEN_WIDTH - textWidth - rightMargin, infoY, 0, textScale, textScale, textColor);
+        infoY += lineHeight;
+    }
+
+    if (projectStreamIsActive()) {
+        C2D_TextBufClear(g_textBuf);
+        snprintf(textBuf, sizeof(textBuf), "Loading %d%%", (int)(projectStreamProgress() * 100.0f));
+        C2D_TextParse(&text, g_textBuf, textBuf);
+        C2D_TextOptimize(&text);
+        C2D_TextGetDimensions(&text, textScale, textScale, &textWidth, &textHeight);
+        C2D_DrawText(&text, C2D_WithColor, TOP_SCREEN_WIDTH - textWidth - rightMargin, infoY, 0, textScale, textScale, textColor);
+        infoY += lineHeight;
+    }
+
+    if (autosaveIsRunning()) {
+        C2D_TextBufClear(g_textBuf);
+        C2D_TextParse(&text, g_textBuf, "Autosaving...");
+        C2D_TextOptimize(&text);
+        C2D_TextGetDimensions(&text, textScale, textScale, &textWidth, &textHeight);
+        C2D_DrawText(&text, C2D_WithColor, TOP_SCREEN_WIDTH - textWidth - rightMargin, infoY, 0, textScale, textScale, textColor);
+        infoY += lineHeight;
+    }
+
     C2D_TextBufClear(g_textBuf);
     snprintf(textBuf, sizeof(textBuf), "Zoom: x%.1f", canvasZoom);
     C2D_TextParse(&text, g_textBuf, textBuf);
@@ -300,16 +357,15 @@ void renderPreviewTop(C3D_RenderTarget* target) {
     C2D_TargetClear(target, C2D_Color32(0x30, 0x30, 0x30, 0xFF));
     C2D_SceneBegin(target);
 
-    float scaleX = (float)TOP_SCREEN_WIDTH / CANVAS_WIDTH;
-    float scaleY = (float)TOP_SCREEN_HEIGHT / CANVAS_HEIGHT;
-    float scale = (scaleX < scaleY) ? scaleX : scaleY;
+    CanvasView preview;
+    getCanvasTopView(&preview);
+    drawCanvasView(&preview);
 
+    float scale = preview.zoom;
     float previewWidth = CANVAS_WIDTH * scale;
     float previewHeight = CANVAS_HEIGHT * scale;
-    float previewX = (TOP_SCREEN_WIDTH - previewWidth) / 2;
-    float previewY = (TOP_SCREEN_HEIGHT - previewHeight) / 2;
-
-    C2D_DrawImageAt(canvasImage, previewX, previewY, 0, NULL, scale, scale);
+    float previewX = preview.x;
+    float previewY = preview.y;
 
     float drawX = canvasPanX + (BOTTOM_SCREEN_WIDTH - CANVAS_WIDTH * canvasZoom) / 2;
     float drawY = canvasPanY + (BOTTOM_SCREEN_HEIGHT - CANVAS_HEIGHT * canvasZoom) / 2;
@@ -354,10 +410,9 @@ void renderCanvas(C3D_RenderTarget* target, bool showOverlay) {
     C2D_TargetClear(target, C2D_Color32(0x80, 0x80, 0x80, 0xFF));
     C2D_SceneBegin(target);
 
-    float drawX = canvasPanX + (BOTTOM_SCREEN_WIDTH - CANVAS_WIDTH * canvasZoom) / 2;
-    float drawY = canvasPanY + (BOTTOM_SCREEN_HEIGHT - CANVAS_HEIGHT * canvasZoom) / 2;
-
-    C2D_DrawImageAt(canvasImage, drawX, drawY, 0, NULL, canvasZoom, canvasZoom);
+    CanvasView view;
+    getCanvasBottomView(&view);
+    drawCanvasView(&view);
 
     if (showDrawMenuButton) {
         u32 menuBtnColor;
@@ -1052,6 +1107,16 @@ void renderMenu(C3D_RenderTarget* target) {
         };
         drawButton(&renameBtn);
 
+        ButtonConfig importBtn = {
+            .x = col4X, .y = row2Y, .size = opBtnSize,
+            .icon = &folderIconSprite, .label = NULL,
+            .isActive = false, .isToggle = false, .isSkeleton = false,
+            .useCustomColors = true, .bgColor = UI_COLOR_GRAY_3,
+            .iconColor = UI_COLOR_WHITE,
+            .labelColor = UI_COLOR_TEXT, .iconScale = 0.4f
+        };
+        drawButton(&importBtn);
+
         float sliderY = row2Y + opBtnSize + 10;
         float sliderX = opX;
         float opacityRatio = layers[currentLayerIndex].opacity / 255.0f;
@@ -1286,7 +1351,7 @@ void renderOpenMenu(C3D_RenderTarget* target) {
                     .bgColor = itemBg,
                     .drawBorder = false,
                     .borderColor = 0,
-                    .text = openProjectNames[i],
+                    .text = openProjects[i].name,
                     .textX = textX,
                     .textY = textY_pos,
                     .textScale = textScale,
@@ -1298,6 +1363,20 @@ void renderOpenMenu(C3D_RenderTarget* target) {
                     .rightIconColor = UI_COLOR_WHITE
                 };
                 drawListItem(&item);
+
+                if (openProjects[i].width > 0) {
+                    char sizeText[16];
+                    snprintf(sizeText, sizeof(sizeText), "%lux%lu",
+                             (unsigned long)openProjects[i].width, (unsigned long)openProjects[i].height);
+                    C2D_TextBufClear(g_textBuf);
+                    C2D_Text infoText;
+                    C2D_TextParse(&infoText, g_textBuf, sizeText);
+                    C2D_TextOptimize(&infoText);
+                    float infoW, infoH;
+                    C2D_TextGetDimensions(&infoText, 0.4f, 0.4f, &infoW, &infoH);
+                    C2D_DrawText(&infoText, C2D_WithColor, listX + listWidth - 10 - infoW, itemY + (itemHeight - infoH) / 2,
+                                 0, 0.4f, 0.4f, UI_COLOR_TEXT_DIM);
+                }
             } else {
                 float bgTop = (itemY + 2 < listY) ? listY : itemY + 2;
                 float bgBottom = (itemY + itemHeight - 2 > listY + listHeight) ? listY + listHeight : itemY + itemHeight - 2;
@@ -1307,7 +1386,7 @@ void renderOpenMenu(C3D_RenderTarget* target) {
                 if (textY_pos >= listY && textY_pos + 16 <= listY + listHeight) {
                     C2D_TextBufClear(g_textBuf);
                     C2D_Text nameText;
-                    C2D_TextParse(&nameText, g_textBuf, openProjectNames[i]);
+                    C2D_TextParse(&nameText, g_textBuf, openProjects[i].name);
                     C2D_TextOptimize(&nameText);
                     C2D_DrawText(&nameText, C2D_WithColor, textX, textY_pos, 0, textScale, textScale, UI_COLOR_WHITE);
                 }
@@ -1333,7 +1412,7 @@ void renderOpenMenu(C3D_RenderTarget* target) {
     RectButtonConfig openBtn = {
         .x = SAVE_EXIT_BTN_X,
         .y = SAVE_EXIT_BTN_Y,
-        .width = SAVE_EXIT_BTN_WIDTH,
+        .width = OPEN_BTN_WIDTH,
         .height = MENU_BOTTOM_BAR_HEIGHT,
         .drawBackground = false,
         .bgColor = 0,
@@ -1349,6 +1428,15 @@ void renderOpenMenu(C3D_RenderTarget* target) {
         .textColor = UI_COLOR_WHITE
     };
     drawRectButton(&openBtn);
+
+    C2D_DrawRectSolid(OPEN_SORT_BTN_X, MENU_BOTTOM_BAR_Y + 4, 0, 1, MENU_BOTTOM_BAR_HEIGHT - 8, UI_COLOR_GRAY_3);
+
+    RectButtonConfig sortBtn = openBtn;
+    sortBtn.x = OPEN_SORT_BTN_X;
+    sortBtn.width = OPEN_SORT_BTN_WIDTH;
+    sortBtn.text = (openSortMode == OPEN_SORT_DATE) ? "Sort: Date" : "Sort: Name";
+    sortBtn.textScale = 0.45f;
+    drawRectButton(&sortBtn);
 }
 
 void renderNewProjectMenu(C3D_RenderTarget* target) {
@@ -0,0 +1,30 @@
+#include "worker.h"
+
+Thread workerThreadCreate(ThreadFunc entry, void* arg, int priorityOffset) {
+    s32 mainPriority = 0x30;
+    svcGetThreadPriority(&mainPriority, CUR_THREAD_HANDLE);
+
+    s32 priority = mainPriority + priorityOffset;
+    if (priority < 0x18) priority = 0x18;
+    if (priority > 0x3F) priority = 0x3F;
+
+    // New 3DS exposes a third core to applications; use it when present.
+    bool isNew3DS = false;
+    APT_CheckNew3DS(&isNew3DS);
+    int core = isNew3DS ? 2 : -2;
+
+    Thread thread = threadCreate(entry, arg, WORKER_STACK_SIZE, priority, core, false);
+    if (!thread && core != -2) {
+        thread = threadCreate(entry, arg, WORKER_STACK_SIZE, priority, -2, false);
+    }
+    return thread;
+}
+
+void workerSleepMs(int ms) {
+    if (ms < 0) ms = 0;
+    svcSleepThread((s64)ms * 1000000LL);
+}
+
+float workerTicksToMs(u64 ticks) {
+    return (float)ticks * 1000.0f / (float)SYSCLOCK_ARM11;
+}
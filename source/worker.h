@@ -0,0 +1,33 @@
+#pragma once
+
+#include <3ds.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @file worker.h
+ * @brief Background thread helpers.
+ */
+
+/** @brief Default stack size for background worker threads. */
+#define WORKER_STACK_SIZE (64 * 1024)
+
+/**
+ * @brief Create a background thread that runs below the main thread priority.
+ *
+ * The thread is placed on a spare core when one is available (New 3DS),
+ * otherwise on the application core where it only runs while the main
+ * thread waits for VBlank or the GPU.
+ *
+ * @param entry Thread entry point.
+ * @param arg Argument passed to the entry point.
+ * @param priorityOffset Priority offset from the main thread (1 = just below).
+ * @return Thread handle, or NULL on failure.
+ */
+Thread workerThreadCreate(ThreadFunc entry, void* arg, int priorityOffset);
+
+/** @brief Sleep the calling thread for the given number of milliseconds. */
+void workerSleepMs(int ms);
+
+/** @brief Convert a system tick delta to milliseconds. */
+float workerTicksToMs(u64 ticks);
@@ -0,0 +1,155 @@
+#include "zip_write.h"
+
+#include <string.h>
+#include <zlib.h>
+
+#define ZIP_LOCAL_HEADER_SIZE 30
+#define ZIP_CENTRAL_HEADER_SIZE 46
+#define ZIP_END_SIZE 22
+#define ZIP_VERSION 20        // 2.0
+#define ZIP_COPY_CHUNK 32768
+
+static void putLittleEndian16(uint8_t* out, uint16_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+
+static void putLittleEndian32(uint8_t* out, uint32_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+    out[2] = (uint8_t)(value >> 16);
+    out[3] = (uint8_t)(value >> 24);
+}
+
+void zipWriteBegin(ZipWriter* writer, FILE* fp, const struct tm* time) {
+    memset(writer, 0, sizeof(*writer));
+    writer->fp = fp;
+    writer->ok = true;
+    // MS-DOS time stamps count from 1980, in two-second steps.
+    int year = time->tm_year + 1900 < 1980 ? 0 : time->tm_year + 1900 - 1980;
+    writer->dosTime = (uint16_t)((time->tm_hour << 11) | (time->tm_min << 5) | (time->tm_sec / 2));
+    writer->dosDate = (uint16_t)((year << 9) | ((time->tm_mon + 1) << 5) | time->tm_mday);
+}
+
+static bool writeBytes(ZipWriter* writer, const void* data, size_t size) {
+    if (writer->ok && size > 0 && fwrite(data, 1, size, writer->fp) != size) writer->ok = false;
+    return writer->ok;
+}
+
+// The local header of a stored entry; crc and size are patched later for
+// entries whose contents are streamed.
+static void fillLocalHeader(const ZipWriter* writer, const ZipWriteEntry* entry, uint8_t* header) {
+    memset(header, 0, ZIP_LOCAL_HEADER_SIZE);
+    putLittleEndian32(&header[0], 0x04034B50);
+    putLittleEndian16(&header[4], ZIP_VERSION);
+    putLittleEndian16(&header[10], writer->dosTime);
+    putLittleEndian16(&header[12], writer->dosDate);
+    putLittleEndian32(&header[14], entry->crc);
+    putLittleEndian32(&header[18], entry->size);   // Compressed
+    putLittleEndian32(&header[22], entry->size);   // Uncompressed
+    putLittleEndian16(&header[26], (uint16_t)strlen(entry->name));
+}
+
+static ZipWriteEntry* addEntry(ZipWriter* writer, const char* name) {
+    size_t nameLength = strlen(name);
+    if (!writer->ok || writer->count >= ZIP_WRITE_MAX_ENTRIES || nameLength >= ZIP_WRITE_MAX_NAME) {
+        writer->ok = false;
+        return NULL;
+    }
+    long offset = ftell(writer->fp);
+    if (offset < 0) {
+        writer->ok = false;
+        return NULL;
+    }
+    ZipWriteEntry* entry = &writer->entries[writer->count++];
+    memset(entry, 0, sizeof(*entry));
+    memcpy(entry->name, name, nameLength + 1);
+    entry->offset = (uint32_t)offset;
+    return entry;
+}
+
+bool zipWriteStored(ZipWriter* writer, const char* name, const void* data, size_t size) {
+    ZipWriteEntry* entry = addEntry(writer, name);
+    if (!entry) return false;
+    entry->crc = (uint32_t)crc32(crc32(0L, Z_NULL, 0), (const Bytef*)data, (uInt)size);
+    entry->size = (uint32_t)size;
+
+    uint8_t header[ZIP_LOCAL_HEADER_SIZE];
+    fillLocalHeader(writer, entry, header);
+    writeBytes(writer, header, sizeof(header));
+    writeBytes(writer, entry->name, strlen(entry->name));
+    return writeBytes(writer, data, size);
+}
+
+bool zipWriteStoredFile(ZipWriter* writer, const char* name, FILE* src) {
+    ZipWriteEntry* entry = addEntry(writer, name);
+    if (!entry) return false;
+
+    uint8_t header[ZIP_LOCAL_HEADER_SIZE];
+    fillLocalHeader(writer, entry, header);
+    writeBytes(writer, header, sizeof(header));
+    writeBytes(writer, entry->name, strlen(entry->name));
+
+    uint8_t buffer[ZIP_COPY_CHUNK];
+    uLong crc = crc32(0L, Z_NULL, 0);
+    uint64_t size = 0;
+    size_t read;
+    while (writer->ok && (read = fread(buffer, 1, sizeof(buffer), src)) > 0) {
+        crc = crc32(crc, buffer, (uInt)read);
+        size += read;
+        writeBytes(writer, buffer, read);
+    }
+    if (ferror(src) || size > 0xFFFFFFFFu) writer->ok = false;
+    if (!writer->ok) return false;
+
+    // Patch crc and sizes into the local header, then return to the end.
+    entry->crc = (uint32_t)crc;
+    entry->size = (uint32_t)size;
+    fillLocalHeader(writer, entry, header);
+    long end = ftell(writer->fp);
+    if (end < 0 || fseek(writer->fp, (long)entry->offset, SEEK_SET) != 0) {
+        writer->ok = false;
+        return false;
+    }
+    writeBytes(writer, header, sizeof(header));
+    if (fseek(writer->fp, end, SEEK_SET) != 0) writer->ok = false;
+    return writer->ok;
+}
+
+bool zipWriteEnd(ZipWriter* writer) {
+    long start = writer->ok ? ftell(writer->fp) : -1;
+    if (start < 0) {
+        writer->ok = false;
+        return false;
+    }
+
+    uint32_t directorySize = 0;
+    for (int i = 0; i < writer->count; i++) {
+        const ZipWriteEntry* entry = &writer->entries[i];
+        uint16_t nameLength = (uint16_t)strlen(entry->name);
+        uint8_t header[ZIP_CENTRAL_HEADER_SIZE];
+        memset(header, 0, sizeof(header));
+        putLittleEndian32(&header[0], 0x02014B50);
+        putLittleEndian16(&header[4], ZIP_VERSION);   // Made by
+        putLittleEndian16(&header[6], ZIP_VERSION);   // Needed
+        putLittleEndian16(&header[12], writer->dosTime);
+        putLittleEndian16(&header[14], writer->dosDate);
+        putLittleEndian32(&header[16], entry->crc);
+        putLittleEndian32(&header[20], entry->size);
+        putLittleEndian32(&header[24], entry->size);
+        putLittleEndian16(&header[28], nameLength);
+        putLittleEndian32(&header[42], entry->offset);
+        writeBytes(writer, header, sizeof(header));
+        writeBytes(writer, entry->name, nameLength);
+        directorySize += sizeof(header) + nameLength;
+    }
+
+    uint8_t end[ZIP_END_SIZE];
+    memset(end, 0, sizeof(end));
+    putLittleEndian32(&end[0], 0x06054B50);
+    putLittleEndian16(&end[8], (uint16_t)writer->count);
+    putLittleEndian16(&end[10], (uint16_t)writer->count);
+    putLittleEndian32(&end[12], directorySize);
+    putLittleEndian32(&end[16], (uint32_t)start);
+    return writeBytes(writer, end, sizeof(end));
+}
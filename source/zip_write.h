@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * @file zip_write.h
+ * @brief Minimal zip archive writer (stored entries only).
+ *
+ * Platform independent (stdio + zlib's crc32) so it can be built on a host.
+ * Entries are written one after another and never compressed, which suits
+ * archives of PNGs (OpenRaster); sizes are limited to 4 GB (no zip64).
+ */
+
+#define ZIP_WRITE_MAX_ENTRIES 16
+#define ZIP_WRITE_MAX_NAME 64
+
+typedef struct {
+    char name[ZIP_WRITE_MAX_NAME];
+    uint32_t crc;
+    uint32_t size;
+    uint32_t offset;          /**< Of the local header. */
+} ZipWriteEntry;
+
+typedef struct {
+    FILE* fp;
+    uint16_t dosTime;
+    uint16_t dosDate;
+    ZipWriteEntry entries[ZIP_WRITE_MAX_ENTRIES];
+    int count;
+    bool ok;                  /**< false after any failed write; later calls do nothing. */
+} ZipWriter;
+
+/** @brief Start an archive in fp (opened for binary writing, seekable); time stamps every entry. */
+void zipWriteBegin(ZipWriter* writer, FILE* fp, const struct tm* time);
+
+/** @brief Add an entry from memory. */
+bool zipWriteStored(ZipWriter* writer, const char* name, const void* data, size_t size);
+
+/** @brief Add an entry holding the rest of src, read to end of file. */
+bool zipWriteStoredFile(ZipWriter* writer, const char* name, FILE* src);
+
+/** @brief Write the central directory. The caller closes fp. */
+bool zipWriteEnd(ZipWriter* writer);
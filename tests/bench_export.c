@@ -0,0 +1,95 @@
+// Times PNG export by visible layer count and row filter, then by deflate
+// thread count, printing the composite and total time and the file size. Host timings only show
+// relative costs; the 3DS CPU is far slower.
+
+#include "export.h"
+
+#include <unistd.h>
+
+#include "history.h"
+#include "layers.h"
+#include "test.h"
+
+#define BENCH_W 1024
+#define BENCH_H 768
+
+static const char* filterNames[] = {"none", "sub", "up", "paeth", "adaptive"};
+
+static bool exportOnce(const ExportOptions* options, ExportStats* stats) {
+    char path[256];
+    if (!exportCanvasPNG(options, path, sizeof(path))) return false;
+    getExportStats(stats);
+    remove(path);
+    return true;
+}
+
+static void benchLayersAndFilters(void) {
+    printf("PNG export %dx%d, libpng on the calling thread (deflateThreads 0), zlib level %d:\n", BENCH_W, BENCH_H,
+           EXPORT_DEFAULT_ZLIB_LEVEL);
+    printf("  layers  filter     composite     total       size\n");
+    for (int visible = 1; visible <= MAX_LAYERS; visible++) {
+        for (int i = 0; i < MAX_LAYERS; i++) layers[i].visible = i < visible;
+        for (int f = EXPORT_FILTER_NONE; f <= EXPORT_FILTER_ADAPTIVE; f++) {
+            ExportOptions options;
+            exportDefaultOptions(&options);
+            options.filter = (ExportFilter)f;
+            options.deflateThreads = 0;
+            ExportStats stats;
+            if (!exportOnce(&options, &stats)) {
+                printf("  %6d  %-8s   FAILED\n", visible, filterNames[f]);
+                continue;
+            }
+            printf("  %6d  %-8s %8.1f ms %8.1f ms %9llu\n", visible, filterNames[f], stats.compositeMs, stats.ms,
+                   (unsigned long long)stats.bytes);
+        }
+    }
+    for (int i = 0; i < MAX_LAYERS; i++) layers[i].visible = true;
+}
+
+// Segmented deflate on 1 to EXPORT_MAX_DEFLATE_THREADS workers against
+// libpng on the calling thread. Speedups need as many host cores; the 3DS
+// has two (four on the New 3DS).
+static void benchThreads(void) {
+    printf("PNG export %dx%d by deflate threads (%ld host CPUs online), default filter and level:\n", BENCH_W,
+           BENCH_H, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("  threads     composite     total       size\n");
+    for (int threads = 0; threads <= EXPORT_MAX_DEFLATE_THREADS; threads++) {
+        ExportOptions options;
+        exportDefaultOptions(&options);
+        options.deflateThreads = threads;
+        // Best of three, since the other threads share the host with everything else.
+        ExportStats best;
+        memset(&best, 0, sizeof(best));
+        bool ok = true;
+        for (int run = 0; run < 3 && ok; run++) {
+            ExportStats stats;
+            ok = exportOnce(&options, &stats);
+            if (ok && (run == 0 || stats.ms < best.ms)) best = stats;
+        }
+        if (!ok) {
+            printf("  %7d   FAILED\n", threads);
+            continue;
+        }
+        printf("  %7d%s %8.1f ms %8.1f ms %9llu\n", threads, threads == 0 ? " (libpng)" : "         ",
+               best.compositeMs, best.ms, (unsigned long long)best.bytes);
+    }
+}
+
+int main(void) {
+    initLayers();
+    applyCanvasSize(BENCH_W, BENCH_H);
+    initHistory();
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        testFillDrawing(layers[i].buffer, BENCH_W, BENCH_H, 70u + (u32)i);
+        markLayerTilesDirty(i, 0, 0, BENCH_W - 1, BENCH_H - 1);
+    }
+    layers[1].blendMode = BLEND_MULTIPLY;
+    layers[2].opacity = 160;
+
+    benchLayersAndFilters();
+    benchThreads();
+
+    exitHistory();
+    exitLayers();
+    return 0;
+}
@@ -0,0 +1,81 @@
+// Saves and loads v3 projects of a few canvas sizes, printing the time, the
+// throughput over the raw layer bytes and the file size. Host timings only
+// show relative costs (compression vs I/O); the SD card on the 3DS is slower.
+
+#include "project_io.h"
+
+#include <sys/stat.h>
+
+#include "brush.h"
+#include "history.h"
+#include "layers.h"
+#include "project_stream.h"
+#include "test.h"
+#include "worker.h"
+
+static long fileSize(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+static double elapsedMs(u64 start) {
+    return workerTicksToMs(svcGetSystemTick() - start);
+}
+
+static double mbPerSecond(double bytes, double ms) {
+    return ms > 0.0 ? bytes / (1024.0 * 1024.0) / (ms / 1000.0) : 0.0;
+}
+
+static void benchCanvas(int width, int height, int drawnLayers) {
+    applyCanvasSize(width, height);
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        if (i < drawnLayers) {
+            testFillDrawing(layers[i].buffer, width, height, 40u + (u32)i);
+        } else {
+            clearLayer(i, 0);
+        }
+        markLayerTilesDirty(i, 0, 0, width - 1, height - 1);
+    }
+    double rawBytes = (double)MAX_LAYERS * LAYER_BUFFER_SIZE;
+
+    u64 start = svcGetSystemTick();
+    bool saved = saveProject("bench");
+    double saveMs = elapsedMs(start);
+    long size = fileSize(SAVE_DIR "/bench.mgdw");
+
+    start = svcGetSystemTick();
+    bool loaded = loadProject("bench");
+    projectStreamWaitAll();
+    double loadMs = elapsedMs(start);
+
+    // Quick save after one dab: only the touched tiles are written.
+    drawBrushToLayer(0, width / 2, height / 2, 8, 0x204080FFu);
+    start = svcGetSystemTick();
+    bool quick = quickSaveProject();
+    double quickMs = elapsedMs(start);
+    ProjectIoStats stats;
+    getProjectIoStats(&stats);
+
+    printf("  %4dx%-4d %d drawn: save %7.1f ms (%6.1f MB/s)  load %7.1f ms (%6.1f MB/s)  "
+           "file %5.1f%% of %5.1f MB  quick save %5.1f ms, %llu bytes%s\n",
+           width, height, drawnLayers, saveMs, mbPerSecond(rawBytes, saveMs), loadMs,
+           mbPerSecond(rawBytes, loadMs), 100.0 * (double)size / rawBytes, rawBytes / (1024.0 * 1024.0),
+           quickMs, (unsigned long long)stats.bytes, saved && loaded && quick ? "" : "  FAILED");
+
+    remove(SAVE_DIR "/bench.mgdw");
+}
+
+int main(void) {
+    initLayers();
+    initHistory();
+    printf("v3 project save/load (%d layers, raw bytes = all layers):\n", MAX_LAYERS);
+    int sizes[][2] = {{320, 240}, {1024, 768}, {2048, 2048}};
+    for (int s = 0; s < 3; s++) {
+        benchCanvas(sizes[s][0], sizes[s][1], 1);
+        benchCanvas(sizes[s][0], sizes[s][1], MAX_LAYERS);
+    }
+    projectStreamCancel();
+    exitHistory();
+    exitLayers();
+    return 0;
+}
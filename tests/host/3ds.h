@@ -0,0 +1,83 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file 3ds.h
+ * @brief Host stand-in for the parts of libctru the tested modules use.
+ *
+ * Types match libctru; locks, events and threads run on pthreads (see
+ * ctru.c). As on the console, threadGetCurrent() is NULL on the main thread.
+ */
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef s32 Result;
+typedef u32 Handle;
+
+#define U64_MAX UINT64_MAX
+#define CUR_THREAD_HANDLE 0xFFFF8000
+#define SYSCLOCK_ARM11 268111856LL
+#define R_SUCCEEDED(res) ((res) >= 0)
+#define R_FAILED(res) ((res) < 0)
+
+typedef pthread_mutex_t LightLock;
+
+typedef enum {
+    RESET_ONESHOT,
+    RESET_STICKY,
+    RESET_PULSE
+} ResetType;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    ResetType type;
+    bool signaled;
+} LightEvent;
+
+typedef struct HostThread* Thread;
+typedef void (*ThreadFunc)(void*);
+
+void LightLock_Init(LightLock* lock);
+void LightLock_Lock(LightLock* lock);
+int LightLock_TryLock(LightLock* lock);
+void LightLock_Unlock(LightLock* lock);
+
+void LightEvent_Init(LightEvent* event, ResetType resetType);
+void LightEvent_Clear(LightEvent* event);
+void LightEvent_Signal(LightEvent* event);
+int LightEvent_TryWait(LightEvent* event);
+void LightEvent_Wait(LightEvent* event);
+
+Thread threadCreate(ThreadFunc entrypoint, void* arg, size_t stackSize, int prio, int coreId, bool detached);
+Result threadJoin(Thread thread, u64 timeoutNs);
+void threadFree(Thread thread);
+Thread threadGetCurrent(void);
+
+Result svcGetThreadPriority(s32* out, Handle handle);
+Result svcGetThreadId(u32* out, Handle handle);
+void svcSleepThread(s64 ns);
+u64 svcGetSystemTick(void);
+u64 osGetTime(void);
+Result APT_CheckNew3DS(bool* out);
+
+/** @brief Heap size memGetFreeBytes() measures against; tests may change it. */
+extern u32 __ctru_heap_size;
+
+/** @brief Added to osGetTime(), so tests can skip ahead instead of waiting. */
+extern u64 hostTimeOffsetMs;
+
+typedef struct {
+    u16 px;
+    u16 py;
+} touchPosition;
@@ -0,0 +1,54 @@
+// Host stand-ins for the display and file system entry points the painting
+// and project modules call. Nothing is displayed on the host: the view is off
+// canvas, so a streamed load decodes every tile in the background.
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "canvas.h"
+#include "util.h"
+
+void markCanvasDirtyFull(void) {
+}
+
+void markCanvasDirtyRect(int minX, int minY, int maxX, int maxY) {
+    (void)minX;
+    (void)minY;
+    (void)maxX;
+    (void)maxY;
+}
+
+void resetCanvasDisplay(void) {
+}
+
+void getCanvasBottomView(CanvasView* view) {
+    memset(view, 0, sizeof(*view));
+}
+
+bool getCanvasViewRect(const CanvasView* view, int* minX, int* minY, int* maxX, int* maxY) {
+    (void)view;
+    *minX = 0;
+    *minY = 0;
+    *maxX = -1;
+    *maxY = -1;
+    return false;
+}
+
+void ensureDirectoryExists(const char* path) {
+    char partial[256];
+    size_t length = strlen(path);
+    if (length >= sizeof(partial)) return;
+    for (size_t i = 1; i <= length; i++) {
+        if (path[i] == '/' || path[i] == '\0') {
+            memcpy(partial, path, i);
+            partial[i] = '\0';
+            if (mkdir(partial, 0777) != 0 && errno != EEXIST) return;
+        }
+    }
+}
+
+bool fileExists(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <citro3d.h>
+
+/**
+ * @file citro2d.h
+ * @brief Host stand-in: the citro2d types shared headers mention.
+ */
+
+typedef struct {
+    u16 width;
+    u16 height;
+    float left, top, right, bottom;
+} Tex3DS_SubTexture;
+
+typedef struct {
+    C3D_Tex* tex;
+    const Tex3DS_SubTexture* subtex;
+} C2D_Image;
+
+typedef struct {
+    struct { float x, y, w, h; } pos;
+    struct { float x, y; } center;
+    float depth;
+    float angle;
+} C2D_DrawParams;
+
+typedef struct {
+    C2D_Image image;
+    C2D_DrawParams params;
+} C2D_Sprite;
+
+typedef struct C2D_SpriteSheet_s* C2D_SpriteSheet;
+typedef struct C2D_TextBuf_s* C2D_TextBuf;
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <3ds.h>
+
+/**
+ * @file citro3d.h
+ * @brief Host stand-in: the citro3d types shared headers mention.
+ */
+
+typedef struct {
+    void* data;
+    u16 width;
+    u16 height;
+} C3D_Tex;
+
+typedef struct C3D_RenderTarget_tag C3D_RenderTarget;
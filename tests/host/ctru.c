@@ -0,0 +1,148 @@
+#include <3ds.h>
+
+#include <stdlib.h>
+#include <time.h>
+
+struct HostThread {
+    pthread_t thread;
+    ThreadFunc entry;
+    void* arg;
+};
+
+u32 __ctru_heap_size = 256u * 1024u * 1024u;
+u64 hostTimeOffsetMs = 0;
+
+static __thread Thread currentThread = NULL;
+static __thread u32 currentThreadId = 0;
+static u32 nextThreadId = 1;
+static pthread_mutex_t threadIdMutex = PTHREAD_MUTEX_INITIALIZER;
+
+void LightLock_Init(LightLock* lock) {
+    pthread_mutex_init(lock, NULL);
+}
+
+void LightLock_Lock(LightLock* lock) {
+    pthread_mutex_lock(lock);
+}
+
+int LightLock_TryLock(LightLock* lock) {
+    return pthread_mutex_trylock(lock) == 0 ? 0 : 1;
+}
+
+void LightLock_Unlock(LightLock* lock) {
+    pthread_mutex_unlock(lock);
+}
+
+void LightEvent_Init(LightEvent* event, ResetType resetType) {
+    pthread_mutex_init(&event->mutex, NULL);
+    pthread_cond_init(&event->cond, NULL);
+    event->type = resetType;
+    event->signaled = false;
+}
+
+void LightEvent_Clear(LightEvent* event) {
+    pthread_mutex_lock(&event->mutex);
+    event->signaled = false;
+    pthread_mutex_unlock(&event->mutex);
+}
+
+void LightEvent_Signal(LightEvent* event) {
+    pthread_mutex_lock(&event->mutex);
+    event->signaled = event->type != RESET_PULSE;
+    pthread_cond_broadcast(&event->cond);
+    pthread_mutex_unlock(&event->mutex);
+}
+
+int LightEvent_TryWait(LightEvent* event) {
+    pthread_mutex_lock(&event->mutex);
+    int signaled = event->signaled;
+    if (signaled && event->type == RESET_ONESHOT) event->signaled = false;
+    pthread_mutex_unlock(&event->mutex);
+    return signaled;
+}
+
+void LightEvent_Wait(LightEvent* event) {
+    pthread_mutex_lock(&event->mutex);
+    if (event->type == RESET_PULSE) {
+        pthread_cond_wait(&event->cond, &event->mutex);
+    } else {
+        while (!event->signaled) pthread_cond_wait(&event->cond, &event->mutex);
+        if (event->type == RESET_ONESHOT) event->signaled = false;
+    }
+    pthread_mutex_unlock(&event->mutex);
+}
+
+static void* threadMain(void* arg) {
+    Thread thread = (Thread)arg;
+    currentThread = thread;
+    thread->entry(thread->arg);
+    return NULL;
+}
+
+Thread threadCreate(ThreadFunc entrypoint, void* arg, size_t stackSize, int prio, int coreId, bool detached) {
+    (void)stackSize;
+    (void)prio;
+    (void)coreId;
+    Thread thread = (Thread)calloc(1, sizeof(*thread));
+    if (!thread) return NULL;
+    thread->entry = entrypoint;
+    thread->arg = arg;
+    if (pthread_create(&thread->thread, NULL, threadMain, thread) != 0) {
+        free(thread);
+        return NULL;
+    }
+    if (detached) pthread_detach(thread->thread);
+    return thread;
+}
+
+Result threadJoin(Thread thread, u64 timeoutNs) {
+    (void)timeoutNs;
+    return pthread_join(thread->thread, NULL) == 0 ? 0 : -1;
+}
+
+void threadFree(Thread thread) {
+    free(thread);
+}
+
+Thread threadGetCurrent(void) {
+    return currentThread;
+}
+
+Result svcGetThreadPriority(s32* out, Handle handle) {
+    (void)handle;
+    *out = 0x30;
+    return 0;
+}
+
+Result svcGetThreadId(u32* out, Handle handle) {
+    (void)handle;
+    if (currentThreadId == 0) {
+        pthread_mutex_lock(&threadIdMutex);
+        currentThreadId = nextThreadId++;
+        pthread_mutex_unlock(&threadIdMutex);
+    }
+    *out = currentThreadId;
+    return 0;
+}
+
+void svcSleepThread(s64 ns) {
+    struct timespec ts = {(time_t)(ns / 1000000000LL), (long)(ns % 1000000000LL)};
+    nanosleep(&ts, NULL);
+}
+
+u64 svcGetSystemTick(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * (u64)SYSCLOCK_ARM11 + (u64)ts.tv_nsec * (u64)SYSCLOCK_ARM11 / 1000000000ull;
+}
+
+u64 osGetTime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (u64)ts.tv_sec * 1000u + (u64)ts.tv_nsec / 1000000u + hostTimeOffsetMs;
+}
+
+Result APT_CheckNew3DS(bool* out) {
+    *out = false;
+    return 0;
+}
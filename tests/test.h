@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @file test.h
+ * @brief Assertion helpers shared by the host tests.
+ *
+ * Every test is its own program: CHECK records a failure and carries on,
+ * main() returns testResult() so make stops at the first failing program.
+ * The Makefile runs each program in an empty scratch directory, so tests
+ * create their files with relative paths.
+ */
+
+static int testChecks = 0;
+static int testFailures = 0;
+
+#define CHECK(cond) do { \
+        testChecks++; \
+        if (!(cond)) { \
+            testFailures++; \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while (0)
+
+/** @brief Print the summary line and return the process exit code. */
+static inline int testResult(const char* name) {
+    printf("%s: %d checks, %d failed\n", name, testChecks, testFailures);
+    return testFailures ? 1 : 0;
+}
+
+/** @brief Deterministic xorshift32 so failures reproduce. */
+static inline uint32_t testRandom(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/**
+ * @brief Fill a layer-format buffer with something like a drawing: a
+ * transparent background with a few opaque strokes and a soft gradient blob.
+ */
+static inline void testFillDrawing(uint32_t* pixels, int width, int height, uint32_t seed) {
+    memset(pixels, 0, (size_t)width * height * sizeof(uint32_t));
+    uint32_t state = seed ? seed : 1;
+    for (int stroke = 0; stroke < 12; stroke++) {
+        int x = (int)(testRandom(&state) % (uint32_t)width);
+        int y = (int)(testRandom(&state) % (uint32_t)height);
+        int dx = (int)(testRandom(&state) % 5) - 2;
+        int dy = (int)(testRandom(&state) % 5) - 2;
+        uint32_t color = testRandom(&state) | 0xFF;
+        for (int step = 0; step < width; step++) {
+            for (int oy = -2; oy <= 2; oy++) {
+                for (int ox = -2; ox <= 2; ox++) {
+                    int px = x + ox, py = y + oy;
+                    if (px >= 0 && px < width && py >= 0 && py < height) {
+                        pixels[py * width + px] = color;
+                    }
+                }
+            }
+            x += dx;
+            y += dy;
+            if (x < 0 || x >= width || y < 0 || y >= height) break;
+        }
+    }
+    int cx = width / 3, cy = height / 2, r = (width < height ? width : height) / 4;
+    for (int y = cy - r; y < cy + r; y++) {
+        for (int x = cx - r; x < cx + r; x++) {
+            if (x < 0 || x >= width || y < 0 || y >= height) continue;
+            int d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+            if (d2 >= r * r) continue;
+            uint32_t a = (uint32_t)(255 - d2 * 255 / (r * r));
+            pixels[y * width + x] = 0x3080C000u | a;
+        }
+    }
+}
@@ -0,0 +1,219 @@
+#include "autosave.h"
+
+#include <sys/stat.h>
+
+#include "brush.h"
+#include "history.h"
+#include "layers.h"
+#include "project_io.h"
+#include "project_stream.h"
+#include "test.h"
+#include "util.h"
+
+#define STRESS_PATH AUTOSAVE_DIR "/stress.mgdw"
+
+static long fileSize(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+// Make the next autosave due, as if the interval had passed.
+static void runAutosavePass(bool busy) {
+    hostTimeOffsetMs += AUTOSAVE_INTERVAL_MS;
+    updateAutosave(busy);
+}
+
+// Let the worker finish and keep passing until one has nothing to write.
+static void settleAutosave(void) {
+    for (int pass = 0; pass < 1000; pass++) {
+        while (autosaveIsRunning()) {
+            svcSleepThread(1000000);
+            updateAutosave(false);
+        }
+        runAutosavePass(false);
+        if (!autosaveIsRunning()) return;
+    }
+    CHECK(!"autosave never settled");
+}
+
+// A copy of the project as an autosave pass saw it.
+typedef struct {
+    u32* pixels[MAX_LAYERS];
+    ProjectLayerInfo info[MAX_LAYERS];
+} ProjectCopy;
+
+static void copyProject(ProjectCopy* copy) {
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        if (!copy->pixels[i]) copy->pixels[i] = (u32*)malloc(LAYER_BUFFER_SIZE);
+        memcpy(copy->pixels[i], layers[i].buffer, LAYER_BUFFER_SIZE);
+        projectFillLayerInfo(i, &copy->info[i]);
+    }
+}
+
+static void freeProjectCopy(ProjectCopy* copy) {
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        free(copy->pixels[i]);
+        copy->pixels[i] = NULL;
+    }
+}
+
+// The recovery file must read back exactly as the copy.
+static bool recoveryMatches(const ProjectCopy* copy) {
+    ProjectReader reader;
+    if (!projectReaderOpenFile(&reader, STRESS_PATH)) return false;
+    bool ok = reader.header.canvasWidth == (u32)CANVAS_WIDTH && reader.header.canvasHeight == (u32)CANVAS_HEIGHT;
+    u32* pixels = (u32*)malloc(LAYER_BUFFER_SIZE);
+    for (int i = 0; ok && i < MAX_LAYERS; i++) {
+        ProjectLayerInfo info;
+        ok = projectReaderReadLayer(&reader, &info, pixels, LAYER_STRIDE) &&
+             memcmp(&info, &copy->info[i], sizeof(info)) == 0 &&
+             memcmp(pixels, copy->pixels[i], LAYER_BUFFER_SIZE) == 0;
+    }
+    free(pixels);
+    projectReaderClose(&reader);
+    return ok;
+}
+
+static bool recoveryMatchesLayers(void) {
+    ProjectCopy copy = {{NULL}};
+    copyProject(&copy);
+    bool ok = recoveryMatches(&copy);
+    freeProjectCopy(&copy);
+    return ok;
+}
+
+static void startStressSession(int width, int height) {
+    initLayers();
+    applyCanvasSize(width, height);
+    initHistory();
+    initAutosave();
+    snprintf(currentProjectName, sizeof(currentProjectName), "stress");
+    projectHasName = true;
+    projectHasUnsavedChanges = true;
+}
+
+static void endStressSession(void) {
+    exitAutosave();
+    projectStreamCancel();
+    exitHistory();
+    exitLayers();
+}
+
+static void randomEdit(u32* rng) {
+    int layer = (int)(testRandom(rng) % MAX_LAYERS);
+    u32 kind = testRandom(rng) % 20;
+    if (kind < 14) {
+        int x = (int)(testRandom(rng) % CANVAS_WIDTH);
+        int y = (int)(testRandom(rng) % CANVAS_HEIGHT);
+        drawLineToLayer(layer, x, y, x + (int)(testRandom(rng) % 80) - 40, y + (int)(testRandom(rng) % 80) - 40,
+                        1 + (int)(testRandom(rng) % 12), testRandom(rng) | 0xFF);
+    } else if (kind < 16) {
+        // Large edits exceed the snapshot budget and spread over several passes.
+        testFillDrawing(layers[layer].buffer, CANVAS_WIDTH, CANVAS_HEIGHT, testRandom(rng));
+        markLayerTilesDirty(layer, 0, 0, CANVAS_WIDTH - 1, CANVAS_HEIGHT - 1);
+    } else if (kind < 17) {
+        clearLayer(layer, 0);
+    } else if (kind < 18) {
+        floodFill(layer, (int)(testRandom(rng) % CANVAS_WIDTH), (int)(testRandom(rng) % CANVAS_HEIGHT),
+                  testRandom(rng) | 0xFF, 0, 10);
+    } else {
+        layers[layer].opacity = (u8)testRandom(rng);
+        layers[layer].visible = !layers[layer].visible;
+    }
+    projectHasUnsavedChanges = true;
+}
+
+// Edit while passes run on a canvas large enough for full-layer edits to
+// exceed the snapshot budget; the file must catch up once editing stops.
+static void testStressBacklog(void) {
+    startStressSession(1024, 768);
+
+    // Edits land while the worker is packing and appending the previous pass.
+    u32 rng = 1234;
+    int settles = 0;
+    for (int step = 0; step < 600; step++) {
+        randomEdit(&rng);
+        u32 pace = testRandom(&rng) % 8;
+        if (pace == 0) {
+            runAutosavePass(false);
+        } else if (pace == 1) {
+            // Mid-stroke passes are postponed.
+            runAutosavePass(true);
+        } else {
+            updateAutosave(false);
+        }
+        if (step % 100 == 99) {
+            settleAutosave();
+            CHECK(recoveryMatchesLayers());
+            settles++;
+        }
+    }
+    CHECK(settles == 6);
+
+    settleAutosave();
+    long recoverySize = fileSize(STRESS_PATH);
+    CHECK(recoverySize > 0);
+
+    // Recover as after a crash: the newest recovery file loads as the live project.
+    u32* live[MAX_LAYERS];
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        live[i] = (u32*)malloc(LAYER_BUFFER_SIZE);
+        memcpy(live[i], layers[i].buffer, LAYER_BUFFER_SIZE);
+        clearLayer(i, 0);
+    }
+    char name[PROJECT_NAME_MAX];
+    char path[256];
+    CHECK(findNewestAutosave(name, path, sizeof(path)));
+    CHECK(strcmp(name, "stress") == 0);
+    CHECK(loadRecoveredProject(path, name));
+    projectStreamWaitAll();
+    CHECK(projectHasUnsavedChanges);
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        CHECK(memcmp(live[i], layers[i].buffer, LAYER_BUFFER_SIZE) == 0);
+        free(live[i]);
+    }
+
+    // Saving the project makes the recovery file redundant.
+    CHECK(saveProject("stress"));
+    long savedSize = fileSize(SAVE_DIR "/stress.mgdw");
+    // Dead space was compacted: the recovery file stayed within a few copies of the project.
+    CHECK(recoverySize < 3 * savedSize + 64 * 1024);
+    updateAutosave(false);
+    CHECK(!fileExists(STRESS_PATH));
+
+    endStressSession();
+}
+
+// On a canvas whose layers fit the snapshot budget every pass is complete, so
+// each finished pass must leave exactly what it copied, appended or rewritten.
+static void testStressEveryPass(void) {
+    startStressSession(512, 384);
+    CHECK((size_t)MAX_LAYERS * LAYER_BUFFER_SIZE <= AUTOSAVE_SNAPSHOT_BUDGET);
+
+    ProjectCopy queued = {{NULL}};
+    u32 rng = 99;
+    int passes = 0;
+    for (int step = 0; step < 1500; step++) {
+        randomEdit(&rng);
+        if (autosaveIsRunning()) {
+            // Without the interval passing, this only collects a finished pass.
+            updateAutosave(false);
+            if (!autosaveIsRunning()) {
+                CHECK(recoveryMatches(&queued));
+                passes++;
+            }
+        } else if (testRandom(&rng) % 3 == 0) {
+            runAutosavePass(false);
+            if (autosaveIsRunning()) copyProject(&queued);
+        }
+    }
+    CHECK(passes > 20);
+    freeProjectCopy(&queued);
+    endStressSession();
+}
+
+int main(void) {
+    testStressBacklog();
+    testStressEveryPass();
+    return testResult("test_autosave");
+}
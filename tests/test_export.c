@@ -0,0 +1,86 @@
+#include "export.h"
+
+#include <png.h>
+
+#include "history.h"
+#include "layers.h"
+#include "test.h"
+
+#define EXPORT_W 333
+#define EXPORT_H 250
+
+// Decode an exported PNG to 8-bit RGBA; NULL when libpng refuses it.
+static uint8_t* decodePng(const char* path, int* w, int* h) {
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, path)) return NULL;
+    image.format = PNG_FORMAT_RGBA;
+    uint8_t* pixels = (uint8_t*)malloc(PNG_IMAGE_SIZE(image));
+    if (!png_image_finish_read(&image, NULL, pixels, 0, NULL)) {
+        free(pixels);
+        return NULL;
+    }
+    *w = (int)image.width;
+    *h = (int)image.height;
+    return pixels;
+}
+
+static uint8_t* exportAndDecode(const ExportOptions* options) {
+    char path[256];
+    if (!exportCanvasPNG(options, path, sizeof(path))) return NULL;
+    int w = 0, h = 0;
+    uint8_t* pixels = decodePng(path, &w, &h);
+    remove(path);
+    if (pixels && (w != EXPORT_W || h != EXPORT_H)) {
+        free(pixels);
+        return NULL;
+    }
+    return pixels;
+}
+
+// Every deflate thread count and filter must produce the image libpng alone writes.
+static void testThreadsAndFilters(void) {
+    ExportOptions options;
+    exportDefaultOptions(&options);
+    options.deflateThreads = 0;
+    options.filter = EXPORT_FILTER_NONE;
+    uint8_t* reference = exportAndDecode(&options);
+    CHECK(reference != NULL);
+    if (!reference) return;
+    size_t size = (size_t)EXPORT_W * EXPORT_H * 4;
+
+    for (int threads = 0; threads <= EXPORT_MAX_DEFLATE_THREADS; threads++) {
+        for (int f = EXPORT_FILTER_NONE; f <= EXPORT_FILTER_ADAPTIVE; f++) {
+            exportDefaultOptions(&options);
+            options.deflateThreads = threads;
+            options.filter = (ExportFilter)f;
+            options.zlibLevel = (threads + f) % 10;
+            uint8_t* pixels = exportAndDecode(&options);
+            CHECK(pixels && memcmp(pixels, reference, size) == 0);
+            ExportStats stats;
+            getExportStats(&stats);
+            CHECK(stats.valid && stats.deflateThreads == threads && stats.bytes > 0);
+            free(pixels);
+        }
+    }
+    free(reference);
+}
+
+int main(void) {
+    initLayers();
+    applyCanvasSize(EXPORT_W, EXPORT_H);
+    initHistory();
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        testFillDrawing(layers[i].buffer, EXPORT_W, EXPORT_H, 50u + (u32)i);
+        markLayerTilesDirty(i, 0, 0, EXPORT_W - 1, EXPORT_H - 1);
+    }
+    layers[1].blendMode = BLEND_MULTIPLY;
+    layers[2].opacity = 100;
+
+    testThreadsAndFilters();
+
+    exitHistory();
+    exitLayers();
+    return testResult("test_export");
+}
@@ -0,0 +1,164 @@
+#include "brush.h"
+
+#include "history.h"
+#include "layers.h"
+#include "test.h"
+
+// The reference fill: the 4-connected region of the start pixel's colour in
+// the composite as it was, grown by `expand` in Manhattan distance, each
+// pixel drawn once.
+static void referenceFill(u32* composite, int layerIndex, int startX, int startY, u32 fillColor, int expand,
+                          int tolerancePct) {
+    int w = CANVAS_WIDTH, h = CANVAS_HEIGHT;
+    compositeLayerRect(composite, w, 0, 0, w - 1, h - 1);
+    u32 target = composite[startY * w + startX];
+    if (target == fillColor) return;
+    int threshold = tolerancePct * 255 / 100;
+
+    u8* region = (u8*)calloc((size_t)w * h, 1);
+    int* queue = (int*)malloc((size_t)w * h * sizeof(int));
+    int head = 0, tail = 0;
+    queue[tail++] = startY * w + startX;
+    region[startY * w + startX] = 1;
+    while (head < tail) {
+        int i = queue[head++];
+        int x = i % w, y = i / w;
+        int nx[4] = {x - 1, x + 1, x, x}, ny[4] = {y, y, y - 1, y + 1};
+        for (int d = 0; d < 4; d++) {
+            if (nx[d] < 0 || nx[d] >= w || ny[d] < 0 || ny[d] >= h) continue;
+            int n = ny[d] * w + nx[d];
+            if (region[n]) continue;
+            u32 c = composite[n];
+            int diff = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                int dc = (int)((c >> shift) & 0xFF) - (int)((target >> shift) & 0xFF);
+                if (dc < 0) dc = -dc;
+                if (dc > diff) diff = dc;
+            }
+            if (tolerancePct <= 0 ? c != target : diff > threshold) continue;
+            region[n] = 1;
+            queue[tail++] = n;
+        }
+    }
+    free(queue);
+
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            bool paint = false;
+            for (int dy = -expand; dy <= expand && !paint; dy++) {
+                int r = expand - (dy < 0 ? -dy : dy);
+                if (y + dy < 0 || y + dy >= h) continue;
+                for (int dx = -r; dx <= r && !paint; dx++) {
+                    paint = x + dx >= 0 && x + dx < w && region[(y + dy) * w + x + dx];
+                }
+            }
+            if (paint) drawPixelToLayer(layerIndex, x, y, fillColor);
+        }
+    }
+    free(region);
+}
+
+// Random shapes in a few flat colours, so regions have edges and holes.
+static void drawShapes(u32* rng) {
+    static const u32 palette[] = {0xFF0000FF, 0x00FF00FF, 0x0000FF80, 0xFFFFFF00, 0x102030FF, 0x112131FF};
+    for (int i = 0; i < MAX_LAYERS; i++) clearLayer(i, 0);
+    for (int n = 0; n < 60; n++) {
+        int layer = (int)(testRandom(rng) % MAX_LAYERS);
+        int x = (int)(testRandom(rng) % CANVAS_WIDTH), y = (int)(testRandom(rng) % CANVAS_HEIGHT);
+        drawLineToLayer(layer, x, y, x + (int)(testRandom(rng) % 120) - 60, y + (int)(testRandom(rng) % 120) - 60,
+                        1 + (int)(testRandom(rng) % 6), palette[testRandom(rng) % 6]);
+    }
+    // A comb of one-pixel gaps makes many short spans.
+    int layer = (int)(testRandom(rng) % MAX_LAYERS);
+    for (int x = 0; x < CANVAS_WIDTH; x += 2) {
+        for (int y = CANVAS_HEIGHT / 4; y < CANVAS_HEIGHT * 3 / 4; y++) {
+            if ((x / 2 + y) % 7 != 0) drawPixelToLayer(layer, x, y, palette[0]);
+        }
+    }
+    for (int i = 0; i < MAX_LAYERS; i++) markLayerTilesDirty(i, 0, 0, CANVAS_WIDTH - 1, CANVAS_HEIGHT - 1);
+}
+
+// floodFill must leave the layer exactly as the reference does.
+static bool fillMatchesReference(int layer, int x, int y, u32 color, int expand, int tolerance) {
+    u32* composite = (u32*)malloc(LAYER_BUFFER_SIZE);
+    u32* before = (u32*)malloc(LAYER_BUFFER_SIZE);
+    u32* expected = (u32*)malloc(LAYER_BUFFER_SIZE);
+    memcpy(before, layers[layer].buffer, LAYER_BUFFER_SIZE);
+    referenceFill(composite, layer, x, y, color, expand, tolerance);
+    memcpy(expected, layers[layer].buffer, LAYER_BUFFER_SIZE);
+    memcpy(layers[layer].buffer, before, LAYER_BUFFER_SIZE);
+
+    floodFill(layer, x, y, color, expand, tolerance);
+    bool ok = memcmp(layers[layer].buffer, expected, LAYER_BUFFER_SIZE) == 0;
+    free(expected);
+    free(before);
+    free(composite);
+    return ok;
+}
+
+static void testMatchesReference(int width, int height, int rounds) {
+    initLayers();
+    applyCanvasSize(width, height);
+    initHistory();
+    u32 rng = 5 + (u32)width;
+    for (int round = 0; round < rounds; round++) {
+        drawShapes(&rng);
+        layers[1].blendMode = (BlendMode)(testRandom(&rng) % 3);
+        layers[2].opacity = (u8)(128 + testRandom(&rng) % 128);
+        layers[3].visible = testRandom(&rng) % 4 != 0;
+        for (int fill = 0; fill < 6; fill++) {
+            int layer = (int)(testRandom(&rng) % MAX_LAYERS);
+            int x = (int)(testRandom(&rng) % CANVAS_WIDTH), y = (int)(testRandom(&rng) % CANVAS_HEIGHT);
+            // Translucent and clear colours blend, so a pixel drawn twice would differ.
+            static const u32 colors[] = {0x336699FF, 0x33669980, 0x00000000, 0xFF0000FF};
+            u32 color = colors[testRandom(&rng) % 4];
+            int expand = (int)(testRandom(&rng) % 11);
+            int tolerance = (int)(testRandom(&rng) % 4) * 15;
+            layers[layer].alphaLock = testRandom(&rng) % 5 == 0;
+            CHECK(fillMatchesReference(layer, x, y, color, expand, tolerance));
+            layers[layer].alphaLock = false;
+        }
+    }
+    exitHistory();
+    exitLayers();
+}
+
+// Full rows between rows of one-pixel gaps: every full row seeds half the
+// row below it, more spans than the fill's stack holds.
+static void testManySpans(void) {
+    initLayers();
+    applyCanvasSize(MAX_CANVAS_DIM, 48);
+    initHistory();
+    for (int y = 1; y < CANVAS_HEIGHT; y += 2) {
+        for (int x = y % 4 == 1 ? 1 : 0; x < CANVAS_WIDTH; x += 2) layers[2].buffer[y * LAYER_STRIDE + x] = 0x000000FF;
+    }
+    markLayerTilesDirty(2, 0, 0, CANVAS_WIDTH - 1, CANVAS_HEIGHT - 1);
+    CHECK(fillMatchesReference(0, 0, 0, 0xFF00FFFF, 0, 0));
+    CHECK(fillMatchesReference(1, CANVAS_WIDTH - 1, CANVAS_HEIGHT - 1, 0x00FF0080, 2, 0));
+    exitHistory();
+    exitLayers();
+}
+
+// A canvas-wide region: the whole canvas fills, on the largest canvas too.
+static void testWholeCanvas(int width, int height) {
+    initLayers();
+    applyCanvasSize(width, height);
+    initHistory();
+    floodFill(0, width / 2, height / 2, 0x123456FF, 0, 0);
+    bool all = true;
+    for (int y = 0; y < height && all; y++) {
+        for (int x = 0; x < width && all; x++) all = layers[0].buffer[y * LAYER_STRIDE + x] == 0x123456FF;
+    }
+    CHECK(all);
+    exitHistory();
+    exitLayers();
+}
+
+int main(void) {
+    testMatchesReference(200, 150, 12);
+    testMatchesReference(97, 301, 6);
+    testMatchesReference(1, 64, 2);
+    testManySpans();
+    testWholeCanvas(MAX_CANVAS_DIM, MAX_CANVAS_DIM);
+    return testResult("test_fill");
+}
@@ -0,0 +1,244 @@
+#include "history.h"
+
+#include <sys/stat.h>
+
+#include "brush.h"
+#include "layers.h"
+#include "test.h"
+
+#define CANVAS_W 96
+#define CANVAS_H 64
+#define UNDO_LOG SAVE_DIR "/.undo.log"
+#define UNDO_INDEX SAVE_DIR "/.undo.idx"
+
+static long fileSize(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+// Step k of a scripted session leaves layer 0 holding noise seeded k + 1;
+// noise does not compress, so every snapshot stays raw and eviction spills
+// full buffers, the case that used to stall the main thread.
+static void fillNoise(u32* pixels, u32 seed) {
+    u32 state = seed * 0x9E3779B9u + 1;
+    for (int i = 0; i < CANVAS_W * CANVAS_H; i++) pixels[i] = testRandom(&state);
+}
+
+static bool layerIsNoise(int layerIndex, u32 seed) {
+    static u32 expected[CANVAS_W * CANVAS_H];
+    if (seed == 0) {
+        memset(expected, 0, sizeof(expected));
+    } else {
+        fillNoise(expected, seed);
+    }
+    return memcmp(layers[layerIndex].buffer, expected, sizeof(expected)) == 0;
+}
+
+// Undo, then let the worker finish a read-back the way the main loop does.
+static void undoAndWait(void) {
+    undo();
+    float progress = 0.0f;
+    for (int i = 0; i < 10000 && historyIsLoading(&progress); i++) {
+        svcSleepThread(1000000);
+        updateHistory();
+    }
+}
+
+static void startSession(void) {
+    initLayers();
+    applyCanvasSize(CANVAS_W, CANVAS_H);
+    initHistory();
+}
+
+static void endSession(void) {
+    exitHistory();
+    exitLayers();
+}
+
+static void testSpillRoundTrip(void) {
+    startSession();
+    // Room for three snapshots: almost every step evicts one.
+    historySetByteBudget(3 * LAYER_BUFFER_SIZE);
+
+    const int steps = 40;
+    for (int step = 0; step < steps; step++) {
+        pushLayerHistory(0);
+        fillNoise(layers[0].buffer, (u32)step + 1);
+    }
+    HistoryStats stats;
+    getHistoryStats(&stats);
+    CHECK(stats.spilledCount > 0);
+    CHECK(stats.entryCount + stats.spilledCount == steps);
+
+    // Undo all the way back through the spilled records, some of which may
+    // still be queued for the worker.
+    for (int step = steps - 1; step >= 0; step--) {
+        CHECK(canUndo());
+        undoAndWait();
+        CHECK(layerIsNoise(0, (u32)step));
+    }
+    CHECK(!canUndo());
+    CHECK(layerIsNoise(0, 0));
+
+    // Every record was read back, so the spill files are back to their headers.
+    CHECK(fileSize(UNDO_LOG) == 8);
+    CHECK(fileSize(UNDO_INDEX) == 8);
+
+    // Redo replays whatever stayed within the budget, in order.
+    int redone = 0;
+    while (canRedo()) {
+        redo();
+        redone++;
+        CHECK(layerIsNoise(0, (u32)redone));
+    }
+    CHECK(redone > 0);
+    endSession();
+}
+
+static void testSpillThenEdit(void) {
+    startSession();
+    historySetByteBudget(3 * LAYER_BUFFER_SIZE);
+    for (int step = 0; step < 20; step++) {
+        pushLayerHistory(0);
+        fillNoise(layers[0].buffer, (u32)step + 1);
+    }
+    // Undo into the spilled part, then branch off with a new edit: the redo
+    // steps go, the older spilled steps stay reachable.
+    for (int i = 0; i < 6; i++) undoAndWait();
+    CHECK(layerIsNoise(0, 14));
+    pushLayerHistory(0);
+    fillNoise(layers[0].buffer, 100);
+    CHECK(!canRedo());
+    undoAndWait();
+    CHECK(layerIsNoise(0, 14));
+    for (int step = 13; step >= 0; step--) {
+        undoAndWait();
+        CHECK(layerIsNoise(0, (u32)step));
+    }
+    CHECK(!canUndo());
+    endSession();
+}
+
+//---------------------------------------------------------------------------------
+// Journal replay: undo and redo rebuild strokes, fills, clears and merges from
+// a keyframe, and must land on exactly the pixels the direct draw produced.
+//---------------------------------------------------------------------------------
+#define SCRIPT_STEPS 48
+#define CANVAS_PIXELS (CANVAS_W * CANVAS_H)
+
+static u32* scriptStates = NULL;
+
+static void captureState(int step) {
+    for (int j = 0; j < MAX_LAYERS; j++) {
+        memcpy(scriptStates + ((size_t)step * MAX_LAYERS + j) * CANVAS_PIXELS, layers[j].buffer, LAYER_BUFFER_SIZE);
+    }
+}
+
+static bool stateMatches(int step) {
+    for (int j = 0; j < MAX_LAYERS; j++) {
+        if (memcmp(scriptStates + ((size_t)step * MAX_LAYERS + j) * CANVAS_PIXELS, layers[j].buffer,
+                   LAYER_BUFFER_SIZE) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Feed a stroke the way main.c does: the journal and the brush see the same calls.
+static void scriptStroke(u32* rng, int layerIndex) {
+    BrushType type = (BrushType)(testRandom(rng) % BRUSH_TYPE_COUNT);
+    u32 color = testRandom(rng) | 0x40;
+    if (testRandom(rng) % 4 == 0) color = 0x00000000;
+    int size = 1 + (int)(testRandom(rng) % 8);
+    int x = (int)(testRandom(rng) % CANVAS_W);
+    int y = (int)(testRandom(rng) % CANVAS_H);
+
+    historyBeginStroke(layerIndex, type);
+    startStroke(layerIndex, type);
+    drawBrushToLayer(layerIndex, x, y, size, color);
+    historyAddStrokeDot(x, y, size, color);
+    int segments = 1 + (int)(testRandom(rng) % 12);
+    for (int i = 0; i < segments; i++) {
+        int nx = x + (int)(testRandom(rng) % 31) - 15;
+        int ny = y + (int)(testRandom(rng) % 31) - 15;
+        drawLineToLayer(layerIndex, x, y, nx, ny, size, color);
+        historyAddStrokeLine(x, y, nx, ny, size, color);
+        x = nx;
+        y = ny;
+    }
+    endStroke();
+    historyEndStroke();
+}
+
+static void runScriptStep(u32* rng, int step) {
+    int layerIndex = (int)(testRandom(rng) % 3);
+    currentLayerIndex = layerIndex;
+    u32 kind = testRandom(rng) % 16;
+    if (kind < 9) {
+        scriptStroke(rng, layerIndex);
+    } else if (kind < 12) {
+        int x = (int)(testRandom(rng) % CANVAS_W);
+        int y = (int)(testRandom(rng) % CANVAS_H);
+        u32 color = testRandom(rng) | 0xFF;
+        int expand = (int)(testRandom(rng) % 3);
+        int tolerance = (int)(testRandom(rng) % 40);
+        pushFillHistory(layerIndex, x, y, color, expand, tolerance);
+        floodFill(layerIndex, x, y, color, expand, tolerance);
+    } else if (kind < 13) {
+        pushClearHistory(layerIndex, 0x00000000);
+        clearLayer(layerIndex, 0x00000000);
+    } else if (kind < 14 && layerIndex > 0) {
+        pushMergeDownHistory(layerIndex);
+        mergeLayerDown(layerIndex);
+    } else if (kind < 15) {
+        // A props record breaks the op chain, so the next op opens a keyframe.
+        pushLayerPropsHistory(layerIndex);
+        layers[layerIndex].alphaLock = !layers[layerIndex].alphaLock;
+    } else {
+        // A pixel record in the middle of a chain.
+        pushLayerHistory(layerIndex);
+        drawBrushToLayer(layerIndex, step % CANVAS_W, step % CANVAS_H, 6, 0x3366CCFF);
+    }
+}
+
+static void testJournalReplay(size_t budget) {
+    startSession();
+    historySetByteBudget(budget);
+    scriptStates = (u32*)malloc((size_t)(SCRIPT_STEPS + 1) * MAX_LAYERS * LAYER_BUFFER_SIZE);
+    u32 rng = 0xC0FFEEu ^ (u32)budget;
+    captureState(0);
+    for (int step = 1; step <= SCRIPT_STEPS; step++) {
+        runScriptStep(&rng, step);
+        captureState(step);
+    }
+
+    // Every record is one undo step, each landing on the state before it.
+    int undone = 0;
+    for (int step = SCRIPT_STEPS - 1; step >= 0 && canUndo(); step--) {
+        undoAndWait();
+        undone++;
+        CHECK(stateMatches(step));
+    }
+    CHECK(!canUndo());
+    CHECK(undone == SCRIPT_STEPS);
+
+    int redone = 0;
+    while (canRedo()) {
+        redo();
+        redone++;
+        CHECK(stateMatches(redone));
+    }
+    CHECK(redone > 0);
+    free(scriptStates);
+    scriptStates = NULL;
+    endSession();
+}
+
+int main(void) {
+    testSpillRoundTrip();
+    testSpillThenEdit();
+    // Ample room, then a budget tight enough that keyframes and their ops spill.
+    testJournalReplay(64u * 1024u * 1024u);
+    testJournalReplay(4 * LAYER_BUFFER_SIZE);
+    return testResult("test_history");
+}
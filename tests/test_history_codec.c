@@ -0,0 +1,139 @@
+#include "history_codec.h"
+
+#include "test.h"
+
+// Compress and decompress, checking the data comes back bit for bit.
+// Returns the packed size, or 0 when the codec declined to pack it.
+static size_t roundTrip(const uint32_t* pixels, size_t count) {
+    size_t packedSize = 0;
+    uint8_t* packed = historyCodecCompress(pixels, count, &packedSize, NULL);
+    if (!packed) return 0;
+
+    CHECK(packedSize > 0);
+    CHECK(packed[0] == HISTORY_CODEC_UNIFORM || packedSize < count * sizeof(uint32_t));
+    uint32_t* out = (uint32_t*)malloc(count * sizeof(uint32_t));
+    memset(out, 0xA5, count * sizeof(uint32_t));
+    CHECK(historyCodecDecompress(packed, packedSize, out, count));
+    CHECK(memcmp(out, pixels, count * sizeof(uint32_t)) == 0);
+
+    // A wrong pixel count must be refused rather than half-filled.
+    if (packed[0] != HISTORY_CODEC_UNIFORM && count > 1) {
+        CHECK(!historyCodecDecompress(packed, packedSize, out, count - 1));
+    }
+    free(out);
+    free(packed);
+    return packedSize;
+}
+
+static void testUniform(void) {
+    size_t count = 320 * 240;
+    uint32_t* pixels = (uint32_t*)malloc(count * sizeof(uint32_t));
+    uint32_t fills[] = {0x00000000u, 0xFFFFFFFFu, 0x12345678u};
+    for (int f = 0; f < 3; f++) {
+        for (size_t i = 0; i < count; i++) pixels[i] = fills[f];
+        size_t packedSize = 0;
+        uint8_t* packed = historyCodecCompress(pixels, count, &packedSize, NULL);
+        CHECK(packed && packed[0] == HISTORY_CODEC_UNIFORM && packedSize == 5);
+        free(packed);
+        CHECK(roundTrip(pixels, count) == 5);
+    }
+    // A single pixel is trivially uniform.
+    CHECK(roundTrip(pixels, 1) == 5);
+    free(pixels);
+}
+
+static void testDrawing(void) {
+    // Canvas-sized layers as the app holds them, including odd sizes.
+    int sizes[][2] = {{320, 240}, {1024, 1024}, {333, 77}, {2048, 1536}};
+    for (int s = 0; s < 4; s++) {
+        int w = sizes[s][0], h = sizes[s][1];
+        uint32_t* pixels = (uint32_t*)malloc((size_t)w * h * sizeof(uint32_t));
+        testFillDrawing(pixels, w, h, 17u + (uint32_t)s);
+        size_t packedSize = roundTrip(pixels, (size_t)w * h);
+        CHECK(packedSize > 0);
+        printf("  drawing %dx%d: %zu -> %zu bytes\n", w, h, (size_t)w * h * 4, packedSize);
+        free(pixels);
+    }
+}
+
+static void testRandomData(void) {
+    // Noise does not shrink below 3/4, so the codec declines and the caller keeps it raw.
+    size_t count = 256 * 256;
+    uint32_t* pixels = (uint32_t*)malloc(count * sizeof(uint32_t));
+    uint32_t state = 0x9E3779B9u;
+    for (size_t i = 0; i < count; i++) pixels[i] = testRandom(&state);
+    size_t packedSize = 1;
+    CHECK(historyCodecCompress(pixels, count, &packedSize, NULL) == NULL);
+
+    // Noise confined to the low bits of the colour does shrink, and must survive.
+    for (size_t i = 0; i < count; i++) pixels[i] = 0x808080FFu ^ (testRandom(&state) & 0x03030300u);
+    CHECK(roundTrip(pixels, count) > 0);
+
+    // Sparse noise on a transparent layer (speckle, airbrush).
+    memset(pixels, 0, count * sizeof(uint32_t));
+    for (int i = 0; i < 2000; i++) pixels[testRandom(&state) % count] = testRandom(&state);
+    CHECK(roundTrip(pixels, count) > 0);
+    free(pixels);
+}
+
+static void testRawTag(void) {
+    // Spilled raw snapshots carry the RAW tag in front of the pixels.
+    size_t count = 1000;
+    uint32_t* pixels = (uint32_t*)malloc(count * sizeof(uint32_t));
+    uint32_t state = 5;
+    for (size_t i = 0; i < count; i++) pixels[i] = testRandom(&state);
+    uint8_t* packed = (uint8_t*)malloc(1 + count * sizeof(uint32_t));
+    packed[0] = HISTORY_CODEC_RAW;
+    memcpy(packed + 1, pixels, count * sizeof(uint32_t));
+    uint32_t* out = (uint32_t*)malloc(count * sizeof(uint32_t));
+    CHECK(historyCodecDecompress(packed, 1 + count * sizeof(uint32_t), out, count));
+    CHECK(memcmp(out, pixels, count * sizeof(uint32_t)) == 0);
+    CHECK(!historyCodecDecompress(packed, count * sizeof(uint32_t), out, count));
+    free(out);
+    free(packed);
+    free(pixels);
+}
+
+static void testCorrupt(void) {
+    int w = 320, h = 240;
+    size_t count = (size_t)w * h;
+    uint32_t* pixels = (uint32_t*)malloc(count * sizeof(uint32_t));
+    testFillDrawing(pixels, w, h, 3);
+    size_t packedSize = 0;
+    uint8_t* packed = historyCodecCompress(pixels, count, &packedSize, NULL);
+    CHECK(packed != NULL);
+    uint32_t* out = (uint32_t*)malloc(count * sizeof(uint32_t));
+    // Truncated stream.
+    CHECK(!historyCodecDecompress(packed, packedSize / 2, out, count));
+    // Unknown tag.
+    uint8_t tag = packed[0];
+    packed[0] = 0x7F;
+    CHECK(!historyCodecDecompress(packed, packedSize, out, count));
+    packed[0] = tag;
+    // Flipped payload byte: zlib's adler check catches it.
+    packed[packedSize / 2] ^= 0x40;
+    CHECK(!historyCodecDecompress(packed, packedSize, out, count));
+    free(out);
+    free(packed);
+    free(pixels);
+}
+
+static void testCancel(void) {
+    int w = 1024, h = 1024;
+    uint32_t* pixels = (uint32_t*)malloc((size_t)w * h * sizeof(uint32_t));
+    testFillDrawing(pixels, w, h, 11);
+    volatile bool cancel = true;
+    size_t packedSize = 0;
+    CHECK(historyCodecCompress(pixels, (size_t)w * h, &packedSize, &cancel) == NULL);
+    free(pixels);
+}
+
+int main(void) {
+    testUniform();
+    testDrawing();
+    testRandomData();
+    testRawTag();
+    testCorrupt();
+    testCancel();
+    return testResult("test_history_codec");
+}
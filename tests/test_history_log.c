@@ -0,0 +1,249 @@
+#include "history_log.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define LOG_DIR "."
+#define LOG_NAME "log"
+#define LOG_DATA "./log.log"
+#define LOG_INDEX "./log.idx"
+
+static long fileSize(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+// Record payloads are derived from their id, so any read can be verified.
+static size_t recordSize(uint32_t id) {
+    return 1 + (size_t)id * 1237 % 70000;
+}
+
+static void fillRecord(uint32_t id, uint8_t* data, size_t size) {
+    uint32_t state = id * 2654435761u + 1;
+    for (size_t i = 0; i < size; i++) data[i] = (uint8_t)testRandom(&state);
+}
+
+// Append a record in two writes, as history does (header, then payload).
+static bool appendRecord(HistoryLog* log, uint32_t id) {
+    size_t size = recordSize(id);
+    uint8_t* data = (uint8_t*)malloc(size);
+    fillRecord(id, data, size);
+    uint32_t outId = 0xFFFFFFFFu;
+    bool ok = historyLogBeginRecord(log);
+    ok = historyLogWrite(log, data, size / 2) && ok;
+    ok = historyLogWrite(log, data + size / 2, size - size / 2) && ok;
+    ok = historyLogEndRecord(log, &outId) && ok;
+    free(data);
+    return ok && outId == id;
+}
+
+static bool recordMatches(HistoryLog* log, uint32_t id) {
+    size_t size = historyLogRecordSize(log, id);
+    if (size != recordSize(id)) return false;
+    uint8_t* data = (uint8_t*)malloc(size);
+    uint8_t* expected = (uint8_t*)malloc(size);
+    fillRecord(id, expected, size);
+    bool ok = historyLogRead(log, id, data, size, NULL, NULL, NULL) && memcmp(data, expected, size) == 0;
+    free(expected);
+    free(data);
+    return ok;
+}
+
+static void testAppendRead(void) {
+    HistoryLog log;
+    CHECK(historyLogOpen(&log, LOG_DIR, LOG_NAME, true));
+    CHECK(historyLogCount(&log) == 0);
+    CHECK(historyLogRecordSize(&log, 0) == 0);
+    for (uint32_t id = 0; id < 40; id++) CHECK(appendRecord(&log, id));
+    CHECK(historyLogCount(&log) == 40);
+    // Read in a scattered order: the reader seeks per record.
+    for (uint32_t i = 0; i < 40; i++) CHECK(recordMatches(&log, (i * 7) % 40));
+
+    // A short destination and out-of-range ids are refused.
+    uint8_t small[4];
+    CHECK(!historyLogRead(&log, 39, small, sizeof(small), NULL, NULL, NULL));
+    CHECK(!historyLogRead(&log, 40, small, sizeof(small), NULL, NULL, NULL));
+
+    // Nothing can be read or truncated in the middle of an append.
+    CHECK(historyLogBeginRecord(&log));
+    CHECK(!historyLogBeginRecord(&log));
+    CHECK(!historyLogTruncate(&log, 0));
+    CHECK(!historyLogRead(&log, 0, small, sizeof(small), NULL, NULL, NULL));
+    CHECK(historyLogEndRecord(&log, NULL));
+    CHECK(historyLogCount(&log) == 41);
+    CHECK(historyLogRecordSize(&log, 40) == 0);
+    historyLogClose(&log, true);
+    CHECK(fileSize(LOG_DATA) < 0 && fileSize(LOG_INDEX) < 0);
+}
+
+static void testTruncateShrinks(void) {
+    HistoryLog log;
+    CHECK(historyLogOpen(&log, LOG_DIR, LOG_NAME, true));
+    for (uint32_t id = 0; id < 10; id++) CHECK(appendRecord(&log, id));
+    long fullData = fileSize(LOG_DATA);
+    long fullIndex = fileSize(LOG_INDEX);
+    CHECK(fullData == (long)log.writeOffset);
+
+    // Undo reads the newest record back and drops it, over and over: the
+    // files must follow the live records down instead of growing.
+    for (uint32_t count = 10; count > 0; count--) {
+        CHECK(recordMatches(&log, count - 1));
+        CHECK(historyLogTruncate(&log, count - 1));
+        CHECK(historyLogCount(&log) == count - 1);
+        CHECK(fileSize(LOG_INDEX) == HISTORY_LOG_FILE_HEADER_SIZE + (long)(count - 1) * HISTORY_LOG_INDEX_ENTRY_SIZE);
+    }
+    CHECK(fileSize(LOG_DATA) == HISTORY_LOG_FILE_HEADER_SIZE);
+    CHECK(fileSize(LOG_INDEX) == HISTORY_LOG_FILE_HEADER_SIZE);
+
+    // Interleaved spills and read-backs stay bounded by the live records.
+    for (int round = 0; round < 50; round++) {
+        uint32_t count = historyLogCount(&log);
+        CHECK(appendRecord(&log, count));
+        CHECK(appendRecord(&log, count + 1));
+        CHECK(historyLogTruncate(&log, count + 1));
+    }
+    CHECK(historyLogCount(&log) == 50);
+    for (uint32_t id = 0; id < 50; id++) CHECK(recordMatches(&log, id));
+    CHECK(fileSize(LOG_INDEX) == HISTORY_LOG_FILE_HEADER_SIZE + 50 * HISTORY_LOG_INDEX_ENTRY_SIZE);
+    CHECK(historyLogTruncate(&log, 10));
+    CHECK(fileSize(LOG_DATA) == fullData);
+    CHECK(fileSize(LOG_INDEX) == fullIndex);
+
+    // Truncating past the end changes nothing.
+    CHECK(historyLogTruncate(&log, 99));
+    CHECK(historyLogCount(&log) == 10);
+    historyLogClose(&log, true);
+}
+
+static void testReopen(void) {
+    HistoryLog log;
+    CHECK(historyLogOpen(&log, LOG_DIR, LOG_NAME, true));
+    for (uint32_t id = 0; id < 12; id++) CHECK(appendRecord(&log, id));
+    CHECK(historyLogTruncate(&log, 8));
+    historyLogClose(&log, false);
+
+    CHECK(historyLogOpen(&log, LOG_DIR, LOG_NAME, false));
+    CHECK(historyLogCount(&log) == 8);
+    for (uint32_t id = 0; id < 8; id++) CHECK(recordMatches(&log, id));
+    // Appends continue after the kept prefix.
+    CHECK(appendRecord(&log, 8));
+    CHECK(recordMatches(&log, 8));
+    historyLogClose(&log, false);
+
+    // A truncate mark (written where files cannot shrink) is honoured on reopen.
+    FILE* index = fopen(LOG_INDEX, "ab");
+    uint8_t mark[HISTORY_LOG_INDEX_ENTRY_SIZE] = {0};
+    mark[0] = 5;
+    memset(mark + 12, 0xFF, 4);
+    fwrite(mark, 1, sizeof(mark), index);
+    fclose(index);
+    CHECK(historyLogOpen(&log, LOG_DIR, LOG_NAME, false));
+    CHECK(historyLogCount(&log) == 5);
+    for (uint32_t id = 0; id < 5; id++) CHECK(recordMatches(&log, id));
+    historyLogClose(&log, false);
+
+    // Reopening with truncate starts empty.
+    CHECK(historyLogOpen(&log, LOG_DIR, LOG_NAME, true));
+    CHECK(historyLogCount(&log) == 0);
+    historyLogClose(&log, true);
+}
+
+static void testTornTail(void) {
+    HistoryLog log;
+    CHECK(historyLogOpen(&log, LOG_DIR, LOG_NAME, true));
+    for (uint32_t id = 0; id < 6; id++) CHECK(appendRecord(&log, id));
+    uint64_t lastOffset = log.entries[5].offset;
+    historyLogClose(&log, false);
+
+    // Power lost while the last record was written: its header is cut off.
+    CHECK(truncate(LOG_DATA, (off_t)lastOffset + 5) == 0);
+    CHECK(historyLogOpen(&log, LOG_DIR, LOG_NAME, false));
+    CHECK(historyLogCount(&log) == 5);
+    for (uint32_t id = 0; id < 5; id++) CHECK(recordMatches(&log, id));
+    historyLogClose(&log, false);
+
+    // A torn index entry is dropped as well.
+    long indexSize = fileSize(LOG_INDEX);
+    CHECK(truncate(LOG_INDEX, indexSize - 3) == 0);
+    CHECK(historyLogOpen(&log, LOG_DIR, LOG_NAME, false));
+    CHECK(historyLogCount(&log) == 4);
+    historyLogClose(&log, false);
+
+    // Files that are not a log at all are replaced by an empty one.
+    FILE* junk = fopen(LOG_DATA, "wb");
+    fputs("not a log", junk);
+    fclose(junk);
+    CHECK(historyLogOpen(&log, LOG_DIR, LOG_NAME, false));
+    CHECK(historyLogCount(&log) == 0);
+    historyLogClose(&log, true);
+}
+
+static void testCorruptPayload(void) {
+    HistoryLog log;
+    CHECK(historyLogOpen(&log, LOG_DIR, LOG_NAME, true));
+    for (uint32_t id = 0; id < 3; id++) CHECK(appendRecord(&log, id));
+    uint64_t offset = log.entries[1].offset + HISTORY_LOG_RECORD_HEADER_SIZE;
+    historyLogClose(&log, false);
+
+    // Flip a payload byte: the header is intact, the crc is not.
+    FILE* data = fopen(LOG_DATA, "r+b");
+    fseek(data, (long)offset, SEEK_SET);
+    int c = fgetc(data);
+    fseek(data, (long)offset, SEEK_SET);
+    fputc(c ^ 0x01, data);
+    fclose(data);
+
+    CHECK(historyLogOpen(&log, LOG_DIR, LOG_NAME, false));
+    CHECK(historyLogCount(&log) == 3);
+    CHECK(recordMatches(&log, 0));
+    CHECK(!recordMatches(&log, 1));
+    CHECK(recordMatches(&log, 2));
+    historyLogClose(&log, true);
+}
+
+static size_t progressCalls = 0;
+static size_t progressDone = 0;
+
+static void countProgress(size_t done, size_t total, void* user) {
+    (void)total;
+    progressCalls++;
+    progressDone = done;
+    // Cancel from the callback, as a superseded read-back would.
+    if (user && progressCalls == 2) *(volatile bool*)user = true;
+}
+
+static void testProgressCancel(void) {
+    HistoryLog log;
+    CHECK(historyLogOpen(&log, LOG_DIR, LOG_NAME, true));
+    size_t size = 200 * 1024;
+    uint8_t* data = (uint8_t*)malloc(size);
+    for (size_t i = 0; i < size; i++) data[i] = (uint8_t)(i * 31);
+    CHECK(historyLogBeginRecord(&log));
+    CHECK(historyLogWrite(&log, data, size));
+    CHECK(historyLogEndRecord(&log, NULL));
+
+    uint8_t* out = (uint8_t*)malloc(size);
+    CHECK(historyLogRead(&log, 0, out, size, countProgress, NULL, NULL));
+    CHECK(memcmp(out, data, size) == 0);
+    CHECK(progressCalls > 1 && progressDone == size);
+
+    volatile bool cancel = false;
+    progressCalls = 0;
+    CHECK(!historyLogRead(&log, 0, out, size, countProgress, (void*)&cancel, &cancel));
+    CHECK(progressCalls == 2);
+    free(out);
+    free(data);
+    historyLogClose(&log, true);
+}
+
+int main(void) {
+    testAppendRead();
+    testTruncateShrinks();
+    testReopen();
+    testTornTail();
+    testCorruptPayload();
+    testProgressCancel();
+    return testResult("test_history_log");
+}
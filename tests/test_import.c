@@ -0,0 +1,164 @@
+#include "import.h"
+
+#include <png.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history.h"
+#include "layers.h"
+#include "test.h"
+
+#define CANVAS_W 160
+#define CANVAS_H 120
+
+// Write a w x h drawing as an RGBA PNG; returns the file size, 0 on failure.
+static long writePng(const char* path, int w, int h, u32 seed, bool interlaced) {
+    u32* pixels = (u32*)malloc((size_t)w * h * 4);
+    testFillDrawing(pixels, w, h, seed);
+    // Layer pixels are 0xRRGGBBAA; PNG rows are R, G, B, A bytes.
+    u8* rgba = (u8*)malloc((size_t)w * h * 4);
+    for (int i = 0; i < w * h; i++) {
+        for (int c = 0; c < 4; c++) rgba[i * 4 + c] = (u8)(pixels[i] >> (24 - 8 * c));
+    }
+    free(pixels);
+
+    FILE* fp = fopen(path, "wb");
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct(png);
+    png_init_io(png, fp);
+    png_set_IHDR(png, info, (png_uint_32)w, (png_uint_32)h, 8, PNG_COLOR_TYPE_RGBA,
+                 interlaced ? PNG_INTERLACE_ADAM7 : PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                 PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    int passes = png_set_interlace_handling(png);
+    for (int pass = 0; pass < passes; pass++) {
+        for (int y = 0; y < h; y++) png_write_row(png, rgba + (size_t)y * w * 4);
+    }
+    png_write_end(png, info);
+    png_destroy_write_struct(&png, &info);
+    free(rgba);
+    long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+static u32* copyLayer(int layerIndex) {
+    u32* copy = (u32*)malloc(LAYER_BUFFER_SIZE);
+    memcpy(copy, layers[layerIndex].buffer, LAYER_BUFFER_SIZE);
+    return copy;
+}
+
+static bool layerEquals(int layerIndex, const u32* pixels) {
+    return memcmp(layers[layerIndex].buffer, pixels, LAYER_BUFFER_SIZE) == 0;
+}
+
+static void startSession(void) {
+    initLayers();
+    applyCanvasSize(CANVAS_W, CANVAS_H);
+    initHistory();
+    testFillDrawing(layers[1].buffer, CANVAS_W, CANVAS_H, 7);
+    markLayerDirtyFull(1);
+}
+
+static void endSession(void) {
+    exitHistory();
+    exitLayers();
+}
+
+// A good import is one undo step, and the stats describe the placement.
+static void testImportUndoRedo(void) {
+    startSession();
+    u32* before = copyLayer(1);
+
+    CHECK(writePng("small.png", 64, 40, 11, false) > 0);
+    CHECK(importPNGToLayer("small.png", 1));
+    ImportStats stats;
+    getImportStats(&stats);
+    CHECK(stats.valid && !stats.downscaled);
+    CHECK(stats.width == 64 && stats.height == 40);
+    CHECK(stats.x == (CANVAS_W - 64) / 2 && stats.y == (CANVAS_H - 40) / 2);
+    u32* imported = copyLayer(1);
+    CHECK(!layerEquals(1, before));
+
+    CHECK(canUndo());
+    undo();
+    CHECK(layerEquals(1, before));
+    CHECK(canRedo());
+    redo();
+    CHECK(layerEquals(1, imported));
+
+    // Larger than the canvas: shrunk to fit.
+    CHECK(writePng("large.png", CANVAS_W * 3, CANVAS_H * 2, 12, false) > 0);
+    CHECK(importPNGToLayer("large.png", 1));
+    getImportStats(&stats);
+    CHECK(stats.valid && stats.downscaled);
+    CHECK(stats.width <= CANVAS_W && stats.height <= CANVAS_H);
+
+    free(imported);
+    free(before);
+    remove("small.png");
+    remove("large.png");
+    endSession();
+}
+
+// A file cut short fails midway through the rows: the layer comes back as it
+// was, with nothing to redo and the earlier steps still undoable.
+static void testTruncatedImport(bool downscaled, bool interlaced) {
+    startSession();
+    int w = downscaled ? CANVAS_W * 2 : CANVAS_W - 10;
+    int h = downscaled ? CANVAS_H * 2 : CANVAS_H - 6;
+    long size = writePng("cut.png", w, h, 21, interlaced);
+    CHECK(size > 0);
+    CHECK(truncate("cut.png", size / 2) == 0);
+
+    // An earlier step to undo back past.
+    u32* original = copyLayer(1);
+    pushLayerHistory(1);
+    clearLayer(1, 0x336699FF);
+    u32* before = copyLayer(1);
+    HistoryStats stats;
+    getHistoryStats(&stats);
+    int entries = stats.entryCount;
+
+    CHECK(!importPNGToLayer("cut.png", 1));
+    CHECK(layerEquals(1, before));
+    CHECK(!canRedo());
+    getHistoryStats(&stats);
+    CHECK(stats.entryCount == entries);
+    redo();
+    CHECK(layerEquals(1, before));
+
+    CHECK(canUndo());
+    undo();
+    CHECK(layerEquals(1, original));
+
+    free(before);
+    free(original);
+    remove("cut.png");
+    endSession();
+}
+
+// Without a history snapshot there would be nothing to restore from, so the
+// import is refused before the layer is cleared.
+static void testNoSnapshot(void) {
+    startSession();
+    CHECK(writePng("small.png", 32, 32, 31, false) > 0);
+    exitHistory();
+    CHECK(!pushLayerHistory(1));
+    u32* before = copyLayer(1);
+    CHECK(!importPNGToLayer("small.png", 1));
+    CHECK(layerEquals(1, before));
+    free(before);
+    remove("small.png");
+    initHistory();
+    endSession();
+}
+
+int main(void) {
+    testImportUndoRedo();
+    testTruncatedImport(false, false);
+    testTruncatedImport(true, false);
+    testTruncatedImport(false, true);
+    testNoSnapshot();
+    return testResult("test_import");
+}
@@ -0,0 +1,220 @@
+#include "jpeg_encode.h"
+
+#include <jpeglib.h>
+#include <math.h>
+#include <setjmp.h>
+#include <unistd.h>
+
+#include "test.h"
+
+// Encode RGBA rows (alpha ignored) to a file; returns the file size, 0 on failure.
+static long encodeFile(const char* path, const uint8_t* rgba, int w, int h, int quality) {
+    FILE* fp = fopen(path, "wb");
+    if (!fp) return 0;
+    JpegEncoder encoder;
+    bool ok = jpegEncodeBegin(&encoder, fp, w, h, quality);
+    for (int y = 0; ok && y < h; y++) ok = jpegEncodeRow(&encoder, rgba + (size_t)y * w * 4);
+    ok = ok && jpegEncodeEnd(&encoder);
+    jpegEncodeFree(&encoder);
+    long size = ftell(fp);
+    fclose(fp);
+    return ok ? size : 0;
+}
+
+// The same image through libjpeg (4:2:0 by default), for comparison.
+static long encodeFileLibjpeg(const char* path, const uint8_t* rgba, int w, int h, int quality) {
+    FILE* fp = fopen(path, "wb");
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, fp);
+    cinfo.image_width = (JDIMENSION)w;
+    cinfo.image_height = (JDIMENSION)h;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    uint8_t* row = (uint8_t*)malloc((size_t)w * 3);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const uint8_t* src = rgba + (size_t)cinfo.next_scanline * w * 4;
+        for (int x = 0; x < w; x++) memcpy(row + x * 3, src + x * 4, 3);
+        JSAMPROW rows[1] = {row};
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(row);
+    long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+// libjpeg's error_exit must not return; jump back out of the decode instead.
+typedef struct {
+    struct jpeg_error_mgr base;
+    jmp_buf escape;
+} DecodeError;
+
+static void decodeErrorExit(j_common_ptr cinfo) {
+    longjmp(((DecodeError*)cinfo->err)->escape, 1);
+}
+
+// Warnings are counted, not printed.
+static void decodeOutputMessage(j_common_ptr cinfo) {
+    (void)cinfo;
+}
+
+// Decode with libjpeg to RGB; NULL when it is not a valid JPEG.
+static uint8_t* decodeFile(const char* path, int* w, int* h) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    struct jpeg_decompress_struct cinfo;
+    DecodeError error;
+    cinfo.err = jpeg_std_error(&error.base);
+    error.base.error_exit = decodeErrorExit;
+    error.base.output_message = decodeOutputMessage;
+    uint8_t* volatile pixels = NULL;
+    if (setjmp(error.escape)) {
+        jpeg_destroy_decompress(&cinfo);
+        fclose(fp);
+        free(pixels);
+        return NULL;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, fp);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    *w = (int)cinfo.output_width;
+    *h = (int)cinfo.output_height;
+    pixels = (uint8_t*)malloc((size_t)*w * *h * 3);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW rows[1] = {pixels + (size_t)cinfo.output_scanline * *w * 3};
+        jpeg_read_scanlines(&cinfo, rows, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    // Corrupt entropy data only raises warnings; treat them as failures.
+    bool clean = error.base.num_warnings == 0;
+    jpeg_destroy_decompress(&cinfo);
+    fclose(fp);
+    if (!clean) {
+        free(pixels);
+        return NULL;
+    }
+    return pixels;
+}
+
+static double psnr(const uint8_t* rgba, const uint8_t* rgb, int w, int h) {
+    double sum = 0.0;
+    for (int i = 0; i < w * h; i++) {
+        for (int c = 0; c < 3; c++) {
+            double d = (double)rgba[i * 4 + c] - (double)rgb[i * 3 + c];
+            sum += d * d;
+        }
+    }
+    double mse = sum / ((double)w * h * 3);
+    return mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+// Drawing pixels composited onto white, as the export feeds the encoder.
+static uint8_t* makeImage(int w, int h, uint32_t seed) {
+    uint32_t* pixels = (uint32_t*)malloc((size_t)w * h * 4);
+    testFillDrawing(pixels, w, h, seed);
+    uint8_t* rgba = (uint8_t*)malloc((size_t)w * h * 4);
+    for (int i = 0; i < w * h; i++) {
+        uint32_t p = pixels[i];
+        int a = (int)(p & 0xFF);
+        for (int c = 0; c < 3; c++) {
+            int v = (int)((p >> (24 - 8 * c)) & 0xFF);
+            rgba[i * 4 + c] = (uint8_t)((v * a + 255 * (255 - a) + 127) / 255);
+        }
+        rgba[i * 4 + 3] = 0xFF;
+    }
+    free(pixels);
+    return rgba;
+}
+
+static void testDecodes(void) {
+    // Whole MCUs, partial MCUs in both directions, single rows and columns.
+    int sizes[][2] = {{16, 16}, {1, 1}, {15, 17}, {333, 250}, {640, 1}, {1, 480}, {1024, 768}};
+    int qualities[] = {1, 25, 50, 75, 90, 100};
+    for (int s = 0; s < 7; s++) {
+        int w = sizes[s][0], h = sizes[s][1];
+        uint8_t* rgba = makeImage(w, h, 60u + (uint32_t)s);
+        long previous = 0;
+        for (int q = 0; q < 6; q++) {
+            long size = encodeFile("out.jpg", rgba, w, h, qualities[q]);
+            CHECK(size > 0);
+            int dw = 0, dh = 0;
+            uint8_t* rgb = decodeFile("out.jpg", &dw, &dh);
+            CHECK(rgb && dw == w && dh == h);
+            if (rgb && w * h >= 256 * 256) {
+                // Quality buys fidelity and costs bytes.
+                double db = psnr(rgba, rgb, w, h);
+                CHECK(size >= previous);
+                if (qualities[q] >= 90) CHECK(db > 30.0);
+                printf("  %dx%d q%d: %ld bytes, %.1f dB\n", w, h, qualities[q], size, db);
+            }
+            previous = size;
+            free(rgb);
+        }
+        free(rgba);
+    }
+    remove("out.jpg");
+}
+
+// Within reach of libjpeg's own 4:2:0 output at the same quality.
+static void testAgainstLibjpeg(void) {
+    int w = 800, h = 600;
+    uint8_t* rgba = makeImage(w, h, 91);
+    int qualities[] = {50, 75, 90};
+    for (int q = 0; q < 3; q++) {
+        long ours = encodeFile("ours.jpg", rgba, w, h, qualities[q]);
+        long theirs = encodeFileLibjpeg("libjpeg.jpg", rgba, w, h, qualities[q]);
+        int dw, dh;
+        uint8_t* a = decodeFile("ours.jpg", &dw, &dh);
+        uint8_t* b = decodeFile("libjpeg.jpg", &dw, &dh);
+        CHECK(a && b);
+        if (a && b) {
+            double oursDb = psnr(rgba, a, w, h);
+            double theirsDb = psnr(rgba, b, w, h);
+            CHECK(oursDb > theirsDb - 1.0);
+            CHECK(ours < theirs + theirs / 5);
+            printf("  q%d: %ld bytes %.2f dB, libjpeg %ld bytes %.2f dB\n", qualities[q], ours, oursDb, theirs,
+                   theirsDb);
+        }
+        free(a);
+        free(b);
+    }
+    free(rgba);
+    remove("ours.jpg");
+    remove("libjpeg.jpg");
+}
+
+static void testTruncated(void) {
+    uint8_t* rgba = makeImage(64, 64, 3);
+    long size = encodeFile("cut.jpg", rgba, 64, 64, 90);
+    CHECK(size > 100);
+    CHECK(truncate("cut.jpg", size / 2) == 0);
+    int w, h;
+    CHECK(decodeFile("cut.jpg", &w, &h) == NULL);
+    free(rgba);
+    remove("cut.jpg");
+
+    // Sizes the format cannot hold are refused up front.
+    FILE* fp = fopen("big.jpg", "wb");
+    JpegEncoder encoder;
+    CHECK(!jpegEncodeBegin(&encoder, fp, JPEG_ENCODE_MAX_SIZE + 1, 16, 90));
+    jpegEncodeFree(&encoder);
+    fclose(fp);
+    remove("big.jpg");
+}
+
+int main(void) {
+    testDecodes();
+    testAgainstLibjpeg();
+    testTruncated();
+    return testResult("test_jpeg_encode");
+}
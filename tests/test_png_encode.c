@@ -0,0 +1,275 @@
+#include "png_encode.h"
+
+#include <png.h>
+#include <zlib.h>
+
+#include "test.h"
+
+// Undo one filtered row (the reference decoder side of pngEncodeFilterRow).
+static void unfilterRow(const uint8_t* in, const uint8_t* prev, size_t rowBytes, int bpp, uint8_t* out) {
+    int filter = in[0];
+    const uint8_t* src = in + 1;
+    for (size_t i = 0; i < rowBytes; i++) {
+        int a = i >= (size_t)bpp ? out[i - bpp] : 0;
+        int b = prev ? prev[i] : 0;
+        int c = prev && i >= (size_t)bpp ? prev[i - bpp] : 0;
+        int predictor = 0;
+        switch (filter) {
+            case PNG_ENCODE_FILTER_SUB: predictor = a; break;
+            case PNG_ENCODE_FILTER_UP: predictor = b; break;
+            case PNG_ENCODE_FILTER_AVERAGE: predictor = (a + b) / 2; break;
+            case PNG_ENCODE_FILTER_PAETH: {
+                int p = a + b - c;
+                int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+                predictor = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+                break;
+            }
+            default: break;
+        }
+        out[i] = (uint8_t)(src[i] + predictor);
+    }
+}
+
+// Filter a drawing with the given filter, as the export does row by row.
+static uint8_t* filterImage(const uint32_t* pixels, int w, int h, int filter, size_t* outSize) {
+    size_t rowBytes = (size_t)w * 4;
+    uint8_t* out = (uint8_t*)malloc((rowBytes + 1) * h);
+    uint8_t* row = (uint8_t*)malloc(rowBytes);
+    uint8_t* prev = (uint8_t*)malloc(rowBytes);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            uint32_t p = pixels[y * w + x];
+            row[x * 4 + 0] = (uint8_t)(p >> 24);
+            row[x * 4 + 1] = (uint8_t)(p >> 16);
+            row[x * 4 + 2] = (uint8_t)(p >> 8);
+            row[x * 4 + 3] = (uint8_t)p;
+        }
+        pngEncodeFilterRow(filter, row, y > 0 ? prev : NULL, rowBytes, 4, out + (rowBytes + 1) * y);
+        uint8_t* swap = prev;
+        prev = row;
+        row = swap;
+    }
+    free(row);
+    free(prev);
+    *outSize = (rowBytes + 1) * h;
+    return out;
+}
+
+// Deflate data in segments cut at the given sizes and join them into one
+// zlib stream. Returns the stream (malloc'd) and its size.
+static uint8_t* deflateSegments(const uint8_t* data, size_t size, const size_t* cuts, int count, int level,
+                                bool filtered, size_t* outSize) {
+    PngDeflateSegment* segments = (PngDeflateSegment*)calloc((size_t)count, sizeof(PngDeflateSegment));
+    size_t total = 2 + 4;
+    size_t start = 0;
+    bool ok = true;
+    for (int i = 0; i < count; i++) {
+        size_t end = i == count - 1 ? size : cuts[i];
+        PngDeflateSegment* s = &segments[i];
+        s->data = data + start;
+        s->size = end - start;
+        size_t dictSize = start < PNG_ENCODE_DICT_SIZE ? start : PNG_ENCODE_DICT_SIZE;
+        s->dict = i > 0 ? data + start - dictSize : NULL;
+        s->dictSize = i > 0 ? dictSize : 0;
+        s->level = level;
+        s->filtered = filtered;
+        s->last = i == count - 1;
+        s->out = (uint8_t*)malloc(pngEncodeSegmentBound(s->size));
+        ok = pngEncodeDeflateSegment(s) && ok;
+        total += s->outSize;
+        start = end;
+    }
+
+    uint8_t* stream = (uint8_t*)malloc(total);
+    pngEncodeZlibHeader(level, stream);
+    size_t pos = 2;
+    uint32_t adler = 1;
+    for (int i = 0; i < count; i++) {
+        memcpy(stream + pos, segments[i].out, segments[i].outSize);
+        pos += segments[i].outSize;
+        adler = pngEncodeCombineAdler(adler, segments[i].adler, segments[i].size);
+        free(segments[i].out);
+    }
+    stream[pos++] = (uint8_t)(adler >> 24);
+    stream[pos++] = (uint8_t)(adler >> 16);
+    stream[pos++] = (uint8_t)(adler >> 8);
+    stream[pos++] = (uint8_t)adler;
+    free(segments);
+    CHECK(ok);
+    CHECK(adler == (uint32_t)adler32(adler32(0L, Z_NULL, 0), data, (uInt)size));
+    *outSize = pos;
+    return stream;
+}
+
+static void testFilters(void) {
+    int w = 97, h = 31;
+    uint32_t* pixels = (uint32_t*)malloc((size_t)w * h * 4);
+    testFillDrawing(pixels, w, h, 4);
+    size_t rowBytes = (size_t)w * 4;
+    uint8_t* row = (uint8_t*)malloc(rowBytes);
+    uint8_t* prev = (uint8_t*)malloc(rowBytes);
+    for (int filter = PNG_ENCODE_FILTER_NONE; filter <= PNG_ENCODE_FILTER_ADAPTIVE; filter++) {
+        size_t size;
+        uint8_t* filtered = filterImage(pixels, w, h, filter, &size);
+        bool ok = true;
+        for (int y = 0; y < h; y++) {
+            const uint8_t* in = filtered + (rowBytes + 1) * y;
+            if (filter != PNG_ENCODE_FILTER_ADAPTIVE && in[0] != filter) ok = false;
+            if (in[0] > PNG_ENCODE_FILTER_PAETH) ok = false;
+            unfilterRow(in, y > 0 ? prev : NULL, rowBytes, 4, row);
+            // Pixels are 0xRRGGBBAA words; rows hold the bytes in that order.
+            for (int x = 0; x < w; x++) {
+                uint32_t p = pixels[y * w + x];
+                if (row[x * 4] != (uint8_t)(p >> 24) || row[x * 4 + 1] != (uint8_t)(p >> 16) ||
+                    row[x * 4 + 2] != (uint8_t)(p >> 8) || row[x * 4 + 3] != (uint8_t)p) {
+                    ok = false;
+                }
+            }
+            uint8_t* swap = prev;
+            prev = row;
+            row = swap;
+        }
+        CHECK(ok);
+        free(filtered);
+    }
+    free(prev);
+    free(row);
+    free(pixels);
+}
+
+static void testSegments(void) {
+    int w = 700, h = 500;
+    uint32_t* pixels = (uint32_t*)malloc((size_t)w * h * 4);
+    testFillDrawing(pixels, w, h, 12);
+    size_t size;
+    uint8_t* data = filterImage(pixels, w, h, PNG_ENCODE_FILTER_PAETH, &size);
+    uint8_t* out = (uint8_t*)malloc(size);
+
+    // One segment, several, and cuts smaller than the dictionary or a single byte.
+    size_t even4[] = {size / 4, size / 2, size * 3 / 4};
+    size_t ragged[] = {1, 2, 1000, 1000 + PNG_ENCODE_DICT_SIZE / 2, size / 2, size - 1};
+    struct {
+        const size_t* cuts;
+        int count;
+    } layouts[] = {{NULL, 1}, {even4, 4}, {ragged, 7}};
+    int levels[] = {0, 1, 6, 9};
+    for (int l = 0; l < 3; l++) {
+        for (int v = 0; v < 4; v++) {
+            size_t streamSize;
+            uint8_t* stream = deflateSegments(data, size, layouts[l].cuts, layouts[l].count, levels[v],
+                                              v % 2 == 0, &streamSize);
+            uLongf outSize = (uLongf)size;
+            memset(out, 0, size);
+            CHECK(uncompress(out, &outSize, stream, (uLong)streamSize) == Z_OK);
+            CHECK(outSize == size && memcmp(out, data, size) == 0);
+            free(stream);
+        }
+    }
+
+    // An empty segment still needs room for its flush, and adds nothing to the sum.
+    CHECK(pngEncodeSegmentBound(0) > 0);
+    CHECK(pngEncodeCombineAdler(1, 1, 0) == 1);
+    free(out);
+    free(data);
+    free(pixels);
+}
+
+// Write a complete RGBA PNG from segments and read it back with libpng.
+static void testFile(void) {
+    int w = 321, h = 203;
+    uint32_t* pixels = (uint32_t*)malloc((size_t)w * h * 4);
+    testFillDrawing(pixels, w, h, 30);
+    size_t size;
+    uint8_t* data = filterImage(pixels, w, h, PNG_ENCODE_FILTER_ADAPTIVE, &size);
+    size_t cuts[] = {size / 3, size * 2 / 3};
+    size_t streamSize;
+    uint8_t* stream = deflateSegments(data, size, cuts, 3, 6, true, &streamSize);
+
+    FILE* fp = fopen("segments.png", "wb");
+    CHECK(pngEncodeWriteHeader(fp, (uint32_t)w, (uint32_t)h, 8, PNG_ENCODE_COLOR_RGBA));
+    // IDAT split into several chunks, as the encoder does when flushing.
+    const void* parts[1] = {stream};
+    size_t sizes[1] = {streamSize / 2};
+    CHECK(pngEncodeWriteChunk(fp, "IDAT", parts, sizes, 1));
+    parts[0] = stream + streamSize / 2;
+    sizes[0] = streamSize - streamSize / 2;
+    CHECK(pngEncodeWriteChunk(fp, "IDAT", parts, sizes, 1));
+    CHECK(pngEncodeWriteEnd(fp));
+    fclose(fp);
+
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    CHECK(png_image_begin_read_from_file(&image, "segments.png"));
+    CHECK(image.width == (png_uint_32)w && image.height == (png_uint_32)h);
+    image.format = PNG_FORMAT_RGBA;
+    uint8_t* decoded = (uint8_t*)malloc(PNG_IMAGE_SIZE(image));
+    CHECK(png_image_finish_read(&image, NULL, decoded, 0, NULL));
+    bool same = true;
+    for (int i = 0; i < w * h; i++) {
+        uint32_t p = pixels[i];
+        if (decoded[i * 4] != (uint8_t)(p >> 24) || decoded[i * 4 + 1] != (uint8_t)(p >> 16) ||
+            decoded[i * 4 + 2] != (uint8_t)(p >> 8) || decoded[i * 4 + 3] != (uint8_t)p) {
+            same = false;
+        }
+    }
+    CHECK(same);
+    free(decoded);
+    free(stream);
+    free(data);
+    free(pixels);
+    remove("segments.png");
+}
+
+// A palette image with a transparent entry: PLTE plus a shortened tRNS.
+static void testPalette(void) {
+    uint32_t colors[3] = {0x00000000u, 0xFF0000FFu, 0x00FF0080u};
+    int w = 16, h = 8;
+    size_t rowBytes = (size_t)w;
+    uint8_t* rows = (uint8_t*)malloc((rowBytes + 1) * h);
+    uint8_t index[16];
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) index[x] = (uint8_t)((x + y) % 3);
+        pngEncodeFilterRow(PNG_ENCODE_FILTER_NONE, index, NULL, rowBytes, 1, rows + (rowBytes + 1) * y);
+    }
+    size_t streamSize;
+    uint8_t* stream = deflateSegments(rows, (rowBytes + 1) * h, NULL, 1, 9, false, &streamSize);
+
+    FILE* fp = fopen("palette.png", "wb");
+    CHECK(pngEncodeWriteHeader(fp, (uint32_t)w, (uint32_t)h, 8, PNG_ENCODE_COLOR_PALETTE));
+    CHECK(pngEncodeWritePalette(fp, colors, 3));
+    const void* parts[1] = {stream};
+    CHECK(pngEncodeWriteChunk(fp, "IDAT", parts, &streamSize, 1));
+    CHECK(pngEncodeWriteEnd(fp));
+    fclose(fp);
+    CHECK(!pngEncodeWritePalette(stdout, colors, 0));
+
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    CHECK(png_image_begin_read_from_file(&image, "palette.png"));
+    image.format = PNG_FORMAT_RGBA;
+    uint8_t decoded[16 * 8 * 4];
+    CHECK(png_image_finish_read(&image, NULL, decoded, 0, NULL));
+    bool same = true;
+    for (int i = 0; i < w * h; i++) {
+        uint32_t c = colors[(i % w + i / w) % 3];
+        // Fully transparent entries may come back with any colour.
+        if (decoded[i * 4 + 3] != (uint8_t)c) same = false;
+        if ((uint8_t)c == 0xFF && (decoded[i * 4] != (uint8_t)(c >> 24) || decoded[i * 4 + 1] != (uint8_t)(c >> 16))) {
+            same = false;
+        }
+    }
+    CHECK(same);
+    free(stream);
+    free(rows);
+    remove("palette.png");
+}
+
+int main(void) {
+    testFilters();
+    testSegments();
+    testFile();
+    testPalette();
+    return testResult("test_png_encode");
+}
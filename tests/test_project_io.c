@@ -0,0 +1,387 @@
+#include "project_io.h"
+
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "brush.h"
+#include "history.h"
+#include "layers.h"
+#include "project_format.h"
+#include "project_stream.h"
+#include "test.h"
+#include "util.h"
+#include "worker.h"
+
+static long fileSize(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+static void startSession(int width, int height) {
+    initLayers();
+    applyCanvasSize(width, height);
+    initHistory();
+}
+
+static void endSession(void) {
+    projectStreamCancel();
+    exitHistory();
+    exitLayers();
+}
+
+//---------------------------------------------------------------------------------
+// Format primitives
+//---------------------------------------------------------------------------------
+static void testTiles(void) {
+    CHECK(projectTileCount(64, 64, 64) == 1);
+    CHECK(projectTileCount(65, 64, 64) == 2);
+    CHECK(projectTileCount(333, 211, 64) == 6 * 4);
+
+    // Edge tiles are clipped to the canvas.
+    int x, y, w, h;
+    projectTileRect(333, 211, 64, 5, &x, &y, &w, &h);
+    CHECK(x == 320 && y == 0 && w == 13 && h == 64);
+    projectTileRect(333, 211, 64, 23, &x, &y, &w, &h);
+    CHECK(x == 320 && y == 192 && w == 13 && h == 19);
+
+    int stride = 333;
+    u32* pixels = (u32*)malloc((size_t)stride * 211 * sizeof(u32));
+    u32* out = (u32*)calloc((size_t)stride * 211, sizeof(u32));
+    u32* scratch = (u32*)malloc(64 * 64 * sizeof(u32));
+    testFillDrawing(pixels, stride, 211, 9);
+    // Leave one tile fully transparent.
+    for (int row = 64; row < 128; row++) memset(pixels + row * stride + 64, 0, 64 * sizeof(u32));
+
+    int tileCount = projectTileCount(333, 211, 64);
+    int empty = 0;
+    for (int t = 0; t < tileCount; t++) {
+        projectTileRect(333, 211, 64, t, &x, &y, &w, &h);
+        u8* packed = NULL;
+        size_t packedSize = 0;
+        CHECK(projectPackTile(pixels, stride, x, y, w, h, scratch, &packed, &packedSize));
+        if (!packed) {
+            empty++;
+            continue;
+        }
+        CHECK(projectUnpackTile(packed, packedSize, out, stride, x, y, w, h, scratch));
+        // A damaged tile is refused.
+        packed[packedSize / 2] ^= 0x10;
+        u32 probe = 0;
+        CHECK(packedSize < 8 || !projectUnpackTile(packed, packedSize, &probe, 1, 0, 0, 1, 1, scratch));
+        free(packed);
+    }
+    CHECK(empty >= 1);
+    CHECK(memcmp(pixels, out, (size_t)stride * 211 * sizeof(u32)) == 0);
+    free(scratch);
+    free(out);
+    free(pixels);
+}
+
+static void testChunkTable(void) {
+    ProjectBlockWriter writer;
+    CHECK(projectWriterOpen(&writer, "table.bin"));
+    u8 prefix[100] = {0};
+    CHECK(projectWriterWrite(&writer, prefix, sizeof(prefix)));
+
+    // Enough payload to cross several blocks.
+    ProjectChunkList list = {0};
+    u8* payload = (u8*)malloc(PROJECT_IO_BLOCK_SIZE / 3);
+    for (size_t i = 0; i < PROJECT_IO_BLOCK_SIZE / 3; i++) payload[i] = (u8)(i * 7);
+    for (u32 i = 0; i < 10; i++) {
+        CHECK(projectWriteChunk(&writer, &list, PROJECT_CHUNK_TILE, i % 4, i, payload, PROJECT_IO_BLOCK_SIZE / 3 - i));
+    }
+    ProjectChunkHeader header = {0, 0, PROJECT_TILE_SIZE, 0};
+    CHECK(projectWriteChunkTable(&writer, list.entries, list.count, &header));
+    CHECK(projectWriterPatch(&writer, 0, &header, sizeof(header)));
+    u64 size = projectWriterTell(&writer);
+    CHECK(projectWriterClose(&writer));
+    CHECK(fileSize("table.bin") == (long)size);
+    CHECK(header.chunkCount == 10);
+
+    FILE* fp = fopen("table.bin", "rb");
+    ProjectChunkHeader readHeader;
+    CHECK(fread(&readHeader, sizeof(readHeader), 1, fp) == 1);
+    CHECK(memcmp(&readHeader, &header, sizeof(header)) == 0);
+    ProjectChunk* chunks = NULL;
+    CHECK(projectReadChunkTable(fp, &readHeader, (long)size, &chunks));
+    CHECK(chunks && memcmp(chunks, list.entries, 10 * sizeof(ProjectChunk)) == 0);
+    for (u32 i = 0; chunks && i < 10; i++) {
+        u8* check = (u8*)malloc(chunks[i].size);
+        fseek(fp, (long)chunks[i].offset, SEEK_SET);
+        CHECK(fread(check, 1, chunks[i].size, fp) == chunks[i].size && memcmp(check, payload, chunks[i].size) == 0);
+        free(check);
+    }
+    free(chunks);
+
+    // A cut-off table, a wrong crc and an empty table are refused.
+    CHECK(!projectReadChunkTable(fp, &readHeader, (long)size - 1, &chunks));
+    readHeader.tableCrc ^= 1;
+    CHECK(!projectReadChunkTable(fp, &readHeader, (long)size, &chunks));
+    readHeader.tableCrc ^= 1;
+    readHeader.chunkCount = 0;
+    CHECK(!projectReadChunkTable(fp, &readHeader, (long)size, &chunks));
+    CHECK(chunks == NULL);
+    fclose(fp);
+    free(payload);
+    free(list.entries);
+    remove("table.bin");
+}
+
+static void testThumbnail(void) {
+    int tw, th;
+    projectThumbnailSize(2048, 1024, &tw, &th);
+    CHECK(tw == 400 && th == 200);
+    projectThumbnailSize(100, 50, &tw, &th);
+    CHECK(tw == 100 && th == 50);
+
+    u32* pixels = (u32*)malloc(800 * 480 * sizeof(u32));
+    for (int i = 0; i < 800 * 480; i++) pixels[i] = 0xFF0000FFu;
+    size_t size = 0;
+    u8* payload = projectBuildThumbnail(pixels, 800, 800, 480, &size);
+    CHECK(payload != NULL);
+    int w = 0, h = 0;
+    u16* thumb = payload ? projectDecodeThumbnail(payload, size, &w, &h) : NULL;
+    CHECK(thumb && w == 400 && h == 240);
+    CHECK(thumb && thumb[0] == 0xF800 && thumb[400 * 240 - 1] == 0xF800);
+    free(thumb);
+    CHECK(payload && projectDecodeThumbnail(payload, size / 2, &w, &h) == NULL);
+    free(payload);
+    free(pixels);
+}
+
+//---------------------------------------------------------------------------------
+// Save and load through project_io
+//---------------------------------------------------------------------------------
+static u32* saved[MAX_LAYERS];
+
+static void fillProject(u32 seed) {
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        // One layer stays empty: its tiles have no chunks at all.
+        if (i == 2) {
+            clearLayer(i, 0);
+        } else {
+            testFillDrawing(layers[i].buffer, CANVAS_WIDTH, CANVAS_HEIGHT, seed + (u32)i);
+        }
+        markLayerTilesDirty(i, 0, 0, CANVAS_WIDTH - 1, CANVAS_HEIGHT - 1);
+    }
+    layers[1].opacity = 128;
+    layers[1].blendMode = BLEND_MULTIPLY;
+    layers[3].visible = false;
+    snprintf(layers[3].name, sizeof(layers[3].name), "Ink %u", (unsigned)seed);
+}
+
+static void rememberLayers(void) {
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        free(saved[i]);
+        saved[i] = (u32*)malloc(LAYER_BUFFER_SIZE);
+        memcpy(saved[i], layers[i].buffer, LAYER_BUFFER_SIZE);
+    }
+}
+
+static bool layersMatchSaved(void) {
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        if (memcmp(saved[i], layers[i].buffer, LAYER_BUFFER_SIZE) != 0) return false;
+    }
+    return true;
+}
+
+static bool loadAndWait(const char* name) {
+    if (!loadProject(name)) return false;
+    projectStreamWaitAll();
+    return true;
+}
+
+static void testSaveLoad(void) {
+    startSession(333, 211);
+    fillProject(3);
+    rememberLayers();
+    CHECK(saveProject("round"));
+    long size = fileSize(SAVE_DIR "/round.mgdw");
+    CHECK(size > 0 && size < (long)(MAX_LAYERS * LAYER_BUFFER_SIZE));
+    CHECK(!fileExists(SAVE_DIR "/round.mgdw.tmp"));
+
+    resetLayersForNewProject();
+    applyCanvasSize(64, 64);
+    CHECK(loadAndWait("round"));
+    CHECK(CANVAS_WIDTH == 333 && CANVAS_HEIGHT == 211);
+    CHECK(layersMatchSaved());
+    CHECK(layers[1].opacity == 128 && layers[1].blendMode == BLEND_MULTIPLY);
+    CHECK(!layers[3].visible && strcmp(layers[3].name, "Ink 3") == 0);
+
+    // A quick save after a small edit appends only the touched tiles.
+    drawBrushToLayer(0, 10, 10, 4, 0x123456FFu);
+    rememberLayers();
+    CHECK(quickSaveProject());
+    long grown = fileSize(SAVE_DIR "/round.mgdw");
+    CHECK(grown > size && grown < size + size / 4);
+    CHECK(loadAndWait("round"));
+    CHECK(layersMatchSaved());
+
+    // Once dead space outgrows the live data, the next save rewrites the file:
+    // rewriting everything over and over keeps it within a few copies.
+    long largest = 0;
+    bool shrank = false;
+    for (int round = 0; round < 6; round++) {
+        long before = fileSize(SAVE_DIR "/round.mgdw");
+        fillProject(10 + (u32)round);
+        CHECK(quickSaveProject());
+        long after = fileSize(SAVE_DIR "/round.mgdw");
+        if (after < before) shrank = true;
+        if (after > largest) largest = after;
+    }
+    rememberLayers();
+    CHECK(shrank);
+    CHECK(largest < 4 * size);
+    CHECK(loadAndWait("round"));
+    CHECK(layersMatchSaved());
+
+    // A file that is not a project does not replace the open one.
+    FILE* junk = fopen(SAVE_DIR "/junk.mgdw", "wb");
+    fputs("junk", junk);
+    fclose(junk);
+    CHECK(!loadProject("junk"));
+    CHECK(layersMatchSaved());
+    endSession();
+}
+
+//---------------------------------------------------------------------------------
+// Interrupted saves
+//---------------------------------------------------------------------------------
+static u8* readFile(const char* path, long* outSize) {
+    long size = fileSize(path);
+    FILE* fp = fopen(path, "rb");
+    if (size < 0 || !fp) return NULL;
+    u8* data = (u8*)malloc((size_t)size + 1);
+    *outSize = (long)fread(data, 1, (size_t)size, fp);
+    fclose(fp);
+    return data;
+}
+
+static void writeFile(const char* path, const u8* data, long size) {
+    FILE* fp = fopen(path, "wb");
+    fwrite(data, 1, (size_t)size, fp);
+    fclose(fp);
+}
+
+#define FIRST_PATH SAVE_DIR "/first.mgdw"
+#define FIRST_TEMP SAVE_DIR "/first.mgdw.tmp"
+
+// Leave a temp file as a save of a new project would if it stopped after
+// `cut` bytes, then run the startup recovery.
+static bool recoverCut(const u8* data, long cut) {
+    writeFile(FIRST_TEMP, data, cut);
+    recoverInterruptedSaves();
+    return !fileExists(FIRST_TEMP);
+}
+
+static void testRecoverTruncated(void) {
+    startSession(300, 200);
+    fillProject(5);
+    rememberLayers();
+    CHECK(saveProject("first"));
+    long size = 0;
+    u8* full = readFile(FIRST_PATH, &size);
+    CHECK(full != NULL && size > 0);
+    if (!full) return;
+    remove(FIRST_PATH);
+
+    // Before the headers are patched, the chunk header is a placeholder.
+    u8* unpatched = (u8*)malloc((size_t)size);
+    memcpy(unpatched, full, (size_t)size);
+    ProjectChunkHeader placeholder = {0, 0, PROJECT_TILE_SIZE, 0};
+    memcpy(unpatched + sizeof(ProjectHeader), &placeholder, sizeof(placeholder));
+
+    long headers = (long)(sizeof(ProjectHeader) + sizeof(ProjectChunkHeader));
+    long cuts[] = {0, 1, (long)sizeof(ProjectHeader), headers - 1, headers, headers + 1,
+                   size / 4, size / 2, size - 64, size - (long)sizeof(ProjectChunk), size - 1};
+    for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++) {
+        CHECK(recoverCut(full, cuts[i]));
+        CHECK(!fileExists(FIRST_PATH));
+    }
+    // Every byte position near the table, where a torn write is most likely.
+    for (long cut = size - 512; cut < size; cut += 7) {
+        CHECK(recoverCut(full, cut));
+        CHECK(!fileExists(FIRST_PATH));
+    }
+    CHECK(recoverCut(unpatched, size));
+    CHECK(!fileExists(FIRST_PATH));
+
+    // A complete temp file without an original is installed and loads.
+    CHECK(recoverCut(full, size));
+    CHECK(fileSize(FIRST_PATH) == size);
+    clearLayer(0, 0);
+    CHECK(loadAndWait("first"));
+    CHECK(layersMatchSaved());
+
+    // With the original in place the temp file is dropped, complete or not.
+    writeFile(FIRST_TEMP, unpatched, size / 2);
+    recoverInterruptedSaves();
+    CHECK(!fileExists(FIRST_TEMP));
+    CHECK(fileSize(FIRST_PATH) == size);
+
+    free(unpatched);
+    free(full);
+    remove(FIRST_PATH);
+    endSession();
+}
+
+// Kill a process in the middle of the first save of a project, at a range
+// of moments, then recover: the project is either absent or loads intact.
+static void testKillDuringSave(void) {
+    startSession(1024, 768);
+    fillProject(21);
+    // Noise on one layer makes the file large enough to be caught mid-write.
+    u32 state = 77;
+    for (int i = 0; i < CANVAS_WIDTH * CANVAS_HEIGHT; i += 3) layers[2].buffer[i] = testRandom(&state);
+    markLayerTilesDirty(2, 0, 0, CANVAS_WIDTH - 1, CANVAS_HEIGHT - 1);
+    rememberLayers();
+
+    u64 start = svcGetSystemTick();
+    CHECK(saveProject("killed"));
+    long saveUs = (long)(workerTicksToMs(svcGetSystemTick() - start) * 1000.0f);
+    remove(SAVE_DIR "/killed.mgdw");
+
+    const int rounds = 24;
+    int installed = 0;
+    int interrupted = 0;
+    for (int round = 0; round < rounds; round++) {
+        pid_t child = fork();
+        if (child == 0) {
+            saveProject("killed");
+            _exit(0);
+        }
+        CHECK(child > 0);
+        if (child <= 0) break;
+        // From right away to well past the end of the save (the forked
+        // child starts slower, copying pages as it goes).
+        usleep((useconds_t)(saveUs * 2 * round / rounds));
+        kill(child, SIGKILL);
+        waitpid(child, NULL, 0);
+
+        if (fileExists(SAVE_DIR "/killed.mgdw.tmp")) interrupted++;
+        recoverInterruptedSaves();
+        CHECK(!fileExists(SAVE_DIR "/killed.mgdw.tmp"));
+        if (fileExists(SAVE_DIR "/killed.mgdw")) {
+            installed++;
+            CHECK(loadAndWait("killed"));
+            CHECK(layersMatchSaved());
+            remove(SAVE_DIR "/killed.mgdw");
+        }
+    }
+    printf("  kill during save: %d of %d rounds interrupted, %d installed\n", interrupted, rounds, installed);
+    CHECK(installed > 0);
+    endSession();
+}
+
+int main(void) {
+    testTiles();
+    testChunkTable();
+    testThumbnail();
+    testSaveLoad();
+    testRecoverTruncated();
+    testKillDuringSave();
+    for (int i = 0; i < MAX_LAYERS; i++) free(saved[i]);
+    return testResult("test_project_io");
+}